@@ -95,21 +95,9 @@ static void AnalogDevicesSync(ISP_ENVIRONMENT *IspEnvironment)
     }
 
     DebugPrintf(1, "No (or unacceptable) answer on sync attempt\n");
-    exit(4);
+    IspExit(IspEnvironment, 4);
 }
 
-typedef struct {
-    char start1;
-    char start2;
-    BINARY bytes;
-    char cmd;
-    BINARY address_h;
-    BINARY address_u;
-    BINARY address_m;
-    BINARY address_l;
-    BINARY data[251];
-} AD_PACKET;
-
 /***************************** AnalogDevicesFormPacket ******************/
 /**  Create an Analog Devices communication packet from the constituent
 elements.
@@ -122,7 +110,7 @@ the packet.
 is zero.
 \param[out] packet that will be filled.
 */
-static void AnalogDevicesFormPacket(ISP_ENVIRONMENT *IspEnvironment,
+void AnalogDevicesFormPacket(ISP_ENVIRONMENT *IspEnvironment,
                                                 char cmd, int no_bytes, unsigned int address,
                                                 const void *data, AD_PACKET *packet)
 {
@@ -248,7 +236,7 @@ static void AnalogDevicesSendPacket(ISP_ENVIRONMENT *IspEnvironment,
     } while (retry < 3);
 
     DebugPrintf(1, "Send packet failed\n");
-    exit(-1);
+    IspExit(IspEnvironment, -1);
 }
 
 /***************************** AnalogDevicesErase ***********************/
@@ -267,8 +255,6 @@ static void AnalogDevicesErase(ISP_ENVIRONMENT *IspEnvironment)
     DebugPrintf(2, "Erased\n");
 }
 
-#define AD_PACKET_SIZE (250)
-
 /***************************** AnalogDevicesWrite ***********************/
 /**  Write the program.
 \param [in] data the program to download to the micro.
@@ -44,4 +44,21 @@ typedef struct
     BINARY terminator[2];
 } AD_SYNC_RESPONSE;
 
+#define AD_PACKET_SIZE (250)
+
+typedef struct {
+    char start1;
+    char start2;
+    BINARY bytes;
+    char cmd;
+    BINARY address_h;
+    BINARY address_u;
+    BINARY address_m;
+    BINARY address_l;
+    BINARY data[251];
+} AD_PACKET;
+
+void AnalogDevicesFormPacket(ISP_ENVIRONMENT *IspEnvironment,
+                             char cmd, int no_bytes, unsigned int address,
+                             const void *data, AD_PACKET *packet);
 int AnalogDevicesDownload(ISP_ENVIRONMENT *IspEnvironment);
@@ -39,6 +39,12 @@ Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.c
 #include "adprog.h"
 #include "lpcprog.h"
 #include "lpcterm.h"
+#include "lpcevent.h"
+#include "lpctrace.h"
+#include "lpcstats.h"
+#include "lpcdaemon.h"
+#include "lpcplan.h"
+#include "lpcjournal.h"
 
 /*
 Change-History:
@@ -417,32 +423,36 @@ Change-History:
 // Don't forget to update the version string that is on the next line
 #define VERSION_STR "1.97"
 
-#if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
-static char RxTmpBuf[256];        // save received data to this buffer for half-duplex
-char * pRxTmpBuf = RxTmpBuf;
-#endif
-
 #if !defined COMPILE_FOR_LPC21
-int debug_level = 2;
+ISP_THREAD_LOCAL int debug_level = 2;
 #endif
 
 static void ControlModemLines(ISP_ENVIRONMENT *IspEnvironment, unsigned char DTR, unsigned char RTS);
-static unsigned char Ascii2Hex(unsigned char c);
+static unsigned char Ascii2Hex(ISP_ENVIRONMENT *IspEnvironment, unsigned char c);
 
 #ifdef COMPILE_FOR_WINDOWS
 static void SerialTimeoutSet(ISP_ENVIRONMENT *IspEnvironment, unsigned timeout_milliseconds);
 static int SerialTimeoutCheck(ISP_ENVIRONMENT *IspEnvironment);
 #endif // COMPILE_FOR_WINDOWS
 
+#if defined(__linux__)
+static void SerialTimeoutSet(ISP_ENVIRONMENT *IspEnvironment, unsigned timeout_milliseconds);
+static void ReceiveComPortBlock(ISP_ENVIRONMENT *IspEnvironment,
+                                void *answer, unsigned long max_size,
+                                unsigned long *real_size);
+#endif
+
+#if !defined LPC21ISP_LIBRARY
 static int AddFileHex(ISP_ENVIRONMENT *IspEnvironment, const char *arg);
 static int AddFileBinary(ISP_ENVIRONMENT *IspEnvironment, const char *arg);
+#endif
 static int LoadFile(ISP_ENVIRONMENT *IspEnvironment, const char *filename, int FileFormat);
 
 /************* Portability layer. Serial and console I/O differences    */
 /* are taken care of here.                                              */
 
 #if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
-static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
+int OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
 {
     DCB    dcb;
     COMMTIMEOUTS commtimeouts;
@@ -457,7 +467,7 @@ static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
     if (IspEnvironment->hCom == INVALID_HANDLE_VALUE)
     {
         DebugPrintf(1, "Can't open COM-Port %s ! - Error: %ld\n", IspEnvironment->serial_port, GetLastError());
-        exit(2);
+        return ERR_OPEN_PORT;
     }
 
     DebugPrintf(3, "COM-Port %s opened...\n", IspEnvironment->serial_port);
@@ -480,7 +490,8 @@ static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
     if (SetCommState(IspEnvironment->hCom, &dcb) == 0)
     {
         DebugPrintf(1, "Can't set baudrate %s ! - Error: %ld", IspEnvironment->baud_rate, GetLastError());
-        exit(3);
+        CloseHandle(IspEnvironment->hCom);
+        return ERR_SETUP_PORT;
     }
 
    /*
@@ -509,19 +520,166 @@ static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
     commtimeouts.WriteTotalTimeoutMultiplier =    0;
     commtimeouts.WriteTotalTimeoutConstant   =    0;
     SetCommTimeouts(IspEnvironment->hCom, &commtimeouts);
+
+    return 0;
+}
+
+/***************************** SetSerialBaud ****************************/
+/**  Changes the baud rate of the open serial port.
+\param [in] Baud the new baud rate.
+\return 0 if ok, ERR_SETUP_PORT otherwise.
+*/
+static int SetSerialBaud(ISP_ENVIRONMENT *IspEnvironment, unsigned long Baud)
+{
+    DCB dcb;
+
+    GetCommState(IspEnvironment->hCom, &dcb);
+    dcb.BaudRate = Baud;
+
+    if (SetCommState(IspEnvironment->hCom, &dcb) == 0)
+    {
+        DebugPrintf(1, "Can't set baudrate %lu ! - Error: %ld\n", Baud, GetLastError());
+        return ERR_SETUP_PORT;
+    }
+
+    return 0;
 }
 #endif // defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
 
+#if defined GPIOCHIP_SUPPORT
+#define GPIOCHIP_RST    0x01    /* bits of the lines in the line request */
+#define GPIOCHIP_ISP    0x02
+
+/***************************** GpioChipRequest **************************/
+/**  Requests the RST and ISP lines of -gpiochip as outputs, both high
+(deasserted), for as long as the serial port is open. Both lines are in
+one request, so ResetTarget changes them with a single ioctl, also both
+at once. Unlike sysfs this needs no export in a startup script, and works
+the same with the gpio-sim and gpio-mockup kernel modules.
+\return 0 if ok, ERR_OPEN_PORT otherwise.
+*/
+static int GpioChipRequest(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct gpio_v2_line_request req;
+    char path[64];
+    const char *chip = IspEnvironment->GpioChip;
+    int fd;
+
+    if (*chip != '/')
+    {
+        snprintf(path, sizeof(path), isdigit(*chip) ? "/dev/gpiochip%s" : "/dev/%s", chip);
+        chip = path;
+    }
+
+    fd = open(chip, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        DebugPrintf(1, "Can't open GPIO chip %s: %s\n", chip, strerror(errno));
+        return ERR_OPEN_PORT;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = IspEnvironment->GpioRst;
+    req.offsets[1] = IspEnvironment->GpioIsp;
+    req.num_lines  = 2;
+    strcpy(req.consumer, "lpc21isp");
+    req.config.flags               = GPIO_V2_LINE_FLAG_OUTPUT;
+    req.config.num_attrs           = 1;
+    req.config.attrs[0].attr.id     = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[0].attr.values = GPIOCHIP_RST | GPIOCHIP_ISP;
+    req.config.attrs[0].mask        = GPIOCHIP_RST | GPIOCHIP_ISP;
+
+    if (ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0)
+    {
+        DebugPrintf(1, "Can't request lines %u (RST) and %u (ISP) of %s: %s\n",
+                    IspEnvironment->GpioRst, IspEnvironment->GpioIsp, chip, strerror(errno));
+        close(fd);
+        return ERR_OPEN_PORT;
+    }
+
+    close(fd);
+    IspEnvironment->GpioFd = req.fd;
+    DebugPrintf(3, "GPIO lines %u (RST) and %u (ISP) of %s requested\n",
+                IspEnvironment->GpioRst, IspEnvironment->GpioIsp, chip);
+    return 0;
+}
+
+/***************************** GpioChipSet ******************************/
+/**  Sets lines of the -gpiochip request.
+\param [in] Lines GPIOCHIP_RST and/or GPIOCHIP_ISP, the lines to set.
+\param [in] Values their new levels, a bit set is high.
+*/
+static void GpioChipSet(ISP_ENVIRONMENT *IspEnvironment, unsigned Lines, unsigned Values)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = Lines;
+    values.bits = Values;
+
+    if (ioctl(IspEnvironment->GpioFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+    {
+        DebugPrintf(1, "GPIO set failed: %s\n", strerror(errno));
+    }
+}
+#endif // defined GPIOCHIP_SUPPORT
+
+#if defined COMPILE_FOR_LINUX && !defined(__FreeBSD__) && !defined(__OpenBSD__)
+/***************************** BaudToSpeed ******************************/
+/**  Converts a baud rate to the termios speed constant.
+\param [in] Baud the baud rate.
+\return the Bxxx constant, B0 if the baud rate isn't supported.
+*/
+static speed_t BaudToSpeed(long Baud)
+{
+    switch (Baud)
+    {
+#ifdef B1152000
+          case 1152000: return B1152000;
+#endif // B1152000
+#ifdef B576000
+          case  576000: return B576000;
+#endif // B576000
+#ifdef B230400
+          case  230400: return B230400;
+#endif // B230400
+#ifdef B115200
+          case  115200: return B115200;
+#endif // B115200
+#ifdef B57600
+          case   57600: return B57600;
+#endif // B57600
+#ifdef B38400
+          case   38400: return B38400;
+#endif // B38400
+#ifdef B19200
+          case   19200: return B19200;
+#endif // B19200
+#ifdef B9600
+          case    9600: return B9600;
+#endif // B9600
+
+          // Special value
+          // case   32000: return 32000;
+    }
+
+    return B0;
+}
+#endif
+
 #if defined COMPILE_FOR_LINUX
-static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
+int OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
 {
+#if !defined(__FreeBSD__) && !defined(__OpenBSD__)
+    speed_t speed;
+#endif
+
     IspEnvironment->fdCom = open(IspEnvironment->serial_port, O_RDWR | O_NOCTTY | O_NONBLOCK);
 
     if (IspEnvironment->fdCom < 0)
     {
         int err = errno;
         DebugPrintf(1, "Can't open COM-Port %s ! (Error: %dd (0x%X))\n", IspEnvironment->serial_port, err, err);
-        exit(2);
+        return ERR_OPEN_PORT;
     }
 
     DebugPrintf(3, "COM-Port %s opened...\n", IspEnvironment->serial_port);
@@ -540,7 +698,8 @@ static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
 
     if(cfsetspeed(&IspEnvironment->newtio,(speed_t) strtol(IspEnvironment->baud_rate,NULL,10))) {
                   DebugPrintf(1, "baudrate %s not supported\n", IspEnvironment->baud_rate);
-                  exit(3);
+                  close(IspEnvironment->fdCom);
+                  return ERR_SETUP_PORT;
               };
 #else
 
@@ -550,42 +709,14 @@ static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
 #define NEWTERMIOS_SETBAUDARTE(bps) IspEnvironment->newtio.c_cflag |= bps;
 #endif
 
-    switch (atol(IspEnvironment->baud_rate))
+    speed = BaudToSpeed(atol(IspEnvironment->baud_rate));
+    if (speed == B0)
     {
-#ifdef B1152000
-          case 1152000: NEWTERMIOS_SETBAUDARTE(B1152000); break;
-#endif // B1152000
-#ifdef B576000
-          case  576000: NEWTERMIOS_SETBAUDARTE(B576000); break;
-#endif // B576000
-#ifdef B230400
-          case  230400: NEWTERMIOS_SETBAUDARTE(B230400); break;
-#endif // B230400
-#ifdef B115200
-          case  115200: NEWTERMIOS_SETBAUDARTE(B115200); break;
-#endif // B115200
-#ifdef B57600
-          case   57600: NEWTERMIOS_SETBAUDARTE(B57600); break;
-#endif // B57600
-#ifdef B38400
-          case   38400: NEWTERMIOS_SETBAUDARTE(B38400); break;
-#endif // B38400
-#ifdef B19200
-          case   19200: NEWTERMIOS_SETBAUDARTE(B19200); break;
-#endif // B19200
-#ifdef B9600
-          case    9600: NEWTERMIOS_SETBAUDARTE(B9600); break;
-#endif // B9600
-
-          // Special value
-          // case   32000: NEWTERMIOS_SETBAUDARTE(32000); break;
-
-          default:
-              {
-                  DebugPrintf(1, "unknown baudrate %s\n", IspEnvironment->baud_rate);
-                  exit(3);
-              }
+        DebugPrintf(1, "unknown baudrate %s\n", IspEnvironment->baud_rate);
+        close(IspEnvironment->fdCom);
+        return ERR_SETUP_PORT;
     }
+    NEWTERMIOS_SETBAUDARTE(speed);
 
 #endif
 
@@ -603,14 +734,273 @@ static void OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment)
     if(tcsetattr(IspEnvironment->fdCom, TCSANOW, &IspEnvironment->newtio))
     {
        DebugPrintf(1, "Could not change serial port behaviour (wrong baudrate?)\n");
-       exit(3);
+       close(IspEnvironment->fdCom);
+       return ERR_SETUP_PORT;
+    }
+
+#if defined(__linux__)
+    IspEnvironment->SavedSerialFlags  = -1;
+    IspEnvironment->SavedLatencyTimer = -1;
+#endif
+
+#if defined GPIOCHIP_SUPPORT
+    if (IspEnvironment->GpioChip != NULL && GpioChipRequest(IspEnvironment) != 0)
+    {
+        tcsetattr(IspEnvironment->fdCom, TCSANOW, &IspEnvironment->oldtio);
+        close(IspEnvironment->fdCom);
+        return ERR_OPEN_PORT;
+    }
+#endif
+
+    return 0;
+}
+
+/***************************** SetSerialBaud ****************************/
+/**  Changes the baud rate of the open serial port, the other settings
+stay those of OpenSerialPort.
+\param [in] Baud the new baud rate.
+\return 0 if ok, ERR_SETUP_PORT otherwise.
+*/
+static int SetSerialBaud(ISP_ENVIRONMENT *IspEnvironment, unsigned long Baud)
+{
+    struct termios tio = IspEnvironment->newtio;
+
+#if defined(__FreeBSD__) || defined(__OpenBSD__)
+    if (cfsetspeed(&tio, (speed_t)Baud) != 0)
+#else
+    speed_t speed = BaudToSpeed(Baud);
+
+    if (speed == B0 || cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0)
+#endif
+    {
+        DebugPrintf(1, "unknown baudrate %lu\n", Baud);
+        return ERR_SETUP_PORT;
+    }
+
+    tcdrain(IspEnvironment->fdCom);
+    if (tcsetattr(IspEnvironment->fdCom, TCSANOW, &tio) != 0)
+    {
+        DebugPrintf(1, "Could not change serial port behaviour (wrong baudrate?)\n");
+        return ERR_SETUP_PORT;
     }
 
+    return 0;
 }
 #endif // defined COMPILE_FOR_LINUX
 
+#if defined(__linux__)
+/***************************** LowLatencyEnable *************************/
+/**  Switches the serial driver to low latency operation. Sets
+ASYNC_LOW_LATENCY and, where the driver exposes it in sysfs (ftdi_sio),
+lowers the USB latency timer from its default of 16 ms to 1 ms. The
+previous settings are saved and restored by LowLatencyRestore.
+*/
+void LowLatencyEnable(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct serial_struct serinfo;
+    char *devpath;
+    const char *ttyname;
+    FILE *fp;
+
+    if (ioctl(IspEnvironment->fdCom, TIOCGSERIAL, &serinfo) == 0)
+    {
+        IspEnvironment->SavedSerialFlags = serinfo.flags;
+        serinfo.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(IspEnvironment->fdCom, TIOCSSERIAL, &serinfo) == 0)
+        {
+            DebugPrintf(3, "ASYNC_LOW_LATENCY set\n");
+        }
+        else
+        {
+            DebugPrintf(2, "Could not set ASYNC_LOW_LATENCY (%s)\n", strerror(errno));
+            IspEnvironment->SavedSerialFlags = -1;
+        }
+    }
+    else
+    {
+        DebugPrintf(3, "TIOCGSERIAL not supported by driver\n");
+    }
+
+    // /dev/serial/by-id/... and friends are symlinks, sysfs knows the real name
+    devpath = realpath(IspEnvironment->serial_port, NULL);
+    ttyname = strrchr(devpath ? devpath : IspEnvironment->serial_port, '/');
+    ttyname = ttyname ? ttyname + 1 : IspEnvironment->serial_port;
+    snprintf(IspEnvironment->LatencyTimerPath, sizeof(IspEnvironment->LatencyTimerPath),
+             "/sys/class/tty/%s/device/latency_timer", ttyname);
+    free(devpath);
+
+    fp = fopen(IspEnvironment->LatencyTimerPath, "r");
+    if (fp != NULL)
+    {
+        if (fscanf(fp, "%d", &IspEnvironment->SavedLatencyTimer) != 1)
+        {
+            IspEnvironment->SavedLatencyTimer = -1;
+        }
+        fclose(fp);
+    }
+
+    if (IspEnvironment->SavedLatencyTimer > 1)
+    {
+        fp = fopen(IspEnvironment->LatencyTimerPath, "w");
+        if (fp != NULL && fprintf(fp, "1\n") > 0 && fclose(fp) == 0)
+        {
+            DebugPrintf(3, "%s: %d ms -> 1 ms\n", IspEnvironment->LatencyTimerPath, IspEnvironment->SavedLatencyTimer);
+        }
+        else
+        {
+            DebugPrintf(2, "Could not write %s (%s)\n", IspEnvironment->LatencyTimerPath, strerror(errno));
+            IspEnvironment->SavedLatencyTimer = -1;
+        }
+    }
+    else
+    {
+        IspEnvironment->SavedLatencyTimer = -1;     // nothing to change / restore
+    }
+}
+
+/***************************** LowLatencyRestore ************************/
+/**  Restores the settings changed by LowLatencyEnable.
+*/
+static void LowLatencyRestore(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct serial_struct serinfo;
+    FILE *fp;
+
+    if (IspEnvironment->SavedSerialFlags != -1 &&
+        ioctl(IspEnvironment->fdCom, TIOCGSERIAL, &serinfo) == 0)
+    {
+        serinfo.flags = IspEnvironment->SavedSerialFlags;
+        ioctl(IspEnvironment->fdCom, TIOCSSERIAL, &serinfo);
+    }
+    IspEnvironment->SavedSerialFlags = -1;
+
+    if (IspEnvironment->SavedLatencyTimer != -1)
+    {
+        fp = fopen(IspEnvironment->LatencyTimerPath, "w");
+        if (fp != NULL)
+        {
+            fprintf(fp, "%d\n", IspEnvironment->SavedLatencyTimer);
+            fclose(fp);
+        }
+    }
+    IspEnvironment->SavedLatencyTimer = -1;
+}
+
+/***************************** ProbeRoundTrip ***************************/
+/**  Measures the round trip time of the serial link by sending '?' to the
+bootloader and timing the first byte of its "Synchronized" answer. The
+answer is then terminated with an empty line instead of "Synchronized",
+which makes the bootloader start over with its auto baud detection. The
+probes go through SendComPortBlock and ReceiveComPortBlock like all other
+traffic, so they are paced, captured and, in a gang, let the other
+sessions run while waiting.
+\param [in] probes number of probes to send (at most 16).
+
+\return median round trip time in microseconds, -1 if there was no answer.
+*/
+static long ProbeRoundTrip(ISP_ENVIRONMENT *IspEnvironment, int probes)
+{
+    long rtt[16];
+    int answered = 0;
+    int i, j;
+
+    if (probes > 16)
+    {
+        probes = 16;
+    }
+
+    for (i = 0; i < probes; i++)
+    {
+        unsigned long long t0;
+        unsigned long realsize;
+        char c;
+
+        t0 = IspClock();
+        if (!SendComPortBlock(IspEnvironment, "?", 1))
+        {
+            DebugPrintf(2, "Round trip probe: could not write to %s\n", IspEnvironment->serial_port);
+            break;
+        }
+
+        SerialTimeoutSet(IspEnvironment, 200);
+        ReceiveComPortBlock(IspEnvironment, &c, 1, &realsize);
+        if (realsize == 0)
+        {
+            continue;
+        }
+
+        rtt[answered++] = (long)(IspClock() - t0);
+
+        // Swallow the rest of the answer
+        SerialTimeoutSet(IspEnvironment, 50);
+        do
+        {
+            ReceiveComPortBlock(IspEnvironment, &c, 1, &realsize);
+        } while (realsize == 1 && c != '\n');
+
+        if (!SendComPortBlock(IspEnvironment, "\r\n", 2))
+        {
+            DebugPrintf(2, "Round trip probe: could not write to %s\n", IspEnvironment->serial_port);
+            break;
+        }
+        Sleep(10);
+        ClearSerialPortBuffers(IspEnvironment);
+    }
+
+    if (answered == 0)
+    {
+        return -1;
+    }
+
+    for (i = 1; i < answered; i++)      // tiny insertion sort for the median
+    {
+        long v = rtt[i];
+        for (j = i; j > 0 && rtt[j - 1] > v; j--)
+        {
+            rtt[j] = rtt[j - 1];
+        }
+        rtt[j] = v;
+    }
+
+    return rtt[answered / 2];
+}
+
+/***************************** LowLatencyTuning *************************/
+/**  Opt-in tuning step (-lowlatency): measures the round trip time, tunes
+the driver for latency and measures again. For the line by line ISP
+protocol latency matters more than the baud rate.
+*/
+static void LowLatencyTuning(ISP_ENVIRONMENT *IspEnvironment)
+{
+    long before = -1, after = -1;
+    int probe = (IspEnvironment->micro == NXP_ARM) &&
+                (IspEnvironment->ProgramChip || IspEnvironment->DetectOnly);
+
+    if (probe)
+    {
+        before = ProbeRoundTrip(IspEnvironment, 5);
+    }
+
+    LowLatencyEnable(IspEnvironment);
+
+    if (probe)
+    {
+        after = ProbeRoundTrip(IspEnvironment, 5);
+        if (before < 0 || after < 0)
+        {
+            DebugPrintf(2, "Round trip latency: no answer on '?' probes\n");
+        }
+        else
+        {
+            DebugPrintf(2, "Round trip latency: %ld us before, %ld us after low latency tuning\n", before, after);
+        }
+        ClearSerialPortBuffers(IspEnvironment);
+    }
+}
+#endif // defined(__linux__)
+
 #if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
-static void CloseSerialPort(ISP_ENVIRONMENT *IspEnvironment)
+void CloseSerialPort(ISP_ENVIRONMENT *IspEnvironment)
 {
     CloseHandle(IspEnvironment->hCom);
 
@@ -623,13 +1013,24 @@ static void CloseSerialPort(ISP_ENVIRONMENT *IspEnvironment)
 #endif // defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
 
 #if defined COMPILE_FOR_LINUX
-static void CloseSerialPort(ISP_ENVIRONMENT *IspEnvironment)
+void CloseSerialPort(ISP_ENVIRONMENT *IspEnvironment)
 {
+#if defined(__linux__)
+    LowLatencyRestore(IspEnvironment);
+#endif
+
     tcflush(IspEnvironment->fdCom, TCOFLUSH);
     tcflush(IspEnvironment->fdCom, TCIFLUSH);
     tcsetattr(IspEnvironment->fdCom, TCSANOW, &IspEnvironment->oldtio);
 
     close(IspEnvironment->fdCom);
+
+#if defined GPIOCHIP_SUPPORT
+    if (IspEnvironment->GpioChip != NULL)
+    {
+        close(IspEnvironment->GpioFd);  // releases the lines
+    }
+#endif
 }
 #endif // defined COMPILE_FOR_LINUX
 
@@ -654,7 +1055,7 @@ void ControlXonXoffSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char Xon
     if (SetCommState(IspEnvironment->hCom, &dcb) == 0)
     {
         DebugPrintf(1, "Can't set XonXoff ! - Error: %ld", GetLastError());
-        exit(3);
+        IspExit(IspEnvironment, 3);
     }
 }
 
@@ -666,7 +1067,7 @@ void ControlXonXoffSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char Xon
     if(tcgetattr(IspEnvironment->fdCom, &IspEnvironment->newtio))
     {
        DebugPrintf(1, "Could not get serial port behaviour\n");
-       exit(3);
+       IspExit(IspEnvironment, 3);
     }
 
     if(XonXoff)
@@ -683,52 +1084,220 @@ void ControlXonXoffSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char Xon
     if(tcsetattr(IspEnvironment->fdCom, TCSANOW, &IspEnvironment->newtio))
     {
        DebugPrintf(1, "Could not set serial port behaviour\n");
-       exit(3);
+       IspExit(IspEnvironment, 3);
     }
 }
 #endif // defined COMPILE_FOR_LINUX
 
-/***************************** SendComPortBlock *************************/
-/**  Sends a block of bytes out the opened com port.
-\param [in] s block to send.
-\param [in] n size of the block.
-*/
-void SendComPortBlock(ISP_ENVIRONMENT *IspEnvironment, const void *s, size_t n)
-{
 #if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
+void ControlRtsCtsSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char RtsCts)
+{
+    DCB dcb;
 
-    unsigned long realsize;
-    size_t m;
-    unsigned long rxsize;
-    char * pch;
-    char * rxpch;
-#endif // defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
-
-    DumpString(4, s, n, "Sending ");
-
-#if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
+    GetCommState(IspEnvironment->hCom, &dcb);
 
-    if (IspEnvironment->HalfDuplex == 0)
+    if(RtsCts)
     {
-        WriteFile(IspEnvironment->hCom, s, n, &realsize, NULL);
+        dcb.fOutxCtsFlow = TRUE;
+        dcb.fRtsControl  = RTS_CONTROL_HANDSHAKE;
     }
     else
     {
-        pch = (char *)s;
-        rxpch = RxTmpBuf;
-        pRxTmpBuf = RxTmpBuf;
+        dcb.fOutxCtsFlow = FALSE;
+        dcb.fRtsControl  = RTS_CONTROL_DISABLE;
+    }
 
-        // avoid buffer otherflow
-        if (n > sizeof (RxTmpBuf))
-            n = sizeof (RxTmpBuf);
+    if (SetCommState(IspEnvironment->hCom, &dcb) == 0)
+    {
+        DebugPrintf(1, "Can't set RtsCts ! - Error: %ld", GetLastError());
+        IspExit(IspEnvironment, 3);
+    }
+}
+#endif // defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
 
-        for (m = 0; m < n; m++)
-        {
-            WriteFile(IspEnvironment->hCom, pch, 1, &realsize, NULL);
+#if defined COMPILE_FOR_LINUX
+void ControlRtsCtsSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char RtsCts)
+{
+    if(tcgetattr(IspEnvironment->fdCom, &IspEnvironment->newtio))
+    {
+       DebugPrintf(1, "Could not get serial port behaviour\n");
+       IspExit(IspEnvironment, 3);
+    }
 
-            if ((*pch != '?') || (n != 1))
-            {
-                do
+    if(RtsCts)
+    {
+      IspEnvironment->newtio.c_cflag |= CRTSCTS;
+    }
+    else
+    {
+      IspEnvironment->newtio.c_cflag &= ~CRTSCTS;
+    }
+
+    if(tcsetattr(IspEnvironment->fdCom, TCSANOW, &IspEnvironment->newtio))
+    {
+       DebugPrintf(1, "Could not set serial port behaviour\n");
+       IspExit(IspEnvironment, 3);
+    }
+}
+#endif // defined COMPILE_FOR_LINUX
+
+#if !defined COMPILE_FOR_LPC21
+/***************************** IspClock *********************************/
+/**  Monotonic time base for the token bucket and the synchronization.
+
+\return time in microseconds.
+*/
+unsigned long long IspClock(void)
+{
+#if defined COMPILE_FOR_WINDOWS
+    LARGE_INTEGER freq, now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+#endif
+}
+
+/***************************** SetPacing ********************************/
+/**  Selects how data is paced towards the target: XON/XOFF, no flow
+control, RTS/CTS, or no flow control with the host limiting the rate by a
+token bucket (bytes per second, burst size) to what the target UART can
+absorb.
+\param [in] Pacing the pacing mode to use.
+*/
+void SetPacing(ISP_ENVIRONMENT *IspEnvironment, PACING_MODE Pacing)
+{
+    if (Pacing == PACING_DEFAULT)
+    {
+        Pacing = PACING_XONXOFF;
+    }
+
+    if (IspEnvironment->Transport == NULL)
+    {
+        ControlXonXoffSerialPort(IspEnvironment, Pacing == PACING_XONXOFF);
+        ControlRtsCtsSerialPort(IspEnvironment, Pacing == PACING_RTSCTS);
+    }
+
+    if (Pacing == PACING_TOKENBUCKET)
+    {
+        if (IspEnvironment->PaceRate == 0)
+        {
+            // 8N1: 10 bits per byte, leave the target 25% headroom
+            IspEnvironment->PaceRate = atol(IspEnvironment->baud_rate) / 10 * 3 / 4;
+        }
+        if (IspEnvironment->PaceBurst == 0)
+        {
+            IspEnvironment->PaceBurst = 64;
+        }
+        IspEnvironment->PaceTokens     = IspEnvironment->PaceBurst;
+        IspEnvironment->PaceLastRefill = IspClock();
+        DebugPrintf(3, "Pacing: token bucket, %lu bytes/s, burst %lu bytes\n",
+                    IspEnvironment->PaceRate, IspEnvironment->PaceBurst);
+    }
+    else
+    {
+        DebugPrintf(3, "Pacing: %s\n", Pacing == PACING_XONXOFF ? "XON/XOFF" :
+                                        Pacing == PACING_RTSCTS  ? "RTS/CTS"  : "none");
+    }
+
+    IspEnvironment->PacingActive = Pacing;
+}
+
+/***************************** PaceWait *********************************/
+/**  Token bucket: waits until n bytes may be sent and takes them out of
+the bucket. n must not exceed the burst size.
+*/
+static void PaceWait(ISP_ENVIRONMENT *IspEnvironment, size_t n)
+{
+    for (;;)
+    {
+        unsigned long long now = IspClock();
+
+        IspEnvironment->PaceTokens += (now - IspEnvironment->PaceLastRefill) * (double)IspEnvironment->PaceRate / 1000000.0;
+        IspEnvironment->PaceLastRefill = now;
+        if (IspEnvironment->PaceTokens > IspEnvironment->PaceBurst)
+        {
+            IspEnvironment->PaceTokens = IspEnvironment->PaceBurst;
+        }
+
+        if (IspEnvironment->PaceTokens >= n)
+        {
+            IspEnvironment->PaceTokens -= n;
+            return;
+        }
+
+        Sleep((unsigned long)((n - IspEnvironment->PaceTokens) * 1000.0 / IspEnvironment->PaceRate) + 1);
+    }
+}
+#endif // !defined COMPILE_FOR_LPC21
+
+/***************************** SendComPortBlock *************************/
+/**  Sends a block of bytes out the opened com port.
+\param [in] s block to send.
+\param [in] n size of the block.
+\return 1 if the block was sent, 0 if a write failed or was short.
+*/
+int SendComPortBlock(ISP_ENVIRONMENT *IspEnvironment, const void *s, size_t n)
+{
+    int Sent = 1;
+#if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
+
+    unsigned long realsize;
+    size_t m;
+    unsigned long rxsize;
+    char * pch;
+    char * rxpch;
+#endif // defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
+
+    DumpString(4, s, n, "Sending ");
+    TraceRecord(IspEnvironment->PortId, TRACE_TX, s, n);
+
+    if (IspEnvironment->Transport != NULL)
+    {
+        IspEnvironment->Transport->Send(IspEnvironment->TransportContext, s, n);
+        return 1;
+    }
+
+#if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
+
+    if (IspEnvironment->HalfDuplex == 0 && IspEnvironment->PacingActive == PACING_TOKENBUCKET)
+    {
+        pch = (char *)s;
+        while (n > 0)
+        {
+            m = (n > IspEnvironment->PaceBurst) ? IspEnvironment->PaceBurst : n;
+            PaceWait(IspEnvironment, m);
+            WriteFile(IspEnvironment->hCom, pch, m, &realsize, NULL);
+            pch += m;
+            n -= m;
+        }
+    }
+    else if (IspEnvironment->HalfDuplex == 0)
+    {
+        WriteFile(IspEnvironment->hCom, s, n, &realsize, NULL);
+    }
+    else
+    {
+        pch = (char *)s;
+        rxpch = IspEnvironment->RxTmpBuf;
+        IspEnvironment->RxTmpPos = 0;
+
+        // avoid buffer otherflow, keep room for the terminating 0
+        if (n > sizeof (IspEnvironment->RxTmpBuf) - 1)
+            n = sizeof (IspEnvironment->RxTmpBuf) - 1;
+
+        for (m = 0; m < n; m++)
+        {
+            WriteFile(IspEnvironment->hCom, pch, 1, &realsize, NULL);
+
+            if ((*pch != '?') || (n != 1))
+            {
+                do
                 {
                     ReadFile(IspEnvironment->hCom, rxpch, 1, &rxsize, NULL);
                 }while (rxsize == 0);
@@ -740,16 +1309,45 @@ void SendComPortBlock(ISP_ENVIRONMENT *IspEnvironment, const void *s, size_t n)
     }
 #endif // defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
 
-#if defined COMPILE_FOR_LINUX || defined COMPILE_FOR_LPC21
+#if defined COMPILE_FOR_LINUX
+
+    if (IspEnvironment->PacingActive == PACING_TOKENBUCKET)
+    {
+        const char *p = (const char *)s;
+        size_t chunk;
+
+        while (n > 0)
+        {
+            chunk = (n > IspEnvironment->PaceBurst) ? IspEnvironment->PaceBurst : n;
+            PaceWait(IspEnvironment, chunk);
+            if (write(IspEnvironment->fdCom, p, chunk) != (ssize_t)chunk)
+            {
+                Sent = 0;
+                break;
+            }
+            p += chunk;
+            n -= chunk;
+        }
+    }
+    else if (write(IspEnvironment->fdCom, s, n) != (ssize_t)n)
+    {
+        Sent = 0;
+    }
+
+#endif // defined COMPILE_FOR_LINUX
+
+#if defined COMPILE_FOR_LPC21
 
     write(IspEnvironment->fdCom, s, n);
 
-#endif // defined COMPILE_FOR_LINUX || defined COMPILE_FOR_LPC21
+#endif // defined COMPILE_FOR_LPC21
 
     if (IspEnvironment->WriteDelay == 1)
     {
         Sleep(100); // 100 ms delay after each block (makes lpc21isp to work with bad UARTs)
     }
+
+    return Sent;
 }
 
 /***************************** SendComPort ******************************/
@@ -777,42 +1375,39 @@ static void SerialTimeoutTick(ISP_ENVIRONMENT *IspEnvironment)
     }
 }
 
-/***************************** ReceiveComPortBlock **********************/
-/**  Receives a buffer from the open com port. Returns all the characters
-ready (waits for up to 'n' milliseconds before accepting that no more
-characters are ready) or when the buffer is full. 'n' is system dependant,
-see SerialTimeout routines.
+/***************************** ReadSerialPort ***************************/
+/**  Platform dependant part of ReceiveComPortBlock.
 \param [out] answer buffer to hold the bytes read from the serial port.
 \param [in] max_size the size of buffer pointed to by answer.
 \param [out] real_size pointer to a long that returns the amout of the
 buffer that is actually used.
 */
-static void ReceiveComPortBlock(ISP_ENVIRONMENT *IspEnvironment,
-                                          void *answer, unsigned long max_size,
-                                          unsigned long *real_size)
+static void ReadSerialPort(ISP_ENVIRONMENT *IspEnvironment,
+                           void *answer, unsigned long max_size,
+                           unsigned long *real_size)
 {
-    char tmp_string[32];
-
 #if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
 
     if (IspEnvironment->HalfDuplex == 0)
         ReadFile(IspEnvironment->hCom, answer, max_size, real_size, NULL);
     else
     {
+        const char *pRxTmpBuf = &IspEnvironment->RxTmpBuf[IspEnvironment->RxTmpPos];
+
         *real_size = strlen (pRxTmpBuf);
         if (*real_size)
         {
             if (max_size >= *real_size)
             {
                 strncpy((char*) answer, pRxTmpBuf, *real_size);
-                RxTmpBuf[0] = 0;
-                pRxTmpBuf = RxTmpBuf;
+                IspEnvironment->RxTmpBuf[0] = 0;
+                IspEnvironment->RxTmpPos = 0;
             }
             else
             {
                 strncpy((char*) answer, pRxTmpBuf, max_size);
                 *real_size = max_size;
-                pRxTmpBuf += max_size;
+                IspEnvironment->RxTmpPos += max_size;
             }
         }
         else
@@ -833,12 +1428,28 @@ static void ReceiveComPortBlock(ISP_ENVIRONMENT *IspEnvironment,
             readSet;
         struct timeval
             timeVal;
-
-        FD_ZERO(&readSet);                             // clear the set
-        FD_SET(IspEnvironment->fdCom,&readSet);        // add this descriptor to the set
-        timeVal.tv_sec=0;                              // set up the timeout waiting for one to come ready (500ms)
-        timeVal.tv_usec=500*1000;
-        if(select(FD_SETSIZE,&readSet,NULL,NULL,&timeVal)==1)    // wait up to 500 ms or until our data is ready
+        int
+            ready;
+        unsigned long long
+            now = IspClock(),
+            wait_us = now < IspEnvironment->serial_deadline ? IspEnvironment->serial_deadline - now : 0;
+
+#if defined GANG_SUPPORT
+        if (IspEnvironment->GangSession != NULL)
+        {
+            // let the other sessions run while we wait
+            ready = GangWaitReadable(IspEnvironment, (unsigned)((wait_us + 999) / 1000));
+        }
+        else
+#endif
+        {
+            FD_ZERO(&readSet);                             // clear the set
+            FD_SET(IspEnvironment->fdCom,&readSet);        // add this descriptor to the set
+            timeVal.tv_sec=wait_us / 1000000;              // set up the timeout waiting for one to come ready
+            timeVal.tv_usec=wait_us % 1000000;
+            ready = (select(FD_SETSIZE,&readSet,NULL,NULL,&timeVal)==1);    // wait until the deadline or until our data is ready
+        }
+        if(ready)
         {
             *real_size=read(IspEnvironment->fdCom, answer, max_size);
         }
@@ -850,14 +1461,47 @@ static void ReceiveComPortBlock(ISP_ENVIRONMENT *IspEnvironment,
         }
     }
 #endif // defined COMPILE_FOR_LINUX
+}
+
+/***************************** ReceiveComPortBlock **********************/
+/**  Receives a buffer from the open com port. Returns all the characters
+ready (waits for up to 'n' milliseconds before accepting that no more
+characters are ready) or when the buffer is full. 'n' is system dependant,
+see SerialTimeout routines.
+\param [out] answer buffer to hold the bytes read from the serial port.
+\param [in] max_size the size of buffer pointed to by answer.
+\param [out] real_size pointer to a long that returns the amout of the
+buffer that is actually used.
+*/
+static void ReceiveComPortBlock(ISP_ENVIRONMENT *IspEnvironment,
+                                          void *answer, unsigned long max_size,
+                                          unsigned long *real_size)
+{
+    char tmp_string[32];
+
+    if (IspEnvironment->Transport != NULL)
+    {
+        *real_size = IspEnvironment->Transport->Receive(IspEnvironment->TransportContext, answer, max_size);
+    }
+    else
+    {
+        ReadSerialPort(IspEnvironment, answer, max_size, real_size);
+    }
 
-    sprintf(tmp_string, "Read(Length=%ld): ", (*real_size));
-    DumpString(5, answer, (*real_size), tmp_string);
+    if (debug_level >= 5)
+    {
+        sprintf(tmp_string, "Read(Length=%ld): ", (*real_size));
+        DumpString(5, answer, (*real_size), tmp_string);
+    }
 
     if (*real_size == 0)
     {
         SerialTimeoutTick(IspEnvironment);
     }
+    else
+    {
+        TraceRecord(IspEnvironment->PortId, TRACE_RX, answer, *real_size);
+    }
 }
 
 
@@ -870,13 +1514,16 @@ use. Used by the serial input routines, the actual counting takes place in
 ReceiveComPortBlock.
 \param [in] timeout_milliseconds the time in milliseconds to use for
 timeout.  Note that just because it is set in milliseconds doesn't mean
-that the granularity is that fine.  In many cases (particularly Linux) it
-will be coarser.
+that the granularity is that fine.  On Linux it is the total time of the
+read, to the microsecond.
 */
 static void SerialTimeoutSet(ISP_ENVIRONMENT *IspEnvironment, unsigned timeout_milliseconds)
 {
 #if defined COMPILE_FOR_LINUX
-    IspEnvironment->serial_timeout_count = timeout_milliseconds / 100;
+    // Reads from the serial port wait until the deadline, a transport
+    // (replay, emulated target) counts its empty reads instead
+    IspEnvironment->serial_timeout_count = (timeout_milliseconds + 99) / 100;
+    IspEnvironment->serial_deadline = IspClock() + timeout_milliseconds * 1000ULL;
 #elif defined COMPILE_FOR_LPC21
     IspEnvironment->serial_timeout_count = timeout_milliseconds * 200;
 #else
@@ -1042,39 +1689,24 @@ static void ControlModemLines(ISP_ENVIRONMENT *IspEnvironment, unsigned char DTR
     }
 
 #if defined COMPILE_FOR_LINUX
-    int status;
-
-    if (ioctl(IspEnvironment->fdCom, TIOCMGET, &status) == 0)
-    {
-        DebugPrintf(3, "ioctl get ok, status = %X\n",status);
-    }
-    else
-    {
-        DebugPrintf(1, "ioctl get failed\n");
-    }
+    // Set and clear only the two lines, one ioctl each, instead of
+    // reading, modifying and writing back all modem lines.
+    int set = 0, clear = 0;
 
-    if (DTR) status |=  TIOCM_DTR;
-    else    status &= ~TIOCM_DTR;
+    if (DTR) set   |= TIOCM_DTR;
+    else     clear |= TIOCM_DTR;
 
-    if (RTS) status |=  TIOCM_RTS;
-    else    status &= ~TIOCM_RTS;
+    if (RTS) set   |= TIOCM_RTS;
+    else     clear |= TIOCM_RTS;
 
-    if (ioctl(IspEnvironment->fdCom, TIOCMSET, &status) == 0)
-    {
-        DebugPrintf(3, "ioctl set ok, status = %X\n",status);
-    }
-    else
+    if (set != 0 && ioctl(IspEnvironment->fdCom, TIOCMBIS, &set) != 0)
     {
-        DebugPrintf(1, "ioctl set failed\n");
+        DebugPrintf(1, "ioctl TIOCMBIS failed\n");
     }
 
-    if (ioctl(IspEnvironment->fdCom, TIOCMGET, &status) == 0)
-    {
-        DebugPrintf(3, "ioctl get ok, status = %X\n",status);
-    }
-    else
+    if (clear != 0 && ioctl(IspEnvironment->fdCom, TIOCMBIC, &clear) != 0)
     {
-        DebugPrintf(1, "ioctl get failed\n");
+        DebugPrintf(1, "ioctl TIOCMBIC failed\n");
     }
 
 #endif // defined COMPILE_FOR_LINUX
@@ -1105,6 +1737,14 @@ void ClearSerialPortBuffers(ISP_ENVIRONMENT *IspEnvironment)
 #if defined COMPILE_FOR_LINUX
     /* variables to store the current tty state, create a new one */
     struct termios origtty, tty;
+#endif // defined COMPILE_FOR_LINUX
+
+    if (IspEnvironment->Transport != NULL)
+    {
+        return;
+    }
+
+#if defined COMPILE_FOR_LINUX
 
     /* store the current tty settings */
     tcgetattr(IspEnvironment->fdCom, &origtty);
@@ -1130,6 +1770,12 @@ void ClearSerialPortBuffers(ISP_ENVIRONMENT *IspEnvironment)
 */
 void Sleep(unsigned long MilliSeconds)
 {
+#if defined GANG_SUPPORT
+    if (GangSleep(MilliSeconds))
+    {
+        return;     // other sessions were served in the meantime
+    }
+#endif
     usleep(MilliSeconds*1000); //convert to microseconds
 }
 #endif // defined COMPILE_FOR_LINUX
@@ -1152,6 +1798,23 @@ void Sleep(unsigned long MilliSeconds)
 /************* Applicationlayer.                                        */
 
 #if !defined COMPILE_FOR_LPC21
+/***************************** IspExit **********************************/
+/**  Ends the session after a fatal error. If ProgramTarget runs the
+session (gang mode, library) it continues there and returns ExitCode as
+error, otherwise the program ends.
+\param [in] ExitCode the exit code of the program.
+*/
+void IspExit(ISP_ENVIRONMENT *IspEnvironment, int ExitCode)
+{
+    if (IspEnvironment != NULL && IspEnvironment->Abort != NULL)
+    {
+        IspEnvironment->ExitCode = ExitCode;
+        longjmp(*IspEnvironment->Abort, 1);
+    }
+
+    exit(ExitCode);
+}
+
 /***************************** DebugPrintf ******************************/
 /**  Prints a debug string depending the current debug level. The higher
 the debug level the more detail that will be printed.  Each print
@@ -1172,7 +1835,7 @@ void DebugPrintf(int level, const char *fmt, ...)
         char pTemp[2000];
         va_start(ap, fmt);
         //vprintf(fmt, ap);
-        vsprintf(pTemp, fmt, ap);
+        vsnprintf(pTemp, sizeof(pTemp), fmt, ap);
         TRACE(pTemp);
         va_end(ap);
         fflush(stdout);
@@ -1182,6 +1845,62 @@ void DebugPrintf(int level, const char *fmt, ...)
 #endif // !defined COMPILE_FOR_LPC21
 
 
+/***************************** ScanLineEnds *****************************/
+/**  Counts the line ends in a block of an answer. The bootloaders may send
+0x0d,0x0a,0x0a or 0x0d,0x0a as linefeed pattern, a 0x0d followed by anything
+but 0x0a also ends a line. Stops at the wanted line end, what follows
+belongs to the next answer.
+\param [in,out] Scanner state of the scan, zeroed before the first block.
+\param [in] Answer the answer received so far.
+\param [in] From offset of the first new byte.
+\param [in] To offset behind the last new byte.
+\param [in] WantedNr0x0A the number of line ends the caller waits for.
+*/
+void ScanLineEnds(LINE_SCANNER *Scanner, const unsigned char *Answer,
+                  unsigned long From, unsigned long To, unsigned long WantedNr0x0A)
+{
+    unsigned long p;
+
+    for (p = From; p < To; p++)
+    {
+        /* Torsten Lang 2013-05-06 Scan for 0x0d,0x0a,0x0a and 0x0d,0x0a as linefeed pattern */
+        if (Answer[p] == 0x0a)
+        {
+            if (Scanner->lf != 0)
+            {
+                Scanner->nr_of_0x0A++;
+                Scanner->lf = 0;
+                if (Scanner->nr_of_0x0A >= WantedNr0x0A)
+                {
+                    Scanner->end = p + 1;
+                    return;
+                }
+            }
+        }
+        else if (Answer[p] == 0x0d)
+        {
+            Scanner->nr_of_0x0D++;
+            Scanner->lf = 1;
+        }
+        else if (((signed char) Answer[p]) < 0)
+        {
+            Scanner->eof = 1;
+            Scanner->lf  = 0;
+        }
+        else if (Scanner->lf != 0)
+        {
+            Scanner->nr_of_0x0D++;
+            Scanner->nr_of_0x0A++;
+            Scanner->lf = 0;
+            if (Scanner->nr_of_0x0A >= WantedNr0x0A)
+            {
+                Scanner->end = p + 1;
+                return;
+            }
+        }
+    }
+}
+
 /***************************** ReceiveComPort ***************************/
 /**  Receives a buffer from the open com port. Returns when the buffer is
 filled, the numer of requested linefeeds has been received or the timeout
@@ -1211,15 +1930,11 @@ void ReceiveComPort(ISP_ENVIRONMENT *IspEnvironment,
                                     unsigned timeOutMilliseconds)
 {
     unsigned long tmp_realsize;
-    unsigned long nr_of_0x0A = 0;
-    unsigned long nr_of_0x0D = 0;
-    int eof = 0;
-    unsigned long p;
+    LINE_SCANNER scanner;
     unsigned char *Answer;
     unsigned char *endPtr;
     char tmp_string[32];
-    static char residual_data[128] = {'\0'};
-    int lf = 0;
+    char *residual_data = IspEnvironment->ResidualData;
 
     Answer  = (unsigned char*) Ans;
 
@@ -1227,6 +1942,7 @@ void ReceiveComPort(ISP_ENVIRONMENT *IspEnvironment,
 
     *RealSize = 0;
     endPtr = NULL;
+    memset(&scanner, 0, sizeof(scanner));
 
     do
     {
@@ -1245,50 +1961,16 @@ void ReceiveComPort(ISP_ENVIRONMENT *IspEnvironment,
 
         if (tmp_realsize != 0)
         {
-            for (p = (*RealSize); p < (*RealSize) + tmp_realsize; p++)
-            {
-                /* Torsten Lang 2013-05-06 Scan for 0x0d,0x0a,0x0a and 0x0d,0x0a as linefeed pattern */
-                if (Answer[p] == 0x0a)
-                {
-                    if (lf != 0)
-                    {
-                        nr_of_0x0A++;
-                        lf = 0;
-                        if (nr_of_0x0A >= WantedNr0x0A)
-                        {
-                            endPtr = &Answer[p+1];
-                        }
-                    }
-                }
-                else if (Answer[p] == 0x0d)
-                {
-                    nr_of_0x0D++;
-                    lf = 1;
-                }
-                else if (((signed char) Answer[p]) < 0)
-                {
-                    eof = 1;
-                    lf  = 0;
-                }
-                else if (lf != 0)
-                {
-                    nr_of_0x0D++;
-                    nr_of_0x0A++;
-                    lf = 0;
-                    if (nr_of_0x0A >= WantedNr0x0A)
-                    {
-                        endPtr = &Answer[p+1];
-                    }
-                }
-            }
+            ScanLineEnds(&scanner, Answer, *RealSize, (*RealSize) + tmp_realsize, WantedNr0x0A);
             (*RealSize) += tmp_realsize;
         }
-    } while (((*RealSize) < MaxSize) && (SerialTimeoutCheck(IspEnvironment) == 0) && (nr_of_0x0A < WantedNr0x0A) && !eof);
+    } while (((*RealSize) < MaxSize) && (SerialTimeoutCheck(IspEnvironment) == 0) && (scanner.nr_of_0x0A < WantedNr0x0A) && !scanner.eof);
 
     /* Torsten Lang 2013-05-06 Store residual data and cut answer after expected nr. of 0x0a */
     Answer[*RealSize] = '\0';
-    if (endPtr != NULL)
+    if (scanner.end != 0)
     {
+        endPtr = &Answer[scanner.end];
         strcpy(residual_data, (char *)endPtr);
         *endPtr = '\0';
         /* Torsten Lang 2013-06-28 Update size info */
@@ -1340,204 +2022,530 @@ int ReceiveComPortBlockComplete(ISP_ENVIRONMENT *IspEnvironment,
     return 0;
 }
 
-/***************************** ReadArguments ****************************/
-/**  Reads the command line arguments and parses it for the various
-options. Uses the same arguments as main.  Used to separate the command
-line parsing from main and improve its readability.  This should also make
-it easier to modify the command line parsing in the future.
-\param [in] argc the number of arguments.
-\param [in] argv an array of pointers to the arguments.
+/***************************** ParseEscapes *****************************/
+/**  Decodes an option argument with \\r, \\n, \\t, \\\\ and \\xHH escapes.
+\param [in] Text the argument.
+\param [out] Out the bytes, room for 64.
+\param [out] Length the number of bytes.
+\return 0 if ok, 1 if too long or a bad escape.
 */
-static void ReadArguments(ISP_ENVIRONMENT *IspEnvironment, unsigned int argc, char *argv[])
+static int ParseEscapes(const char *Text, char *Out, unsigned char *Length)
 {
-    unsigned int i;
+    unsigned n = 0;
+    unsigned value;
 
-    if (argc >= 5)
+    while (*Text != 0)
     {
-        for (i = 1; i < argc - 3; i++)
+        if (n == 64)
         {
-            if (stricmp(argv[i], "-wipe") == 0)
-            {
-                IspEnvironment->WipeDevice = 1;
-                DebugPrintf(3, "Wipe entire device before writing.\n");
-                continue;
-            }
+            return 1;
+        }
 
-            if (stricmp(argv[i], "-bin") == 0)
-            {
-                IspEnvironment->FileFormat = FORMAT_BINARY;
-                DebugPrintf(3, "Binary format file input.\n");
-                continue;
-            }
+        if (*Text != '\\')
+        {
+            Out[n++] = *Text++;
+            continue;
+        }
 
-            if (stricmp(argv[i], "-hex") == 0)
+        switch (Text[1])
+        {
+        case 'r':  Out[n++] = '\r'; Text += 2; break;
+        case 'n':  Out[n++] = '\n'; Text += 2; break;
+        case 't':  Out[n++] = '\t'; Text += 2; break;
+        case '\\': Out[n++] = '\\'; Text += 2; break;
+        case 'x':
+            if (!isxdigit(Text[2]) || !isxdigit(Text[3]) || sscanf(Text + 2, "%2x", &value) != 1)
             {
-                IspEnvironment->FileFormat = FORMAT_HEX;
-                DebugPrintf(3, "Hex format file input.\n");
-                continue;
+                return 1;
             }
+            Out[n++] = (char)value;
+            Text += 4;
+            break;
+        default:
+            return 1;
+        }
+    }
 
-            if (stricmp(argv[i], "-logfile") == 0)
-            {
-                IspEnvironment->LogFile = 1;
-                DebugPrintf(3, "Log terminal output.\n");
-                continue;
-            }
+    *Length = (unsigned char)n;
+    return 0;
+}
 
-            if (stricmp(argv[i], "-detectonly") == 0)
-            {
-                IspEnvironment->DetectOnly  = 1;
-                IspEnvironment->ProgramChip = 0;
-                DebugPrintf(3, "Only detect LPC chip part id.\n");
-                continue;
-            }
+/***************************** ParseOption ******************************/
+/**  Evaluates one option of the command line. Also used to set up
+library sessions (see lpcsession.c).
+\param [in] Option the option, e.g. "-verify".
+\return 1 if the option is known, 0 otherwise.
+*/
+int ParseOption(ISP_ENVIRONMENT *IspEnvironment, const char *Option)
+{
+    if (stricmp(Option, "-wipe") == 0)
+    {
+        IspEnvironment->WipeDevice = 1;
+        DebugPrintf(3, "Wipe entire device before writing.\n");
+        return 1;
+    }
 
-            if(strnicmp(argv[i],"-debug", 6) == 0)
-            {
-                char* num;
-                num = argv[i] + 6;
-                while(*num && isdigit(*num) == 0) num++;
-                if(isdigit(*num) != 0) debug_level = atoi( num);
-                else debug_level = 4;
-                DebugPrintf(3, "Turn on debug, level: %d.\n", debug_level);
-                continue;
-            }
+    if (stricmp(Option, "-bin") == 0)
+    {
+        IspEnvironment->FileFormat = FORMAT_BINARY;
+        DebugPrintf(3, "Binary format file input.\n");
+        return 1;
+    }
 
-            if (stricmp(argv[i], "-boothold") == 0)
-            {
-                IspEnvironment->BootHold = 1;
-                DebugPrintf(3, "hold EnableBootLoader asserted throughout programming sequence.\n");
-                continue;
-            }
+    if (stricmp(Option, "-hex") == 0)
+    {
+        IspEnvironment->FileFormat = FORMAT_HEX;
+        DebugPrintf(3, "Hex format file input.\n");
+        return 1;
+    }
 
-            if (stricmp(argv[i], "-donotstart") == 0)
-            {
-                IspEnvironment->DoNotStart = 1;
-                DebugPrintf(3, "Do NOT start MCU after programming.\n");
-                continue;
-            }
+    if (stricmp(Option, "-logfile") == 0)
+    {
+        IspEnvironment->LogFile = 1;
+        DebugPrintf(3, "Log terminal output.\n");
+        return 1;
+    }
 
-            if(strnicmp(argv[i],"-try", 4) == 0)
-            {
-                int
-                    retry;
-                retry=atoi(&argv[i][4]);
-                if(retry>0)
-                {
-                    IspEnvironment->nQuestionMarks=retry;
-                    DebugPrintf(3, "Retry count: %d.\n", IspEnvironment->nQuestionMarks);
-                }
-                else
-                {
-                    fprintf(stderr,"invalid argument for -try: \"%s\"\n",argv[i]);
-                }
-                continue;
-            }
+    if (stricmp(Option, "-detectonly") == 0)
+    {
+        IspEnvironment->DetectOnly  = 1;
+        IspEnvironment->ProgramChip = 0;
+        DebugPrintf(3, "Only detect LPC chip part id.\n");
+        return 1;
+    }
+
+    if(strnicmp(Option,"-debug", 6) == 0)
+    {
+        const char* num;
+        num = Option + 6;
+        while(*num && isdigit(*num) == 0) num++;
+        if(isdigit(*num) != 0) debug_level = atoi( num);
+        else debug_level = 4;
+        DebugPrintf(3, "Turn on debug, level: %d.\n", debug_level);
+        return 1;
+    }
+
+    if (stricmp(Option, "-boothold") == 0)
+    {
+        IspEnvironment->BootHold = 1;
+        DebugPrintf(3, "hold EnableBootLoader asserted throughout programming sequence.\n");
+        return 1;
+    }
+
+    if (strnicmp(Option, "-swentryack", 11) == 0)
+    {
+        if (ParseEscapes(&Option[11], IspEnvironment->SwEntryAck, &IspEnvironment->SwEntryAckLength) != 0)
+        {
+            fprintf(stderr,"invalid argument for -swentryack: \"%s\"\n",Option);
+        }
+        return 1;
+    }
+
+    if (strnicmp(Option, "-swentrybaud", 12) == 0)
+    {
+        IspEnvironment->SwEntryBaud = strtoul(&Option[12], NULL, 10);
+        DebugPrintf(3, "Application baud rate %lu.\n", IspEnvironment->SwEntryBaud);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-swentrywait", 12) == 0)
+    {
+        IspEnvironment->SwEntryWait = atoi(&Option[12]);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-swentry", 8) == 0)
+    {
+        if (ParseEscapes(&Option[8], IspEnvironment->SwEntry, &IspEnvironment->SwEntryLength) != 0 ||
+            IspEnvironment->SwEntryLength == 0)
+        {
+            fprintf(stderr,"invalid argument for -swentry: \"%s\"\n",Option);
+        }
+        else
+        {
+            DebugPrintf(3, "Enter ISP mode by software.\n");
+        }
+        return 1;
+    }
+
+    if (strnicmp(Option, "-resettiming", 12) == 0)
+    {
+        RESET_TIMING *Timing = &IspEnvironment->ResetTiming;
+
+        if (sscanf(&Option[12], "%u,%u,%u", &Timing->Setup, &Timing->Pulse, &Timing->Settle) == 3)
+        {
+            IspEnvironment->ResetTimingSet = 1;
+            DebugPrintf(3, "Reset timing: setup %u, pulse %u, settle %u ms.\n",
+                        Timing->Setup, Timing->Pulse, Timing->Settle);
+        }
+        else
+        {
+            fprintf(stderr,"invalid argument for -resettiming: \"%s\"\n",Option);
+        }
+        return 1;
+    }
+
+    if (strnicmp(Option, "-resettune", 10) == 0)
+    {
+        IspEnvironment->ResetTune = 1;
+        if (Option[10] != 0)
+        {
+            IspEnvironment->ResetTuneFile = &Option[10];
+        }
+        DebugPrintf(3, "Tune the reset timing.\n");
+        return 1;
+    }
+
+    if (stricmp(Option, "-donotstart") == 0)
+    {
+        IspEnvironment->DoNotStart = 1;
+        DebugPrintf(3, "Do NOT start MCU after programming.\n");
+        return 1;
+    }
+
+    if(strnicmp(Option,"-try", 4) == 0)
+    {
+        int
+            retry;
+        retry=atoi(&Option[4]);
+        if(retry>0)
+        {
+            IspEnvironment->nQuestionMarks=retry;
+            DebugPrintf(3, "Retry count: %d.\n", IspEnvironment->nQuestionMarks);
+        }
+        else
+        {
+            fprintf(stderr,"invalid argument for -try: \"%s\"\n",Option);
+        }
+        return 1;
+    }
+
+    if (strnicmp(Option, "-syncprobe", 10) == 0)
+    {
+        IspEnvironment->SyncProbe = atoi(&Option[10]);
+        if (IspEnvironment->SyncProbe > 0)
+        {
+            DebugPrintf(3, "Wait %u ms for the answer to '?'.\n", IspEnvironment->SyncProbe);
+        }
+        else
+        {
+            fprintf(stderr,"invalid argument for -syncprobe: \"%s\"\n",Option);
+        }
+        return 1;
+    }
 
 #if defined SYSFS_GPIO_SUPPORT
-             if(strnicmp(argv[i],"-gpiorst", 8) == 0)
-             {
-                int rst;
-                rst=atoi(&argv[i][8]);
-                if(rst>0)
-                {
-                    IspEnvironment->GpioRst=rst;
-                    DebugPrintf(3, "GPIO RST: %d.\n", rst);
-                }
-                else
-                {
-                    fprintf(stderr,"invalid argument for -gpiorst: \"%s\"\n",argv[i]);
-                }
-                continue;
-            }
-            if(strnicmp(argv[i],"-gpioisp", 8) == 0)
-            {
-                int isp;
-                isp=atoi(&argv[i][8]);
-                if(isp>0)
-                {
-                    IspEnvironment->GpioIsp=isp;
-                    DebugPrintf(3, "GPIO ISP: %d.\n", isp);
-                }
-                else
-                {
-                    fprintf(stderr,"invalid argument for -gpioisp: \"%s\"\n",argv[i]);
-                }
-                continue;
-            }
+     if(strnicmp(Option,"-gpiorst", 8) == 0)
+     {
+        if(isdigit(Option[8]))
+        {
+            IspEnvironment->GpioRst=atoi(&Option[8]);
+            IspEnvironment->GpioSet|=GPIO_RST_SET;
+            DebugPrintf(3, "GPIO RST: %u.\n", IspEnvironment->GpioRst);
+        }
+        else
+        {
+            fprintf(stderr,"invalid argument for -gpiorst: \"%s\"\n",Option);
+        }
+        return 1;
+    }
+    if(strnicmp(Option,"-gpioisp", 8) == 0)
+    {
+        if(isdigit(Option[8]))
+        {
+            IspEnvironment->GpioIsp=atoi(&Option[8]);
+            IspEnvironment->GpioSet|=GPIO_ISP_SET;
+            DebugPrintf(3, "GPIO ISP: %u.\n", IspEnvironment->GpioIsp);
+        }
+        else
+        {
+            fprintf(stderr,"invalid argument for -gpioisp: \"%s\"\n",Option);
+        }
+        return 1;
+    }
+#if defined GPIOCHIP_SUPPORT
+    if(strnicmp(Option,"-gpiochip", 9) == 0 && Option[9] != 0)
+    {
+        IspEnvironment->GpioChip=&Option[9];
+        DebugPrintf(3, "GPIO chip: %s.\n", IspEnvironment->GpioChip);
+        return 1;
+    }
+#endif
 #endif
 
-            if (stricmp(argv[i], "-control") == 0)
-            {
-                IspEnvironment->ControlLines = 1;
-                DebugPrintf(3, "Use RTS/DTR to control target state.\n");
-                continue;
-            }
+    if (stricmp(Option, "-control") == 0)
+    {
+        IspEnvironment->ControlLines = 1;
+        DebugPrintf(3, "Use RTS/DTR to control target state.\n");
+        return 1;
+    }
 
-            if (stricmp(argv[i], "-controlswap") == 0)
-            {
-                IspEnvironment->ControlLinesSwapped = 1;
-                DebugPrintf(3, "Use RTS to control reset, and DTR to control P0.14(ISP).\n");
-                continue;
-            }
+    if (stricmp(Option, "-controlswap") == 0)
+    {
+        IspEnvironment->ControlLinesSwapped = 1;
+        DebugPrintf(3, "Use RTS to control reset, and DTR to control P0.14(ISP).\n");
+        return 1;
+    }
 
-            if (stricmp(argv[i], "-controlinv") == 0)
-            {
-                IspEnvironment->ControlLinesInverted = 1;
-                DebugPrintf(3, "Invert state of RTS & DTR (0=true/assert/set, 1=false/deassert/clear).\n");
-                continue;
-            }
+    if (stricmp(Option, "-controlinv") == 0)
+    {
+        IspEnvironment->ControlLinesInverted = 1;
+        DebugPrintf(3, "Invert state of RTS & DTR (0=true/assert/set, 1=false/deassert/clear).\n");
+        return 1;
+    }
 
-            if (stricmp(argv[i], "-halfduplex") == 0)
-            {
-                IspEnvironment->HalfDuplex = 1;
-                DebugPrintf(3, "halfduplex serial communication.\n");
-                continue;
-            }
+    if (stricmp(Option, "-halfduplex") == 0)
+    {
+        IspEnvironment->HalfDuplex = 1;
+        DebugPrintf(3, "halfduplex serial communication.\n");
+        return 1;
+    }
+
+    if (stricmp(Option, "-writedelay") == 0)
+    {
+        IspEnvironment->WriteDelay = 1;
+        DebugPrintf(3, "Write delay enabled.\n");
+        return 1;
+    }
+
+    if (stricmp(Option, "-flowxonxoff") == 0)
+    {
+        IspEnvironment->Pacing = PACING_XONXOFF;
+        DebugPrintf(3, "Use XON/XOFF flow control.\n");
+        return 1;
+    }
+
+    if (stricmp(Option, "-flownone") == 0)
+    {
+        IspEnvironment->Pacing = PACING_NONE;
+        DebugPrintf(3, "Use no flow control.\n");
+        return 1;
+    }
+
+    if (stricmp(Option, "-flowrtscts") == 0)
+    {
+        IspEnvironment->Pacing = PACING_RTSCTS;
+        DebugPrintf(3, "Use RTS/CTS flow control.\n");
+        return 1;
+    }
+
+    if (strnicmp(Option, "-pace", 5) == 0)
+    {
+        char *next;
+
+        IspEnvironment->Pacing   = PACING_TOKENBUCKET;
+        IspEnvironment->PaceRate = strtoul(&Option[5], &next, 10);
+        if (*next == ',')
+        {
+            IspEnvironment->PaceBurst = strtoul(next + 1, NULL, 10);
+        }
+        DebugPrintf(3, "Pace transmit data to %lu bytes/s (burst %lu).\n", IspEnvironment->PaceRate, IspEnvironment->PaceBurst);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-capture", 8) == 0 && Option[8] != '\0')
+    {
+        IspEnvironment->CaptureFile = &Option[8];
+        DebugPrintf(3, "Capture serial traffic to %s.\n", IspEnvironment->CaptureFile);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-replay", 7) == 0 && Option[7] != '\0')
+    {
+        IspEnvironment->ReplayFile = &Option[7];
+        DebugPrintf(3, "Replay serial traffic from %s.\n", IspEnvironment->ReplayFile);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-stats", 6) == 0 && Option[6] != '\0')
+    {
+        IspEnvironment->StatsFile = &Option[6];
+        DebugPrintf(3, "Write timing statistics to %s.\n", IspEnvironment->StatsFile);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-events", 7) == 0 && Option[7] != '\0')
+    {
+        IspEnvironment->EventsFile = &Option[7];
+        DebugPrintf(3, "Write timing events to %s.\n", IspEnvironment->EventsFile);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-metrics", 8) == 0 && Option[8] != '\0')
+    {
+        IspEnvironment->MetricsFile = &Option[8];
+        DebugPrintf(3, "Write metrics to %s.\n", IspEnvironment->MetricsFile);
+        return 1;
+    }
+
+#if defined GANG_SUPPORT
+    if (stricmp(Option, "-gang") == 0)
+    {
+        IspEnvironment->Gang = 1;
+        DebugPrintf(3, "Gang programming, comport is a comma separated list.\n");
+        return 1;
+    }
+
+    if (strnicmp(Option, "-daemon", 7) == 0 && Option[7] != '\0')
+    {
+        IspEnvironment->DaemonSocket = &Option[7];
+        DebugPrintf(3, "Serve programming jobs on %s.\n", IspEnvironment->DaemonSocket);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-manifest", 9) == 0 && Option[9] != '\0')
+    {
+        IspEnvironment->ManifestFile = &Option[9];
+        DebugPrintf(3, "Run the jobs of %s.\n", IspEnvironment->ManifestFile);
+        return 1;
+    }
+#endif
+
+    if (strnicmp(Option, "-partid", 7) == 0 && Option[7] != '\0')
+    {
+        IspEnvironment->ExpectedPartId = strtoul(&Option[7], NULL, 0);
+        DebugPrintf(3, "Expect part ID 0x%08lX.\n", IspEnvironment->ExpectedPartId);
+        return 1;
+    }
+
+    if (stricmp(Option, "-pinpart") == 0)
+    {
+        IspEnvironment->PinPart = 1;
+        DebugPrintf(3, "Take the part of -partid without reading its ID again.\n");
+        return 1;
+    }
+
+    if (stricmp(Option, "-pipeline") == 0)
+    {
+        IspEnvironment->Pipeline = 1;
+        DebugPrintf(3, "Send the commands after synchronizing back to back.\n");
+        return 1;
+    }
+
+    if (strnicmp(Option, "-journal", 8) == 0 && Option[8] != '\0')
+    {
+        IspEnvironment->JournalDir = &Option[8];
+        DebugPrintf(3, "Resume journal in %s.\n", IspEnvironment->JournalDir);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-recover", 8) == 0 && Option[8] != '\0')
+    {
+        IspEnvironment->Recover = atoi(&Option[8]);
+        DebugPrintf(3, "Recover up to %d times from failed commands.\n", IspEnvironment->Recover);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-timeouts", 9) == 0)
+    {
+        if (Option[9] == '\0')
+        {
+            IspEnvironment->TimeoutFloor   = TIMEOUT_FLOOR_MS;
+            IspEnvironment->TimeoutCeiling = TIMEOUT_CEILING_MS;
+        }
+        if (Option[9] == '\0' ||
+            (sscanf(&Option[9], "%u,%u", &IspEnvironment->TimeoutFloor, &IspEnvironment->TimeoutCeiling) == 2 &&
+             IspEnvironment->TimeoutFloor != 0 && IspEnvironment->TimeoutFloor <= IspEnvironment->TimeoutCeiling))
+        {
+            DebugPrintf(3, "Learned timeouts between %u and %u ms.\n",
+                        IspEnvironment->TimeoutFloor, IspEnvironment->TimeoutCeiling);
+        }
+        else
+        {
+            IspEnvironment->TimeoutFloor   = 0;
+            IspEnvironment->TimeoutCeiling = 0;
+            fprintf(stderr,"invalid argument for -timeouts: \"%s\"\n",Option);
+        }
+        return 1;
+    }
+
+#if defined DRYRUN_SUPPORT
+    if (strnicmp(Option, "-dryrun", 7) == 0 && Option[7] != '\0')
+    {
+        IspEnvironment->DryRunPart = &Option[7];
+        DebugPrintf(3, "Plan the download for %s without hardware.\n", IspEnvironment->DryRunPart);
+        return 1;
+    }
+
+    if (strnicmp(Option, "-linkmodel", 10) == 0 && Option[10] != '\0')
+    {
+        IspEnvironment->LinkModel = &Option[10];
+        DebugPrintf(3, "Link model %s.\n", IspEnvironment->LinkModel);
+        return 1;
+    }
+#endif
 
-            if (stricmp(argv[i], "-writedelay") == 0)
-            {
-                IspEnvironment->WriteDelay = 1;
-                DebugPrintf(3, "Write delay enabled.\n");
-                continue;
-            }
+#if defined(__linux__)
+    if (stricmp(Option, "-lowlatency") == 0)
+    {
+        IspEnvironment->LowLatency = 1;
+        DebugPrintf(3, "Tune serial driver for low latency.\n");
+        return 1;
+    }
+#endif
 
-            if (stricmp(argv[i], "-ADARM") == 0)
-            {
-                IspEnvironment->micro = ANALOG_DEVICES_ARM;
-                DebugPrintf(2, "Target: Analog Devices.\n");
-                continue;
-            }
+    if (stricmp(Option, "-ADARM") == 0)
+    {
+        IspEnvironment->micro = ANALOG_DEVICES_ARM;
+        DebugPrintf(2, "Target: Analog Devices.\n");
+        return 1;
+    }
 
-            if (stricmp(argv[i], "-NXPARM") == 0 || stricmp(argv[i], "-PHILIPSARM") == 0)
-            {
-                IspEnvironment->micro = NXP_ARM;
-                DebugPrintf(2, "Target: NXP.\n");
-                continue;
-            }
+    if (stricmp(Option, "-NXPARM") == 0 || stricmp(Option, "-PHILIPSARM") == 0)
+    {
+        IspEnvironment->micro = NXP_ARM;
+        DebugPrintf(2, "Target: NXP.\n");
+        return 1;
+    }
 
-            if (stricmp(argv[i], "-Verify") == 0)
-            {
-                IspEnvironment->Verify = 1;
-                DebugPrintf(2, "Verify after copy RAM to Flash.\n");
-                continue;
-            }
+    if (stricmp(Option, "-Verify") == 0)
+    {
+        IspEnvironment->Verify = 1;
+        DebugPrintf(2, "Verify after copy RAM to Flash.\n");
+        return 1;
+    }
 
 #ifdef INTEGRATED_IN_WIN_APP
-            if (stricmp(argv[i], "-nosync") == 0)
-            {
-                IspEnvironment->NoSync = 1;
-                DebugPrintf(2, "Performing no syncing, already done.\n");
-                continue;
-            }
+    if (stricmp(Option, "-nosync") == 0)
+    {
+        IspEnvironment->NoSync = 1;
+        DebugPrintf(2, "Performing no syncing, already done.\n");
+        return 1;
+    }
 #endif
 
 #ifdef TERMINAL_SUPPORT
-            if (CheckTerminalParameters(IspEnvironment, argv[i]))
+    if (CheckTerminalParameters(IspEnvironment, Option))
+    {
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+#if !defined LPC21ISP_LIBRARY
+
+/***************************** ReadArguments ****************************/
+/**  Reads the command line arguments and parses it for the various
+options. Uses the same arguments as main.  Used to separate the command
+line parsing from main and improve its readability.  This should also make
+it easier to modify the command line parsing in the future.
+\param [in] argc the number of arguments.
+\param [in] argv an array of pointers to the arguments.
+*/
+static void ReadArguments(ISP_ENVIRONMENT *IspEnvironment, unsigned int argc, char *argv[])
+{
+    unsigned int i;
+
+    if (argc >= 5)
+    {
+        for (i = 1; i < argc - 3; i++)
+        {
+            if (ParseOption(IspEnvironment, argv[i]))
             {
                 continue;
             }
-#endif
 
             if(*argv[i] == '-') DebugPrintf( 2, "Unknown command line option: \"%s\"\n", argv[i]);
             else
@@ -1571,90 +2579,560 @@ static void ReadArguments(ISP_ENVIRONMENT *IspEnvironment, unsigned int argc, ch
         IspEnvironment->baud_rate = argv[argc - 2];
     }
 
-    if (argc < 5)
+    if (argc < 5)
+    {
+        debug_level = (debug_level < 2) ? 2 : debug_level;
+    }
+
+    if (argc < 5)
+    {
+        DebugPrintf(2, "\n"
+                       "Portable command line ISP\n"
+                       "for NXP LPC family and Analog Devices ADUC 70xx\n"
+                       "Version " VERSION_STR " compiled for " COMPILED_FOR ": " __DATE__ ", " __TIME__ "\n"
+                       "Copyright (c) by Martin Maurer, 2003-2013, Email: Martin.Maurer@clibb.de\n"
+                       "Portions Copyright (c) by Aeolus Development 2004, www.aeolusdevelopment.com\n"
+                       "\n");
+
+        DebugPrintf(1, "Syntax:  lpc21isp [Options] file[ file[ ...]] comport baudrate Oscillator_in_kHz\n\n"
+                       "Example: lpc21isp test.hex com1 115200 14746\n\n"
+                       "Options: -bin         for uploading binary file\n"
+                       "         -hex         for uploading file in intel hex format (default)\n"
+                       "         -term        for starting terminal after upload\n"
+                       "         -termonly    for starting terminal without an upload\n"
+                       "         -localecho   for local echo in terminal\n"
+                       "         -detectonly  detect only used LPC chiptype (NXPARM only)\n"
+                       "         -debug0      for no debug\n"
+                       "         -debug3      for progress info only\n"
+                       "         -debug5      for full debug\n"
+                       "         -donotstart  do not start MCU after download\n"
+                       "         -try<n>      try n times to synchronise\n"
+                       "         -syncprobe<ms> wait ms for the answer to '?' (default 100, less\n"
+                       "                      for a fast sync over a link with a short round trip)\n"
+                       "         -wipe        Erase entire device before upload\n"
+                       "         -control     for controlling RS232 lines for easier booting\n"
+                       "                      (Reset = DTR, EnableBootLoader = RTS)\n"
+#if defined SYSFS_GPIO_SUPPORT
+                       "         -gpiorst<n>  for controlling RST pin (Reset) with GPIO\n"
+                       "         -gpioisp<n>  for controlling ISP pin (EnableBootLoader) with GPIO\n"
+#if defined GPIOCHIP_SUPPORT
+                       "         -gpiochip<c> RST and ISP are lines of GPIO chip c (e.g. 0 or\n"
+                       "                      /dev/gpiochip0) instead of sysfs GPIO numbers\n"
+#endif
+#endif
+                       "         -boothold    hold EnableBootLoader asserted throughout sequence\n");
+
+        // Each DebugPrintf must fit its buffer, so the options come in parts
+        DebugPrintf(1, "         -resettiming<s>,<p>,<t> EnableBootLoader setup, Reset pulse and\n"
+                       "                      settle time in ms (default 0,200,500, GPIO 100,500,200)\n"
+                       "         -resettune[<file>] shorten the reset timing while the target\n"
+                       "                      synchronizes, keep it per port in file\n"
+                       "         -swentry<s>  enter ISP mode by sending s to the running application\n"
+                       "                      instead of a reset (escapes \\r \\n \\t \\\\ \\xHH)\n"
+                       "         -swentryack<s> wait for the application to answer s\n"
+                       "         -swentrybaud<n> baud rate of the application (default: baudrate)\n"
+                       "         -swentrywait<ms> time to wait for the answer (default 1000)\n"
+#ifdef INTEGRATED_IN_WIN_APP
+                       "         -nosync      Do not synchronize device via '?'\n"
+#endif
+                       "         -controlswap swap RS232 control lines\n"
+                       "                      (Reset = RTS, EnableBootLoader = DTR)\n"
+                       "         -controlinv  Invert state of RTS & DTR \n"
+                       "                      (0=true/assert/set, 1=false/deassert/clear).\n"
+                       "         -verify      Verify the data in Flash after every writes to\n"
+                       "                      sector. To detect errors in writing to Flash ROM\n"
+                       "         -logfile     for enabling logging of terminal output to lpc21isp.log\n"
+                       "         -halfduplex  use halfduplex serial communication (i.e. with K-Line)\n"
+                       "         -writedelay  Add delay after serial port writes (for compatibility)\n");
+
+        DebugPrintf(1, "         -flowxonxoff use XON/XOFF flow control\n"
+                       "         -flownone    use no flow control\n"
+                       "         -flowrtscts  use RTS/CTS flow control (not together with -control)\n"
+                       "         -pace<n>[,b] limit transmit rate to n bytes/s, bursts of b bytes\n"
+                       "                      (n = 0: 75%% of baudrate). Default: XON/XOFF, LPC8xx: -pace0\n"
+                       "         -capture<f>  write all serial traffic with timestamps to file f\n"
+                       "                      (decode with lpctracedump)\n"
+                       "         -replay<f>   talk to a trace written by -capture instead of the\n"
+                       "                      target, check the data sent and report host time\n"
+                       "         -stats<f>    write time per phase, command latencies and sector\n"
+                       "                      throughput as JSON to file f\n"
+                       "         -events<f>   write each phase, command and sector as one line of\n"
+                       "                      JSON to file f while programming\n"
+                       "         -metrics<f>  keep totals over all downloads (results, bytes, sync\n"
+                       "                      attempts and resets, resends, flash time per part,\n"
+                       "                      latency and time to sync per port) in file f,\n"
+                       "                      Prometheus text format\n");
+
+        DebugPrintf(1,
+#if defined(__linux__)
+                       "         -lowlatency  set ASYNC_LOW_LATENCY and lower the USB latency timer\n"
+                       "                      while programming, report round trip time\n"
+#endif
+#if defined GANG_SUPPORT
+                       "         -gang        program several targets at once, comport is a\n"
+                       "                      comma separated list (e.g. /dev/ttyUSB0,/dev/ttyUSB1)\n"
+                       "         -daemon<s>   keep the ports (comma separated list) open and program\n"
+                       "                      the jobs sent to the unix socket s, no file needed\n"
+                       "         -manifest<f> program the jobs listed in file f on the ports (comma\n"
+                       "                      separated list) as boards turn up, no file needed\n"
+#endif
+                       "         -partid<n>   stop unless the part ID is n (e.g. 0x0444102B)\n"
+                       "         -pinpart     with -partid<n> and -manifest, don't read the part ID\n"
+                       "                      again if the probe of the port found n\n"
+                       "         -pipeline    send oscillator, unlock, K and J without waiting for\n"
+                       "                      the answers in between\n"
+                       "         -recover<n>  after a failed command get the bootloader back (resync\n"
+                       "                      if needed) and resume, at most n times (default 0)\n"
+                       "         -timeouts[<f>,<c>] wait for answers as long as they took so far\n"
+                       "                      (mean + 4 deviations), but f to c ms (default 100,5000)\n"
+                       "                      instead of always 5000 ms\n"
+                       "         -journal<d>  keep a journal of the programmed sectors in directory d,\n"
+                       "                      an interrupted download resumes where it stopped\n"
+#if defined DRYRUN_SUPPORT
+                       "         -dryrun<p>   don't touch comport, program an emulated part p (name\n"
+                       "                      or ID) and print the command plan and predicted time\n"
+                       "         -linkmodel<rtt>,<erase>,<prog> link model of -dryrun: round trip\n"
+                       "                      latency in us, erase ms per sector, program ms per\n"
+                       "                      KiB (default 1000,100,4)\n"
+#endif
+                       "         -ADARM       for downloading to an Analog Devices\n"
+                       "                      ARM microcontroller ADUC70xx\n"
+                       "         -NXPARM      for downloading to a chip of NXP LPC family (default)\n");
+
+        exit(1);
+    }
+
+#if defined GANG_SUPPORT
+    if (IspEnvironment->ReplayFile != NULL &&
+        (IspEnvironment->Gang || IspEnvironment->DaemonSocket != NULL || IspEnvironment->ManifestFile != NULL))
+    {
+        DebugPrintf(1, "-replay can't be used together with -gang, -daemon or -manifest\n");
+        exit(1);
+    }
+#endif
+
+#if defined DRYRUN_SUPPORT
+    if (IspEnvironment->DryRunPart != NULL &&
+        (IspEnvironment->ReplayFile != NULL || IspEnvironment->CaptureFile != NULL
+#if defined GANG_SUPPORT
+         || IspEnvironment->Gang || IspEnvironment->DaemonSocket != NULL || IspEnvironment->ManifestFile != NULL
+#endif
+        ))
+    {
+        DebugPrintf(1, "-dryrun can't be used together with -capture, -replay, -gang, -daemon or -manifest\n");
+        exit(1);
+    }
+#endif
+
+    if (IspEnvironment->Pacing == PACING_RTSCTS && IspEnvironment->ControlLines)
+    {
+        DebugPrintf(1, "-flowrtscts can't be used together with -control\n");
+        exit(1);
+    }
+
+#if defined SYSFS_GPIO_SUPPORT
+    if ( IspEnvironment->GpioSet == GPIO_RST_SET || IspEnvironment->GpioSet == GPIO_ISP_SET
+#if defined GPIOCHIP_SUPPORT
+         || (IspEnvironment->GpioChip != NULL && IspEnvironment->GpioSet == 0)
+#endif
+       )
+    {
+         DebugPrintf(1, "You must set both RST and ISP pins with -gpiorst<n> and -gpioisp<n>\n");
+         exit(1);
+    }
+#endif
+
+#if defined GPIOCHIP_SUPPORT && defined GANG_SUPPORT
+    if (IspEnvironment->GpioChip != NULL && IspEnvironment->Gang)
+    {
+        DebugPrintf(1, "-gpiochip can't be used together with -gang\n");
+        exit(1);
+    }
+#endif
+
+    if (IspEnvironment->micro == NXP_ARM)
+    {
+        // If StringOscillator is bigger than 100 MHz, there seems to be something wrong
+        if (strlen(IspEnvironment->StringOscillator) > 5)
+        {
+            DebugPrintf(1, "Invalid crystal frequency %s\n", IspEnvironment->StringOscillator);
+            exit(1);
+        }
+    }
+}
+
+#endif // !defined LPC21ISP_LIBRARY
+
+/* Reset timing defaults of the two backends, in ms (setup, pulse, settle).  */
+static const RESET_TIMING ModemResetTiming = {   0, 200, 500 };
+static const RESET_TIMING GpioResetTiming  = { 100, 500, 200 };
+
+#define RESET_TUNE_STEP         75      /* a trial keeps this % of the timing */
+#define RESET_TUNE_MARGIN       200     /* tuned: this % of the failed trial, */
+#define RESET_TUNE_MIN_MARGIN   10      /*   but at least this many ms more   */
+
+/** Reset tuning state of a port, see ResetTimingGet. */
+typedef struct reset_tune
+{
+    struct reset_tune *Next;
+    char          Port[256];            /**< Full path, by-id names are long.   */
+    RESET_TIMING  Good;                 /**< Last timing that synchronized.     */
+    RESET_TIMING  Trial;                /**< Shorter timing being tried.        */
+    unsigned char Done;                 /**< Tuned, Good includes the margin.   */
+    unsigned char Trying;               /**< Last reset used Trial.             */
+    unsigned char TrialFailed;          /**< Reset again after the trial.       */
+} RESET_TUNE;
+
+static ISP_THREAD_LOCAL RESET_TUNE *ResetTunes;
+static ISP_THREAD_LOCAL int ResetTunesLoaded;
+
+/***************************** ResetTuneAdd *****************************/
+/**  Adds a port to the tuning table.
+\param [in] Port name of the serial port.
+\param [in] Good timing to start from.
+\return the new entry, NULL if out of memory.
+*/
+static RESET_TUNE *ResetTuneAdd(const char *Port, const RESET_TIMING *Good)
+{
+    RESET_TUNE *Tune;
+
+    Tune = (RESET_TUNE *)calloc(1, sizeof(RESET_TUNE));
+    if (Tune == NULL)
+    {
+        return NULL;
+    }
+
+    strncpy(Tune->Port, Port, sizeof(Tune->Port) - 1);
+    Tune->Good = *Good;
+    Tune->Next = ResetTunes;
+    ResetTunes = Tune;
+    return Tune;
+}
+
+/***************************** ResetTuneLoad ****************************/
+/**  Reads the tuned timings of all ports from the -resettune file, one
+line "port setup pulse settle tuning|done" per port.
+*/
+static void ResetTuneLoad(ISP_ENVIRONMENT *IspEnvironment)
+{
+    FILE *fp;
+    char Line[512], Port[256], State[16];
+    RESET_TIMING Timing;
+    RESET_TUNE *Tune;
+
+    ResetTunesLoaded = 1;
+
+    if (IspEnvironment->ResetTuneFile == NULL ||
+        (fp = fopen(IspEnvironment->ResetTuneFile, "r")) == NULL)
+    {
+        return;
+    }
+
+    while (fgets(Line, sizeof(Line), fp) != NULL)
+    {
+        if (Line[0] == '#' ||
+            sscanf(Line, "%255s %u %u %u %15s", Port, &Timing.Setup, &Timing.Pulse,
+                   &Timing.Settle, State) != 5)
+        {
+            continue;
+        }
+
+        Tune = ResetTuneAdd(Port, &Timing);
+        if (Tune != NULL)
+        {
+            Tune->Done = strcmp(State, "done") == 0;
+        }
+    }
+
+    fclose(fp);
+}
+
+/***************************** ResetTuneSave ****************************/
+/**  Writes the tuned timings of all ports to the -resettune file.
+*/
+static void ResetTuneSave(ISP_ENVIRONMENT *IspEnvironment)
+{
+    FILE *fp;
+    RESET_TUNE *Tune;
+
+    if (IspEnvironment->ResetTuneFile == NULL)
+    {
+        return;
+    }
+
+    fp = fopen(IspEnvironment->ResetTuneFile, "w");
+    if (fp == NULL)
+    {
+        DebugPrintf(1, "Can't write %s: %s\n", IspEnvironment->ResetTuneFile, strerror(errno));
+        return;
+    }
+
+    fprintf(fp, "# lpc21isp -resettune: port setup pulse settle (ms) tuning|done\n");
+    for (Tune = ResetTunes; Tune != NULL; Tune = Tune->Next)
+    {
+        fprintf(fp, "%s %u %u %u %s\n", Tune->Port, Tune->Good.Setup, Tune->Good.Pulse,
+                Tune->Good.Settle, Tune->Done ? "done" : "tuning");
+    }
+
+    fclose(fp);
+}
+
+/***************************** ResetTuneFind ****************************/
+/**  Finds the tuning state of the port of the session.
+\param [in] Base timing to start from if the port is new.
+\return the entry, NULL if out of memory.
+*/
+static RESET_TUNE *ResetTuneFind(ISP_ENVIRONMENT *IspEnvironment, const RESET_TIMING *Base)
+{
+    RESET_TUNE *Tune;
+
+    if (!ResetTunesLoaded)
+    {
+        ResetTuneLoad(IspEnvironment);
+    }
+
+    for (Tune = ResetTunes; Tune != NULL; Tune = Tune->Next)
+    {
+        if (strncmp(Tune->Port, IspEnvironment->serial_port, sizeof(Tune->Port) - 1) == 0)
+        {
+            return Tune;
+        }
+    }
+
+    return ResetTuneAdd(IspEnvironment->serial_port, Base);
+}
+
+/***************************** ResetTimingGet ***************************/
+/**  Timing of the next reset: -resettiming or the backend's defaults, with
+-resettune the port's tuned timing.
+
+While tuning, every reset into the bootloader of a new session tries all
+times shortened to RESET_TUNE_STEP %. ResetTuneResult keeps the trial if
+the target synchronized without a further reset. Once a trial needed
+another reset (with the last good timing), tuning is done: the timing is
+set to RESET_TUNE_MARGIN % of the failed trial, but never below what
+worked nor above the defaults.
+\param [in] mode the mode the target is reset into.
+\param [in] Default the defaults of the backend.
+\param [out] Timing the timing to use.
+*/
+static void ResetTimingGet(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode,
+                           const RESET_TIMING *Default, RESET_TIMING *Timing)
+{
+    RESET_TUNE *Tune;
+    RESET_TIMING Trial;
+
+    *Timing = IspEnvironment->ResetTimingSet ? IspEnvironment->ResetTiming : *Default;
+
+    if (!IspEnvironment->ResetTune || (Tune = ResetTuneFind(IspEnvironment, Timing)) == NULL)
+    {
+        return;
+    }
+
+    *Timing = Tune->Good;
+
+    if (mode != PROGRAM_MODE || Tune->Done || IspEnvironment->micro != NXP_ARM)
+    {
+        return;
+    }
+
+    if (Tune->Trying || Tune->TrialFailed)
+    {
+        // Reset again in the same session: the trial didn't synchronize
+        Tune->Trying      = 0;
+        Tune->TrialFailed = 1;
+        return;
+    }
+
+    Trial.Setup  = Tune->Good.Setup  * RESET_TUNE_STEP / 100;
+    Trial.Pulse  = Tune->Good.Pulse  * RESET_TUNE_STEP / 100;
+    Trial.Settle = Tune->Good.Settle * RESET_TUNE_STEP / 100;
+
+    if (memcmp(&Trial, &Tune->Good, sizeof(Trial)) == 0)
+    {
+        Tune->Done = 1;                 // nothing left to shorten
+        ResetTuneSave(IspEnvironment);
+        return;
+    }
+
+    DebugPrintf(3, "Reset tuning: trying setup %u, pulse %u, settle %u ms\n",
+                Trial.Setup, Trial.Pulse, Trial.Settle);
+
+    Tune->Trial  = Trial;
+    Tune->Trying = 1;
+    *Timing      = Trial;
+}
+
+/***************************** ResetTuneMargin **************************/
+/**  Tuned value of one time of the timing, see ResetTimingGet.
+\param [in] Failed time of the failed trial.
+\param [in] Good time that worked.
+\param [in] Default time before tuning.
+\return the time to keep.
+*/
+static unsigned ResetTuneMargin(unsigned Failed, unsigned Good, unsigned Default)
+{
+    unsigned Tuned = Failed * RESET_TUNE_MARGIN / 100;
+
+    if (Tuned < Failed + RESET_TUNE_MIN_MARGIN)
+    {
+        Tuned = Failed + RESET_TUNE_MIN_MARGIN;
+    }
+
+    if (Tuned > Default)
+    {
+        Tuned = Default;
+    }
+
+    return Tuned < Good ? Good : Tuned;
+}
+
+/***************************** ResetTuneResult **************************/
+/**  Tells the tuning how synchronizing after a reset went.
+\param [in] Synced the target synchronized.
+\param [in] Resets resets needed while synchronizing.
+*/
+void ResetTuneResult(ISP_ENVIRONMENT *IspEnvironment, int Synced, int Resets)
+{
+    RESET_TUNE *Tune;
+    RESET_TIMING Default;
+    int Gpio = 0;
+
+    if (!IspEnvironment->ResetTune || IspEnvironment->Transport != NULL)
+    {
+        return;
+    }
+
+    for (Tune = ResetTunes; Tune != NULL; Tune = Tune->Next)
+    {
+        if (strncmp(Tune->Port, IspEnvironment->serial_port, sizeof(Tune->Port) - 1) == 0)
+        {
+            break;
+        }
+    }
+
+    if (Tune == NULL || Tune->Done)
     {
-        debug_level = (debug_level < 2) ? 2 : debug_level;
+        return;
     }
 
-    if (argc < 5)
+    if (Synced && Resets == 0 && Tune->Trying)
     {
-        DebugPrintf(2, "\n"
-                       "Portable command line ISP\n"
-                       "for NXP LPC family and Analog Devices ADUC 70xx\n"
-                       "Version " VERSION_STR " compiled for " COMPILED_FOR ": " __DATE__ ", " __TIME__ "\n"
-                       "Copyright (c) by Martin Maurer, 2003-2013, Email: Martin.Maurer@clibb.de\n"
-                       "Portions Copyright (c) by Aeolus Development 2004, www.aeolusdevelopment.com\n"
-                       "\n");
-
-        DebugPrintf(1, "Syntax:  lpc21isp [Options] file[ file[ ...]] comport baudrate Oscillator_in_kHz\n\n"
-                       "Example: lpc21isp test.hex com1 115200 14746\n\n"
-                       "Options: -bin         for uploading binary file\n"
-                       "         -hex         for uploading file in intel hex format (default)\n"
-                       "         -term        for starting terminal after upload\n"
-                       "         -termonly    for starting terminal without an upload\n"
-                       "         -localecho   for local echo in terminal\n"
-                       "         -detectonly  detect only used LPC chiptype (NXPARM only)\n"
-                       "         -debug0      for no debug\n"
-                       "         -debug3      for progress info only\n"
-                       "         -debug5      for full debug\n"
-                       "         -donotstart  do not start MCU after download\n"
-                       "         -try<n>      try n times to synchronise\n"
-                       "         -wipe        Erase entire device before upload\n"
-                       "         -control     for controlling RS232 lines for easier booting\n"
-                       "                      (Reset = DTR, EnableBootLoader = RTS)\n"
-#if defined SYSFS_GPIO_SUPPORT
-                       "         -gpiorst<n>  for controlling RST pin (Reset) with GPIO\n"
-                       "         -gpioisp<n>  for controlling ISP pin (EnableBootLoader) with GPIO\n"
+        Tune->Good = Tune->Trial;
+        ResetTuneSave(IspEnvironment);
+    }
+    else if (Synced && Resets != 0 && Tune->TrialFailed)
+    {
+#if defined(__linux__) && ( defined(SYSFS_GPIO_SUPPORT) || ( defined(GPIO_RST) && defined(GPIO_ISP) ) )
+#if defined(SYSFS_GPIO_SUPPORT)
+        Gpio = IspEnvironment->GpioSet == (GPIO_RST_SET | GPIO_ISP_SET);
+#else
+        Gpio = 1;
 #endif
-                       "         -boothold    hold EnableBootLoader asserted throughout sequence\n"
-#ifdef INTEGRATED_IN_WIN_APP
-                       "         -nosync      Do not synchronize device via '?'\n"
 #endif
-                       "         -controlswap swap RS232 control lines\n"
-                       "                      (Reset = RTS, EnableBootLoader = DTR)\n"
-                       "         -controlinv  Invert state of RTS & DTR \n"
-                       "                      (0=true/assert/set, 1=false/deassert/clear).\n"
-                       "         -verify      Verify the data in Flash after every writes to\n"
-                       "                      sector. To detect errors in writing to Flash ROM\n"
-                       "         -logfile     for enabling logging of terminal output to lpc21isp.log\n"
-                       "         -halfduplex  use halfduplex serial communication (i.e. with K-Line)\n"
-                       "         -writedelay  Add delay after serial port writes (for compatibility)\n"
-                       "         -ADARM       for downloading to an Analog Devices\n"
-                       "                      ARM microcontroller ADUC70xx\n"
-                       "         -NXPARM      for downloading to a chip of NXP LPC family (default)\n");
+        Default = IspEnvironment->ResetTimingSet ? IspEnvironment->ResetTiming
+                                                 : Gpio ? GpioResetTiming : ModemResetTiming;
 
-        exit(1);
+        Tune->Good.Setup  = ResetTuneMargin(Tune->Trial.Setup,  Tune->Good.Setup,  Default.Setup);
+        Tune->Good.Pulse  = ResetTuneMargin(Tune->Trial.Pulse,  Tune->Good.Pulse,  Default.Pulse);
+        Tune->Good.Settle = ResetTuneMargin(Tune->Trial.Settle, Tune->Good.Settle, Default.Settle);
+        Tune->Done        = 1;
+
+        DebugPrintf(2, "Reset timing of %s tuned to setup %u, pulse %u, settle %u ms\n",
+                    Tune->Port, Tune->Good.Setup, Tune->Good.Pulse, Tune->Good.Settle);
+        ResetTuneSave(IspEnvironment);
     }
 
-#if defined SYSFS_GPIO_SUPPORT
-    if ( (IspEnvironment->GpioRst > 0 && ! IspEnvironment->GpioIsp) ||
-         (!IspEnvironment->GpioRst && IspEnvironment->GpioIsp > 0) )
+    Tune->Trying      = 0;
+    Tune->TrialFailed = 0;
+}
+
+#define SWENTRY_WAIT_MS         1000    /* default of -swentrywait */
+
+/***************************** BlockContains ****************************/
+/**  Looks for a byte sequence in a block.
+\return 1 if found, 0 if not.
+*/
+static int BlockContains(const char *Block, unsigned long Size, const char *Pattern, unsigned Length)
+{
+    unsigned long i;
+
+    for (i = 0; i + Length <= Size; i++)
     {
-         DebugPrintf(1, "You must set both RST and ISP pins with -gpiorst<n> and -gpioisp<n>\n");
-         exit(1);
+        if (memcmp(Block + i, Pattern, Length) == 0)
+        {
+            return 1;
+        }
     }
-#endif
 
-    if (IspEnvironment->micro == NXP_ARM)
+    return 0;
+}
+
+/***************************** SoftwareEntry ****************************/
+/**  Asks the running application to jump to the ISP bootloader: sends the
+-swentry sequence at the application's baud rate, waits for the
+-swentryack answer and switches to the ISP baud rate. Needs no reset
+lines and saves the reset and settle time. Without an answer to wait for
+the sync probes find out when the bootloader is there.
+\return 0 if ok, 1 if the application didn't answer.
+*/
+static int SoftwareEntry(ISP_ENVIRONMENT *IspEnvironment)
+{
+    char Window[256];
+    unsigned long Filled = 0, Read, Keep;
+    unsigned long IspBaud = strtoul(IspEnvironment->baud_rate, NULL, 10);
+    unsigned long AppBaud = IspEnvironment->SwEntryBaud != 0 ? IspEnvironment->SwEntryBaud : IspBaud;
+    unsigned Length = IspEnvironment->SwEntryAckLength;
+    int Found = Length == 0;
+
+    if (AppBaud != IspBaud && SetSerialBaud(IspEnvironment, AppBaud) != 0)
     {
-        // If StringOscillator is bigger than 100 MHz, there seems to be something wrong
-        if (strlen(IspEnvironment->StringOscillator) > 5)
+        return 1;
+    }
+
+    DebugPrintf(3, "Sending -swentry at %lu baud\n", AppBaud);
+    ClearSerialPortBuffers(IspEnvironment);
+    SendComPortBlock(IspEnvironment, IspEnvironment->SwEntry, IspEnvironment->SwEntryLength);
+
+    SerialTimeoutSet(IspEnvironment, IspEnvironment->SwEntryWait != 0 ? IspEnvironment->SwEntryWait : SWENTRY_WAIT_MS);
+    while (!Found && SerialTimeoutCheck(IspEnvironment) == 0)
+    {
+        if (Filled == sizeof(Window))
         {
-            DebugPrintf(1, "Invalid crystal frequency %s\n", IspEnvironment->StringOscillator);
-            exit(1);
+            Keep = Length - 1;          // the answer may start in the tail
+            memmove(Window, Window + Filled - Keep, Keep);
+            Filled = Keep;
         }
+
+        ReceiveComPortBlock(IspEnvironment, Window + Filled, sizeof(Window) - Filled, &Read);
+        Filled += Read;
+        Found = BlockContains(Window, Filled, IspEnvironment->SwEntryAck, Length);
     }
+
+    if (AppBaud != IspBaud)
+    {
+        SetSerialBaud(IspEnvironment, IspBaud);
+    }
+    ClearSerialPortBuffers(IspEnvironment);
+
+    if (!Found)
+    {
+        DumpString(3, Window, Filled, "No -swentryack, received: ");
+        return 1;
+    }
+
+    DebugPrintf(3, "Application entered ISP mode\n");
+    return 0;
 }
 
-/***************************** ResetTarget ******************************/
-/**  Resets the target leaving it in either download (program) mode or
-run mode.
+#if defined(__linux__) && ( defined(SYSFS_GPIO_SUPPORT) || ( defined(GPIO_RST) && defined(GPIO_ISP) ) )
+/***************************** GpioReset ********************************/
+/**  ResetTarget with Linux GPIO pins for -RST and -ISP.
 \param [in] mode the mode to leave the target in.
+\param [in] Timing the reset timing.
 */
-void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode)
+static void GpioReset(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode, const RESET_TIMING *Timing)
 {
-#if defined(__linux__) && ( defined(SYSFS_GPIO_SUPPORT) || ( defined(GPIO_RST) && defined(GPIO_ISP) ) )
-
 // This code section allows using Linux GPIO pins to control the -RST and -ISP
 // signals of the target microcontroller.
 //
@@ -1683,10 +3161,34 @@ void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode)
 //
 // Then if the user is a member of the gpio group, lpc21isp will not requre any
 // special permissions to access the GPIO signals.
+//
+// With -gpiochip<c> -gpiorst<n> and -gpioisp<n> are line offsets of the
+// GPIO character device instead, no such setup is needed (see GpioChipRequest).
 
-#if defined(SYSFS_GPIO_SUPPORT)
-  if (!IspEnvironment->ControlLines && (IspEnvironment->GpioIsp == 0 || IspEnvironment->GpioRst == 0))
+#if defined GPIOCHIP_SUPPORT
+  if (IspEnvironment->GpioChip != NULL)
   {
+    switch (mode)
+    {
+      case PROGRAM_MODE :
+        if (Timing->Setup != 0)
+        {
+          GpioChipSet(IspEnvironment, GPIOCHIP_ISP, 0);                           // Assert -ISP
+          Sleep(Timing->Setup);
+        }
+        GpioChipSet(IspEnvironment, GPIOCHIP_RST | GPIOCHIP_ISP, 0);              // Assert -RST (and -ISP)
+        Sleep(Timing->Pulse);
+        GpioChipSet(IspEnvironment, GPIOCHIP_RST, GPIOCHIP_RST);                 // Deassert -RST
+        Sleep(Timing->Settle);
+        GpioChipSet(IspEnvironment, GPIOCHIP_ISP, GPIOCHIP_ISP);                 // Deassert -ISP
+        break;;
+
+      case RUN_MODE :
+        GpioChipSet(IspEnvironment, GPIOCHIP_RST | GPIOCHIP_ISP, GPIOCHIP_ISP);   // Assert -RST
+        Sleep(Timing->Pulse);
+        GpioChipSet(IspEnvironment, GPIOCHIP_RST, GPIOCHIP_RST);                 // Deassert -RST
+        break;;
+    }
     return;
   }
 #endif
@@ -1699,14 +3201,14 @@ void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode)
   memset(gpio_isp_filename, 0, sizeof(gpio_isp_filename));
 
 #if defined(SYSFS_GPIO_SUPPORT)
-  sprintf(gpio_isp_filename, "/sys/class/gpio/gpio%d/value", IspEnvironment->GpioIsp);
+  sprintf(gpio_isp_filename, "/sys/class/gpio/gpio%u/value", IspEnvironment->GpioIsp);
 #else
   sprintf(gpio_isp_filename, "/sys/class/gpio/gpio%d/value", GPIO_ISP);
 #endif
 
   memset(gpio_rst_filename, 0, sizeof(gpio_rst_filename));
 #if defined(SYSFS_GPIO_SUPPORT)
-  sprintf(gpio_rst_filename, "/sys/class/gpio/gpio%d/value", IspEnvironment->GpioRst);
+  sprintf(gpio_rst_filename, "/sys/class/gpio/gpio%u/value", IspEnvironment->GpioRst);
 #else
   sprintf(gpio_rst_filename, "/sys/class/gpio/gpio%d/value", GPIO_RST);
 #endif
@@ -1715,56 +3217,107 @@ void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode)
   if (gpio_isp < 0)
   {
     fprintf(stderr, "ERROR: open() for %s failed, %s\n", gpio_isp_filename, strerror(errno));
-    exit(1);
+    IspExit(IspEnvironment, 1);
   }
 
   gpio_rst = open(gpio_rst_filename, O_WRONLY);
   if (gpio_rst < 0)
   {
     fprintf(stderr, "ERROR: open() for %s failed, %s\n", gpio_rst_filename, strerror(errno));
-    exit(1);
+    close(gpio_isp);
+    IspExit(IspEnvironment, 1);
   }
 
   switch (mode)
   {
     case PROGRAM_MODE :
       write(gpio_isp, "0\n", 2);  // Assert -ISP
-      Sleep(100);
+      Sleep(Timing->Setup);
       write(gpio_rst, "0\n", 2);  // Assert -RST
-      Sleep(500);
+      Sleep(Timing->Pulse);
       write(gpio_rst, "1\n", 2);  // Deassert -RST
-      Sleep(100);
+      Sleep(Timing->Settle);
       write(gpio_isp, "1\n", 2);  // Deassert -ISP
-      Sleep(100);
       break;;
 
     case RUN_MODE :
       write(gpio_rst, "0\n", 2);  // Assert -RST
-      Sleep(500);
-      write(gpio_rst, "1\n", 2);  // Deassert -ISP
-      Sleep(100);
+      Sleep(Timing->Pulse);
+      write(gpio_rst, "1\n", 2);  // Deassert -RST
       break;;
   }
 
   close(gpio_isp);
   close(gpio_rst);
+}
+#endif
+
+/***************************** ResetTarget ******************************/
+/**  Resets the target leaving it in either download (program) mode or
+run mode, with GPIO pins if they are set, else with the modem lines
+if -control is given. The timing is set by -resettiming and -resettune,
+see ResetTimingGet. With -swentry program mode is entered by software,
+the reset is only the fallback if that fails.
+\param [in] mode the mode to leave the target in.
+*/
+void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode)
+{
+    RESET_TIMING Timing;
 
-  return;
+    if (IspEnvironment->Transport != NULL)
+    {
+        return;     // no modem lines, a recording starts after the reset
+    }
+
+    if (mode == PROGRAM_MODE && IspEnvironment->SwEntryLength != 0)
+    {
+        if (SoftwareEntry(IspEnvironment) == 0)
+        {
+#if !defined COMPILE_FOR_LPC21
+            IspEnvironment->CommandMode = 0;
+#endif
+            return;
+        }
+        DebugPrintf(2, "No answer on -swentry, resetting\n");
+    }
+
+#if defined(__linux__) && ( defined(SYSFS_GPIO_SUPPORT) || ( defined(GPIO_RST) && defined(GPIO_ISP) ) )
+#if defined(SYSFS_GPIO_SUPPORT)
+    if (IspEnvironment->GpioSet == (GPIO_RST_SET | GPIO_ISP_SET))
+#endif
+    {
+        ResetTimingGet(IspEnvironment, mode, &GpioResetTiming, &Timing);
+        GpioReset(IspEnvironment, mode, &Timing);
+#if !defined COMPILE_FOR_LPC21
+        IspEnvironment->CommandMode = 0;
+#endif
+        return;
+    }
 #endif
 
     if (IspEnvironment->ControlLines)
     {
+        ResetTimingGet(IspEnvironment, mode, &ModemResetTiming, &Timing);
+#if !defined COMPILE_FOR_LPC21
+        IspEnvironment->CommandMode = 0;
+#endif
+
         switch (mode)
         {
         /* Reset and jump to boot loader.                       */
         case PROGRAM_MODE:
+            if (Timing.Setup != 0)
+            {
+                ControlModemLines(IspEnvironment, 0, 1);
+                Sleep(Timing.Setup);
+            }
             ControlModemLines(IspEnvironment, 1, 1);
-            Sleep(100);
+            Sleep(Timing.Pulse / 2);
             ClearSerialPortBuffers(IspEnvironment);
-            Sleep(100);
+            Sleep(Timing.Pulse - Timing.Pulse / 2);
             ControlModemLines(IspEnvironment, 0, 1);
             //Longer delay is the Reset signal is conected to an external rest controller
-            Sleep(500);
+            Sleep(Timing.Settle);
             // Clear the RTS line after having reset the micro
             // Needed for the "GO <Address> <Mode>" ISP command to work */
             if(!IspEnvironment->BootHold)
@@ -1776,11 +3329,10 @@ void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode)
         /* Reset and start uploaded program                     */
         case RUN_MODE:
             ControlModemLines(IspEnvironment, 1, 0);
-            Sleep(100);
+            Sleep(Timing.Pulse / 2);
             ClearSerialPortBuffers(IspEnvironment);
-            Sleep(100);
+            Sleep(Timing.Pulse - Timing.Pulse / 2);
             ControlModemLines(IspEnvironment, 0, 0);
-            Sleep(100);
             break;
         }
     }
@@ -1789,11 +3341,11 @@ void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode)
 
 /***************************** Ascii2Hex ********************************/
 /**  Converts a hex character to its equivalent number value. In case of an
-error rather abruptly terminates the program.
+error rather abruptly ends the session (see IspExit).
 \param [in] c the hex digit to convert.
 \return the value of the hex digit.
 */
-static unsigned char Ascii2Hex(unsigned char c)
+static unsigned char Ascii2Hex(ISP_ENVIRONMENT *IspEnvironment, unsigned char c)
 {
     if (c >= '0' && c <= '9')
     {
@@ -1811,12 +3363,14 @@ static unsigned char Ascii2Hex(unsigned char c)
     }
 
     DebugPrintf(1, "Wrong Hex-Nibble %c (%02X)\n", c, c);
-    exit(1);
+    IspExit(IspEnvironment, 1);
 
     return 0;  // this "return" will never be reached, but some compilers give a warning if it is not present
 }
 
 
+#if !defined LPC21ISP_LIBRARY
+
 /***************************** AddFileHex *******************************/
 /**  Add a file to the list of files to read in, flag it as hex format.
 \param [in] IspEnvironment Programming environment.
@@ -1872,6 +3426,8 @@ static int AddFileBinary(ISP_ENVIRONMENT *IspEnvironment, const char *arg)
     return 0;       // Success.
 }
 
+#endif // !defined LPC21ISP_LIBRARY
+
 #if 0
 void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
 {
@@ -1917,19 +3473,19 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
 
             Pos++;
 
-            RecordLength   = Ascii2Hex(FileContent[Pos++]);
+            RecordLength   = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
             RecordLength <<= 4;
-            RecordLength  |= Ascii2Hex(FileContent[Pos++]);
+            RecordLength  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
 
             DebugPrintf(4, "RecordLength = %02X\n", RecordLength);
 
-            RecordAddress   = Ascii2Hex(FileContent[Pos++]);
+            RecordAddress   = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
             RecordAddress <<= 4;
-            RecordAddress  |= Ascii2Hex(FileContent[Pos++]);
+            RecordAddress  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
             RecordAddress <<= 4;
-            RecordAddress  |= Ascii2Hex(FileContent[Pos++]);
+            RecordAddress  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
             RecordAddress <<= 4;
-            RecordAddress  |= Ascii2Hex(FileContent[Pos++]);
+            RecordAddress  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
 
             DebugPrintf(4, "RecordAddress = %04X\n", RecordAddress);
 
@@ -1937,9 +3493,9 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
 
             DebugPrintf(4, "RealAddress = %08lX\n", RealAddress);
 
-            RecordType      = Ascii2Hex(FileContent[Pos++]);
+            RecordType      = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
             RecordType    <<= 4;
-            RecordType     |= Ascii2Hex(FileContent[Pos++]);
+            RecordType     |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
 
             DebugPrintf(4, "RecordType = %02X\n", RecordType);
 
@@ -1968,9 +3524,9 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
 
                 for (i = 0; i < RecordLength; i++)
                 {
-                    Hexvalue        = Ascii2Hex(FileContent[Pos++]);
+                    Hexvalue        = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     Hexvalue      <<= 4;
-                    Hexvalue       |= Ascii2Hex(FileContent[Pos++]);
+                    Hexvalue       |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     IspEnvironment->BinaryContent[RealAddress + i - IspEnvironment->BinaryOffset] = Hexvalue;
                 }
             }
@@ -1985,11 +3541,11 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
                     RealAddress <<= 4;
                     if (i == 0)
                     {
-                        RealAddress  = Ascii2Hex(FileContent[Pos++]);
+                        RealAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                     else
                     {
-                        RealAddress |= Ascii2Hex(FileContent[Pos++]);
+                        RealAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                 }
                 RealAddress <<= 4;
@@ -2001,11 +3557,11 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
                     RealAddress <<= 4;
                     if (i == 0)
                     {
-                        RealAddress  = Ascii2Hex(FileContent[Pos++]);
+                        RealAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                     else
                     {
-                        RealAddress |= Ascii2Hex(FileContent[Pos++]);
+                        RealAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                 }
                 RealAddress <<= 8;
@@ -2017,11 +3573,11 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
                     RealAddress <<= 4;
                     if (i == 0)
                     {
-                        RealAddress  = Ascii2Hex(FileContent[Pos++]);
+                        RealAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                     else
                     {
-                        RealAddress |= Ascii2Hex(FileContent[Pos++]);
+                        RealAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                 }
                 RealAddress <<= 16;
@@ -2051,11 +3607,11 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
                     StartAddress <<= 4;
                     if (i == 0)
                     {
-                        StartAddress  = Ascii2Hex(FileContent[Pos++]);
+                        StartAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                     else
                     {
-                        StartAddress |= Ascii2Hex(FileContent[Pos++]);
+                        StartAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                     }
                 }
                 DebugPrintf(1,"Start Address = 0x%08X\n", StartAddress);
@@ -2082,269 +3638,291 @@ void ReadHexFile(ISP_ENVIRONMENT *IspEnvironment)
 #endif // #if 0
 
 
-/***************************** LoadFile *********************************/
-/**  Loads the requested file to download into memory.
-\param [in] IspEnvironment  structure containing input filename
-\param [in] filename  the name of the file to read in.
-\param [in] FileFormat  the format of the file to read in (FORMAT_HEX or FORMAT_BINARY)
+/***************************** ConvertHexImage **************************/
+/**  Converts the content of an Intel hex file to the binary image in
+IspEnvironment->BinaryContent.
+\param [in] IspEnvironment structure that receives the image.
+\param [in] FileContent the text of the hex file.
+\param [in] FileLength the length of the text.
 \return 0 if successful, otherwise an error code.
 */
-static int LoadFile(ISP_ENVIRONMENT *IspEnvironment, const char *filename, int FileFormat)
+int ConvertHexImage(ISP_ENVIRONMENT *IspEnvironment, const BINARY *FileContent, unsigned long FileLength)
 {
-    int            fd;
     int            i;
-    int            BinaryOffsetDefined;
+    int            BinaryOffsetDefined = 0;
     unsigned long  Pos;
-    unsigned long  FileLength;
-    BINARY        *FileContent;              /**< Used to store the content of a hex */
-                                             /*   file before converting to binary.  */
-    unsigned long  BinaryMemSize;
-
-    fd = open(filename, O_RDONLY | O_BINARY);
-    if (fd == -1)
-    {
-        DebugPrintf(1, "Can't open file %s\n", filename);
-        return ERR_FILE_OPEN_HEX;
-    }
-
-    FileLength = lseek(fd, 0L, 2);      // Get file size
-
-    if (FileLength == (size_t)-1)
+    unsigned long  BinaryMemSize = IspEnvironment->BinaryLength;
+    unsigned char  RecordLength;
+    unsigned short RecordAddress;
+    unsigned long  RealAddress = 0;
+    unsigned char  RecordType;
+    unsigned char  Hexvalue;
+    unsigned long  StartAddress;
+
+    Pos = 0;
+    while (Pos < FileLength)
     {
-        DebugPrintf(1, "\nFileLength = -1 !?!\n");
-        return ERR_FILE_SIZE_HEX;
-    }
+        if (FileContent[Pos] == '\r')
+        {
+            Pos++;
+            continue;
+        }
 
-    lseek(fd, 0L, 0);
+        if (FileContent[Pos] == '\n')
+        {
+            Pos++;
+            continue;
+        }
 
-    // Just read the entire file into memory to parse.
-    FileContent = (BINARY*) malloc(FileLength);
+        if (FileContent[Pos] != ':')
+        {
+            DebugPrintf(1, "Missing start of record (':') wrong byte %c / %02X\n", FileContent[Pos], FileContent[Pos]);
+            IspExit(IspEnvironment, 1);
+        }
 
-    if( FileContent == 0)
-    {
-        DebugPrintf( 1, "\nCouldn't allocate enough memory for file.\n");
-        return ERR_FILE_ALLOC_HEX;
-    }
+        Pos++;
 
-    BinaryOffsetDefined = 0;
+        RecordLength   = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+        RecordLength <<= 4;
+        RecordLength  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
 
-    BinaryMemSize = IspEnvironment->BinaryLength;
+        DebugPrintf(4, "RecordLength = %02X\n", RecordLength);
 
-    read(fd, FileContent, FileLength);
+        RecordAddress   = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+        RecordAddress <<= 4;
+        RecordAddress  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+        RecordAddress <<= 4;
+        RecordAddress  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+        RecordAddress <<= 4;
+        RecordAddress  |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
 
-    close(fd);
+        DebugPrintf(4, "RecordAddress = %04X\n", RecordAddress);
 
-    DebugPrintf(2, "File %s:\n\tloaded...\n", filename);
+        RealAddress = RealAddress - (RealAddress & 0xffff) + RecordAddress;
 
-    // Intel-Hex -> Binary Conversion
+        DebugPrintf(4, "RealAddress = %08lX\n", RealAddress);
 
-    if (FileFormat == FORMAT_HEX)
-    {
-        unsigned char  RecordLength;
-        unsigned short RecordAddress;
-        unsigned long  RealAddress = 0;
-        unsigned char  RecordType;
-        unsigned char  Hexvalue;
-        unsigned long  StartAddress;
+        RecordType      = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+        RecordType    <<= 4;
+        RecordType     |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
 
-        DebugPrintf(3, "Converting file %s to binary format...\n", filename);
+        DebugPrintf(4, "RecordType = %02X\n", RecordType);
 
-        Pos = 0;
-        while (Pos < FileLength)
+        if (RecordType == 0x00)          // 00 - Data record
         {
-            if (FileContent[Pos] == '\r')
+            /*
+            * Binary Offset is defined as soon as first data record read
+            */
+            BinaryOffsetDefined = 1;
+            // Memory for binary file big enough ?
+            while (RealAddress + RecordLength - IspEnvironment->BinaryOffset > BinaryMemSize)
             {
-                Pos++;
-                continue;
+                unsigned long OldMemSize = BinaryMemSize;
+
+                if(!BinaryMemSize) BinaryMemSize = FileLength * 2;
+                else BinaryMemSize <<= 1;
+                IspEnvironment->BinaryContent = realloc(IspEnvironment->BinaryContent, BinaryMemSize);
+                // gaps between records are erased flash
+                memset(&IspEnvironment->BinaryContent[OldMemSize], 0xFF, BinaryMemSize - OldMemSize);
             }
 
-            if (FileContent[Pos] == '\n')
+            // We need to know, what the highest address is,
+            // how many bytes / sectors we must flash
+            if (RealAddress + RecordLength - IspEnvironment->BinaryOffset > IspEnvironment->BinaryLength)
             {
-                Pos++;
-                continue;
+                IspEnvironment->BinaryLength = RealAddress + RecordLength - IspEnvironment->BinaryOffset;
+                DebugPrintf(3, "Image size now: %ld\n", IspEnvironment->BinaryLength);
             }
 
-            if (FileContent[Pos] != ':')
+            for (i = 0; i < RecordLength; i++)
             {
-                DebugPrintf(1, "Missing start of record (':') wrong byte %c / %02X\n", FileContent[Pos], FileContent[Pos]);
-                exit(1);
+                Hexvalue        = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+                Hexvalue      <<= 4;
+                Hexvalue       |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+                IspEnvironment->BinaryContent[RealAddress + i - IspEnvironment->BinaryOffset] = Hexvalue;
             }
-
-            Pos++;
-
-            RecordLength   = Ascii2Hex(FileContent[Pos++]);
-            RecordLength <<= 4;
-            RecordLength  |= Ascii2Hex(FileContent[Pos++]);
-
-            DebugPrintf(4, "RecordLength = %02X\n", RecordLength);
-
-            RecordAddress   = Ascii2Hex(FileContent[Pos++]);
-            RecordAddress <<= 4;
-            RecordAddress  |= Ascii2Hex(FileContent[Pos++]);
-            RecordAddress <<= 4;
-            RecordAddress  |= Ascii2Hex(FileContent[Pos++]);
-            RecordAddress <<= 4;
-            RecordAddress  |= Ascii2Hex(FileContent[Pos++]);
-
-            DebugPrintf(4, "RecordAddress = %04X\n", RecordAddress);
-
-            RealAddress = RealAddress - (RealAddress & 0xffff) + RecordAddress;
-
-            DebugPrintf(4, "RealAddress = %08lX\n", RealAddress);
-
-            RecordType      = Ascii2Hex(FileContent[Pos++]);
-            RecordType    <<= 4;
-            RecordType     |= Ascii2Hex(FileContent[Pos++]);
-
-            DebugPrintf(4, "RecordType = %02X\n", RecordType);
-
-            if (RecordType == 0x00)          // 00 - Data record
+        }
+        else if (RecordType == 0x01)     // 01 - End of file record
+        {
+            break;
+        }
+        else if (RecordType == 0x02)     // 02 - Extended segment address record
+        {
+            for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
             {
-                /*
-                * Binary Offset is defined as soon as first data record read
-                */
-                BinaryOffsetDefined = 1;
-                // Memory for binary file big enough ?
-                while (RealAddress + RecordLength - IspEnvironment->BinaryOffset > BinaryMemSize)
-                {
-                    if(!BinaryMemSize) BinaryMemSize = FileLength * 2;
-                    else BinaryMemSize <<= 1;
-                    IspEnvironment->BinaryContent = realloc(IspEnvironment->BinaryContent, BinaryMemSize);
-                }
-
-                // We need to know, what the highest address is,
-                // how many bytes / sectors we must flash
-                if (RealAddress + RecordLength - IspEnvironment->BinaryOffset > IspEnvironment->BinaryLength)
-                {
-                    IspEnvironment->BinaryLength = RealAddress + RecordLength - IspEnvironment->BinaryOffset;
-                    DebugPrintf(3, "Image size now: %ld\n", IspEnvironment->BinaryLength);
-                }
-
-                for (i = 0; i < RecordLength; i++)
+                RealAddress <<= 4;
+                if (i == 0)
                 {
-                    Hexvalue        = Ascii2Hex(FileContent[Pos++]);
-                    Hexvalue      <<= 4;
-                    Hexvalue       |= Ascii2Hex(FileContent[Pos++]);
-                    IspEnvironment->BinaryContent[RealAddress + i - IspEnvironment->BinaryOffset] = Hexvalue;
+                    RealAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                 }
-            }
-            else if (RecordType == 0x01)     // 01 - End of file record
-            {
-                break;
-            }
-            else if (RecordType == 0x02)     // 02 - Extended segment address record
-            {
-                for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
+                else
                 {
-                    RealAddress <<= 4;
-                    if (i == 0)
-                    {
-                        RealAddress  = Ascii2Hex(FileContent[Pos++]);
-                    }
-                    else
-                    {
-                        RealAddress |= Ascii2Hex(FileContent[Pos++]);
-                    }
+                    RealAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                 }
-                RealAddress <<= 4;
             }
-            else if (RecordType == 0x03)     // 03 - Start segment address record
+            RealAddress <<= 4;
+        }
+        else if (RecordType == 0x03)     // 03 - Start segment address record
+        {
+            unsigned long cs,ip;
+            StartAddress = 0;
+            for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
             {
-                unsigned long cs,ip;
-                StartAddress = 0;
-                for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
+                StartAddress <<= 4;
+                if (i == 0)
                 {
-                    StartAddress <<= 4;
-                    if (i == 0)
-                    {
-                        StartAddress  = Ascii2Hex(FileContent[Pos++]);
-                    }
-                    else
-                    {
-                        StartAddress |= Ascii2Hex(FileContent[Pos++]);
-                    }
+                    StartAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                 }
-                cs = StartAddress >> 16; //high part
-                ip = StartAddress & 0xffff; //low part
-                StartAddress = cs*16+ip; //segmented 20-bit space
-                DebugPrintf(1,"Start Address = 0x%08X\n", StartAddress);
-                IspEnvironment->StartAddress = StartAddress;
-            }
-            else if (RecordType == 0x04)     // 04 - Extended linear address record, used by IAR
-            {
-                for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
+                else
                 {
-                    RealAddress <<= 4;
-                    if (i == 0)
-                    {
-                        RealAddress  = Ascii2Hex(FileContent[Pos++]);
-                    }
-                    else
-                    {
-                        RealAddress |= Ascii2Hex(FileContent[Pos++]);
-                    }
+                    StartAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                 }
-                RealAddress <<= 16;
-                if (!BinaryOffsetDefined)
+            }
+            cs = StartAddress >> 16; //high part
+            ip = StartAddress & 0xffff; //low part
+            StartAddress = cs*16+ip; //segmented 20-bit space
+            DebugPrintf(1,"Start Address = 0x%08X\n", StartAddress);
+            IspEnvironment->StartAddress = StartAddress;
+        }
+        else if (RecordType == 0x04)     // 04 - Extended linear address record, used by IAR
+        {
+            for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
+            {
+                RealAddress <<= 4;
+                if (i == 0)
                 {
-                    // set startaddress of BinaryContent
-                    // use of LPC_FLASHMASK to allow a memory range, not taking the first
-                    // [04] record as actual start-address.
-                    IspEnvironment->BinaryOffset = RealAddress & LPC_FLASHMASK;
+                    RealAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                 }
                 else
                 {
-                    if ((RealAddress & LPC_FLASHMASK) != IspEnvironment->BinaryOffset)
-                    {
-                        DebugPrintf(1, "New Extended Linear Address Record [04] out of memory range\n");
-                        DebugPrintf(1, "Current Memory starts at: 0x%08X, new Address is: 0x%08X",
-                            IspEnvironment->BinaryOffset, RealAddress);
-                        return ERR_MEMORY_RANGE;
-                    }
+                    RealAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
                 }
             }
-            else if (RecordType == 0x05)     // 05 - Start linear address record
+            RealAddress <<= 16;
+            if (!BinaryOffsetDefined)
             {
-                StartAddress = 0;
-                for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
-                {
-                    StartAddress <<= 4;
-                    if (i == 0)
-                    {
-                        StartAddress  = Ascii2Hex(FileContent[Pos++]);
-                    }
-                    else
-                    {
-                        StartAddress |= Ascii2Hex(FileContent[Pos++]);
-                    }
-                }
-                DebugPrintf(1,"Start Address = 0x%08X\n", StartAddress);
-                IspEnvironment->StartAddress = StartAddress;
+                // set startaddress of BinaryContent
+                // use of LPC_FLASHMASK to allow a memory range, not taking the first
+                // [04] record as actual start-address.
+                IspEnvironment->BinaryOffset = RealAddress & LPC_FLASHMASK;
             }
             else
             {
-                free( FileContent);
-                DebugPrintf( 1, "Error %d RecordType %02X not yet implemented\n", ERR_RECORD_TYPE_LOADFILE, RecordType);
-                return( ERR_RECORD_TYPE_LOADFILE);
+                if ((RealAddress & LPC_FLASHMASK) != IspEnvironment->BinaryOffset)
+                {
+                    DebugPrintf(1, "New Extended Linear Address Record [04] out of memory range\n");
+                    DebugPrintf(1, "Current Memory starts at: 0x%08X, new Address is: 0x%08X",
+                        IspEnvironment->BinaryOffset, RealAddress);
+                    return ERR_MEMORY_RANGE;
+                }
             }
-
-            while (FileContent[Pos++] != 0x0a)      // Search till line end
+        }
+        else if (RecordType == 0x05)     // 05 - Start linear address record
+        {
+            StartAddress = 0;
+            for (i = 0; i < RecordLength * 2; i++)   // double amount of nibbles
             {
+                StartAddress <<= 4;
+                if (i == 0)
+                {
+                    StartAddress  = Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+                }
+                else
+                {
+                    StartAddress |= Ascii2Hex(IspEnvironment, FileContent[Pos++]);
+                }
             }
+            DebugPrintf(1,"Start Address = 0x%08X\n", StartAddress);
+            IspEnvironment->StartAddress = StartAddress;
+        }
+        else
+        {
+            DebugPrintf( 1, "Error %d RecordType %02X not yet implemented\n", ERR_RECORD_TYPE_LOADFILE, RecordType);
+            return( ERR_RECORD_TYPE_LOADFILE);
         }
 
-        DebugPrintf(2, "\tconverted to binary format...\n");
-
-        // When debugging is switched on, output result of conversion to file debugout.bin
-        if (debug_level >= 4)
+        while (FileContent[Pos++] != 0x0a)      // Search till line end
         {
-            int fdout;
-            fdout = open("debugout.bin", O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0777);
-            write(fdout, IspEnvironment->BinaryContent, IspEnvironment->BinaryLength);
-            close(fdout);
         }
+    }
+
+    DebugPrintf(2, "\tconverted to binary format...\n");
+
+    // When debugging is switched on, output result of conversion to file debugout.bin
+    if (debug_level >= 4)
+    {
+        int fdout;
+        fdout = open("debugout.bin", O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0777);
+        write(fdout, IspEnvironment->BinaryContent, IspEnvironment->BinaryLength);
+        close(fdout);
+    }
+
+    return 0;
+}
+
+/***************************** LoadFile *********************************/
+/**  Loads the requested file to download into memory.
+\param [in] IspEnvironment  structure containing input filename
+\param [in] filename  the name of the file to read in.
+\param [in] FileFormat  the format of the file to read in (FORMAT_HEX or FORMAT_BINARY)
+\return 0 if successful, otherwise an error code.
+*/
+static int LoadFile(ISP_ENVIRONMENT *IspEnvironment, const char *filename, int FileFormat)
+{
+    int            fd;
+    int            i;
+    unsigned long  FileLength;
+    BINARY        *FileContent;              /**< Used to store the content of a hex */
+                                             /*   file before converting to binary.  */
+
+    fd = open(filename, O_RDONLY | O_BINARY);
+    if (fd == -1)
+    {
+        DebugPrintf(1, "Can't open file %s\n", filename);
+        return ERR_FILE_OPEN_HEX;
+    }
+
+    FileLength = lseek(fd, 0L, 2);      // Get file size
+
+    if (FileLength == (size_t)-1)
+    {
+        DebugPrintf(1, "\nFileLength = -1 !?!\n");
+        return ERR_FILE_SIZE_HEX;
+    }
+
+    lseek(fd, 0L, 0);
+
+    // Just read the entire file into memory to parse.
+    FileContent = (BINARY*) malloc(FileLength);
+
+    if( FileContent == 0)
+    {
+        DebugPrintf( 1, "\nCouldn't allocate enough memory for file.\n");
+        return ERR_FILE_ALLOC_HEX;
+    }
+
+    read(fd, FileContent, FileLength);
+
+    close(fd);
+
+    DebugPrintf(2, "File %s:\n\tloaded...\n", filename);
+
+    // Intel-Hex -> Binary Conversion
+
+    if (FileFormat == FORMAT_HEX)
+    {
+        DebugPrintf(3, "Converting file %s to binary format...\n", filename);
+
+        IspEnvironment->FileContent = FileContent;  // freed by whoever catches IspExit
+        i = ConvertHexImage(IspEnvironment, FileContent, FileLength);
+        IspEnvironment->FileContent = NULL;
 
         free( FileContent);   // Done with file contents
+
+        if (i != 0)
+        {
+            return i;
+        }
     }
     else // FORMAT_BINARY
     {
@@ -2398,17 +3976,16 @@ static int LoadFiles1(ISP_ENVIRONMENT *IspEnvironment, const FILE_LIST *file)
 /***************************** LoadFiles ********************************/
 /**  Loads the requested files to download into memory.
 \param [in] IspEnvironment structure containing input filename(s).
-\param [in] file simple linked list of files to read
 \return 0 if successful, otherwise an error code.
 */
-static int LoadFiles(ISP_ENVIRONMENT *IspEnvironment)
+int LoadFiles(ISP_ENVIRONMENT *IspEnvironment)
 {
   int ret_val;
 
     ret_val = LoadFiles1(IspEnvironment, IspEnvironment->f_list);
     if( ret_val != 0)
     {
-    exit(1); // return ret_val;
+    return ret_val;
     }
 
   DebugPrintf( 2, "Image size : %ld\n", IspEnvironment->BinaryLength);
@@ -2423,6 +4000,21 @@ static int LoadFiles(ISP_ENVIRONMENT *IspEnvironment)
         IspEnvironment->BinaryLength = NewBinaryLength;
     }
 
+    // The uuencoder reads whole groups of 4 * 45 bytes (RAM downloads
+    // 0x200 bytes further on), so provide the bytes behind the image.
+    // Padding them with erased flash contents keeps the data sent
+    // identical between runs, which -replay relies on.
+    {
+        unsigned long ImageLength = IspEnvironment->BinaryLength;
+        IspEnvironment->BinaryContent = (BINARY*) realloc(IspEnvironment->BinaryContent, ImageLength + BINARY_PADDING);
+        if (IspEnvironment->BinaryContent == NULL)
+        {
+            DebugPrintf(1, "Out of memory\n");
+            return ERR_FILE_ALLOC_HEX;
+        }
+        memset(&IspEnvironment->BinaryContent[ImageLength], 0xFF, BINARY_PADDING);
+    }
+
   // When debugging is switched on, output result of conversion to file debugout.bin
     if(debug_level >= 4)
     {
@@ -2437,24 +4029,50 @@ static int LoadFiles(ISP_ENVIRONMENT *IspEnvironment)
 #endif // !defined COMPILE_FOR_LPC21
 
 #ifndef COMPILE_FOR_LPC21
-int PerformActions(ISP_ENVIRONMENT *IspEnvironment)
+/***************************** ReplayTransportSend **********************/
+static void ReplayTransportSend(void *Context, const void *Data, size_t Length)
 {
-    int downloadResult = -1;
+    (void)Context;
+    ReplaySend(Data, Length);
+}
 
-    DebugPrintf(2, "lpc21isp version " VERSION_STR "\n");
+/***************************** ReplayTransportReceive *******************/
+static unsigned long ReplayTransportReceive(void *Context, void *Data, unsigned long MaxLength)
+{
+    (void)Context;
+    return ReplayReceive(Data, MaxLength);
+}
 
-    /* Download requested, read in the input file.                  */
-    if (IspEnvironment->ProgramChip)
-    {
-        LoadFiles(IspEnvironment);
-    }
+static const ISP_TRANSPORT ReplayTransport =
+{
+    ReplayTransportSend,
+    ReplayTransportReceive
+};
+
+/***************************** DownloadSequence *************************/
+/**  Puts the target into program mode and performs the requested download
+on an already opened serial port.
+
+\return 0 if successful (or nothing to download), otherwise an error code.
+*/
+static int DownloadSequence(ISP_ENVIRONMENT *IspEnvironment)
+{
+    int downloadResult = -1;
 
-    OpenSerialPort(IspEnvironment);   /* Open the serial port to the microcontroller. */
+    StatsBegin(IspEnvironment);
+    StatsPhase(IspEnvironment, STATS_RESET);
 
     ResetTarget(IspEnvironment, PROGRAM_MODE);
 
     ClearSerialPortBuffers(IspEnvironment);
 
+#if defined(__linux__)
+    if (IspEnvironment->LowLatency && IspEnvironment->Transport == NULL)
+    {
+        LowLatencyTuning(IspEnvironment);
+    }
+#endif
+
     /* Perform the requested download.                              */
     if (IspEnvironment->ProgramChip || IspEnvironment->DetectOnly)
     {
@@ -2473,11 +4091,150 @@ int PerformActions(ISP_ENVIRONMENT *IspEnvironment)
 #endif
         }
 
-        if (downloadResult != 0)
+        JournalClose(IspEnvironment);
+        StatsEnd(IspEnvironment, downloadResult);
+        return downloadResult;
+    }
+
+    StatsEnd(IspEnvironment, 0);
+    return 0;
+}
+
+/***************************** ProgramTarget ****************************/
+/**  Complete programming cycle for one target: open the port, download,
+start the new code and close the port again. The image must already be
+loaded. Used for each target in gang mode.
+
+\return 0 if successful, otherwise an error code.
+*/
+int ProgramTarget(ISP_ENVIRONMENT *IspEnvironment)
+{
+    int downloadResult;
+
+    downloadResult = OpenSerialPort(IspEnvironment);   /* Open the serial port to the microcontroller. */
+    if (downloadResult != 0)
+    {
+        return downloadResult;
+    }
+    TraceRecord(IspEnvironment->PortId, TRACE_PORT, IspEnvironment->serial_port, strlen(IspEnvironment->serial_port));
+
+    downloadResult = ProgramOpenTarget(IspEnvironment);
+
+    CloseSerialPort(IspEnvironment);
+
+    return downloadResult;
+}
+
+/***************************** ProgramOpenTarget ************************/
+/**  Like ProgramTarget, for a target whose serial port is already open
+(and stays open afterwards).
+\return 0 on success, an error code otherwise.
+*/
+int ProgramOpenTarget(ISP_ENVIRONMENT *IspEnvironment)
+{
+    int downloadResult;
+    jmp_buf Abort;
+
+    // Fatal errors (IspExit) only end this target, not the program.
+    if (setjmp(Abort) == 0)
+    {
+        IspEnvironment->Abort = &Abort;
+
+        downloadResult = DownloadSequence(IspEnvironment);
+
+        if (downloadResult == 0 && IspEnvironment->StartAddress == 0)
+        {
+            ResetTarget(IspEnvironment, RUN_MODE);
+        }
+    }
+    else
+    {
+        downloadResult = IspEnvironment->ExitCode;
+        JournalClose(IspEnvironment);
+        StatsEnd(IspEnvironment, downloadResult);
+    }
+    IspEnvironment->Abort = NULL;
+
+    return downloadResult;
+}
+
+int PerformActions(ISP_ENVIRONMENT *IspEnvironment)
+{
+    int downloadResult;
+
+    DebugPrintf(2, "lpc21isp version " VERSION_STR "\n");
+
+    /* Download requested, read in the input file.                  */
+    if (IspEnvironment->ProgramChip && IspEnvironment->DaemonSocket == NULL && IspEnvironment->ManifestFile == NULL &&
+        LoadFiles(IspEnvironment) != 0)
+    {
+        exit(1);
+    }
+
+    if (IspEnvironment->CaptureFile != NULL && TraceOpen(IspEnvironment->CaptureFile) != 0)
+    {
+        DebugPrintf(1, "Can't create capture file %s\n", IspEnvironment->CaptureFile);
+        exit(1);
+    }
+
+    if ((IspEnvironment->StatsFile != NULL || IspEnvironment->EventsFile != NULL || IspEnvironment->MetricsFile != NULL) &&
+        StatsOpen(IspEnvironment->StatsFile, IspEnvironment->EventsFile, IspEnvironment->MetricsFile) != 0)
+    {
+        DebugPrintf(1, "Can't create event file %s\n", IspEnvironment->EventsFile);
+        exit(1);
+    }
+
+    if (IspEnvironment->ReplayFile != NULL)
+    {
+        if (ReplayOpen(IspEnvironment->ReplayFile, IspEnvironment->PortId) != 0)
+        {
+            DebugPrintf(1, "Can't read trace %s\n", IspEnvironment->ReplayFile);
+            exit(1);
+        }
+        IspEnvironment->Transport = &ReplayTransport;
+
+        return DownloadSequence(IspEnvironment);
+    }
+
+#if defined DRYRUN_SUPPORT
+    if (IspEnvironment->DryRunPart != NULL)
+    {
+        if (PlanOpen(IspEnvironment) != 0)
         {
-            CloseSerialPort(IspEnvironment);
-            exit(downloadResult);
+            exit(1);
         }
+
+        downloadResult = DownloadSequence(IspEnvironment);
+        PlanReport(IspEnvironment, downloadResult);
+        return downloadResult;
+    }
+#endif
+
+#if defined GANG_SUPPORT
+    if (IspEnvironment->DaemonSocket != NULL || IspEnvironment->ManifestFile != NULL)
+    {
+        return DaemonRun(IspEnvironment);
+    }
+
+    if (IspEnvironment->Gang)
+    {
+        return GangDownload(IspEnvironment);
+    }
+#endif
+
+    downloadResult = OpenSerialPort(IspEnvironment);   /* Open the serial port to the microcontroller. */
+    if (downloadResult != 0)
+    {
+        exit(downloadResult == ERR_OPEN_PORT ? 2 : 3);
+    }
+    TraceRecord(IspEnvironment->PortId, TRACE_PORT, IspEnvironment->serial_port, strlen(IspEnvironment->serial_port));
+
+    downloadResult = DownloadSequence(IspEnvironment);
+
+    if (downloadResult != 0)
+    {
+        CloseSerialPort(IspEnvironment);
+        exit(downloadResult);
     }
 
     if (IspEnvironment->StartAddress == 0 || IspEnvironment->TerminalOnly)
@@ -2509,7 +4266,7 @@ int PerformActions(ISP_ENVIRONMENT *IspEnvironment)
 \param [in] argv an array of pointers to the arguments.
 */
 
-#if !defined COMPILE_FOR_LPC21
+#if !defined COMPILE_FOR_LPC21 && !defined LPC21ISP_LIBRARY
 
 #if defined INTEGRATED_IN_WIN_APP
 int AppDoProgram(int argc, char *argv[])
@@ -2535,7 +4292,7 @@ int main(int argc, char *argv[])
     return PerformActions(&IspEnvironment);                   // Do as requested !
 }
 
-#endif // !defined COMPILE_FOR_LPC21
+#endif // !defined COMPILE_FOR_LPC21 && !defined LPC21ISP_LIBRARY
 
 /***************************** DumpString ******************************/
 /**  Prints an area of memory to stdout. Converts non-printables to hex.
@@ -2552,6 +4309,11 @@ void DumpString(int level, const void *b, size_t size, const char *prefix_string
     const char * s = (const char*) b;
     unsigned char c;
 
+    if (level > debug_level)
+    {
+        return;
+    }
+
     DebugPrintf(level, prefix_string);
 
     DebugPrintf(level, "'");
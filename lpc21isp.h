@@ -68,6 +68,14 @@ Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.c
 #define SYSFS_GPIO_SUPPORT
 #endif
 
+#if defined(__linux__) && !defined(INTEGRATED_IN_WIN_APP)
+#define GANG_SUPPORT
+#endif
+
+#if defined COMPILE_FOR_LINUX && !defined(INTEGRATED_IN_WIN_APP)
+#define DRYRUN_SUPPORT
+#endif
+
 #if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
 #include <windows.h>
 #include <io.h>
@@ -95,6 +103,18 @@ extern void Sleep(unsigned long MilliSeconds);
 #define TRACE(x) printf("%s",x)
 #endif // defined COMPILE_FOR_LINUX
 
+#if defined(__linux__)
+#include <linux/serial.h>   // for TIOCGSERIAL / ASYNC_LOW_LATENCY
+#include <poll.h>
+#endif
+
+#if defined SYSFS_GPIO_SUPPORT
+#include <linux/gpio.h>
+#if defined GPIO_V2_GET_LINE_IOCTL
+#define GPIOCHIP_SUPPORT    // -gpiochip, needs the line request API v2 (Linux 5.10)
+#endif
+#endif
+
 #if defined COMPILE_FOR_LINUX || defined COMPILE_FOR_CYGWIN
 #include <termios.h>
 #include <unistd.h>     // for read and return value of lseek
@@ -107,6 +127,7 @@ extern struct termios keyboard_origtty;
 #include <ctype.h>      // isdigit()
 #include <stdio.h>      // stdout
 #include <stdarg.h>
+#include <setjmp.h>
 #include <time.h>
 #if defined (COMPILE_FOR_LINUX)
 #if defined(__OpenBSD__)
@@ -136,15 +157,42 @@ typedef enum
     RUN_MODE
 } TARGET_MODE;
 
+#define GPIO_RST_SET    0x01            /**< -gpiorst given */
+#define GPIO_ISP_SET    0x02            /**< -gpioisp given */
+
+/** Reset sequence timing in ms, see ResetTarget. */
+typedef struct
+{
+    unsigned Setup;                     /**< EnableBootLoader before Reset.     */
+    unsigned Pulse;                     /**< Reset asserted.                    */
+    unsigned Settle;                    /**< Reset released, EnableBootLoader   */
+                                        /*   still asserted.                    */
+} RESET_TIMING;
+
 typedef enum
 {
     FORMAT_BINARY,
     FORMAT_HEX
 } FILE_FORMAT_TYPE;
 
+/** How data is paced towards the target. */
+typedef enum
+{
+    PACING_DEFAULT,         /**< Chosen per chip variant after detection. */
+    PACING_XONXOFF,         /**< Software flow control (LPC user manual). */
+    PACING_NONE,            /**< No flow control, full line rate.         */
+    PACING_RTSCTS,          /**< Hardware flow control.                   */
+    PACING_TOKENBUCKET      /**< No flow control, host limits the rate.   */
+} PACING_MODE;
+
 typedef unsigned char BINARY;               // Data type used for microcontroller
 
+/* Bytes allocated behind the image, see LoadFiles. */
+#define BINARY_PADDING  (0x200 + 4 * 45)
+
 /** Used to create list of files to read in. */
+struct isp_progress;    /* see lpcsession.h */
+
 typedef struct file_list FILE_LIST;
 
 #define ERR_RECORD_TYPE_LOADFILE  55  /**< File record type not yet implemented. */
@@ -153,6 +201,59 @@ typedef struct file_list FILE_LIST;
 #define ERR_FILE_SIZE_HEX         62  /**< Unexpected hex file size. */
 #define ERR_FILE_ALLOC_HEX        63  /**< Couldn't allocate enough memory for hex file. */
 #define ERR_MEMORY_RANGE          69  /**< Out of memory range. */
+#define ERR_OPEN_PORT             70  /**< Couldn't open the serial port. */
+#define ERR_SETUP_PORT            71  /**< Couldn't set up the serial port. */
+
+/* Variables that differ between sessions running at the same time on
+ * different threads (library build), e.g. the debug level.
+ */
+#if defined __GNUC__
+#define ISP_THREAD_LOCAL __thread
+#elif defined _MSC_VER
+#define ISP_THREAD_LOCAL __declspec(thread)
+#else
+#define ISP_THREAD_LOCAL
+#endif
+
+/* Functions that do not return (IspExit). */
+#if defined __GNUC__
+#define ISP_NORETURN __attribute__((noreturn))
+#elif defined _MSC_VER
+#define ISP_NORETURN __declspec(noreturn)
+#else
+#define ISP_NORETURN
+#endif
+
+/** Replaces the serial port, e.g. by a recorded trace or an emulated target. */
+typedef struct
+{
+    void          (*Send)(void *Context, const void *Data, size_t Length);
+    unsigned long (*Receive)(void *Context, void *Data, unsigned long MaxLength);
+} ISP_TRANSPORT;
+
+/** Kinds of answers with latency models of their own (see NxpTimeout). */
+typedef enum
+{
+    LATENCY_COMMAND,    /**< Echo and return code of a command.        */
+    LATENCY_DATA,       /**< Echo of a data line, answer to a checksum.*/
+    LATENCY_ERASE,      /**< Erase, one model per erased size.         */
+    LATENCY_COPY,       /**< Copy RAM to flash, one model per size.    */
+    LATENCY_COMPARE,    /**< Compare, one model per size.              */
+    LATENCY_CLASSES
+} LATENCY_CLASS;
+
+/** Running latency estimate of one kind of answer. */
+typedef struct
+{
+    LATENCY_CLASS Class;
+    unsigned long Bytes;                /**< Size erased, copied or compared,   */
+                                        /*   else 0.                            */
+    unsigned long Count;                /**< Answers timed, 0 for a free slot.  */
+    unsigned long Mean;                 /**< Smoothed latency (us).             */
+    unsigned long Deviation;            /**< Smoothed mean deviation (us).      */
+} LATENCY_MODEL;
+
+#define LATENCY_MODELS  16
 
 /** Structure used to build list of input files. */
 struct file_list
@@ -175,8 +276,19 @@ typedef struct
     unsigned char LogFile;
     FILE_LIST *f_list;                  // List of files to read in.
     int nQuestionMarks; // how many times to try to synchronise
+    unsigned SyncProbe; // -syncprobe: wait for "Synchronized" (ms), 0 for SYNC_PROBE_MS
     int DoNotStart;
     int BootHold;
+    unsigned char ResetTimingSet;       // -resettiming given, else the defaults
+    RESET_TIMING ResetTiming;           // of the reset backend are used
+    unsigned char ResetTune;            // -resettune: shorten the reset timing
+    const char *ResetTuneFile;          // and keep the result in this file
+    char SwEntry[64];                   // -swentry: sent to the application to
+    unsigned char SwEntryLength;        // enter ISP mode instead of a reset,
+    char SwEntryAck[64];                // its answer (none if SwEntryAckLength 0),
+    unsigned char SwEntryAckLength;
+    unsigned long SwEntryBaud;          // its baud rate, 0: the ISP baud rate
+    unsigned SwEntryWait;               // and ms to wait for the answer
     char *serial_port;                  // Name of the serial port to use to
                                         // communicate with the microcontroller.
                                         // Read from the command line.
@@ -189,12 +301,42 @@ typedef struct
 #endif
 
 #if defined SYSFS_GPIO_SUPPORT
-    unsigned char GpioRst;
-    unsigned char GpioIsp;
+    unsigned GpioRst;
+    unsigned GpioIsp;
+    unsigned char GpioSet;              // GPIO_RST_SET | GPIO_ISP_SET, pins given
+#if defined GPIOCHIP_SUPPORT
+    const char *GpioChip;               // -gpiochip: the pins are lines of this chip
+    int GpioFd;                         // request of both lines while the port is open
+#endif
+#endif
+
+#if defined GANG_SUPPORT
+    unsigned char Gang;                 /**< serial_port is a comma separated list */
+    struct gang_session *GangSession;   /**< Session this environment belongs to,  */
+                                        /*   NULL when not running in gang mode.   */
 #endif
 
     unsigned char HalfDuplex;           // Only used for LPC Programming
     unsigned char WriteDelay;
+    PACING_MODE   Pacing;               /**< Requested pacing, PACING_DEFAULT   */
+                                        /*   lets the chip variant decide.      */
+    PACING_MODE   PacingActive;         /**< Pacing currently in effect.        */
+    unsigned long PaceRate;             /**< Token bucket rate in bytes/s, 0 to */
+                                        /*   derive it from the baud rate.      */
+    unsigned long PaceBurst;            /**< Token bucket size in bytes.        */
+    double        PaceTokens;           /**< Bytes that may be sent right now.  */
+    unsigned long long PaceLastRefill;  /**< Time of last refill (us).          */
+    const char   *CaptureFile;          /**< Binary trace of the serial traffic.*/
+    unsigned      PortId;               /**< Port number in the trace.          */
+    const char   *ReplayFile;           /**< Talk to a recorded trace instead   */
+                                        /*   of the serial port.                */
+    const ISP_TRANSPORT *Transport;     /**< Used instead of the serial port if */
+    void         *TransportContext;     /*   set (replay, emulated target).     */
+    const char   *StatsFile;            /**< JSON summary of the timing.        */
+    const char   *EventsFile;           /**< JSON lines written while running.  */
+    const char   *MetricsFile;          /**< Prometheus totals of all downloads.*/
+    struct isp_stats *Stats;            /**< Timing of the current download,    */
+                                        /*   NULL if not collected.             */
     unsigned char DetectOnly;
     unsigned char WipeDevice;
     unsigned char Verify;
@@ -209,12 +351,61 @@ typedef struct
 
     BINARY *FileContent;
     BINARY *BinaryContent;              /**< Binary image of the                  */
-                                          /* microcontroller's memory.            */
+                                          /* microcontroller's memory. Only read  */
+                                          /* while programming, so sessions can   */
+                                          /* share it.                            */
     unsigned long BinaryLength;
     unsigned long BinaryOffset;
     unsigned long StartAddress;
     unsigned long BinaryMemSize;
 
+    unsigned long VectorPatchOffset;    /**< Where the vector checksum goes, 0 if */
+    BINARY        VectorPatch[4];       /*   the image is sent unchanged.         */
+
+    const unsigned int *SectorTable;    /**< Sector layout of this download: the  */
+    unsigned int  FlashSectors;         /*   detected part's, or a single sector  */
+    unsigned int  MaxCopySize;          /*   of all RAM for downloads to RAM.     */
+    unsigned int  RamSectorTable[1];
+
+#if !defined COMPILE_FOR_LPC21
+    char          ResendLines[20][128]; /**< Data lines of the current checksum   */
+                                        /*   group, sent again on RESEND.         */
+    unsigned      GroupLines;           /**< Lines per checksum group for now,    */
+    unsigned      CleanGroups;          /*   adapted to the link (NxpGroupDone).  */
+    jmp_buf      *Abort;                /**< Fatal errors end the session here    */
+                                        /*   instead of the program, see IspExit. */
+    int           ExitCode;             /**< Error that ended it that way.        */
+    void        (*Progress)(void *Context, const struct isp_progress *Progress);
+    void         *ProgressContext;      /**< Progress is called after each sector */
+                                        /*   (see lpcsession.h).                  */
+    const char   *DaemonSocket;         /**< -daemon: serve jobs on this socket.  */
+    const char   *ManifestFile;         /**< -manifest: run the jobs listed here. */
+    unsigned long ExpectedPartId;       /**< -partid: refuse other parts, 0 for   */
+                                        /*   any part.                            */
+    int           PinPart;              /**< -pinpart: take the part of -partid   */
+                                        /*   instead of reading its ID, if it is  */
+                                        /*   KnownPartId.                         */
+    unsigned long KnownPartId;          /**< Part ID read on the board before (the*/
+                                        /*   -manifest probe), 0 if not known.    */
+    int           Pipeline;             /**< -pipeline: send the commands after   */
+                                        /*   synchronizing back to back.          */
+    int           CommandMode;          /**< The bootloader takes commands, it    */
+                                        /*   hasn't been reset or started the code*/
+                                        /*   since synchronizing (-manifest keeps */
+                                        /*   it from session to session).         */
+    const char   *DryRunPart;           /**< -dryrun: plan the download against   */
+                                        /*   this emulated part (see lpcplan.h).  */
+    const char   *LinkModel;            /**< -linkmodel: rtt,erase,program times. */
+    int           Recover;              /**< -recover: recoveries allowed in one  */
+                                        /*   download, 0 to stop at the first     */
+                                        /*   failed command.                      */
+    const char   *JournalDir;           /**< -journal: directory of the resume    */
+    struct isp_journal *Journal;        /*   journal, one file per port.          */
+    unsigned      TimeoutFloor;         /**< -timeouts: limits of the timeouts    */
+    unsigned      TimeoutCeiling;       /*   learned from the answers (ms).       */
+    LATENCY_MODEL Latency[LATENCY_MODELS];
+#endif
+
 #if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
     HANDLE hCom;
 #endif // defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
@@ -227,24 +418,43 @@ typedef struct
     struct termios oldtio, newtio;
 #endif // defined COMPILE_FOR_LINUX
 
+#if defined(__linux__)
+    unsigned char LowLatency;           /**< Tune USB serial adapter for latency.  */
+    int  SavedSerialFlags;              /**< serial_struct.flags before tuning,    */
+                                        /*   -1 if not changed.                    */
+    int  SavedLatencyTimer;             /**< latency_timer before tuning, -1 if    */
+                                        /*   not changed.                          */
+    char LatencyTimerPath[128];
+#endif
+
 #ifdef INTEGRATED_IN_WIN_APP
     unsigned char NoSync;
 #endif
 
+#if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
+    char     RxTmpBuf[256];             /**< Received data saved for half-duplex.  */
+    unsigned RxTmpPos;                  /**< Next character to hand out.           */
+#endif
+
 #if defined COMPILE_FOR_WINDOWS || defined COMPILE_FOR_CYGWIN
     unsigned long serial_timeout_count;   /**< Local used to track timeouts on serial port read. */
 #else
     unsigned serial_timeout_count;   /**< Local used to track timeouts on serial port read. */
+    unsigned long long serial_deadline; /**< IspClock time the current read gives up. */
 #endif
 
+    char ResidualData[128];             /**< Data received after the expected answer,
+                                           * handed out by the next ReceiveComPort. */
+
 } ISP_ENVIRONMENT;
 
 #if defined COMPILE_FOR_LPC21
 
 #define DebugPrintf(in, ...)
+#define IspExit(env, code)  exit(code)
 
 #else
-extern int debug_level;
+extern ISP_THREAD_LOCAL int debug_level;
 
 #if defined INTEGRATED_IN_WIN_APP
 
@@ -267,6 +477,12 @@ void DebugPrintf(int level, const char *fmt, ...);
 
 void ClearSerialPortBuffers(ISP_ENVIRONMENT *IspEnvironment);
 void ControlXonXoffSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char XonXoff);
+void ControlRtsCtsSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char RtsCts);
+void SetPacing(ISP_ENVIRONMENT *IspEnvironment, PACING_MODE Pacing);
+unsigned long long IspClock(void);
+ISP_NORETURN void IspExit(ISP_ENVIRONMENT *IspEnvironment, int ExitCode);
+int ParseOption(ISP_ENVIRONMENT *IspEnvironment, const char *Option);
+int LoadFiles(ISP_ENVIRONMENT *IspEnvironment);
 
 #endif
 
@@ -294,7 +510,19 @@ debug levels
 5 - log comm's          - log serial I/O
 */
 
-
+/** State of the line end scan of ReceiveComPort. */
+typedef struct
+{
+    unsigned long nr_of_0x0A;       /**< Line ends seen so far.                  */
+    unsigned long nr_of_0x0D;
+    int           lf;               /**< <CR> seen, line end pending.           */
+    int           eof;              /**< Non ASCII character seen.              */
+    unsigned long end;              /**< Offset behind the last wanted line     */
+                                    /*   end, 0 if not reached yet.             */
+} LINE_SCANNER;
+
+void ScanLineEnds(LINE_SCANNER *Scanner, const unsigned char *Answer,
+                  unsigned long From, unsigned long To, unsigned long WantedNr0x0A);
 void ReceiveComPort(ISP_ENVIRONMENT *IspEnvironment,
                     const char *Ans, unsigned long MaxSize,
                     unsigned long *RealSize, unsigned long WantedNr0x0A,
@@ -302,10 +530,21 @@ void ReceiveComPort(ISP_ENVIRONMENT *IspEnvironment,
 void PrepareKeyboardTtySettings(void);
 void ResetKeyboardTtySettings(void);
 void ResetTarget(ISP_ENVIRONMENT *IspEnvironment, TARGET_MODE mode);
+void ResetTuneResult(ISP_ENVIRONMENT *IspEnvironment, int Synced, int Resets);
+int ProgramTarget(ISP_ENVIRONMENT *IspEnvironment);
+int ProgramOpenTarget(ISP_ENVIRONMENT *IspEnvironment);
+int OpenSerialPort(ISP_ENVIRONMENT *IspEnvironment);
+void CloseSerialPort(ISP_ENVIRONMENT *IspEnvironment);
+#if defined(__linux__)
+void LowLatencyEnable(ISP_ENVIRONMENT *IspEnvironment);
+#endif
+struct isp_image;                       /* see lpcsession.h */
+void ImageAttach(const struct isp_image *Image, ISP_ENVIRONMENT *IspEnvironment);
+int ConvertHexImage(ISP_ENVIRONMENT *IspEnvironment, const BINARY *FileContent, unsigned long FileLength);
 
 void DumpString(int level, const void *s, size_t size, const char *prefix_string);
 void SendComPort(ISP_ENVIRONMENT *IspEnvironment, const char *s);
-void SendComPortBlock(ISP_ENVIRONMENT *IspEnvironment, const void *s, size_t n);
+int SendComPortBlock(ISP_ENVIRONMENT *IspEnvironment, const void *s, size_t n);
 int ReceiveComPortBlockComplete(ISP_ENVIRONMENT *IspEnvironment, void *block, size_t size, unsigned timeout);
 void ClearSerialPortBuffers(ISP_ENVIRONMENT *IspEnvironment);
 void ControlXonXoffSerialPort(ISP_ENVIRONMENT *IspEnvironment, unsigned char XonXoff);
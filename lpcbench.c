@@ -0,0 +1,482 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcbench.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Microbenchmark of the host side kernels that touch every byte of an
+// image: Intel hex decoding (ConvertHexImage), uuencoding with the block
+// checksum (UuencodeLine), answer normalisation (FormatCommand), the echo
+// check of NxpDownload (MatchLine), the line end scan of ReceiveComPort
+// (ScanLineEnds) and Analog Devices packet forming (AnalogDevicesFormPacket).
+//
+//   lpcbench [options] [image ...]
+//
+// Each kernel runs on synthetic images of 64 KiB to 16 MiB and on the
+// given images (binary, or Intel hex if the file starts with ':'). The
+// kernels are linked from an lpc21isp build without main() (compiled with
+// LPC21ISP_LIBRARY), so the numbers are those of the real code. Build with
+// optimisation to measure what a release build does, e.g.
+//   make CDEBUG=-O2 lpcbench
+
+#if defined(_WIN32)
+#if !defined __BORLANDC__
+#include "StdAfx.h"
+#endif
+#endif // defined(_WIN32)
+#include "lpc21isp.h"
+#include "adprog.h"
+#include "lpcprog.h"
+
+#define BENCH_LINE  45      /**< Bytes per uuencoded line, as NxpDownload. */
+
+typedef enum
+{
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_JSON
+} OUTPUT_FORMAT;
+
+/** An image and the inputs derived from it. */
+typedef struct
+{
+    const char    *Name;
+    BINARY        *Data;
+    unsigned long  Length;
+    char          *HexText;     /**< The image as Intel hex.                    */
+    unsigned long  HexLength;
+    char          *Lines;       /**< The image as uuencoded lines, each one     */
+    unsigned long  LinesCount;  /*   <CR><LF> terminated and NUL separated.     */
+    unsigned long  LinesLength; /**< Text bytes without the NULs.               */
+} BENCH_IMAGE;
+
+typedef unsigned long (*BENCH_KERNEL)(const BENCH_IMAGE *Image);
+
+static unsigned long Sink;      /**< Results go here, so nothing is optimised away. */
+
+/***************************** BenchClock *******************************/
+/**  Monotonic time base.
+\return time in nanoseconds.
+*/
+static unsigned long long BenchClock(void)
+{
+#if defined COMPILE_FOR_WINDOWS
+    LARGE_INTEGER freq, now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart * (1000000000.0 / freq.QuadPart));
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/***************************** BenchAlloc *******************************/
+static void *BenchAlloc(unsigned long Size)
+{
+    void *p = malloc(Size);
+
+    if (p == NULL)
+    {
+        fprintf(stderr, "Out of memory (%lu bytes)\n", Size);
+        exit(1);
+    }
+    return p;
+}
+
+/***************************** MakeHexText ******************************/
+/**  Converts an image to Intel hex with 16 byte data records. The loader
+only accepts a window of LPC_FLASHMASK, so bigger images wrap around in it;
+the amount of text to decode is the same.
+*/
+static void MakeHexText(BENCH_IMAGE *Image)
+{
+    static const char Hex[] = "0123456789ABCDEF";
+    unsigned long Address, Window = ~LPC_FLASHMASK + 1;
+    unsigned n, i, Sum;
+    char *p;
+
+    Image->HexText = p = (char *)BenchAlloc(Image->Length / 16 * 45 + Image->Length / 65536 * 17 + 64);
+
+    for (Address = 0; Address < Image->Length; Address += 16)
+    {
+        if ((Address & 0xFFFF) == 0)
+        {
+            unsigned Upper = (unsigned)((Address % Window) >> 16);
+
+            Sum = 2 + 4 + (Upper >> 8) + (Upper & 0xFF);
+            p += sprintf(p, ":02000004%04X%02X\r\n", Upper, (0x100 - Sum) & 0xFF);
+        }
+
+        n = Image->Length - Address < 16 ? (unsigned)(Image->Length - Address) : 16;
+        Sum = n + ((Address >> 8) & 0xFF) + (Address & 0xFF);
+        p += sprintf(p, ":%02X%04lX00", n, Address & 0xFFFF);
+        for (i = 0; i < n; i++)
+        {
+            *p++ = Hex[Image->Data[Address + i] >> 4];
+            *p++ = Hex[Image->Data[Address + i] & 15];
+            Sum += Image->Data[Address + i];
+        }
+        p += sprintf(p, "%02X\r\n", (0x100 - Sum) & 0xFF);
+    }
+    p += sprintf(p, ":00000001FF\r\n");
+
+    Image->HexLength = p - Image->HexText;
+}
+
+/***************************** MakeLines ********************************/
+/**  Converts an image to the uuencoded lines NxpDownload sends, which are
+also the echo ReceiveComPort, FormatCommand and MatchLine work on.
+*/
+static void MakeLines(BENCH_IMAGE *Image)
+{
+    unsigned long Pos, Checksum = 0;
+    unsigned n;
+    char *p;
+
+    Image->Lines = p = (char *)BenchAlloc((Image->Length / BENCH_LINE + 1) * 64);
+    Image->LinesCount  = 0;
+    Image->LinesLength = 0;
+
+    for (Pos = 0; Pos < Image->Length; Pos += BENCH_LINE)
+    {
+        n = Image->Length - Pos < BENCH_LINE ? (unsigned)(Image->Length - Pos) : BENCH_LINE;
+        n = UuencodeLine(p, &Image->Data[Pos], n, &Checksum);
+        Image->LinesLength += n;
+        Image->LinesCount++;
+        p += n + 1;
+    }
+}
+
+/***************************** KernelHexDecode **************************/
+static unsigned long KernelHexDecode(const BENCH_IMAGE *Image)
+{
+    ISP_ENVIRONMENT IspEnvironment;
+    unsigned long Result;
+
+    memset(&IspEnvironment, 0, sizeof(IspEnvironment));
+    if (ConvertHexImage(&IspEnvironment, (const BINARY *)Image->HexText, Image->HexLength) != 0)
+    {
+        fprintf(stderr, "Hex decoding of %s failed\n", Image->Name);
+        exit(1);
+    }
+    Result = IspEnvironment.BinaryLength + IspEnvironment.BinaryContent[0];
+    free(IspEnvironment.BinaryContent);
+    return Result;
+}
+
+/***************************** KernelUuencode ***************************/
+static unsigned long KernelUuencode(const BENCH_IMAGE *Image)
+{
+    char Line[80];
+    unsigned long Pos, Checksum = 0;
+    unsigned n;
+
+    for (Pos = 0; Pos < Image->Length; Pos += BENCH_LINE)
+    {
+        n = Image->Length - Pos < BENCH_LINE ? (unsigned)(Image->Length - Pos) : BENCH_LINE;
+        UuencodeLine(Line, &Image->Data[Pos], n, &Checksum);
+    }
+    return Checksum + Line[1];
+}
+
+/***************************** KernelFormat *****************************/
+static unsigned long KernelFormat(const BENCH_IMAGE *Image)
+{
+    char Out[80];
+    const char *p = Image->Lines;
+    unsigned long i, Result = 0;
+
+    for (i = 0; i < Image->LinesCount; i++)
+    {
+        FormatCommand(p, Out);
+        Result += Out[1];
+        p += strlen(p) + 1;
+    }
+    return Result;
+}
+
+/***************************** KernelMatch ******************************/
+static unsigned long KernelMatch(const BENCH_IMAGE *Image)
+{
+    ANSWER_MATCH Match;
+    const char *p = Image->Lines;
+    unsigned long i, Length, Result = 0;
+
+    for (i = 0; i < Image->LinesCount; i++)
+    {
+        Length = strlen(p);
+        MatchStart(&Match, p, Length);
+        Result += MatchLine(&Match, p);
+        p += Length + 1;
+    }
+    return Result;
+}
+
+/***************************** KernelScan *******************************/
+static unsigned long KernelScan(const BENCH_IMAGE *Image)
+{
+    LINE_SCANNER Scanner;
+    const char *p = Image->Lines;
+    unsigned long i, Length, Result = 0;
+
+    for (i = 0; i < Image->LinesCount; i++)
+    {
+        Length = strlen(p);
+        memset(&Scanner, 0, sizeof(Scanner));
+        ScanLineEnds(&Scanner, (const unsigned char *)p, 0, Length, 1);
+        Result += Scanner.end;
+        p += Length + 1;
+    }
+    return Result;
+}
+
+/***************************** KernelAdPacket ***************************/
+static unsigned long KernelAdPacket(const BENCH_IMAGE *Image)
+{
+    AD_PACKET Packet;
+    unsigned long Pos, Result = 0;
+    int n;
+
+    for (Pos = 0; Pos < Image->Length; Pos += AD_PACKET_SIZE)
+    {
+        n = Image->Length - Pos < AD_PACKET_SIZE ? (int)(Image->Length - Pos) : AD_PACKET_SIZE;
+        AnalogDevicesFormPacket(NULL, 'W', n, (unsigned int)Pos, &Image->Data[Pos], &Packet);
+        Result += Packet.data[n];
+    }
+    return Result;
+}
+
+/***************************** Measure **********************************/
+/**  Runs a kernel until MinTime has passed and prints the result.
+\param [in] InputBytes the bytes the kernel consumes per run.
+*/
+static void Measure(const char *KernelName, BENCH_KERNEL Kernel, const BENCH_IMAGE *Image,
+                    unsigned long InputBytes, unsigned long long MinTime, OUTPUT_FORMAT Format)
+{
+    unsigned long long Start, Elapsed;
+    unsigned long Runs = 0;
+    double Seconds, MBs, NsPerByte;
+
+    Start = BenchClock();
+    do
+    {
+        Sink += Kernel(Image);
+        Runs++;
+        Elapsed = BenchClock() - Start;
+    } while (Elapsed < MinTime);
+
+    Seconds   = Elapsed / 1e9 / Runs;
+    MBs       = InputBytes / Seconds / 1e6;
+    NsPerByte = Seconds * 1e9 / InputBytes;
+
+    switch (Format)
+    {
+    case OUTPUT_CSV:
+        printf("%s,%s,%lu,%lu,%lu,%.9f,%.3f,%.4f\n",
+               KernelName, Image->Name, Image->Length, InputBytes, Runs, Seconds, MBs, NsPerByte);
+        break;
+
+    case OUTPUT_JSON:
+        printf("{\"kernel\":\"%s\",\"image\":\"%s\",\"image_bytes\":%lu,\"input_bytes\":%lu,"
+               "\"runs\":%lu,\"seconds\":%.9f,\"mb_per_s\":%.3f,\"ns_per_byte\":%.4f}\n",
+               KernelName, Image->Name, Image->Length, InputBytes, Runs, Seconds, MBs, NsPerByte);
+        break;
+
+    default:
+        printf("%-11s %-20s %9lu %10lu %6lu %9.1f MB/s %8.3f ns/byte\n",
+               KernelName, Image->Name, Image->Length, InputBytes, Runs, MBs, NsPerByte);
+        break;
+    }
+    fflush(stdout);
+}
+
+/***************************** RunImage *********************************/
+static void RunImage(BENCH_IMAGE *Image, unsigned long long MinTime, OUTPUT_FORMAT Format)
+{
+    MakeHexText(Image);
+    MakeLines(Image);
+
+    Measure("hex_decode", KernelHexDecode, Image, Image->HexLength,   MinTime, Format);
+    Measure("uuencode",   KernelUuencode,  Image, Image->Length,      MinTime, Format);
+    Measure("format",     KernelFormat,    Image, Image->LinesLength, MinTime, Format);
+    Measure("match",      KernelMatch,     Image, Image->LinesLength, MinTime, Format);
+    Measure("line_scan",  KernelScan,      Image, Image->LinesLength, MinTime, Format);
+    Measure("ad_packet",  KernelAdPacket,  Image, Image->Length,      MinTime, Format);
+
+    free(Image->HexText);
+    free(Image->Lines);
+}
+
+/***************************** LoadImage ********************************/
+/**  Reads an image file, Intel hex files are converted to binary.
+*/
+static void LoadImage(BENCH_IMAGE *Image, const char *FileName)
+{
+    FILE *f;
+    long Length;
+    BINARY *Content;
+
+    f = fopen(FileName, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Can't open %s\n", FileName);
+        exit(1);
+    }
+    fseek(f, 0L, SEEK_END);
+    Length = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+    Content = (BINARY *)BenchAlloc(Length + 1);
+    if (fread(Content, 1, Length, f) != (size_t)Length)
+    {
+        fprintf(stderr, "Can't read %s\n", FileName);
+        exit(1);
+    }
+    fclose(f);
+
+    Image->Name = FileName;
+    if (Length > 0 && Content[0] == ':')
+    {
+        ISP_ENVIRONMENT IspEnvironment;
+
+        memset(&IspEnvironment, 0, sizeof(IspEnvironment));
+        Content[Length] = '\n';     // the decoder needs a line end after the last record
+        if (ConvertHexImage(&IspEnvironment, Content, Length) != 0)
+        {
+            exit(1);
+        }
+        free(Content);
+        Image->Data   = IspEnvironment.BinaryContent;
+        Image->Length = IspEnvironment.BinaryLength;
+    }
+    else
+    {
+        Image->Data   = Content;
+        Image->Length = Length;
+    }
+}
+
+/***************************** main *************************************/
+int main(int argc, char *argv[])
+{
+    BENCH_IMAGE Image;
+    OUTPUT_FORMAT Format = OUTPUT_TEXT;
+    unsigned long long MinTime = 200000000ULL;
+    unsigned long MinSize = 64 * 1024, MaxSize = 16 * 1024 * 1024, Size, Pos;
+    unsigned long Random = 2463534242UL;
+    char Name[32];
+    int i, Files = 0;
+
+    debug_level = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (stricmp(argv[i], "-csv") == 0)
+        {
+            Format = OUTPUT_CSV;
+        }
+        else if (stricmp(argv[i], "-json") == 0)
+        {
+            Format = OUTPUT_JSON;
+        }
+        else if (strnicmp(argv[i], "-time", 5) == 0)
+        {
+            MinTime = strtoul(&argv[i][5], NULL, 10) * 1000000ULL;
+        }
+        else if (strnicmp(argv[i], "-min", 4) == 0)
+        {
+            MinSize = strtoul(&argv[i][4], NULL, 10) * 1024;
+        }
+        else if (strnicmp(argv[i], "-max", 4) == 0)
+        {
+            MaxSize = strtoul(&argv[i][4], NULL, 10) * 1024;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Benchmark of the lpc21isp encoding and parsing kernels\n"
+                            "Syntax:  lpcbench [Options] [image ...]\n\n"
+                            "Options: -csv        comma separated output\n"
+                            "         -json       one JSON object per line\n"
+                            "         -time<ms>   minimum time per measurement (default 200)\n"
+                            "         -min<KiB>   smallest synthetic image (default 64)\n"
+                            "         -max<KiB>   biggest synthetic image (default 16384),\n"
+                            "                     0 for only the given images\n");
+            exit(1);
+        }
+        else
+        {
+            Files++;
+        }
+    }
+
+    if (Format == OUTPUT_CSV)
+    {
+        printf("kernel,image,image_bytes,input_bytes,runs,seconds,mb_per_s,ns_per_byte\n");
+    }
+    else if (Format == OUTPUT_TEXT)
+    {
+        printf("%-11s %-20s %9s %10s %6s %14s %16s\n",
+               "kernel", "image", "bytes", "input", "runs", "throughput", "cost");
+    }
+
+    // Synthetic images: random data, like compiled code it has no long runs
+    for (Size = MinSize; MaxSize != 0 && Size <= MaxSize; Size *= 4)
+    {
+        Image.Data   = (BINARY *)BenchAlloc(Size);
+        Image.Length = Size;
+        for (Pos = 0; Pos < Size; Pos++)
+        {
+            Random ^= Random << 13;
+            Random ^= Random >> 17;
+            Random ^= Random << 5;
+            Random &= 0xFFFFFFFFUL;
+            Image.Data[Pos] = (BINARY)(Random >> 11);
+        }
+        sprintf(Name, "synthetic-%luk", Size / 1024);
+        Image.Name = Name;
+
+        RunImage(&Image, MinTime, Format);
+        free(Image.Data);
+    }
+
+    for (i = 1; Files != 0 && i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            LoadImage(&Image, argv[i]);
+            RunImage(&Image, MinTime, Format);
+            free(Image.Data);
+        }
+    }
+
+    return Sink == 0x5A5A5A5AUL;    // never true, but Sink has to be used
+}
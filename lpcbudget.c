@@ -0,0 +1,408 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcbudget.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Protocol round trip budget of NxpDownload:
+//
+//   lpcbudget [options]
+//
+// Flash time over a serial line is dominated by the number of turnarounds
+// the protocol needs, not by host CPU. For one part of each chip variant in
+// LPCtypes and several image shapes, NxpDownload runs against the emulated
+// bootloader of lpcemu.c, in-process through an ISP_TRANSPORT. The number of
+// ISP commands, round trips (the host waiting for an answer after sending),
+// and bytes in both directions are compared with the budget file; more than
+// budgeted is a regression and makes lpcbudget fail.
+
+#include "lpc21isp.h"
+#include "lpcprog.h"
+#include "lpcemu.h"
+
+#define BUDGET_FILE     "lpcbudget.txt"
+#define BUDGET_METRICS  4
+
+/** In-process line between NxpDownload and the emulated target. */
+typedef struct
+{
+    EMU_PORT      *Target;
+    int            Sent;            /**< Host sent something since it last read. */
+    unsigned long  TxBytes;
+    unsigned long  RxBytes;
+    unsigned long  RoundTrips;
+} BUDGET_LINK;
+
+typedef struct
+{
+    char           Variant[8];
+    char           Image[16];
+    unsigned long  Value[BUDGET_METRICS];   /**< commands, round trips, tx, rx */
+} BUDGET_ENTRY;
+
+static const char *VariantName[] =
+{
+    "none", "43xx", "2xxx", "18xx", "17xx", "13xx", "11xx", "8xx"
+};
+
+static const char *ImageName[] =
+{
+    "1k", "half", "full", "sparse"
+};
+
+static const char *MetricName[BUDGET_METRICS] =
+{
+    "commands", "roundtrips", "tx_bytes", "rx_bytes"
+};
+
+static BUDGET_ENTRY Budget[64];
+static int          nBudget;
+
+/***************************** LinkSend *********************************/
+static void LinkSend(void *Context, const void *Data, size_t Length)
+{
+    BUDGET_LINK *Link = (BUDGET_LINK *)Context;
+
+    Link->TxBytes += Length;
+    Link->Sent = 1;
+    EmuHostWrite(Link->Target, Data, Length);
+}
+
+/***************************** LinkReceive ******************************/
+static unsigned long LinkReceive(void *Context, void *Data, unsigned long MaxLength)
+{
+    BUDGET_LINK *Link = (BUDGET_LINK *)Context;
+    unsigned long n;
+
+    n = EmuHostRead(Link->Target, Data, MaxLength);
+    if (n != 0 && Link->Sent)
+    {
+        Link->RoundTrips++;
+        Link->Sent = 0;
+    }
+    Link->RxBytes += n;
+    return n;
+}
+
+static const ISP_TRANSPORT LinkTransport =
+{
+    LinkSend,
+    LinkReceive
+};
+
+/***************************** ReadBudget *******************************/
+/**  Reads the budget file.
+\return 0 if successful, -1 if the file can't be read.
+*/
+static int ReadBudget(const char *FileName)
+{
+    char Line[256];
+    FILE *f;
+    BUDGET_ENTRY *e;
+
+    f = fopen(FileName, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(Line, sizeof(Line), f) != NULL && nBudget < (int)(sizeof(Budget) / sizeof(Budget[0])))
+    {
+        e = &Budget[nBudget];
+        if (Line[0] != '#' &&
+            sscanf(Line, "%7s %15s %lu %lu %lu %lu", e->Variant, e->Image,
+                   &e->Value[0], &e->Value[1], &e->Value[2], &e->Value[3]) == 6)
+        {
+            nBudget++;
+        }
+    }
+    fclose(f);
+
+    return 0;
+}
+
+/***************************** FindBudget *******************************/
+static BUDGET_ENTRY *FindBudget(const char *Variant, const char *Image)
+{
+    int i;
+
+    for (i = 0; i < nBudget; i++)
+    {
+        if (strcmp(Budget[i].Variant, Variant) == 0 && strcmp(Budget[i].Image, Image) == 0)
+        {
+            return &Budget[i];
+        }
+    }
+    return NULL;
+}
+
+/***************************** PickPart *********************************/
+/**  The part with the most flash of a chip variant, so all sector sizes
+of the variant are used.
+\return index in LPCtypes, 0 if the variant has no part with flash.
+*/
+static unsigned PickPart(CHIP_VARIANT Variant)
+{
+    unsigned i, Best = 0;
+
+    for (i = 1; i < LPCtypesCount; i++)
+    {
+        if (LPCtypes[i].ChipVariant == Variant && LPCtypes[i].FlashSectors != 0 &&
+            (Best == 0 || LPCtypes[i].FlashSize > LPCtypes[Best].FlashSize))
+        {
+            Best = i;
+        }
+    }
+    return Best;
+}
+
+/***************************** MakeImage ********************************/
+/**  Builds an image of the given shape for a part.
+\param [out] Length the length of the image.
+\return the image, with BINARY_PADDING bytes behind it.
+*/
+static BINARY *MakeImage(const LPC_DEVICE_TYPE *Part, int Shape, unsigned long *Length)
+{
+    unsigned long FlashBytes = 0, i, Random = 2463534242UL;
+    BINARY *Image;
+
+    for (i = 0; i < Part->FlashSectors; i++)
+    {
+        FlashBytes += Part->SectorTable[i];
+    }
+
+    switch (Shape)
+    {
+    case 0:  *Length = 1024;            break;
+    case 1:  *Length = FlashBytes / 2;  break;
+    default: *Length = FlashBytes;      break;
+    }
+
+    Image = (BINARY *)malloc(*Length + BINARY_PADDING);
+    if (Image == NULL)
+    {
+        DebugPrintf(1, "Out of memory\n");
+        exit(1);
+    }
+    memset(Image, 0xFF, *Length + BINARY_PADDING);
+
+    for (i = 0; i < *Length; i++)
+    {
+        // sparse: code at the start, some data at the end, erased in between
+        if (Shape == 3 && i >= 1024 && i < *Length - 1024)
+        {
+            continue;
+        }
+        Random ^= Random << 13;
+        Random ^= Random >> 17;
+        Random ^= Random << 5;
+        Random &= 0xFFFFFFFFUL;
+        Image[i] = (BINARY)(Random >> 11);
+    }
+
+    return Image;
+}
+
+/***************************** RunCase **********************************/
+/**  Downloads one image to one emulated part and counts the traffic.
+\param [out] Value commands, round trips, tx bytes and rx bytes.
+\return the result of NxpDownload.
+*/
+static int RunCase(unsigned PartIndex, int Shape, unsigned long Value[BUDGET_METRICS])
+{
+    const LPC_DEVICE_TYPE *Part = &LPCtypes[PartIndex];
+    ISP_ENVIRONMENT IspEnvironment;
+    BUDGET_LINK Link;
+    int Result;
+
+    if (EmuSelectPart(Part->Product) != 0)
+    {
+        exit(1);
+    }
+
+    memset(&Link, 0, sizeof(Link));
+    Link.Target = EmuCreate(0);
+
+    memset(&IspEnvironment, 0, sizeof(IspEnvironment));
+    IspEnvironment.micro            = NXP_ARM;
+    IspEnvironment.ProgramChip      = 1;
+    IspEnvironment.nQuestionMarks   = 100;
+    IspEnvironment.serial_port      = "emulator";
+    IspEnvironment.baud_rate        = "115200";
+    strcpy(IspEnvironment.StringOscillator, "12000");
+    IspEnvironment.Transport        = &LinkTransport;
+    IspEnvironment.TransportContext = &Link;
+    IspEnvironment.BinaryContent    = MakeImage(Part, Shape, &IspEnvironment.BinaryLength);
+    if (Part->ChipVariant == CHIP_VARIANT_LPC18XX || Part->ChipVariant == CHIP_VARIANT_LPC43XX)
+    {
+        IspEnvironment.BinaryOffset = 0x1A000000UL;     // flash bank A
+    }
+
+    Result = NxpDownload(&IspEnvironment);
+
+    Value[0] = Link.Target->Commands;
+    Value[1] = Link.RoundTrips;
+    Value[2] = Link.TxBytes;
+    Value[3] = Link.RxBytes;
+
+    free(IspEnvironment.BinaryContent);
+    EmuDestroy(Link.Target);
+
+    return Result;
+}
+
+/***************************** main *************************************/
+int main(int argc, char *argv[])
+{
+    const char *BudgetFile = BUDGET_FILE;
+    unsigned long Value[BUDGET_METRICS];
+    BUDGET_ENTRY *Entry;
+    FILE *Update = NULL;
+    int Variant, Shape, i, Result;
+    int UpdateBudget = 0, Verbose = 0, Regressions = 0, Improvements = 0;
+    unsigned PartIndex;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (stricmp(argv[i], "-update") == 0)
+        {
+            UpdateBudget = 1;
+        }
+        else if (strnicmp(argv[i], "-budget", 7) == 0)
+        {
+            BudgetFile = &argv[i][7];
+        }
+        else if (stricmp(argv[i], "-v") == 0)
+        {
+            Verbose = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Protocol round trip budget of lpc21isp\n"
+                            "Syntax:  lpcbudget [Options]\n\n"
+                            "Options: -budget<file> budget to check against (default " BUDGET_FILE ")\n"
+                            "         -update       write the measured values as the new budget\n"
+                            "         -v            show all measurements\n");
+            exit(1);
+        }
+    }
+
+    debug_level = Verbose ? 1 : 0;
+
+    if (UpdateBudget)
+    {
+        Update = fopen(BudgetFile, "w");
+        if (Update == NULL)
+        {
+            fprintf(stderr, "Can't create %s\n", BudgetFile);
+            exit(1);
+        }
+        fprintf(Update, "# ISP protocol cost of NxpDownload against the emulated bootloader.\n"
+                        "# Checked by \"make budget\", regenerate with \"./lpcbudget -update\"\n"
+                        "# when a change is meant to alter the protocol.\n"
+                        "#\n"
+                        "# variant image     commands roundtrips   tx_bytes   rx_bytes\n");
+    }
+    else if (ReadBudget(BudgetFile) != 0)
+    {
+        fprintf(stderr, "Can't read %s\n", BudgetFile);
+        exit(1);
+    }
+
+    for (Variant = CHIP_VARIANT_LPC43XX; Variant <= CHIP_VARIANT_LPC8XX; Variant++)
+    {
+        PartIndex = PickPart((CHIP_VARIANT)Variant);
+        if (PartIndex == 0)
+        {
+            continue;
+        }
+
+        for (Shape = 0; Shape < (int)(sizeof(ImageName) / sizeof(ImageName[0])); Shape++)
+        {
+            Result = RunCase(PartIndex, Shape, Value);
+            if (Result != 0)
+            {
+                printf("%-5s %-7s LPC%s: download failed (%d)\n",
+                       VariantName[Variant], ImageName[Shape], LPCtypes[PartIndex].Product, Result);
+                Regressions++;
+                continue;
+            }
+
+            if (Update != NULL)
+            {
+                fprintf(Update, "%-9s %-7s %10lu %10lu %10lu %10lu\n", VariantName[Variant], ImageName[Shape],
+                        Value[0], Value[1], Value[2], Value[3]);
+                continue;
+            }
+
+            Entry = FindBudget(VariantName[Variant], ImageName[Shape]);
+            if (Entry == NULL)
+            {
+                printf("%-5s %-7s no budget\n", VariantName[Variant], ImageName[Shape]);
+                Regressions++;
+                continue;
+            }
+
+            if (Verbose)
+            {
+                printf("%-5s %-7s LPC%-16s %6lu commands %6lu round trips %8lu bytes tx %8lu bytes rx\n",
+                       VariantName[Variant], ImageName[Shape], LPCtypes[PartIndex].Product,
+                       Value[0], Value[1], Value[2], Value[3]);
+            }
+
+            for (i = 0; i < BUDGET_METRICS; i++)
+            {
+                if (Value[i] > Entry->Value[i])
+                {
+                    printf("%-5s %-7s %s %lu, budget %lu: REGRESSION\n",
+                           VariantName[Variant], ImageName[Shape], MetricName[i], Value[i], Entry->Value[i]);
+                    Regressions++;
+                }
+                else if (Value[i] < Entry->Value[i])
+                {
+                    printf("%-5s %-7s %s %lu, budget %lu: better, update the budget\n",
+                           VariantName[Variant], ImageName[Shape], MetricName[i], Value[i], Entry->Value[i]);
+                    Improvements++;
+                }
+            }
+        }
+    }
+
+    if (Update != NULL)
+    {
+        fclose(Update);
+        printf("Budget written to %s\n", BudgetFile);
+        return Regressions != 0;
+    }
+
+    printf("%s: %d regressions, %d improvements\n",
+           Regressions == 0 ? "PASS" : "FAIL", Regressions, Improvements);
+
+    return Regressions != 0;
+}
@@ -0,0 +1,1382 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcdaemon.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+// Programming daemon, see lpcdaemon.h. Everything runs in the epoll loop
+// of lpcevent.c: the listening socket and the clients are watched there,
+// and every port has a session that is started again for each job.
+
+#include "lpc21isp.h"
+
+#ifdef GANG_SUPPORT
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "lpcprog.h"
+#include "lpcevent.h"
+#include "lpctrace.h"
+#include "lpcsession.h"
+#include "lpcstats.h"
+#include "lpcdaemon.h"
+
+#define DAEMON_MAX_LINE     1024    /**< Longest job line.                      */
+#define DAEMON_MAX_IMAGES   16      /**< Images kept parsed in memory.          */
+
+typedef struct daemon_client DAEMON_CLIENT;
+
+/** A parsed image in the cache. */
+typedef struct
+{
+    char          *FileName;
+    int            Hex;
+    time_t         ModTime;         /**< Of the file when it was parsed.        */
+    off_t          Size;
+    ISP_IMAGE     *Image;
+    int            Jobs;            /**< Running jobs using it.                 */
+    int            Stale;           /**< The file has changed since, free it    */
+                                    /*   when the last job is done.             */
+    unsigned long  LastUsed;
+} DAEMON_IMAGE;
+
+/** A job of the manifest (-manifest). */
+typedef struct
+{
+    char          *Line;            /**< file part [options]                    */
+    int            LineNr;
+    unsigned long  PartId;          /**< Expected part ID, 0 for any part.      */
+    DAEMON_IMAGE  *Image;
+    int            State;           /**< MANIFEST_PENDING ...                   */
+    int            Attempts;        /**< Failed runs so far.                    */
+    char          *Tried;           /**< Per port: MANIFEST_FAILED if it failed */
+                                    /*   there, MANIFEST_OTHER_PART if the     */
+                                    /*   board there is another part.          */
+    int            Result;
+    int            TimedOut;
+    int            Port;            /**< Of the last run, -1 if never run.      */
+    double         Seconds;         /**< Of the last run.                       */
+} MANIFEST_JOB;
+
+#define MANIFEST_PENDING    0
+#define MANIFEST_RUNNING    1
+#define MANIFEST_DONE       2
+#define MANIFEST_GAVE_UP    3
+
+#define MANIFEST_FAILED     1
+#define MANIFEST_OTHER_PART 2
+
+/** One port of the port list, open all the time. */
+typedef struct
+{
+    ISP_ENVIRONMENT  Port;          /**< Command line settings, port is open.   */
+    GANG_SESSION    *Session;
+    DAEMON_IMAGE    *Image;         /**< Image of the running job, NULL if idle.*/
+    DAEMON_CLIENT   *Client;        /**< Sender of the running job, NULL if it  */
+                                    /*   has gone away.                         */
+    char             Job[DAEMON_MAX_LINE]; /**< Options of the running job.     */
+    unsigned long long Start;       /**< Of the running job (us).               */
+    unsigned long long Deadline;    /**< Manifest: cancel the job then, 0 for   */
+                                    /*   no limit (us).                         */
+    MANIFEST_JOB    *ManifestJob;   /**< Manifest: the running job.             */
+    unsigned long    PartId;        /**< Manifest: part found on the port, 0 if */
+                                    /*   not known (yet).                       */
+    int              Probing;       /**< Manifest: reading the part ID.         */
+    int              Probed;        /**< Manifest: the part ID has been read.   */
+    int              CommandMode;   /**< Manifest: the last session left the    */
+                                    /*   bootloader in command mode.            */
+    int              Finished;      /**< Manifest: the board is programmed.     */
+    int              Ok;
+    int              Failed;
+} DAEMON_PORT;
+
+struct daemon_client
+{
+    GANG_WATCH       Watch;         /**< First member, see DaemonReceive.       */
+    int              Fd;
+    char             Line[DAEMON_MAX_LINE];
+    size_t           Length;
+    int              Overflow;      /**< Skipping the rest of a too long line.  */
+    DAEMON_CLIENT   *Next;
+};
+
+static DAEMON_PORT   *Ports;
+static int            nPorts;
+static DAEMON_IMAGE  *Images[DAEMON_MAX_IMAGES];
+static unsigned long  ImageClock;
+static DAEMON_CLIENT *Clients;
+static int            ListenFd = -1;
+static GANG_WATCH     ListenWatch;
+static volatile sig_atomic_t DaemonStop;
+
+/***************************** DaemonClock ******************************/
+/**  Monotonic time base of the job times.
+\return time in microseconds.
+*/
+static unsigned long long DaemonClock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+/***************************** DaemonJson *******************************/
+/**  Formats a string as JSON string literal.
+\param [out] Out buffer for the literal.
+\param [in] Size size of Out, the string is cut to fit.
+\return Out.
+*/
+static char *DaemonJson(char *Out, size_t Size, const char *s)
+{
+    size_t Pos = 0;
+
+    Out[Pos++] = '"';
+    for (; *s != '\0' && Pos + 8 < Size; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            Out[Pos++] = '\\';
+            Out[Pos++] = *s;
+        }
+        else if ((unsigned char)*s < 0x20)
+        {
+            Pos += sprintf(&Out[Pos], "\\u%04x", (unsigned char)*s);
+        }
+        else
+        {
+            Out[Pos++] = *s;
+        }
+    }
+    Out[Pos++] = '"';
+    Out[Pos]   = '\0';
+
+    return Out;
+}
+
+/***************************** DaemonSend *******************************/
+/**  Sends one answer line to a client. A client that doesn't read its
+answers loses them rather than stalling the other ports.
+*/
+static void DaemonSend(DAEMON_CLIENT *Client, const char *fmt, ...)
+{
+    char Line[DAEMON_MAX_LINE + 256];
+    va_list ap;
+    int Length;
+
+    if (Client == NULL)
+    {
+        return;
+    }
+
+    va_start(ap, fmt);
+    Length = vsnprintf(Line, sizeof(Line) - 1, fmt, ap);
+    va_end(ap);
+    if (Length < 0 || Length > (int)sizeof(Line) - 2)
+    {
+        Length = sizeof(Line) - 2;
+    }
+    Line[Length++] = '\n';
+
+    (void)send(Client->Fd, Line, Length, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/***************************** DaemonError ******************************/
+/**  Sends an error answer.
+*/
+static void DaemonError(DAEMON_CLIENT *Client, const char *Message, const char *Detail)
+{
+    char Text[DAEMON_MAX_LINE];
+    char Json[2 * DAEMON_MAX_LINE];
+
+    snprintf(Text, sizeof(Text), "%s%s%s", Message, Detail ? ": " : "", Detail ? Detail : "");
+    DaemonSend(Client, "{\"event\":\"error\",\"message\":%s}", DaemonJson(Json, sizeof(Json), Text));
+}
+
+/***************************** DaemonImageFree **************************/
+/**  Removes an image from the cache.
+*/
+static void DaemonImageFree(int i)
+{
+    ImageFree(Images[i]->Image);
+    free(Images[i]->FileName);
+    free(Images[i]);
+    Images[i] = NULL;
+}
+
+/***************************** DaemonImage ******************************/
+/**  Looks up an image in the cache, parses the file if it isn't there or
+has changed.
+\param [in] Hex nonzero for an Intel hex file, zero for a binary file.
+\param [out] Error error code if the image couldn't be loaded.
+\return the image, NULL on error.
+*/
+static DAEMON_IMAGE *DaemonImage(const char *FileName, int Hex, int *Error)
+{
+    struct stat st;
+    int i, Free = -1;
+    DAEMON_IMAGE *Entry;
+
+    if (stat(FileName, &st) != 0)
+    {
+        *Error = ERR_FILE_OPEN_HEX;
+        return NULL;
+    }
+
+    for (i = 0; i < DAEMON_MAX_IMAGES; i++)
+    {
+        Entry = Images[i];
+        if (Entry == NULL || Entry->Stale || Entry->Hex != Hex || strcmp(Entry->FileName, FileName) != 0)
+        {
+            continue;
+        }
+
+        if (Entry->ModTime == st.st_mtime && Entry->Size == st.st_size)
+        {
+            Entry->LastUsed = ++ImageClock;
+            return Entry;
+        }
+
+        DebugPrintf(2, "%s has changed, parsing it again\n", FileName);
+        Entry->Stale = 1;
+        if (Entry->Jobs == 0)
+        {
+            DaemonImageFree(i);
+        }
+    }
+
+    // Free slot, otherwise the least recently used image without jobs
+    for (i = 0; i < DAEMON_MAX_IMAGES; i++)
+    {
+        if (Images[i] == NULL)
+        {
+            Free = i;
+            break;
+        }
+        if (Images[i]->Jobs == 0 && (Free < 0 || Images[i]->LastUsed < Images[Free]->LastUsed))
+        {
+            Free = i;
+        }
+    }
+    if (Free < 0)
+    {
+        *Error = ERR_FILE_ALLOC_HEX;
+        return NULL;
+    }
+    if (Images[Free] != NULL)
+    {
+        DaemonImageFree(Free);
+    }
+
+    Entry = (DAEMON_IMAGE *)calloc(1, sizeof(DAEMON_IMAGE));
+    if (Entry == NULL || (Entry->FileName = strdup(FileName)) == NULL)
+    {
+        free(Entry);
+        *Error = ERR_FILE_ALLOC_HEX;
+        return NULL;
+    }
+
+    Entry->Image = ImageLoad(FileName, Hex, Error);
+    if (Entry->Image == NULL)
+    {
+        free(Entry->FileName);
+        free(Entry);
+        return NULL;
+    }
+
+    Entry->Hex      = Hex;
+    Entry->ModTime  = st.st_mtime;
+    Entry->Size     = st.st_size;
+    Entry->LastUsed = ++ImageClock;
+    Images[Free]    = Entry;
+
+    return Entry;
+}
+
+/***************************** DaemonProgress ***************************/
+/**  Progress callback of a job (after each sector).
+*/
+static void DaemonProgress(void *Context, const ISP_PROGRESS *Progress)
+{
+    DAEMON_PORT *Port = (DAEMON_PORT *)Context;
+    char PortName[512];
+
+    DaemonSend(Port->Client, "{\"event\":\"progress\",\"port\":%s,\"sector\":%d,"
+               "\"sectors\":%d,\"sectors_total\":%d,\"done\":%lu,\"total\":%lu}",
+               DaemonJson(PortName, sizeof(PortName), Port->Port.serial_port), Progress->Sector,
+               Progress->SectorsDone, Progress->SectorsTotal, Progress->BytesDone, Progress->BytesTotal);
+}
+
+/***************************** DaemonFindPort ***************************/
+/**  Finds a port by name or by its number in the port list.
+\return the port, NULL if there is no such port.
+*/
+static DAEMON_PORT *DaemonFindPort(const char *Name)
+{
+    char *End;
+    long Nr;
+    int i;
+
+    for (i = 0; i < nPorts; i++)
+    {
+        if (strcmp(Ports[i].Port.serial_port, Name) == 0)
+        {
+            return &Ports[i];
+        }
+    }
+
+    Nr = strtol(Name, &End, 10);
+    if (*Name != '\0' && *End == '\0' && Nr >= 0 && Nr < nPorts)
+    {
+        return &Ports[Nr];
+    }
+
+    return NULL;
+}
+
+/** Options a job may set, they only change its own download. The others
+(-capture, -replay, -gang, -daemon, -manifest, -metrics, -journal, the
+reset wiring ...) stay as the daemon was started, so does -debug: the
+debug level is shared by all ports. A trailing '*' takes a value, e.g.
+-try<n>. */
+static const char * const DaemonJobOptions[] =
+{
+    "-bin", "-hex", "-wipe", "-verify", "-detectonly", "-donotstart",
+    "-try*", "-syncprobe*", "-pace*", "-flowxonxoff", "-flownone", "-writedelay",
+    "-partid*", "-pinpart", "-pipeline", "-recover*", "-timeouts*"
+};
+
+/***************************** DaemonJobOption **************************/
+/**  \return 1 if a job may set the option, 0 else.
+*/
+static int DaemonJobOption(const char *Option)
+{
+    size_t Length;
+    unsigned i;
+
+    for (i = 0; i < sizeof(DaemonJobOptions) / sizeof(DaemonJobOptions[0]); i++)
+    {
+        Length = strlen(DaemonJobOptions[i]);
+        if (DaemonJobOptions[i][Length - 1] == '*'
+            ? strnicmp(Option, DaemonJobOptions[i], Length - 1) == 0
+            : stricmp(Option, DaemonJobOptions[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/***************************** DaemonOptions ****************************/
+/**  Applies the remaining words of the strtok() in progress as command
+line options to a job. The words have to stay valid while the job runs.
+\param [out] Error why the option was refused.
+\return NULL if ok, otherwise the refused option.
+*/
+static const char *DaemonOptions(ISP_ENVIRONMENT *Job, const char **Error)
+{
+    const char *Refused = NULL;
+    char *Option;
+
+    while (Refused == NULL && (Option = strtok(NULL, " \t")) != NULL)
+    {
+        if (!DaemonJobOption(Option))
+        {
+            Refused = Option;
+            *Error  = "option not allowed in a job";
+        }
+        else if (!ParseOption(Job, Option))
+        {
+            Refused = Option;
+            *Error  = "unknown option";
+        }
+    }
+
+    return Refused;
+}
+
+/***************************** DaemonProgram ****************************/
+/**  Starts a job: program <port> <file> [options].
+\param [in] Line the job line.
+*/
+static void DaemonProgram(DAEMON_CLIENT *Client, const char *Line)
+{
+    ISP_ENVIRONMENT Job;
+    DAEMON_PORT *Port;
+    DAEMON_IMAGE *Image;
+    char Copy[DAEMON_MAX_LINE];
+    char *Name, *FileName;
+    const char *Refused, *Reason;
+    char PortName[512], ImageName[2 * DAEMON_MAX_LINE];
+    int Error;
+
+    strcpy(Copy, Line);
+    strtok(Copy, " \t");
+    Name = strtok(NULL, " \t");
+    if (Name == NULL || strtok(NULL, " \t") == NULL)
+    {
+        DaemonError(Client, "usage: program <port> <file> [options]", NULL);
+        return;
+    }
+
+    Port = DaemonFindPort(Name);
+    if (Port == NULL)
+    {
+        DaemonError(Client, "unknown port", Name);
+        return;
+    }
+    if (Port->Image != NULL)
+    {
+        DaemonError(Client, "port busy", Name);
+        return;
+    }
+
+    // The options stay in use while the job runs (file names of -capture
+    // and the like are not copied), so they get tokenized in the port.
+    strcpy(Port->Job, Line);
+    strtok(Port->Job, " \t");
+    strtok(NULL, " \t");
+    FileName = strtok(NULL, " \t");
+
+    Job = Port->Port;
+    Refused = DaemonOptions(&Job, &Reason);
+    if (Refused != NULL)
+    {
+        DaemonError(Client, Reason, Refused);
+        return;
+    }
+
+    Image = DaemonImage(FileName, Job.FileFormat == FORMAT_HEX, &Error);
+    if (Image == NULL)
+    {
+        char Detail[DAEMON_MAX_LINE + 32];
+
+        snprintf(Detail, sizeof(Detail), "%s (error %d)", FileName, Error);
+        DaemonError(Client, "can't load image", Detail);
+        return;
+    }
+
+    ImageAttach(Image->Image, &Job);
+    Job.LowLatency      = 0;            // done once when the port was opened
+    Job.Progress        = DaemonProgress;
+    Job.ProgressContext = Port;
+
+    Image->Jobs++;
+    Port->Image  = Image;
+    Port->Client = Client;
+    Port->Start  = DaemonClock();
+
+    DaemonSend(Client, "{\"event\":\"start\",\"port\":%s,\"image\":%s}",
+               DaemonJson(PortName, sizeof(PortName), Port->Port.serial_port),
+               DaemonJson(ImageName, sizeof(ImageName), FileName));
+
+    if (GangStart(Port->Session, &Job, ProgramOpenTarget) != 0)
+    {
+        DaemonError(Client, "out of memory", NULL);
+        Image->Jobs--;
+        Port->Image = NULL;
+    }
+}
+
+/***************************** DaemonLoad *******************************/
+/**  Loads an image into the cache: load <file> [-bin|-hex].
+\param [in] Line the job line.
+*/
+static void DaemonLoad(DAEMON_CLIENT *Client, const char *Line, int Hex)
+{
+    DAEMON_IMAGE *Image;
+    char Copy[DAEMON_MAX_LINE];
+    char ImageName[2 * DAEMON_MAX_LINE];
+    char *FileName, *Option;
+    int Error;
+
+    strcpy(Copy, Line);
+    strtok(Copy, " \t");
+    FileName = strtok(NULL, " \t");
+    if (FileName == NULL)
+    {
+        DaemonError(Client, "usage: load <file> [-bin|-hex]", NULL);
+        return;
+    }
+
+    while ((Option = strtok(NULL, " \t")) != NULL)
+    {
+        if (stricmp(Option, "-bin") == 0)
+        {
+            Hex = 0;
+        }
+        else if (stricmp(Option, "-hex") == 0)
+        {
+            Hex = 1;
+        }
+        else
+        {
+            DaemonError(Client, "unknown option", Option);
+            return;
+        }
+    }
+
+    Image = DaemonImage(FileName, Hex, &Error);
+    if (Image == NULL)
+    {
+        char Detail[DAEMON_MAX_LINE + 32];
+
+        snprintf(Detail, sizeof(Detail), "%s (error %d)", FileName, Error);
+        DaemonError(Client, "can't load image", Detail);
+        return;
+    }
+
+    DaemonSend(Client, "{\"event\":\"loaded\",\"image\":%s,\"size\":%lu}",
+               DaemonJson(ImageName, sizeof(ImageName), FileName), ImageSize(Image->Image));
+}
+
+/***************************** DaemonClose *****************************/
+/**  Drops a client. Its running jobs go on, their answers are dropped.
+*/
+static void DaemonClose(DAEMON_CLIENT *Client)
+{
+    DAEMON_CLIENT **Link;
+    int i;
+
+    for (i = 0; i < nPorts; i++)
+    {
+        if (Ports[i].Client == Client)
+        {
+            Ports[i].Client = NULL;
+        }
+    }
+
+    for (Link = &Clients; *Link != Client; Link = &(*Link)->Next)
+        /* nothing */;
+    *Link = Client->Next;
+
+    GangUnwatch(Client->Fd);
+    close(Client->Fd);
+    free(Client);
+}
+
+/***************************** DaemonReceive ****************************/
+/**  Handler of a client socket: reads and executes job lines.
+*/
+static void DaemonReceive(GANG_WATCH *Watch, unsigned Events)
+{
+    DAEMON_CLIENT *Client = (DAEMON_CLIENT *)Watch;
+    char Buffer[DAEMON_MAX_LINE];
+    ssize_t n, i;
+
+    (void)Events;
+
+    n = read(Client->Fd, Buffer, sizeof(Buffer));
+    if (n <= 0)
+    {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            return;
+        }
+        DaemonClose(Client);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (Buffer[i] == '\r')
+        {
+            continue;
+        }
+
+        if (Buffer[i] != '\n')
+        {
+            if (Client->Length < sizeof(Client->Line) - 1)
+            {
+                Client->Line[Client->Length++] = Buffer[i];
+            }
+            else
+            {
+                Client->Overflow = 1;
+            }
+            continue;
+        }
+
+        Client->Line[Client->Length] = '\0';
+        Client->Length = 0;
+
+        if (Client->Overflow)
+        {
+            Client->Overflow = 0;
+            DaemonError(Client, "line too long", NULL);
+        }
+        else if (strncmp(Client->Line, "program", 7) == 0 && (Client->Line[7] == ' ' || Client->Line[7] == '\t'))
+        {
+            DaemonProgram(Client, Client->Line);
+        }
+        else if (strncmp(Client->Line, "load", 4) == 0 && (Client->Line[4] == ' ' || Client->Line[4] == '\t'))
+        {
+            DaemonLoad(Client, Client->Line, Ports[0].Port.FileFormat == FORMAT_HEX);
+        }
+        else if (Client->Line[0] != '\0')
+        {
+            DaemonError(Client, "unknown command", Client->Line);
+        }
+    }
+}
+
+/***************************** DaemonAccept *****************************/
+/**  Handler of the listening socket: adds a client.
+*/
+static void DaemonAccept(GANG_WATCH *Watch, unsigned Events)
+{
+    DAEMON_CLIENT *Client;
+    int Fd;
+
+    (void)Watch;
+    (void)Events;
+
+    Fd = accept(ListenFd, NULL, NULL);
+    if (Fd < 0)
+    {
+        return;
+    }
+    fcntl(Fd, F_SETFD, FD_CLOEXEC);
+
+    Client = (DAEMON_CLIENT *)calloc(1, sizeof(DAEMON_CLIENT));
+    if (Client == NULL)
+    {
+        close(Fd);
+        return;
+    }
+
+    Client->Watch.Handler = DaemonReceive;
+    Client->Fd            = Fd;
+    if (GangWatch(Fd, &Client->Watch) != 0)
+    {
+        close(Fd);
+        free(Client);
+        return;
+    }
+
+    Client->Next = Clients;
+    Clients      = Client;
+}
+
+/***************************** DaemonReap *******************************/
+/**  Reports the jobs that are done and makes their ports idle again.
+*/
+static void DaemonReap(void)
+{
+    ISP_ENVIRONMENT *Job;
+    DAEMON_PORT *Port;
+    const char *Part;
+    char PortName[512], PartName[64];
+    int Result, i;
+
+    for (i = 0; i < nPorts; i++)
+    {
+        Port = &Ports[i];
+        if (Port->Image == NULL || !GangDone(Port->Session, &Result))
+        {
+            continue;
+        }
+
+        Job  = GangEnvironment(Port->Session);
+        Part = (Job->micro == NXP_ARM && Job->DetectedDevice != 0) ? LPCtypes[Job->DetectedDevice].Product : NULL;
+
+        DaemonSend(Port->Client, "{\"event\":\"result\",\"port\":%s,\"result\":%d,\"part\":%s,\"ms\":%.3f}",
+                   DaemonJson(PortName, sizeof(PortName), Port->Port.serial_port), Result,
+                   Part != NULL ? DaemonJson(PartName, sizeof(PartName), Part) : "null",
+                   (DaemonClock() - Port->Start) / 1000.0);
+
+        DebugPrintf(2, "%s: %s\n", Port->Port.serial_port, Result == 0 ? "OK" : "failed");
+
+        // Back to the settings of the command line (the job may have
+        // changed the pacing), the port itself stays open.
+        tcsetattr(Port->Port.fdCom, TCSANOW, &Port->Port.newtio);
+
+        Port->Image->Jobs--;
+        if (Port->Image->Stale && Port->Image->Jobs == 0)
+        {
+            int j;
+
+            for (j = 0; j < DAEMON_MAX_IMAGES && Images[j] != Port->Image; j++)
+                /* nothing */;
+            DaemonImageFree(j);
+        }
+        Port->Image  = NULL;
+        Port->Client = NULL;
+    }
+}
+
+/***************************** DaemonSignal *****************************/
+/**  SIGINT / SIGTERM: stop taking jobs, finish the running ones.
+*/
+static void DaemonSignal(int Signal)
+{
+    (void)Signal;
+    DaemonStop = 1;
+}
+
+/***************************** DaemonBusy *******************************/
+/**  Counts the ports with a running job (or part ID probe).
+*/
+static int DaemonBusy(void)
+{
+    int i, Busy;
+
+    for (i = 0, Busy = 0; i < nPorts; i++)
+    {
+        Busy += Ports[i].Image != NULL || Ports[i].Probing;
+    }
+
+    return Busy;
+}
+
+/***************************** DaemonServe ******************************/
+/**  Serves the jobs sent to the socket until SIGINT or SIGTERM.
+\return 0.
+*/
+static int DaemonServe(const char *Socket)
+{
+    struct sockaddr_un Address;
+
+    memset(&Address, 0, sizeof(Address));
+    Address.sun_family = AF_UNIX;
+    if (strlen(Socket) >= sizeof(Address.sun_path))
+    {
+        DebugPrintf(1, "Socket name too long: %s\n", Socket);
+        exit(1);
+    }
+    strcpy(Address.sun_path, Socket);
+
+    ListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(Address.sun_path);
+    ListenWatch.Handler = DaemonAccept;
+    if (ListenFd < 0 ||
+        bind(ListenFd, (struct sockaddr *)&Address, sizeof(Address)) != 0 ||
+        listen(ListenFd, 8) != 0 ||
+        GangWatch(ListenFd, &ListenWatch) != 0)
+    {
+        DebugPrintf(1, "Can't listen on %s (%s)\n", Address.sun_path, strerror(errno));
+        exit(1);
+    }
+
+    DebugPrintf(2, "Serving %d port(s) on %s\n", nPorts, Address.sun_path);
+
+    do
+    {
+        if (DaemonStop && ListenFd >= 0)
+        {
+            DebugPrintf(2, "Stopping, waiting for the running jobs\n");
+            GangUnwatch(ListenFd);
+            close(ListenFd);
+            ListenFd = -1;
+        }
+
+        if (GangPoll(DaemonStop ? 100 : 1000) < 0)
+        {
+            break;
+        }
+        DaemonReap();
+        StatsTick();
+    } while (!DaemonStop || DaemonBusy() > 0);
+
+    while (Clients != NULL)
+    {
+        DaemonClose(Clients);
+    }
+    if (ListenFd >= 0)
+    {
+        close(ListenFd);
+        ListenFd = -1;
+    }
+    unlink(Address.sun_path);
+
+    return 0;
+}
+
+/***************************** ManifestLoad *****************************/
+/**  Reads the manifest: one job per line,
+
+    <file> <part ID or *> [options]
+
+plus the settings "@retries <n>" (further runs of a failing job, on other
+ports if possible, default 2) and "@timeout <seconds>" (per run, default
+none). Empty lines and lines starting with # are skipped. All images are
+parsed here, once.
+\param [out] nJobs number of jobs.
+\return the jobs, the program ends on errors.
+*/
+static MANIFEST_JOB *ManifestLoad(const ISP_ENVIRONMENT *IspEnvironment, int *nJobs,
+                                  int *Retries, unsigned long *Timeout)
+{
+    MANIFEST_JOB *Jobs = NULL;
+    ISP_ENVIRONMENT Job;
+    FILE *fp;
+    char Line[DAEMON_MAX_LINE];
+    char Copy[DAEMON_MAX_LINE];
+    char *FileName, *Part, *End;
+    const char *Refused, *Reason;
+    int LineNr = 0, Error;
+    size_t Length;
+
+    fp = fopen(IspEnvironment->ManifestFile, "r");
+    if (fp == NULL)
+    {
+        DebugPrintf(1, "Can't open manifest %s\n", IspEnvironment->ManifestFile);
+        exit(1);
+    }
+
+    *nJobs   = 0;
+    *Retries = 2;
+    *Timeout = 0;
+
+    while (fgets(Line, sizeof(Line), fp) != NULL)
+    {
+        LineNr++;
+        Length = strlen(Line);
+        while (Length > 0 && (Line[Length - 1] == '\n' || Line[Length - 1] == '\r'))
+        {
+            Line[--Length] = '\0';
+        }
+
+        strcpy(Copy, Line);
+        FileName = strtok(Copy, " \t");
+        if (FileName == NULL || FileName[0] == '#')
+        {
+            continue;
+        }
+
+        if (strcmp(FileName, "@retries") == 0 || strcmp(FileName, "@timeout") == 0)
+        {
+            Part = strtok(NULL, " \t");
+            if (Part == NULL || strtok(NULL, " \t") != NULL)
+            {
+                DebugPrintf(1, "%s:%d: %s needs one number\n", IspEnvironment->ManifestFile, LineNr, FileName);
+                exit(1);
+            }
+            if (FileName[1] == 'r')
+            {
+                *Retries = atoi(Part);
+            }
+            else
+            {
+                *Timeout = strtoul(Part, NULL, 10);
+            }
+            continue;
+        }
+
+        Jobs = (MANIFEST_JOB *)realloc(Jobs, (*nJobs + 1) * sizeof(MANIFEST_JOB));
+        if (Jobs == NULL)
+        {
+            DebugPrintf(1, "Out of memory\n");
+            exit(1);
+        }
+        memset(&Jobs[*nJobs], 0, sizeof(MANIFEST_JOB));
+        Jobs[*nJobs].LineNr = LineNr;
+        Jobs[*nJobs].Port   = -1;
+
+        Part = strtok(NULL, " \t");
+        if (Part == NULL)
+        {
+            DebugPrintf(1, "%s:%d: expected <file> <part ID or *> [options]\n", IspEnvironment->ManifestFile, LineNr);
+            exit(1);
+        }
+        if (strcmp(Part, "*") != 0)
+        {
+            Jobs[*nJobs].PartId = strtoul(Part, &End, 0);
+            if (*End != '\0' || Jobs[*nJobs].PartId == 0)
+            {
+                DebugPrintf(1, "%s:%d: bad part ID %s\n", IspEnvironment->ManifestFile, LineNr, Part);
+                exit(1);
+            }
+        }
+
+        Job = *IspEnvironment;
+        Refused = DaemonOptions(&Job, &Reason);
+        if (Refused != NULL)
+        {
+            DebugPrintf(1, "%s:%d: %s %s\n", IspEnvironment->ManifestFile, LineNr, Reason, Refused);
+            exit(1);
+        }
+
+        Jobs[*nJobs].Image = DaemonImage(FileName, Job.FileFormat == FORMAT_HEX, &Error);
+        if (Jobs[*nJobs].Image == NULL)
+        {
+            DebugPrintf(1, "%s:%d: can't load %s (error %d)\n", IspEnvironment->ManifestFile, LineNr, FileName, Error);
+            exit(1);
+        }
+        Jobs[*nJobs].Image->Jobs++;         // keep it for the whole run
+
+        Jobs[*nJobs].Line  = strdup(Line);
+        Jobs[*nJobs].Tried = (char *)calloc(nPorts, 1);
+        if (Jobs[*nJobs].Line == NULL || Jobs[*nJobs].Tried == NULL)
+        {
+            DebugPrintf(1, "Out of memory\n");
+            exit(1);
+        }
+
+        (*nJobs)++;
+    }
+
+    fclose(fp);
+
+    return Jobs;
+}
+
+/***************************** ManifestProbe ****************************/
+/**  Reads the part ID of the board on an idle port (-detectonly), so that
+it only gets the jobs for its part.
+*/
+static void ManifestProbe(DAEMON_PORT *Port)
+{
+    ISP_ENVIRONMENT Env;
+
+    Env = Port->Port;
+    Env.DetectOnly  = 1;
+    Env.CommandMode = Port->CommandMode;
+    Env.LowLatency  = 0;
+
+    Port->Probing = 1;
+    Port->Start   = DaemonClock();
+
+    DebugPrintf(2, "%s: reading the part ID\n", Port->Port.serial_port);
+
+    if (GangStart(Port->Session, &Env, ProgramOpenTarget) != 0)
+    {
+        DebugPrintf(1, "Out of memory\n");
+        exit(1);
+    }
+}
+
+/***************************** ManifestStart ****************************/
+/**  Runs a job on an idle port.
+*/
+static void ManifestStart(DAEMON_PORT *Port, MANIFEST_JOB *Job, unsigned long Timeout)
+{
+    ISP_ENVIRONMENT Env;
+    const char *Reason;
+
+    // Checked by ManifestLoad already
+    strcpy(Port->Job, Job->Line);
+    strtok(Port->Job, " \t");
+    strtok(NULL, " \t");
+    Env = Port->Port;
+    (void)DaemonOptions(&Env, &Reason);
+
+    ImageAttach(Job->Image->Image, &Env);
+    Env.ExpectedPartId = Job->PartId;
+    Env.KnownPartId    = Port->PartId;
+    Env.CommandMode    = Port->CommandMode;
+    Env.LowLatency     = 0;
+
+    Job->Image->Jobs++;
+    Job->State        = MANIFEST_RUNNING;
+    Job->TimedOut     = 0;
+    Job->Port         = Port - Ports;
+    Port->Image       = Job->Image;
+    Port->ManifestJob = Job;
+    Port->Start       = DaemonClock();
+    Port->Deadline    = Timeout != 0 ? Port->Start + Timeout * 1000000ULL : 0;
+
+    DebugPrintf(2, "%s: line %d, %s\n", Port->Port.serial_port, Job->LineNr, Job->Image->FileName);
+
+    if (GangStart(Port->Session, &Env, ProgramOpenTarget) != 0)
+    {
+        DebugPrintf(1, "Out of memory\n");
+        exit(1);
+    }
+}
+
+/***************************** ManifestFits *****************************/
+/**  Checks whether a port can take a job: its board isn't done yet and is
+(or may be) the part of the job.
+\return 1 if so, 0 else.
+*/
+static int ManifestFits(const MANIFEST_JOB *Job, int i)
+{
+    return !Ports[i].Finished && Job->Tried[i] != MANIFEST_OTHER_PART &&
+           (Job->PartId == 0 || Ports[i].PartId == 0 || Job->PartId == Ports[i].PartId);
+}
+
+/***************************** ManifestReap *****************************/
+/**  Books the jobs that are done and makes their ports idle again.
+*/
+static void ManifestReap(int Retries)
+{
+    ISP_ENVIRONMENT *Env;
+    MANIFEST_JOB *Job;
+    DAEMON_PORT *Port;
+    int Result, i;
+
+    for (i = 0; i < nPorts; i++)
+    {
+        Port = &Ports[i];
+        if (Port->Probing && GangDone(Port->Session, &Result))
+        {
+            Env = GangEnvironment(Port->Session);
+            if (Env->micro == NXP_ARM && Env->DetectedDevice != 0)
+            {
+                Port->PartId = LPCtypes[Env->DetectedDevice].id;
+            }
+            Port->CommandMode = Env->CommandMode;
+            tcsetattr(Port->Port.fdCom, TCSANOW, &Port->Port.newtio);
+
+            DebugPrintf(2, "%s: part ID 0x%08lX\n", Port->Port.serial_port, Port->PartId);
+            Port->Probing = 0;
+            Port->Probed  = 1;      // unknown stays 0: the jobs find it out
+            continue;
+        }
+        if (Port->Image == NULL)
+        {
+            continue;
+        }
+
+        if (Port->Deadline != 0 && DaemonClock() >= Port->Deadline && !GangDone(Port->Session, NULL))
+        {
+            DebugPrintf(1, "%s: line %d out of time\n", Port->Port.serial_port, Port->ManifestJob->LineNr);
+            Port->ManifestJob->TimedOut = 1;
+            GangCancel(Port->Session);
+        }
+
+        if (!GangDone(Port->Session, &Result))
+        {
+            continue;
+        }
+
+        Env = GangEnvironment(Port->Session);
+        if (Env->micro == NXP_ARM && Env->DetectedDevice != 0)
+        {
+            Port->PartId = LPCtypes[Env->DetectedDevice].id;
+        }
+        Port->CommandMode = Env->CommandMode;
+        tcsetattr(Port->Port.fdCom, TCSANOW, &Port->Port.newtio);
+
+        Job          = Port->ManifestJob;
+        Job->Result  = Result;
+        Job->Seconds = (DaemonClock() - Port->Start) / 1000000.0;
+
+        if (Result == 0)
+        {
+            Job->State     = MANIFEST_DONE;
+            Port->Finished = 1;     // one board per port
+            Port->Ok++;
+        }
+        else if (Result == WRONG_PART)
+        {
+            // Not the job's fault: try it where its part is
+            Job->State = MANIFEST_PENDING;
+            Job->Tried[i] = MANIFEST_OTHER_PART;
+        }
+        else
+        {
+            Port->Failed++;
+            Job->Tried[i] = MANIFEST_FAILED;
+            if (++Job->Attempts > Retries)
+            {
+                Job->State = MANIFEST_GAVE_UP;
+            }
+            else
+            {
+                Job->State = MANIFEST_PENDING;     // see ManifestAssign
+            }
+        }
+
+        DebugPrintf(2, "%s: line %d %s\n", Port->Port.serial_port, Job->LineNr,
+                    Result == 0 ? "OK" : Result == WRONG_PART ? "is for another part" : "failed");
+
+        Port->Image->Jobs--;
+        Port->Image       = NULL;
+        Port->ManifestJob = NULL;
+    }
+}
+
+/***************************** ManifestAssign ***************************/
+/**  Reads the part ID on the idle ports first, then gives pending jobs to
+the idle ports whose boards aren't done yet: the first job not tried there
+that fits the part found on the port. Jobs for
+a certain part go first, jobs for any part can still go anywhere later.
+\return number of jobs (and probes) started.
+*/
+static int ManifestAssign(MANIFEST_JOB *Jobs, int nJobs, unsigned long Timeout)
+{
+    DAEMON_PORT *Port;
+    int Started = 0, AnyPart, i, j;
+
+    // Failed jobs tried on all ports that can still take them: on any of
+    // them again, the same one too
+    for (j = 0; j < nJobs; j++)
+    {
+        if (Jobs[j].State != MANIFEST_PENDING)
+        {
+            continue;
+        }
+        for (i = 0; i < nPorts && !(ManifestFits(&Jobs[j], i) && Jobs[j].Tried[i] == 0); i++)
+            /* nothing */;
+        if (i == nPorts)
+        {
+            for (i = 0; i < nPorts; i++)
+            {
+                if (Jobs[j].Tried[i] == MANIFEST_FAILED)
+                {
+                    Jobs[j].Tried[i] = 0;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < nPorts; i++)
+    {
+        Port = &Ports[i];
+        if (Port->Image != NULL || Port->Probing || Port->Finished)
+        {
+            continue;
+        }
+        if (!Port->Probed)
+        {
+            ManifestProbe(Port);
+            Started++;
+            continue;
+        }
+
+        for (AnyPart = 0; AnyPart < 2 && Port->Image == NULL && !Port->Finished; AnyPart++)
+        {
+            for (j = 0; j < nJobs; j++)
+            {
+                if (Jobs[j].State == MANIFEST_PENDING && Jobs[j].Tried[i] == 0 &&
+                    (AnyPart ? Jobs[j].PartId == 0
+                             : Jobs[j].PartId != 0 && (Port->PartId == 0 || Jobs[j].PartId == Port->PartId)))
+                {
+                    ManifestStart(Port, &Jobs[j], Timeout);
+                    Started++;
+                    break;
+                }
+            }
+        }
+    }
+
+    return Started;
+}
+
+/***************************** ManifestRun ******************************/
+/**  Runs the jobs of the manifest on the port pool and reports the
+outcome.
+\return 0 if all jobs were programmed, otherwise the error code of the
+first failing job (1 if it was left unscheduled).
+*/
+static int ManifestRun(const ISP_ENVIRONMENT *IspEnvironment)
+{
+    MANIFEST_JOB *Jobs;
+    unsigned long long Start;
+    unsigned long Timeout;
+    unsigned long Bytes = 0;
+    double Seconds;
+    int nJobs, Retries, nDone = 0, Result = 0, i;
+
+    Jobs  = ManifestLoad(IspEnvironment, &nJobs, &Retries, &Timeout);
+    Start = DaemonClock();
+
+    DebugPrintf(2, "%d job(s) for %d port(s)\n", nJobs, nPorts);
+
+    for (;;)
+    {
+        ManifestReap(Retries);
+        if (!DaemonStop)
+        {
+            ManifestAssign(Jobs, nJobs, Timeout);
+        }
+        if (DaemonBusy() == 0)
+        {
+            break;
+        }
+
+        if (GangPoll(100) < 0)
+        {
+            exit(1);
+        }
+        StatsTick();
+    }
+
+    Seconds = (DaemonClock() - Start) / 1000000.0;
+
+    DebugPrintf(2, "\nManifest results:\n");
+    for (i = 0; i < nJobs; i++)
+    {
+        const char *PortName = Jobs[i].Port >= 0 ? Ports[Jobs[i].Port].Port.serial_port : "-";
+
+        if (Jobs[i].State == MANIFEST_DONE)
+        {
+            DebugPrintf(2, "  line %-4d %-24s OK, %s, %d failed run(s), %.1f s\n", Jobs[i].LineNr,
+                        Jobs[i].Image->FileName, PortName, Jobs[i].Attempts, Jobs[i].Seconds);
+            Bytes += ImageSize(Jobs[i].Image->Image);
+            nDone++;
+            continue;
+        }
+
+        if (Jobs[i].State == MANIFEST_PENDING)
+        {
+            DebugPrintf(1, "  line %-4d %-24s unscheduled, no port left with a fitting board, %d failed run(s)\n",
+                        Jobs[i].LineNr, Jobs[i].Image->FileName, Jobs[i].Attempts);
+            Jobs[i].Result = 1;
+        }
+        else if (Jobs[i].TimedOut)
+        {
+            DebugPrintf(1, "  line %-4d %-24s failed, out of time, %d run(s), last on %s\n", Jobs[i].LineNr,
+                        Jobs[i].Image->FileName, Jobs[i].Attempts, PortName);
+        }
+        else
+        {
+            DebugPrintf(1, "  line %-4d %-24s failed, error 0x%X, %d run(s), last on %s\n", Jobs[i].LineNr,
+                        Jobs[i].Image->FileName, Jobs[i].Result, Jobs[i].Attempts, PortName);
+        }
+
+        if (Result == 0)
+        {
+            Result = Jobs[i].Result;
+        }
+    }
+
+    DebugPrintf(2, "Ports:\n");
+    for (i = 0; i < nPorts; i++)
+    {
+        DebugPrintf(2, "  %-24s %d OK, %d failed\n", Ports[i].Port.serial_port, Ports[i].Ok, Ports[i].Failed);
+    }
+
+    DebugPrintf(2, "%d of %d job(s) programmed in %.1f s, %.2f boards/min, %.1f kB/s\n",
+                nDone, nJobs, Seconds, Seconds > 0 ? nDone * 60.0 / Seconds : 0.0,
+                Seconds > 0 ? Bytes / 1024.0 / Seconds : 0.0);
+
+    for (i = 0; i < nJobs; i++)
+    {
+        Jobs[i].Image->Jobs--;
+        free(Jobs[i].Line);
+        free(Jobs[i].Tried);
+    }
+    free(Jobs);
+
+    return Result;
+}
+
+/***************************** DaemonRun ********************************/
+/**  Opens all ports of the (comma separated) port list, then runs the jobs
+of the manifest (-manifest) or serves the jobs sent to the socket (-daemon)
+until SIGINT or SIGTERM.
+\return 0, with -manifest the outcome of the jobs (see ManifestRun).
+*/
+int DaemonRun(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct sigaction Action;
+    char *PortList;
+    char *Name;
+    int Result, i;
+
+    PortList = strdup(IspEnvironment->serial_port);
+    if (PortList == NULL)
+    {
+        DebugPrintf(1, "Can't set up the daemon (%s)\n", strerror(errno));
+        exit(1);
+    }
+
+    nPorts = 1;
+    for (i = 0; PortList[i] != '\0'; i++)
+    {
+        if (PortList[i] == ',')
+        {
+            nPorts++;
+        }
+    }
+
+    Ports = (DAEMON_PORT *)calloc(nPorts, sizeof(DAEMON_PORT));
+    if (Ports == NULL || GangInit() != 0)
+    {
+        DebugPrintf(1, "Can't set up the daemon (%s)\n", strerror(errno));
+        exit(1);
+    }
+
+    for (i = 0, Name = strtok(PortList, ","); Name != NULL && i < nPorts; Name = strtok(NULL, ","), i++)
+    {
+        DAEMON_PORT *Port = &Ports[i];
+
+        Port->Port             = *IspEnvironment;
+        Port->Port.serial_port = Name;
+        Port->Port.PortId      = i;
+
+        Result = OpenSerialPort(&Port->Port);
+        if (Result != 0)
+        {
+            exit(Result == ERR_OPEN_PORT ? 2 : 3);
+        }
+        TraceRecord(Port->Port.PortId, TRACE_PORT, Name, strlen(Name));
+
+        if (Port->Port.LowLatency)
+        {
+            LowLatencyEnable(&Port->Port);
+        }
+
+        Port->Session = GangCreate();
+        if (Port->Session == NULL)
+        {
+            DebugPrintf(1, "Can't set up session for %s (%s)\n", Name, strerror(errno));
+            exit(1);
+        }
+    }
+    nPorts = i;
+
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = DaemonSignal;       // no SA_RESTART: interrupt epoll_wait
+    sigaction(SIGINT, &Action, NULL);
+    sigaction(SIGTERM, &Action, NULL);
+
+    if (IspEnvironment->ManifestFile != NULL)
+    {
+        Result = ManifestRun(IspEnvironment);
+    }
+    else
+    {
+        Result = DaemonServe(IspEnvironment->DaemonSocket);
+    }
+
+    for (i = 0; i < nPorts; i++)
+    {
+        CloseSerialPort(&Ports[i].Port);
+        GangDestroy(Ports[i].Session);
+    }
+    for (i = 0; i < DAEMON_MAX_IMAGES; i++)
+    {
+        if (Images[i] != NULL)
+        {
+            DaemonImageFree(i);
+        }
+    }
+
+    GangExit();
+    free(Ports);
+    free(PortList);
+
+    return Result;
+}
+#endif // GANG_SUPPORT
@@ -0,0 +1,73 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcdaemon.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+/* Programming daemon (-daemon<socket>).
+ *
+ * Keeps the serial ports open and configured and the parsed images in
+ * memory, and programs the targets as jobs arrive on a unix stream
+ * socket. One job per line, answers are JSON lines:
+ *
+ *   program <port> <file> [options]  program the target on <port> (name
+ *                                    or number in the port list) with
+ *                                    <file>; -bin / -hex select the
+ *                                    format, the other options are those
+ *                                    of the command line that only change
+ *                                    this download (e.g. -verify, -pace,
+ *                                    see DaemonJobOptions)
+ *   load <file> [-bin|-hex]          parse <file> into the image cache
+ *
+ *   {"event":"start","port":...,"image":...}
+ *   {"event":"progress","port":...,"sector":<n>,"sectors":<n>,
+ *    "sectors_total":<n>,"done":<bytes>,"total":<bytes>}
+ *   {"event":"result","port":...,"result":<error code>,"part":...,"ms":...}
+ *   {"event":"loaded","image":...,"size":<bytes>}
+ *   {"event":"error","message":...}
+ *
+ * Images are identified by file name and parsed again when the file has
+ * changed. Jobs on different ports run at the same time (see lpcevent.c);
+ * a port that is busy refuses further jobs.
+ *
+ * Scheduler (-manifest<file>): the same port pool works through a fixed
+ * list of jobs (image, expected part ID, options; see ManifestLoad) and
+ * ends with a report. A job goes to the next idle port whose board fits
+ * its part ID, a failing job is retried on another port, each run can be
+ * given a time limit, and a port takes no further job once its board is
+ * programmed.
+ */
+
+#if defined GANG_SUPPORT
+
+int DaemonRun(ISP_ENVIRONMENT *IspEnvironment);
+
+#endif // GANG_SUPPORT
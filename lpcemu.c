@@ -0,0 +1,1322 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcemu.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Emulates the NXP ISP bootloader on pseudo terminals, so NxpDownload can
+// be run, timed and regression tested without target hardware:
+//
+//   lpcemu [options] <part>
+//
+// <part> is a product name from LPCtypes (e.g. 1114.../301, 812M101FDH16) or
+// a part id (e.g. 0x0444102B). The emulator prints the name of each pty on
+// stdout and serves them until it is terminated; then it prints statistics
+// on stderr. Flash and RAM are modelled after the sector table of the part.
+// Closing the pty acts like a power cycle of the target.
+//
+// Timing is simulated per byte: received bytes become visible to the
+// emulated bootloader at the configured line rate, answers leave it at the
+// line rate plus a fixed latency, and commands take a configurable time
+// (erase and copy proportional to the size of the sectors involved).
+
+#define _GNU_SOURCE
+#include "lpc21isp.h"
+#include "lpcprog.h"
+#include "lpcemu.h"
+
+#include <poll.h>
+#include <signal.h>
+
+#define EMU_MAX_PORTS       64
+
+/* ISP return codes */
+#define CMD_SUCCESS                                 0
+#define INVALID_COMMAND                             1
+#define SRC_ADDR_ERROR                              2
+#define DST_ADDR_ERROR                              3
+#define SRC_ADDR_NOT_MAPPED                         4
+#define DST_ADDR_NOT_MAPPED                         5
+#define COUNT_ERROR                                 6
+#define INVALID_SECTOR                              7
+#define SECTOR_NOT_BLANK                            8
+#define SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION     9
+#define COMPARE_ERROR                               10
+#define PARAM_ERROR                                 12
+#define ADDR_ERROR                                  13
+#define ADDR_NOT_MAPPED                             14
+#define CMD_LOCKED                                  15
+#define INVALID_CODE                                16
+
+static const LPC_DEVICE_TYPE *Part;
+static unsigned long  FlashBase;
+static unsigned long  FlashSize;
+static unsigned long  RamStart;
+static unsigned long  RamSize;
+static unsigned long  SectorStart[64];
+
+static unsigned long long ByteTime;     /**< ns per byte on the line, 0 = no limit. */
+static unsigned long long Latency;      /**< ns added to every byte sent.           */
+static unsigned long long CmdTime;      /**< ns to process a command.               */
+static unsigned long long EraseTime;    /**< ns per KiB erased.                     */
+static unsigned long long CopyTime;     /**< ns per KiB copied to flash.            */
+static unsigned long  RxErrorRate;      /**< A bit error every n received bytes.    */
+static unsigned long  TxErrorRate;      /**< A bit error every n sent bytes.        */
+static unsigned long  RandomState = 1;
+static const char    *Eol = "\r\n";
+
+static const char uuencode_table[64] =
+    "`!\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_";
+
+#if !defined LPCEMU_LIBRARY
+
+ISP_THREAD_LOCAL int debug_level = 2;
+
+static EMU_PORT      *Ports[EMU_MAX_PORTS];
+static int            nPorts = 1;
+static volatile sig_atomic_t Terminate;
+
+/***************************** DebugPrintf ******************************/
+/**  Prints a message to stderr if level is enabled.
+\param [in] level the debug level of the message.
+\param [in] fmt printf style format.
+*/
+void DebugPrintf(int level, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (level <= debug_level)
+    {
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+}
+
+#endif // !defined LPCEMU_LIBRARY
+
+/***************************** Now **************************************/
+/**  Monotonic clock.
+\return time in nanoseconds.
+*/
+static unsigned long long Now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/***************************** LineError ********************************/
+/**  Decides whether a byte gets damaged on the line.
+\param [in] Rate one error every Rate bytes on average, 0 for none.
+\return the bit mask to apply to the byte.
+*/
+static unsigned char LineError(unsigned long Rate)
+{
+    if (Rate == 0)
+    {
+        return 0;
+    }
+
+    // xorshift, reproducible with -seed
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+    RandomState &= 0xFFFFFFFFUL;
+
+    if (RandomState % Rate != 0)
+    {
+        return 0;
+    }
+    return (unsigned char)(1 << ((RandomState >> 16) & 7));
+}
+
+/***************************** QueueCount *******************************/
+static unsigned QueueCount(const EMU_QUEUE *Queue)
+{
+    return (Queue->Tail - Queue->Head) & (EMU_QUEUE_SIZE - 1);
+}
+
+/***************************** QueuePut *********************************/
+/**  Puts a byte on the simulated line.
+\param [in] Start earliest time the byte can go (ns).
+\param [in] Delay extra delay on top of the line time (ns).
+*/
+static void QueuePut(EMU_QUEUE *Queue, unsigned char c,
+                     unsigned long long Start, unsigned long long Delay)
+{
+    if (QueueCount(Queue) == EMU_QUEUE_SIZE - 1)
+    {
+        return;     // overrun, the byte is lost like on a real UART
+    }
+
+    if (Queue->Last < Start)
+    {
+        Queue->Last = Start;
+    }
+    Queue->Last += ByteTime;
+
+    Queue->Data[Queue->Tail] = c;
+    Queue->Due[Queue->Tail]  = Queue->Last + Delay;
+    Queue->Tail = (Queue->Tail + 1) & (EMU_QUEUE_SIZE - 1);
+}
+
+/***************************** Emit *************************************/
+/**  Sends an answer once the current command has been processed.
+*/
+static void Emit(EMU_PORT *Port, const void *Data, size_t Length)
+{
+    const unsigned char *p = (const unsigned char *)Data;
+    unsigned long long Start = Now();
+    unsigned char Error;
+
+    if (Start < Port->BusyUntil)
+    {
+        Start = Port->BusyUntil;
+    }
+
+    while (Length-- > 0)
+    {
+        Error = LineError(TxErrorRate);
+        if (Error != 0)
+        {
+            Port->TxErrors++;
+        }
+        QueuePut(Port->Out, *p++ ^ Error, Start, Latency);
+    }
+}
+
+/***************************** EmitLine *********************************/
+/**  Sends a line of text, terminated like the emulated bootloader does.
+*/
+static void EmitLine(EMU_PORT *Port, const char *fmt, ...)
+{
+    char Line[128];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsprintf(Line, fmt, ap);
+    va_end(ap);
+
+    strcat(Line, Eol);
+    Emit(Port, Line, strlen(Line));
+}
+
+/***************************** Memory ***********************************/
+/**  Maps a target address range to emulator memory.
+\return pointer to the memory, NULL if not (completely) mapped.
+*/
+static unsigned char *Memory(EMU_PORT *Port, unsigned long Address, unsigned long Length)
+{
+    if (Address >= FlashBase && Address - FlashBase + Length <= FlashSize)
+    {
+        return &Port->Flash[Address - FlashBase];
+    }
+    if (Address + Length <= FlashSize && Address + Length >= Address)
+    {
+        return &Port->Flash[Address];       // boot alias of the flash
+    }
+    if (Address >= RamStart && Address + Length <= RamStart + RamSize)
+    {
+        return &Port->Ram[Address - RamStart];
+    }
+    return NULL;
+}
+
+/***************************** SectorOf *********************************/
+static unsigned SectorOf(unsigned long Address)
+{
+    unsigned Sector = 0;
+
+    while (Sector + 1 < Part->FlashSectors && SectorStart[Sector + 1] <= Address)
+    {
+        Sector++;
+    }
+    return Sector;
+}
+
+/***************************** SectorRange ******************************/
+/**  Checks the sector arguments of P, E and I.
+\return CMD_SUCCESS or INVALID_SECTOR.
+*/
+static int SectorRange(int argc, char *argv[], unsigned *First, unsigned *Last)
+{
+    if (argc < 3)
+    {
+        return PARAM_ERROR;
+    }
+
+    *First = strtoul(argv[1], NULL, 10);
+    *Last  = strtoul(argv[2], NULL, 10);
+    if (*First > *Last || *Last >= Part->FlashSectors)
+    {
+        return INVALID_SECTOR;
+    }
+    return CMD_SUCCESS;
+}
+
+/***************************** ResetPort ********************************/
+/**  Power cycle: back to autobaud, flash keeps its contents.
+*/
+static void ResetPort(EMU_PORT *Port)
+{
+    Port->State      = EMU_AUTOBAUD;
+    Port->Echo       = 1;
+    Port->Unlocked   = 0;
+    Port->LineLength = 0;
+    Port->In->Head   = Port->In->Tail = 0;
+    Port->Out->Head  = Port->Out->Tail = 0;
+    memset(Port->Ram, 0, RamSize);
+    memset(Port->Prepared, 0, Part->FlashSectors);
+}
+
+/***************************** SendReadGroup ****************************/
+/**  R: sends the next group of up to 20 uuencoded lines and its checksum.
+*/
+static void SendReadGroup(EMU_PORT *Port)
+{
+    unsigned char *Data = Memory(Port, Port->DataAddress, Port->DataLeft);
+    char Line[70];
+    unsigned long Sum = 0;
+    unsigned Lines, n, i, Pos;
+    unsigned long k;
+
+    Port->GroupAddress = Port->DataAddress;
+    Port->GroupLeft    = Port->DataLeft;
+
+    for (Lines = 0; Lines < 20 && Port->DataLeft > 0; Lines++)
+    {
+        n = Port->DataLeft > 45 ? 45 : Port->DataLeft;
+        Pos = 0;
+        Line[Pos++] = uuencode_table[n];
+        for (i = 0; i < n; i += 3)
+        {
+            k = (unsigned long)Data[i] << 16;
+            if (i + 1 < n) k |= (unsigned long)Data[i + 1] << 8;
+            if (i + 2 < n) k |= Data[i + 2];
+            Sum += Data[i] + (i + 1 < n ? Data[i + 1] : 0) + (i + 2 < n ? Data[i + 2] : 0);
+            Line[Pos++] = uuencode_table[(k >> 18) & 63];
+            Line[Pos++] = uuencode_table[(k >> 12) & 63];
+            Line[Pos++] = uuencode_table[(k >>  6) & 63];
+            Line[Pos++] = uuencode_table[ k        & 63];
+        }
+        Line[Pos] = '\0';
+        EmitLine(Port, "%s", Line);
+
+        Data             += n;
+        Port->DataAddress += n;
+        Port->DataLeft    -= n;
+    }
+
+    EmitLine(Port, "%lu", Sum);
+    Port->State = EMU_READ_UU;
+}
+
+/***************************** Command **********************************/
+/**  Executes one ISP command line.
+*/
+static void Command(EMU_PORT *Port, char *Line)
+{
+    char *argv[8];
+    int argc = 0;
+    unsigned long a1 = 0, a2 = 0, a3 = 0;
+    unsigned First, Last, i;
+    unsigned char *p1, *p2;
+    unsigned long Offset;
+    unsigned long long Busy = CmdTime;
+    int Result = CMD_SUCCESS;
+
+    for (argv[argc] = strtok(Line, " "); argv[argc] != NULL && argc < 7; argv[argc] = strtok(NULL, " "))
+    {
+        argc++;
+    }
+    if (argc == 0)
+    {
+        return;
+    }
+
+    Port->Commands++;
+    DebugPrintf(3, "%s: %s", Port->SlaveName, argv[0]);
+    for (i = 1; i < (unsigned)argc; i++)
+    {
+        DebugPrintf(3, " %s", argv[i]);
+    }
+    DebugPrintf(3, "\n");
+
+    if (argc > 1) a1 = strtoul(argv[1], NULL, 10);
+    if (argc > 2) a2 = strtoul(argv[2], NULL, 10);
+    if (argc > 3) a3 = strtoul(argv[3], NULL, 10);
+
+    Port->BusyUntil = Now() + Busy;
+
+    switch (argv[0][1] == '\0' ? argv[0][0] : '\0')
+    {
+    case 'U':   // Unlock
+        if (argc < 2)
+        {
+            Result = PARAM_ERROR;
+        }
+        else if (a1 != 23130)
+        {
+            Result = INVALID_CODE;
+        }
+        else
+        {
+            Port->Unlocked = 1;
+        }
+        break;
+
+    case 'B':   // Set baud rate, nothing to do on a pty
+        break;
+
+    case 'A':   // Echo
+        if (argc < 2 || a1 > 1)
+        {
+            Result = PARAM_ERROR;
+        }
+        else
+        {
+            Port->Echo = (int)a1;
+        }
+        break;
+
+    case 'W':   // Write to RAM
+        if (argc < 3)
+        {
+            Result = PARAM_ERROR;
+        }
+        else if (a1 % 4 != 0)
+        {
+            Result = ADDR_ERROR;
+        }
+        else if (a2 % 4 != 0)
+        {
+            Result = COUNT_ERROR;
+        }
+        else if (a1 < RamStart || Memory(Port, a1, a2) == NULL)
+        {
+            Result = ADDR_NOT_MAPPED;
+        }
+        else
+        {
+            EmitLine(Port, "%d", CMD_SUCCESS);
+            Port->DataAddress  = Port->GroupAddress = a1;
+            Port->DataLeft     = Port->GroupLeft    = a2;
+            Port->GroupLines   = 0;
+            Port->GroupSum     = 0;
+            Port->State = (Part->ChipVariant == CHIP_VARIANT_LPC8XX) ? EMU_WRITE_BIN : EMU_WRITE_UU;
+            if (a2 == 0)
+            {
+                Port->State = EMU_COMMAND;
+            }
+            return;
+        }
+        break;
+
+    case 'R':   // Read memory
+        if (argc < 3)
+        {
+            Result = PARAM_ERROR;
+        }
+        else if (a1 % 4 != 0)
+        {
+            Result = ADDR_ERROR;
+        }
+        else if (a2 % 4 != 0)
+        {
+            Result = COUNT_ERROR;
+        }
+        else if (Memory(Port, a1, a2) == NULL)
+        {
+            Result = ADDR_NOT_MAPPED;
+        }
+        else
+        {
+            EmitLine(Port, "%d", CMD_SUCCESS);
+            if (Part->ChipVariant == CHIP_VARIANT_LPC8XX)
+            {
+                Emit(Port, Memory(Port, a1, a2), a2);
+            }
+            else if (a2 != 0)
+            {
+                Port->DataAddress = a1;
+                Port->DataLeft    = a2;
+                SendReadGroup(Port);
+            }
+            return;
+        }
+        break;
+
+    case 'P':   // Prepare sectors for write
+        Result = SectorRange(argc, argv, &First, &Last);
+        if (Result == CMD_SUCCESS)
+        {
+            memset(&Port->Prepared[First], 1, Last - First + 1);
+        }
+        break;
+
+    case 'C':   // Copy RAM to flash
+        if (a1 >= FlashBase)
+        {
+            a1 -= FlashBase;    // from here on an offset into the flash
+        }
+        if (argc < 4)
+        {
+            Result = PARAM_ERROR;
+        }
+        else if (!Port->Unlocked)
+        {
+            Result = CMD_LOCKED;
+        }
+        else if (a1 % 64 != 0 || (Part->ChipVariant != CHIP_VARIANT_LPC8XX && a1 % 256 != 0))
+        {
+            Result = DST_ADDR_ERROR;
+        }
+        else if (a1 + a3 > FlashSize)
+        {
+            Result = DST_ADDR_NOT_MAPPED;
+        }
+        else if (a2 % 4 != 0)
+        {
+            Result = SRC_ADDR_ERROR;
+        }
+        else if (a2 < RamStart || Memory(Port, a2, a3) == NULL)
+        {
+            Result = SRC_ADDR_NOT_MAPPED;
+        }
+        else if (a3 < 64 || (a3 & (a3 - 1)) != 0 || a3 > Part->MaxCopySize)
+        {
+            Result = COUNT_ERROR;
+        }
+        else
+        {
+            First = SectorOf(a1);
+            Last  = SectorOf(a1 + a3 - 1);
+            for (i = First; i <= Last; i++)
+            {
+                if (!Port->Prepared[i])
+                {
+                    Result = SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION;
+                }
+            }
+            if (Result == CMD_SUCCESS)
+            {
+                p1 = &Port->Flash[a1];
+                p2 = Memory(Port, a2, a3);
+                for (Offset = 0; Offset < a3; Offset++)
+                {
+                    p1[Offset] &= p2[Offset];   // flash bits can only be cleared
+                }
+                memset(&Port->Prepared[First], 0, Last - First + 1);
+                Port->BusyUntil += CopyTime * a3 / 1024;
+            }
+        }
+        break;
+
+    case 'E':   // Erase sectors
+        Result = SectorRange(argc, argv, &First, &Last);
+        if (Result == CMD_SUCCESS && !Port->Unlocked)
+        {
+            Result = CMD_LOCKED;
+        }
+        for (i = First; Result == CMD_SUCCESS && i <= Last; i++)
+        {
+            if (!Port->Prepared[i])
+            {
+                Result = SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION;
+            }
+        }
+        if (Result == CMD_SUCCESS)
+        {
+            for (i = First; i <= Last; i++)
+            {
+                memset(&Port->Flash[SectorStart[i]], 0xFF, Part->SectorTable[i]);
+                Port->BusyUntil += EraseTime * Part->SectorTable[i] / 1024;
+            }
+            memset(&Port->Prepared[First], 0, Last - First + 1);
+        }
+        break;
+
+    case 'I':   // Blank check sectors
+        Result = SectorRange(argc, argv, &First, &Last);
+        if (Result == CMD_SUCCESS)
+        {
+            for (Offset = SectorStart[First]; Offset < SectorStart[Last] + Part->SectorTable[Last]; Offset++)
+            {
+                if (Port->Flash[Offset] != 0xFF)
+                {
+                    EmitLine(Port, "%d", SECTOR_NOT_BLANK);
+                    EmitLine(Port, "%lu", Offset & ~3UL);
+                    EmitLine(Port, "%lu", (unsigned long)Port->Flash[Offset & ~3UL]
+                                        | (unsigned long)Port->Flash[(Offset & ~3UL) + 1] << 8
+                                        | (unsigned long)Port->Flash[(Offset & ~3UL) + 2] << 16
+                                        | (unsigned long)Port->Flash[(Offset & ~3UL) + 3] << 24);
+                    return;
+                }
+            }
+        }
+        break;
+
+    case 'M':   // Compare
+        if (argc < 4)
+        {
+            Result = PARAM_ERROR;
+        }
+        else if (a1 % 4 != 0)
+        {
+            Result = SRC_ADDR_ERROR;
+        }
+        else if (a2 % 4 != 0)
+        {
+            Result = DST_ADDR_ERROR;
+        }
+        else if ((p1 = Memory(Port, a1, a3)) == NULL)
+        {
+            Result = SRC_ADDR_NOT_MAPPED;
+        }
+        else if ((p2 = Memory(Port, a2, a3)) == NULL)
+        {
+            Result = DST_ADDR_NOT_MAPPED;
+        }
+        else if (a3 % 4 != 0)
+        {
+            Result = COUNT_ERROR;
+        }
+        else
+        {
+            for (Offset = 0; Offset < a3; Offset++)
+            {
+                if (p1[Offset] != p2[Offset])
+                {
+                    EmitLine(Port, "%d", COMPARE_ERROR);
+                    EmitLine(Port, "%lu", Offset);
+                    return;
+                }
+            }
+        }
+        break;
+
+    case 'G':   // Go
+        if (argc < 3 || (strcmp(argv[2], "T") != 0 && strcmp(argv[2], "A") != 0))
+        {
+            Result = PARAM_ERROR;
+        }
+        else if (!Port->Unlocked)
+        {
+            Result = CMD_LOCKED;
+        }
+        else
+        {
+            EmitLine(Port, "%d", CMD_SUCCESS);
+            Port->State = EMU_RUNNING;
+            return;
+        }
+        break;
+
+    case 'J':   // Read part id
+        EmitLine(Port, "%d", CMD_SUCCESS);
+        EmitLine(Port, "%lu", Part->id);
+        if (Part->EvalId2)
+        {
+            EmitLine(Port, "%lu", Part->id2);
+        }
+        return;
+
+    case 'K':   // Read boot code version
+        EmitLine(Port, "%d", CMD_SUCCESS);
+        EmitLine(Port, "%d", 7);    // minor
+        EmitLine(Port, "%d", 1);    // major
+        return;
+
+    case 'N':   // Read serial number
+        EmitLine(Port, "%d", CMD_SUCCESS);
+        EmitLine(Port, "%lu", 0x4C504300UL + Port->Number);
+        EmitLine(Port, "%lu", 0UL);
+        EmitLine(Port, "%lu", 0UL);
+        EmitLine(Port, "%lu", 0UL);
+        return;
+
+    case 'S':   // Set active boot bank (LPC18xx / LPC43xx)
+        if (Part->ChipVariant != CHIP_VARIANT_LPC18XX && Part->ChipVariant != CHIP_VARIANT_LPC43XX)
+        {
+            Result = INVALID_COMMAND;
+        }
+        else if (argc < 2 || a1 > 1)
+        {
+            Result = PARAM_ERROR;
+        }
+        break;
+
+    default:
+        Result = INVALID_COMMAND;
+        break;
+    }
+
+    EmitLine(Port, "%d", Result);
+}
+
+/***************************** WriteLine ********************************/
+/**  W: handles a uuencoded data line or the checksum after a group.
+*/
+static void WriteLine(EMU_PORT *Port, const char *Line)
+{
+    unsigned char *Data;
+    unsigned n, i, Pos;
+    unsigned long k;
+
+    if (Port->GroupLines == 20 || Port->DataLeft == 0)
+    {
+        // Checksum of the group
+        if (strtoul(Line, NULL, 10) == Port->GroupSum)
+        {
+            EmitLine(Port, "OK");
+            Port->GroupAddress = Port->DataAddress;
+            Port->GroupLeft    = Port->DataLeft;
+            if (Port->DataLeft == 0)
+            {
+                Port->State = EMU_COMMAND;
+            }
+        }
+        else
+        {
+            EmitLine(Port, "RESEND");
+            Port->Resends++;
+            Port->DataAddress = Port->GroupAddress;
+            Port->DataLeft    = Port->GroupLeft;
+        }
+        Port->GroupLines = 0;
+        Port->GroupSum   = 0;
+        return;
+    }
+
+    n = (Line[0] - ' ') & 63;
+    if (n > Port->DataLeft)
+    {
+        n = Port->DataLeft;
+    }
+    Data = Memory(Port, Port->DataAddress, n);
+
+    for (i = 0, Pos = 1; i < n; i += 3, Pos += 4)
+    {
+        k = 0;
+        if (Line[Pos] != '\0')
+        {
+            k = (unsigned long)((Line[Pos] - ' ') & 63) << 18
+              | (unsigned long)((Line[Pos + 1] - ' ') & 63) << 12
+              | (unsigned long)((Line[Pos + 2] - ' ') & 63) << 6
+              | (unsigned long)((Line[Pos + 3] - ' ') & 63);
+        }
+        Data[i] = (unsigned char)(k >> 16);
+        Port->GroupSum += Data[i];
+        if (i + 1 < n)
+        {
+            Data[i + 1] = (unsigned char)(k >> 8);
+            Port->GroupSum += Data[i + 1];
+        }
+        if (i + 2 < n)
+        {
+            Data[i + 2] = (unsigned char)k;
+            Port->GroupSum += Data[i + 2];
+        }
+    }
+
+    Port->DataAddress += n;
+    Port->DataLeft    -= n;
+    Port->GroupLines++;
+}
+
+/***************************** Feed *************************************/
+/**  Processes one received byte.
+*/
+static void Feed(EMU_PORT *Port, unsigned char c)
+{
+    switch (Port->State)
+    {
+    case EMU_RUNNING:
+        return;
+
+    case EMU_AUTOBAUD:
+        if (c == '?')
+        {
+            Port->BusyUntil = Now() + CmdTime;
+            EmitLine(Port, "Synchronized");
+            Port->State      = EMU_SYNC;
+            Port->LineLength = 0;
+        }
+        return;
+
+    case EMU_WRITE_BIN:
+        if (Port->Echo)
+        {
+            Emit(Port, &c, 1);
+        }
+        *Memory(Port, Port->DataAddress, 1) = c;
+        Port->DataAddress++;
+        if (--Port->DataLeft == 0)
+        {
+            Port->State = EMU_COMMAND;
+        }
+        return;
+
+    default:
+        break;
+    }
+
+    if (Port->Echo)
+    {
+        Emit(Port, &c, 1);
+    }
+
+    if (c != '\n')
+    {
+        if (c != '\r' && Port->LineLength < sizeof(Port->Line) - 1)
+        {
+            Port->Line[Port->LineLength++] = c;
+        }
+        return;
+    }
+
+    Port->Line[Port->LineLength] = '\0';
+    Port->LineLength = 0;
+
+    switch (Port->State)
+    {
+    case EMU_SYNC:
+        if (strcmp(Port->Line, "Synchronized") == 0)
+        {
+            EmitLine(Port, "OK");
+            Port->State = EMU_OSC;
+        }
+        else
+        {
+            Port->State = EMU_AUTOBAUD;
+        }
+        break;
+
+    case EMU_OSC:
+        EmitLine(Port, "OK");
+        Port->State = EMU_COMMAND;
+        break;
+
+    case EMU_COMMAND:
+        Command(Port, Port->Line);
+        break;
+
+    case EMU_WRITE_UU:
+        WriteLine(Port, Port->Line);
+        break;
+
+    case EMU_READ_UU:
+        if (strcmp(Port->Line, "RESEND") == 0)
+        {
+            Port->DataAddress = Port->GroupAddress;
+            Port->DataLeft    = Port->GroupLeft;
+            Port->Resends++;
+        }
+        if (Port->DataLeft != 0)
+        {
+            SendReadGroup(Port);
+        }
+        else
+        {
+            Port->State = EMU_COMMAND;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+#if !defined LPCEMU_LIBRARY
+
+/***************************** Service **********************************/
+/**  Moves data between the pty and the simulated lines.
+\return time of the next event of this port (ns), 0 if none.
+*/
+static unsigned long long Service(EMU_PORT *Port, short Events)
+{
+    unsigned char Buffer[4096];
+    unsigned long long t = Now();
+    unsigned long long Next = 0;
+    unsigned Free, n, i;
+    ssize_t got;
+    unsigned char Error;
+
+    if (Events & POLLHUP)
+    {
+        if (!Port->Closed)
+        {
+            DebugPrintf(3, "%s: closed, power cycle\n", Port->SlaveName);
+            Port->Closed = 1;
+        }
+        ResetPort(Port);
+        return 0;
+    }
+    Port->Closed = 0;
+
+    if (Events & POLLIN)
+    {
+        Free = EMU_QUEUE_SIZE - 1 - QueueCount(Port->In);
+        got = read(Port->Master, Buffer, Free < sizeof(Buffer) ? Free : sizeof(Buffer));
+        for (i = 0; got > 0 && i < (unsigned)got; i++)
+        {
+            Error = LineError(RxErrorRate);
+            if (Error != 0)
+            {
+                Port->RxErrors++;
+            }
+            QueuePut(Port->In, Buffer[i] ^ Error, t, 0);
+        }
+        if (got > 0)
+        {
+            Port->BytesIn += got;
+        }
+    }
+
+    // Received bytes the bootloader can see now
+    while (QueueCount(Port->In) != 0 && Port->In->Due[Port->In->Head] <= t && Port->BusyUntil <= t)
+    {
+        unsigned char c = Port->In->Data[Port->In->Head];
+
+        Port->In->Head = (Port->In->Head + 1) & (EMU_QUEUE_SIZE - 1);
+        Feed(Port, c);
+        t = Now();
+    }
+
+    // Answers that made it through the line
+    n = 0;
+    while (QueueCount(Port->Out) != 0 && Port->Out->Due[Port->Out->Head] <= t && n < sizeof(Buffer))
+    {
+        Buffer[n++] = Port->Out->Data[Port->Out->Head];
+        Port->Out->Head = (Port->Out->Head + 1) & (EMU_QUEUE_SIZE - 1);
+    }
+    if (n != 0)
+    {
+        got = write(Port->Master, Buffer, n);
+        if (got > 0)
+        {
+            Port->BytesOut += got;
+        }
+    }
+
+    if (QueueCount(Port->In) != 0)
+    {
+        Next = Port->In->Due[Port->In->Head];
+        if (Next < Port->BusyUntil)
+        {
+            Next = Port->BusyUntil;
+        }
+    }
+    if (QueueCount(Port->Out) != 0 && (Next == 0 || Port->Out->Due[Port->Out->Head] < Next))
+    {
+        Next = Port->Out->Due[Port->Out->Head];
+    }
+    return Next;
+}
+
+#endif // !defined LPCEMU_LIBRARY
+
+/***************************** EmuCreate ********************************/
+/**  Creates an emulated target of the selected part, with erased flash.
+\param [in] Number the number of the target, used in its serial number.
+\return the new target.
+*/
+EMU_PORT *EmuCreate(unsigned Number)
+{
+    EMU_PORT *Port;
+
+    Port = (EMU_PORT *)calloc(1, sizeof(EMU_PORT));
+    if (Port != NULL)
+    {
+        Port->In       = (EMU_QUEUE *)calloc(1, sizeof(EMU_QUEUE));
+        Port->Out      = (EMU_QUEUE *)calloc(1, sizeof(EMU_QUEUE));
+        Port->Flash    = (unsigned char *)malloc(FlashSize + 1);
+        Port->Ram      = (unsigned char *)malloc(RamSize);
+        Port->Prepared = (unsigned char *)malloc(Part->FlashSectors + 1);
+    }
+    if (Port == NULL || Port->In == NULL || Port->Out == NULL || Port->Flash == NULL || Port->Ram == NULL || Port->Prepared == NULL)
+    {
+        DebugPrintf(1, "Out of memory\n");
+        exit(1);
+    }
+    Port->Master = -1;
+    Port->Number = Number;
+    memset(Port->Flash, 0xFF, FlashSize);
+    ResetPort(Port);
+
+    return Port;
+}
+
+/***************************** EmuDestroy *******************************/
+void EmuDestroy(EMU_PORT *Port)
+{
+    free(Port->In);
+    free(Port->Out);
+    free(Port->Flash);
+    free(Port->Ram);
+    free(Port->Prepared);
+    free(Port);
+}
+
+/***************************** EmuHostWrite *****************************/
+/**  Hands bytes sent by an in-process host to the target. There is no
+line in between, the bytes are processed right away.
+*/
+void EmuHostWrite(EMU_PORT *Port, const void *Data, size_t Length)
+{
+    const unsigned char *p = (const unsigned char *)Data;
+    unsigned char Error;
+
+    Port->BytesIn += Length;
+    while (Length-- > 0)
+    {
+        Error = LineError(RxErrorRate);
+        if (Error != 0)
+        {
+            Port->RxErrors++;
+        }
+        Feed(Port, *p++ ^ Error);
+    }
+}
+
+/***************************** EmuHostRead ******************************/
+/**  Hands the answers of the target to an in-process host.
+\return the number of bytes copied to Data.
+*/
+unsigned long EmuHostRead(EMU_PORT *Port, void *Data, unsigned long MaxLength)
+{
+    unsigned char *p = (unsigned char *)Data;
+    unsigned long n = 0;
+
+    while (n < MaxLength && QueueCount(Port->Out) != 0)
+    {
+        p[n++] = Port->Out->Data[Port->Out->Head];
+        Port->Out->Head = (Port->Out->Head + 1) & (EMU_QUEUE_SIZE - 1);
+    }
+    Port->BytesOut += n;
+    return n;
+}
+
+#if !defined LPCEMU_LIBRARY
+
+/***************************** OpenPort *********************************/
+/**  Creates the pty of a port and the emulated target behind it.
+*/
+static EMU_PORT *OpenPort(unsigned Number)
+{
+    struct termios tio;
+    EMU_PORT *Port;
+    int Slave;
+
+    Port = EmuCreate(Number);
+
+    Port->Master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (Port->Master < 0 || grantpt(Port->Master) != 0 || unlockpt(Port->Master) != 0)
+    {
+        DebugPrintf(1, "Can't create pty (%s)\n", strerror(errno));
+        exit(1);
+    }
+    strncpy(Port->SlaveName, ptsname(Port->Master), sizeof(Port->SlaveName) - 1);
+    fcntl(Port->Master, F_SETFL, O_NONBLOCK);
+
+    // Raw mode, like a real serial line
+    Slave = open(Port->SlaveName, O_RDWR | O_NOCTTY);
+    if (Slave >= 0)
+    {
+        tcgetattr(Slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(Slave, TCSANOW, &tio);
+        close(Slave);
+    }
+
+    printf("%s\n", Port->SlaveName);
+    fflush(stdout);
+
+    return Port;
+}
+
+#endif // !defined LPCEMU_LIBRARY
+
+/***************************** EmuSelectPart ****************************/
+/**  Finds the part to emulate by product name or part id. Targets created
+afterwards emulate this part.
+\return 0 if successful, -1 if the part is unknown.
+*/
+int EmuSelectPart(const char *Name)
+{
+    unsigned long Id;
+    char *End;
+    unsigned i;
+
+    Id = strtoul(Name, &End, 0);
+    for (i = 1; i < LPCtypesCount; i++)
+    {
+        if (stricmp(LPCtypes[i].Product, Name) == 0 ||
+            (*End == '\0' && LPCtypes[i].id == Id))
+        {
+            break;
+        }
+    }
+    if (i == LPCtypesCount)
+    {
+        DebugPrintf(1, "Unknown part %s\n", Name);
+        return -1;
+    }
+    Part = &LPCtypes[i];
+
+    FlashSize = 0;
+    for (i = 0; i < Part->FlashSectors && i < sizeof(SectorStart) / sizeof(SectorStart[0]); i++)
+    {
+        SectorStart[i] = FlashSize;
+        FlashSize     += Part->SectorTable[i];
+    }
+
+    switch (Part->ChipVariant)
+    {
+    case CHIP_VARIANT_LPC43XX: RamStart = LPC_RAMSTART_LPC43XX; break;
+    case CHIP_VARIANT_LPC2XXX: RamStart = LPC_RAMSTART_LPC2XXX; break;
+    case CHIP_VARIANT_LPC18XX: RamStart = LPC_RAMSTART_LPC18XX; break;
+    case CHIP_VARIANT_LPC17XX: RamStart = LPC_RAMSTART_LPC17XX; break;
+    case CHIP_VARIANT_LPC13XX: RamStart = LPC_RAMSTART_LPC13XX; break;
+    case CHIP_VARIANT_LPC11XX: RamStart = LPC_RAMSTART_LPC11XX; break;
+    case CHIP_VARIANT_LPC8XX:  RamStart = LPC_RAMSTART_LPC8XX;  break;
+    default: break;
+    }
+    RamSize = Part->RAMSize * 1024;
+
+    // Flash bank A, the other parts have their flash at 0
+    FlashBase = 0;
+    if (Part->ChipVariant == CHIP_VARIANT_LPC18XX || Part->ChipVariant == CHIP_VARIANT_LPC43XX)
+    {
+        FlashBase = 0x1A000000UL;
+    }
+
+    return 0;
+}
+
+#if !defined LPCEMU_LIBRARY
+
+/***************************** OnSignal *********************************/
+static void OnSignal(int Signal)
+{
+    (void)Signal;
+    Terminate = 1;
+}
+
+/***************************** main *************************************/
+int main(int argc, char *argv[])
+{
+    struct pollfd fds[EMU_MAX_PORTS];
+    struct timespec Timeout;
+    unsigned long long Next, PortNext, t;
+    const char *PartName = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strnicmp(argv[i], "-ports", 6) == 0)
+        {
+            nPorts = atoi(&argv[i][6]);
+            if (nPorts < 1 || nPorts > EMU_MAX_PORTS)
+            {
+                DebugPrintf(1, "-ports must be 1..%d\n", EMU_MAX_PORTS);
+                exit(1);
+            }
+        }
+        else if (strnicmp(argv[i], "-baud", 5) == 0)
+        {
+            unsigned long Baud = strtoul(&argv[i][5], NULL, 10);
+            ByteTime = Baud ? 10 * 1000000000ULL / Baud : 0;    // 8N1
+        }
+        else if (strnicmp(argv[i], "-latency", 8) == 0)
+        {
+            Latency = strtoull(&argv[i][8], NULL, 10) * 1000;
+        }
+        else if (strnicmp(argv[i], "-cmdtime", 8) == 0)
+        {
+            CmdTime = strtoull(&argv[i][8], NULL, 10) * 1000;
+        }
+        else if (strnicmp(argv[i], "-erasetime", 10) == 0)
+        {
+            EraseTime = strtoull(&argv[i][10], NULL, 10) * 1000;
+        }
+        else if (strnicmp(argv[i], "-copytime", 9) == 0)
+        {
+            CopyTime = strtoull(&argv[i][9], NULL, 10) * 1000;
+        }
+        else if (strnicmp(argv[i], "-rxerrors", 9) == 0)
+        {
+            RxErrorRate = strtoul(&argv[i][9], NULL, 10);
+        }
+        else if (strnicmp(argv[i], "-txerrors", 9) == 0)
+        {
+            TxErrorRate = strtoul(&argv[i][9], NULL, 10);
+        }
+        else if (strnicmp(argv[i], "-seed", 5) == 0)
+        {
+            RandomState = strtoul(&argv[i][5], NULL, 10) | 1;
+        }
+        else if (stricmp(argv[i], "-eolcrlf") == 0)
+        {
+            Eol = "\r\n";
+        }
+        else if (stricmp(argv[i], "-eollf") == 0)
+        {
+            Eol = "\n";
+        }
+        else if (stricmp(argv[i], "-eolcr") == 0)
+        {
+            Eol = "\r";
+        }
+        else if (strnicmp(argv[i], "-debug", 6) == 0)
+        {
+            debug_level = isdigit(argv[i][6]) ? atoi(&argv[i][6]) : 3;
+        }
+        else if (argv[i][0] != '-' && PartName == NULL)
+        {
+            PartName = argv[i];
+        }
+        else
+        {
+            PartName = NULL;
+            break;
+        }
+    }
+
+    if (PartName == NULL)
+    {
+        DebugPrintf(1, "Emulator of the NXP LPC ISP bootloader on pseudo terminals\n"
+                       "Syntax:  lpcemu [Options] part\n\n"
+                       "Example: lpcemu -baud115200 -cmdtime200 0x0444102B\n\n"
+                       "part          product name (e.g. 1114.../301) or part id (e.g. 0x0444102B)\n"
+                       "Options: -ports<n>     number of emulated targets (default 1)\n"
+                       "         -baud<n>      line rate for timing, 0 = unlimited (default)\n"
+                       "         -latency<us>  extra delay of every answer (e.g. USB adapter)\n"
+                       "         -cmdtime<us>  time to process a command\n"
+                       "         -erasetime<us> erase time per KiB of sector size\n"
+                       "         -copytime<us> copy to flash time per KiB\n"
+                       "         -rxerrors<n>  one bit error every n received bytes on average\n"
+                       "         -txerrors<n>  one bit error every n sent bytes on average\n"
+                       "         -seed<n>      seed for the error injection\n"
+                       "         -eolcrlf      terminate answers with CR LF (default)\n"
+                       "         -eollf        terminate answers with LF\n"
+                       "         -eolcr        terminate answers with CR\n"
+                       "         -debug<n>     debug level, 3 shows all commands\n");
+        exit(1);
+    }
+
+    if (EmuSelectPart(PartName) != 0)
+    {
+        exit(1);
+    }
+    DebugPrintf(2, "Emulating LPC%s, %lu bytes flash in %u sectors, %lu bytes RAM at 0x%08lX\n",
+                Part->Product, FlashSize, Part->FlashSectors, RamSize, RamStart);
+
+    for (i = 0; i < nPorts; i++)
+    {
+        Ports[i] = OpenPort(i);
+        fds[i].fd = Ports[i]->Master;
+    }
+
+    signal(SIGINT,  OnSignal);
+    signal(SIGTERM, OnSignal);
+
+    Next = 0;
+    while (!Terminate)
+    {
+        int Hangup = 0;
+
+        for (i = 0; i < nPorts; i++)
+        {
+            fds[i].events  = Ports[i]->Closed ? 0 : POLLIN;
+            fds[i].revents = 0;
+            Hangup |= Ports[i]->Closed;
+        }
+
+        // A closed pty reports POLLHUP all the time, look again later
+        t = Now();
+        if (Hangup && (Next == 0 || Next > t + 20000000ULL))
+        {
+            Next = t + 20000000ULL;
+        }
+
+        if (Next == 0)
+        {
+            ppoll(fds, nPorts, NULL, NULL);
+        }
+        else
+        {
+            t = (Next > t) ? Next - t : 0;
+            Timeout.tv_sec  = t / 1000000000ULL;
+            Timeout.tv_nsec = t % 1000000000ULL;
+            ppoll(fds, nPorts, &Timeout, NULL);
+        }
+
+        Next = 0;
+        for (i = 0; i < nPorts; i++)
+        {
+            short Events = fds[i].revents;
+
+            if (Ports[i]->Closed)
+            {
+                // See whether somebody opened it in the meantime
+                struct pollfd Probe;
+
+                Probe.fd = Ports[i]->Master;
+                Probe.events = POLLIN;
+                poll(&Probe, 1, 0);
+                Events = Probe.revents;
+                if (Events & POLLHUP)
+                {
+                    continue;
+                }
+            }
+
+            PortNext = Service(Ports[i], Events);
+            if (PortNext != 0 && (Next == 0 || PortNext < Next))
+            {
+                Next = PortNext;
+            }
+        }
+    }
+
+    for (i = 0; i < nPorts; i++)
+    {
+        fprintf(stderr, "%s: %lu bytes received, %lu bytes sent, %lu commands, "
+                        "%lu resends, %lu/%lu bit errors injected (rx/tx)\n",
+                Ports[i]->SlaveName, Ports[i]->BytesIn, Ports[i]->BytesOut,
+                Ports[i]->Commands, Ports[i]->Resends, Ports[i]->RxErrors, Ports[i]->TxErrors);
+    }
+
+    return 0;
+}
+
+#endif // !defined LPCEMU_LIBRARY
@@ -0,0 +1,100 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcemu.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Emulated NXP ISP bootloader, see lpcemu.c. Built with LPCEMU_LIBRARY the
+ * emulator has no pty front end and can be driven by an in-process host
+ * through EmuHostWrite and EmuHostRead.
+ */
+
+#define EMU_QUEUE_SIZE      65536   /* power of 2 */
+
+typedef enum
+{
+    EMU_AUTOBAUD,       /**< Waiting for '?'.                                */
+    EMU_SYNC,           /**< Waiting for "Synchronized".                     */
+    EMU_OSC,            /**< Waiting for the oscillator frequency.           */
+    EMU_COMMAND,
+    EMU_WRITE_UU,       /**< W: receiving uuencoded lines and checksums.     */
+    EMU_WRITE_BIN,      /**< W: receiving binary data (LPC8xx).              */
+    EMU_READ_UU,        /**< R: waiting for OK / RESEND after a checksum.    */
+    EMU_RUNNING         /**< G: user code runs, ignore everything.           */
+} EMU_STATE;
+
+/** Bytes on their way through the simulated line. */
+typedef struct
+{
+    unsigned char      Data[EMU_QUEUE_SIZE];
+    unsigned long long Due[EMU_QUEUE_SIZE];     /**< Time the byte is through (ns). */
+    unsigned           Head;
+    unsigned           Tail;
+    unsigned long long Last;                    /**< Time the line gets free (ns).  */
+} EMU_QUEUE;
+
+typedef struct
+{
+    unsigned           Number;
+    int                Master;          /**< pty master, -1 for an in-process host. */
+    char               SlaveName[64];
+    int                Closed;          /**< Nobody has the pty open.               */
+    EMU_QUEUE         *In;
+    EMU_QUEUE         *Out;
+    unsigned long long BusyUntil;       /**< Command still being processed (ns).    */
+
+    EMU_STATE          State;
+    int                Echo;
+    int                Unlocked;
+    char               Line[256];
+    unsigned           LineLength;
+
+    unsigned long      DataAddress;     /**< W / R: next address.                   */
+    unsigned long      DataLeft;        /**< W / R: bytes still to transfer.        */
+    unsigned long      GroupAddress;    /**< Start of the current checksum group.   */
+    unsigned long      GroupLeft;
+    unsigned           GroupLines;
+    unsigned long      GroupSum;
+
+    unsigned char     *Flash;
+    unsigned char     *Ram;
+    unsigned char     *Prepared;        /**< One flag per sector.                   */
+
+    unsigned long      BytesIn;
+    unsigned long      BytesOut;
+    unsigned long      Commands;
+    unsigned long      Resends;
+    unsigned long      RxErrors;
+    unsigned long      TxErrors;
+} EMU_PORT;
+
+int  EmuSelectPart(const char *Name);
+EMU_PORT *EmuCreate(unsigned Number);
+void EmuDestroy(EMU_PORT *Port);
+void EmuHostWrite(EMU_PORT *Port, const void *Data, size_t Length);
+unsigned long EmuHostRead(EMU_PORT *Port, void *Data, unsigned long MaxLength);
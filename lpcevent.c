@@ -0,0 +1,649 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcevent.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// This file drives several programming sessions (one per serial port)
+// from a single thread. Each session runs the unmodified protocol code
+// (NxpDownload, AnalogDevicesDownload) on its own stack. Whenever the
+// protocol code would block waiting for the serial port or in Sleep(),
+// the session yields back to an epoll loop, which resumes it as soon as
+// its port becomes readable or its timerfd deadline expires.
+//
+// Without GangInit a thread drives its sessions with GangStep instead of
+// the epoll loop (the step API of lpcsession.c); the scheduler state is
+// per thread for that.
+
+#include "lpc21isp.h"
+
+#ifdef GANG_SUPPORT
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <ucontext.h>
+#include "lpcprog.h"
+#include "lpcevent.h"
+
+typedef enum
+{
+    GANG_RUNNING,
+    GANG_WAITING,
+    GANG_DONE
+} GANG_STATE;
+
+typedef enum
+{
+    GANG_WAKE_NONE,
+    GANG_WAKE_READABLE,
+    GANG_WAKE_TIMEOUT
+} GANG_WAKE;
+
+struct gang_session
+{
+    ISP_ENVIRONMENT IspEnvironment;     /**< Private copy for this port.           */
+    int           (*Run)(ISP_ENVIRONMENT *IspEnvironment);
+    ucontext_t      Context;
+    void           *Stack;
+    int             TimerFd;
+    int             WatchedFd;          /**< Serial fd known to epoll, -1 if none. */
+    int             WantSerial;         /**< Waiting for the serial port.          */
+    int             Cancelled;          /**< See GangCancel.                       */
+    GANG_STATE      State;
+    GANG_WAKE       Wake;
+    int             Result;
+    GANG_WATCH      SerialWatch;
+    GANG_WATCH      TimerWatch;
+};
+
+static ISP_THREAD_LOCAL int           GangEpollFd = -1;
+static ISP_THREAD_LOCAL ucontext_t    GangSchedulerContext;
+static ISP_THREAD_LOCAL GANG_SESSION *GangCurrent = NULL;
+
+/***************************** GangArmTimer *****************************/
+/**  Arms (or with 0 disarms) the one shot deadline timer of a session.
+*/
+static void GangArmTimer(GANG_SESSION *Session, unsigned long MilliSeconds)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = MilliSeconds / 1000;
+    its.it_value.tv_nsec = (MilliSeconds % 1000) * 1000000L;
+    timerfd_settime(Session->TimerFd, 0, &its, NULL);
+}
+
+/***************************** GangYield ********************************/
+/**  Suspends the running session and returns to the epoll loop. Any
+expiration of the timer that is still pending once the session resumes is
+consumed, so it can't wake up the next wait too early.
+*/
+static void GangYield(GANG_SESSION *Session)
+{
+    uint64_t expirations;
+
+    Session->State = GANG_WAITING;
+    swapcontext(&Session->Context, &GangSchedulerContext);
+
+    GangArmTimer(Session, 0);
+    (void)read(Session->TimerFd, &expirations, sizeof(expirations));
+}
+
+/***************************** GangResume *******************************/
+/**  Continues a suspended session until it yields again or finishes. The
+stack of a finished session is released right away, it is no longer in
+use once we are back in the scheduler.
+*/
+static void GangResume(GANG_SESSION *Session, GANG_WAKE Wake)
+{
+    Session->Wake  = Wake;
+    Session->State = GANG_RUNNING;
+    GangCurrent    = Session;
+    swapcontext(&GangSchedulerContext, &Session->Context);
+    GangCurrent    = NULL;
+
+    if (Session->State == GANG_DONE)
+    {
+        free(Session->Stack);
+        Session->Stack = NULL;
+    }
+}
+
+/***************************** GangCheckCancel **************************/
+/**  Ends a cancelled session while it is downloading (back to the setjmp
+of ProgramOpenTarget). Afterwards, while it closes the port, its waits
+simply return at once.
+*/
+static void GangCheckCancel(GANG_SESSION *Session)
+{
+    if (Session->Cancelled && Session->IspEnvironment.Abort != NULL)
+    {
+        IspExit(&Session->IspEnvironment, USER_ABORT);
+    }
+}
+
+/***************************** GangEntry ********************************/
+/**  First function executed on the stack of a new session. Returning from
+here switches back to the scheduler via uc_link.
+*/
+static void GangEntry(void)
+{
+    GANG_SESSION *Session = GangCurrent;
+
+    Session->Result = Session->Run(&Session->IspEnvironment);
+    Session->State  = GANG_DONE;
+}
+
+/***************************** GangWaitReadable *************************/
+/**  Replacement for select() on the serial port while running inside a
+session. Suspends the session until the port is readable or the timeout
+has expired.
+\param [in] timeOutMilliseconds the maximum time to wait.
+\return 1 if the port is readable, 0 on timeout.
+*/
+int GangWaitReadable(ISP_ENVIRONMENT *IspEnvironment, unsigned timeOutMilliseconds)
+{
+    GANG_SESSION *Session = IspEnvironment->GangSession;
+    struct epoll_event ev;
+
+    GangCheckCancel(Session);
+    if (Session->Cancelled)
+    {
+        return 0;
+    }
+
+    ev.events   = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = &Session->SerialWatch;
+
+    if (GangEpollFd < 0)
+    {
+        // stepped, GangStep polls the port itself
+    }
+    else if (Session->WatchedFd != IspEnvironment->fdCom)
+    {
+        if (epoll_ctl(GangEpollFd, EPOLL_CTL_ADD, IspEnvironment->fdCom, &ev) != 0)
+        {
+            epoll_ctl(GangEpollFd, EPOLL_CTL_MOD, IspEnvironment->fdCom, &ev);
+        }
+        Session->WatchedFd = IspEnvironment->fdCom;
+    }
+    else
+    {
+        epoll_ctl(GangEpollFd, EPOLL_CTL_MOD, IspEnvironment->fdCom, &ev);
+    }
+
+    GangArmTimer(Session, timeOutMilliseconds ? timeOutMilliseconds : 1);
+    Session->WantSerial = 1;
+    GangYield(Session);
+    Session->WantSerial = 0;
+
+    GangCheckCancel(Session);
+
+    return Session->Wake == GANG_WAKE_READABLE;
+}
+
+/***************************** GangSleep ********************************/
+/**  Sleep() replacement while running inside a session.
+\return 1 if the sleep was handled by suspending the current session,
+0 if no session is running and the caller has to sleep itself.
+*/
+int GangSleep(unsigned long MilliSeconds)
+{
+    GANG_SESSION *Session = GangCurrent;
+
+    if (Session == NULL)
+    {
+        return 0;
+    }
+
+    GangCheckCancel(Session);
+    if (!Session->Cancelled)
+    {
+        GangArmTimer(Session, MilliSeconds ? MilliSeconds : 1);
+        GangYield(Session);
+        GangCheckCancel(Session);
+    }
+
+    return 1;
+}
+
+/***************************** GangDispatch *****************************/
+/**  Resumes the session belonging to one epoll event, if the event is
+still relevant for it, or passes the event to the handler of a watch
+without session (GangWatch).
+*/
+static void GangDispatch(const struct epoll_event *ev)
+{
+    GANG_WATCH   *Watch   = (GANG_WATCH *)ev->data.ptr;
+    GANG_SESSION *Session = Watch->Session;
+
+    if (Session == NULL)
+    {
+        Watch->Handler(Watch, ev->events);
+        return;
+    }
+
+    if (Session->State != GANG_WAITING)
+    {
+        return;
+    }
+
+    if (Watch->IsTimer)
+    {
+        uint64_t expirations;
+
+        // An earlier event of the same batch may have re-armed the timer
+        if (read(Session->TimerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        {
+            return;
+        }
+        GangResume(Session, GANG_WAKE_TIMEOUT);
+    }
+    else
+    {
+        struct pollfd pfd;
+
+        if (!Session->WantSerial)
+        {
+            return;
+        }
+
+        // Stale readiness from a previous wait: data may already be consumed
+        pfd.fd      = Session->IspEnvironment.fdCom;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) != 1)
+        {
+            return;
+        }
+        GangResume(Session, GANG_WAKE_READABLE);
+    }
+}
+
+/***************************** GangInit *********************************/
+/**  Sets up the epoll loop shared by all sessions.
+\return 0 if ok, -1 on error (errno is set).
+*/
+int GangInit(void)
+{
+    if (GangEpollFd < 0)
+    {
+        GangEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    return GangEpollFd < 0 ? -1 : 0;
+}
+
+/***************************** GangExit *********************************/
+/**  Closes the epoll loop. All sessions have to be destroyed before.
+*/
+void GangExit(void)
+{
+    if (GangEpollFd >= 0)
+    {
+        close(GangEpollFd);
+        GangEpollFd = -1;
+    }
+}
+
+/***************************** GangCreate *******************************/
+/**  Creates an idle session, GangStart runs something in it.
+\return the session, NULL on error (errno is set).
+*/
+GANG_SESSION *GangCreate(void)
+{
+    GANG_SESSION *Session;
+    struct epoll_event ev;
+
+    Session = (GANG_SESSION *)calloc(1, sizeof(GANG_SESSION));
+    if (Session == NULL)
+    {
+        return NULL;
+    }
+
+    Session->State               = GANG_DONE;
+    Session->WatchedFd           = -1;
+    Session->SerialWatch.Session = Session;
+    Session->SerialWatch.IsTimer = 0;
+    Session->TimerWatch.Session  = Session;
+    Session->TimerWatch.IsTimer  = 1;
+
+    Session->TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (Session->TimerFd < 0)
+    {
+        free(Session);
+        return NULL;
+    }
+
+    if (GangEpollFd >= 0)
+    {
+        ev.events   = EPOLLIN;
+        ev.data.ptr = &Session->TimerWatch;
+        epoll_ctl(GangEpollFd, EPOLL_CTL_ADD, Session->TimerFd, &ev);
+    }
+
+    return Session;
+}
+
+/***************************** GangStart ********************************/
+/**  Runs Run(copy of IspEnvironment) on the own stack of an idle session.
+Returns as soon as the session waits for the first time (or is done).
+\param [in] IspEnvironment settings of the session, they are copied.
+\param [in] Run what to do, e.g. ProgramTarget.
+\return 0 if ok, -1 if out of memory.
+*/
+int GangStart(GANG_SESSION *Session, const ISP_ENVIRONMENT *IspEnvironment,
+              int (*Run)(ISP_ENVIRONMENT *IspEnvironment))
+{
+    Session->Stack = malloc(GANG_STACK_SIZE);
+    if (Session->Stack == NULL)
+    {
+        return -1;
+    }
+
+    Session->IspEnvironment             = *IspEnvironment;
+    Session->IspEnvironment.GangSession = Session;
+    Session->Run                        = Run;
+    Session->Result                     = 0;
+    Session->Cancelled                  = 0;
+
+    getcontext(&Session->Context);
+    Session->Context.uc_stack.ss_sp   = Session->Stack;
+    Session->Context.uc_stack.ss_size = GANG_STACK_SIZE;
+    Session->Context.uc_link          = &GangSchedulerContext;
+    makecontext(&Session->Context, GangEntry, 0);
+
+    GangResume(Session, GANG_WAKE_NONE);
+
+    return 0;
+}
+
+/***************************** GangDone *********************************/
+/**  Tells whether a session is idle.
+\param [out] Result the return value of Run, if done (may be NULL).
+\return 1 if the session is done (or was never started), 0 if it runs.
+*/
+int GangDone(const GANG_SESSION *Session, int *Result)
+{
+    if (Session->State != GANG_DONE)
+    {
+        return 0;
+    }
+
+    if (Result != NULL)
+    {
+        *Result = Session->Result;
+    }
+
+    return 1;
+}
+
+/***************************** GangEnvironment **************************/
+/**  Returns the environment the session works with (a copy, see
+GangStart).
+*/
+ISP_ENVIRONMENT *GangEnvironment(GANG_SESSION *Session)
+{
+    return &Session->IspEnvironment;
+}
+
+/***************************** GangDestroy ******************************/
+/**  Releases an idle session.
+*/
+void GangDestroy(GANG_SESSION *Session)
+{
+    if (Session->WatchedFd >= 0 && GangEpollFd >= 0)
+    {
+        epoll_ctl(GangEpollFd, EPOLL_CTL_DEL, Session->WatchedFd, NULL);
+    }
+    close(Session->TimerFd);
+    free(Session->Stack);
+    free(Session);
+}
+
+/***************************** GangStep *********************************/
+/**  Runs a session of a thread without epoll loop (no GangInit): waits for
+its port or its timer for at most BudgetMilliseconds in total and resumes
+it whenever one of them is ready.
+\param [in] BudgetMilliseconds the maximum time to wait, 0 only looks.
+\return 1 if the session is done, 0 if it still runs.
+*/
+int GangStep(GANG_SESSION *Session, unsigned BudgetMilliseconds)
+{
+    struct pollfd pfd[2];
+    struct timespec now;
+    unsigned long long Deadline, Now;
+    uint64_t expirations;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    Now      = (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    Deadline = Now + BudgetMilliseconds;
+
+    while (Session->State == GANG_WAITING)
+    {
+        pfd[0].fd      = Session->TimerFd;
+        pfd[0].events  = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd      = Session->WantSerial ? Session->IspEnvironment.fdCom : -1;
+        pfd[1].events  = POLLIN;
+        pfd[1].revents = 0;
+
+        if (poll(pfd, 2, (int)(Deadline - Now)) <= 0)
+        {
+            break;      // budget used up (or a signal)
+        }
+
+        if (pfd[1].revents != 0)
+        {
+            GangResume(Session, GANG_WAKE_READABLE);
+        }
+        else if (read(Session->TimerFd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        {
+            GangResume(Session, GANG_WAKE_TIMEOUT);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        Now = (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+        if (Now >= Deadline)
+        {
+            break;
+        }
+    }
+
+    return Session->State == GANG_DONE;
+}
+
+/***************************** GangCancel *******************************/
+/**  Ends a waiting session at once, Run returns USER_ABORT. Called from
+within the session (e.g. from a progress callback), the session ends at its
+next wait.
+*/
+void GangCancel(GANG_SESSION *Session)
+{
+    if (Session->State == GANG_DONE)
+    {
+        return;
+    }
+
+    Session->Cancelled = 1;
+    if (Session->State == GANG_WAITING)
+    {
+        GangResume(Session, GANG_WAKE_NONE);
+    }
+}
+
+/***************************** GangWatch ********************************/
+/**  Adds a descriptor that doesn't belong to a session (e.g. a socket) to
+the epoll loop. Watch->Handler is called from GangPoll when it is readable;
+Watch->Session must be NULL and Watch has to stay valid until GangUnwatch.
+\return 0 if ok, -1 on error (errno is set).
+*/
+int GangWatch(int Fd, GANG_WATCH *Watch)
+{
+    struct epoll_event ev;
+
+    ev.events   = EPOLLIN;
+    ev.data.ptr = Watch;
+
+    return epoll_ctl(GangEpollFd, EPOLL_CTL_ADD, Fd, &ev);
+}
+
+/***************************** GangUnwatch ******************************/
+/**  Removes a descriptor added by GangWatch.
+*/
+void GangUnwatch(int Fd)
+{
+    epoll_ctl(GangEpollFd, EPOLL_CTL_DEL, Fd, NULL);
+}
+
+/***************************** GangPoll *********************************/
+/**  Waits for events and resumes the sessions (or calls the handlers)
+they belong to.
+\param [in] TimeoutMilliseconds the maximum time to wait, -1 for ever.
+\return number of events handled, 0 on timeout or signal, -1 on error.
+*/
+int GangPoll(int TimeoutMilliseconds)
+{
+    struct epoll_event events[64];
+    int nEvents, e;
+
+    nEvents = epoll_wait(GangEpollFd, events, sizeof(events) / sizeof(events[0]), TimeoutMilliseconds);
+    if (nEvents < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        DebugPrintf(1, "epoll_wait failed (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    for (e = 0; e < nEvents; e++)
+    {
+        GangDispatch(&events[e]);
+    }
+
+    return nEvents;
+}
+
+/***************************** GangDownload *****************************/
+/**  Programs all targets listed (comma separated) in serial_port in
+parallel, using one thread and one epoll loop for all of them.
+\return 0 if all targets were programmed, otherwise the error code of the
+first failing target.
+*/
+int GangDownload(ISP_ENVIRONMENT *IspEnvironment)
+{
+    GANG_SESSION **Sessions;
+    ISP_ENVIRONMENT Target;
+    char *PortList;
+    char *Port;
+    int nSessions, nActive, i;
+    int Result = 0;
+
+    PortList = strdup(IspEnvironment->serial_port);
+    if (PortList == NULL)
+    {
+        DebugPrintf(1, "Can't set up gang programming (%s)\n", strerror(errno));
+        exit(1);
+    }
+
+    nSessions = 1;
+    for (i = 0; PortList[i] != '\0'; i++)
+    {
+        if (PortList[i] == ',')
+        {
+            nSessions++;
+        }
+    }
+
+    Sessions = (GANG_SESSION **)calloc(nSessions, sizeof(GANG_SESSION *));
+    if (Sessions == NULL || GangInit() != 0)
+    {
+        DebugPrintf(1, "Can't set up gang programming (%s)\n", strerror(errno));
+        exit(1);
+    }
+
+    DebugPrintf(2, "Gang programming %d targets\n", nSessions);
+
+    // Start every session, each one runs until its first wait.
+    for (i = 0, Port = strtok(PortList, ","); Port != NULL && i < nSessions; Port = strtok(NULL, ","), i++)
+    {
+        Target             = *IspEnvironment;
+        Target.serial_port = Port;
+        Target.PortId      = i;
+
+        Sessions[i] = GangCreate();
+        if (Sessions[i] == NULL || GangStart(Sessions[i], &Target, ProgramTarget) != 0)
+        {
+            DebugPrintf(1, "Can't set up session for %s (%s)\n", Port, strerror(errno));
+            exit(1);
+        }
+    }
+    nSessions = i;
+
+    do
+    {
+        for (i = 0, nActive = 0; i < nSessions; i++)
+        {
+            nActive += !GangDone(Sessions[i], NULL);
+        }
+
+        if (nActive > 0 && GangPoll(-1) < 0)
+        {
+            exit(1);
+        }
+    } while (nActive > 0);
+
+    DebugPrintf(2, "\nGang programming results:\n");
+    for (i = 0; i < nSessions; i++)
+    {
+        if (Sessions[i]->Result == 0)
+        {
+            DebugPrintf(2, "  %-24s OK\n", Sessions[i]->IspEnvironment.serial_port);
+        }
+        else
+        {
+            DebugPrintf(1, "  %-24s failed, error 0x%X\n", Sessions[i]->IspEnvironment.serial_port, Sessions[i]->Result);
+            if (Result == 0)
+            {
+                Result = Sessions[i]->Result;
+            }
+        }
+
+        GangDestroy(Sessions[i]);
+    }
+
+    GangExit();
+    free(Sessions);
+    free(PortList);
+
+    return Result;
+}
+#endif // GANG_SUPPORT
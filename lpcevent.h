@@ -0,0 +1,70 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC1000 / LPC2000 family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcevent.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if defined GANG_SUPPORT
+
+/* Stack size for each session. NxpDownload keeps its buffers on the stack,
+ * DebugPrintf needs another 2000 bytes, so be generous here.
+ */
+#define GANG_STACK_SIZE     (256 * 1024)
+
+typedef struct gang_session GANG_SESSION;
+typedef struct gang_watch   GANG_WATCH;
+
+/** epoll user data: which session and which of its descriptors, or for a
+ * descriptor added by GangWatch (Session NULL) the handler to call.
+ */
+struct gang_watch
+{
+    GANG_SESSION *Session;
+    int           IsTimer;
+    void        (*Handler)(GANG_WATCH *Watch, unsigned Events);
+};
+
+int GangDownload(ISP_ENVIRONMENT *IspEnvironment);
+int GangWaitReadable(ISP_ENVIRONMENT *IspEnvironment, unsigned timeOutMilliseconds);
+int GangSleep(unsigned long MilliSeconds);
+
+int  GangInit(void);
+void GangExit(void);
+GANG_SESSION *GangCreate(void);
+int  GangStart(GANG_SESSION *Session, const ISP_ENVIRONMENT *IspEnvironment,
+               int (*Run)(ISP_ENVIRONMENT *IspEnvironment));
+int  GangDone(const GANG_SESSION *Session, int *Result);
+ISP_ENVIRONMENT *GangEnvironment(GANG_SESSION *Session);
+void GangDestroy(GANG_SESSION *Session);
+int  GangWatch(int Fd, GANG_WATCH *Watch);
+void GangUnwatch(int Fd);
+int  GangPoll(int TimeoutMilliseconds);
+int  GangStep(GANG_SESSION *Session, unsigned BudgetMilliseconds);
+void GangCancel(GANG_SESSION *Session);
+
+#endif // GANG_SUPPORT
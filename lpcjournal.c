@@ -0,0 +1,296 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcjournal.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+// Resume journal, see lpcjournal.h. Only the sector list changes while
+// programming; the file is rewritten from scratch when it is opened, so
+// entries of an older image or device never mix with the current ones.
+
+#if defined(_WIN32)
+#if !defined __BORLANDC__
+#include "StdAfx.h"
+#endif
+#endif // defined(_WIN32)
+#include "lpc21isp.h"
+
+#if !defined COMPILE_FOR_LPC21
+#include "lpcjournal.h"
+
+struct isp_journal
+{
+    FILE              *File;
+    char               Name[512];
+    char               Image[80];           /**< "image" line of this download. */
+    char               Device[80];          /**< "device" line.                 */
+    unsigned char      Done[JOURNAL_MAX_SECTORS];
+    unsigned           Unsynced;            /**< Entries not on disk yet.       */
+    unsigned long long LastSync;
+};
+
+/***************************** JournalHash ******************************/
+/**  FNV-1a hash of the image, to tell images apart, not to protect them.
+*/
+static unsigned long long JournalHash(const BINARY *Data, unsigned long Length)
+{
+    unsigned long long Hash = 14695981039346656037ULL;
+    unsigned long i;
+
+    for (i = 0; i < Length; i++)
+    {
+        Hash ^= Data[i];
+        Hash *= 1099511628211ULL;
+    }
+    return Hash;
+}
+
+/***************************** JournalSync ******************************/
+/**  Puts the entries written so far on disk.
+*/
+static void JournalSync(struct isp_journal *Journal)
+{
+    fflush(Journal->File);
+#if defined COMPILE_FOR_WINDOWS
+    _commit(_fileno(Journal->File));
+#else
+    fsync(fileno(Journal->File));
+#endif
+    Journal->Unsynced = 0;
+    Journal->LastSync = IspClock();
+}
+
+/***************************** JournalWrite *****************************/
+/**  Writes the journal anew: header and the sectors done.
+\return 0 if ok, -1 if the file can't be written.
+*/
+static int JournalWrite(struct isp_journal *Journal)
+{
+    unsigned i;
+
+    if (Journal->File != NULL)
+    {
+        fclose(Journal->File);
+    }
+
+    Journal->File = fopen(Journal->Name, "w");
+    if (Journal->File == NULL)
+    {
+        DebugPrintf(1, "Can't write %s: %s\n", Journal->Name, strerror(errno));
+        return -1;
+    }
+
+    fprintf(Journal->File, "# lpc21isp journal\n%s\n%s\n", Journal->Image, Journal->Device);
+    for (i = 0; i < JOURNAL_MAX_SECTORS; i++)
+    {
+        if (Journal->Done[i])
+        {
+            fprintf(Journal->File, "sector %u\n", i);
+        }
+    }
+
+    JournalSync(Journal);
+    return 0;
+}
+
+/***************************** JournalOpen ******************************/
+/**  Opens the journal of the port for this download (-journal).
+\param [in] Device part ID and serial number of the target.
+\param [in] Fresh start a new journal, ignoring the old one (e.g. the
+device is wiped).
+\return the number of sectors the old journal lists for this image and
+device, 0 if there is none.
+*/
+int JournalOpen(ISP_ENVIRONMENT *IspEnvironment, const char *Device, int Fresh)
+{
+    struct isp_journal *Journal;
+    char Port[256], *p;
+    char Line[128];
+    unsigned Sector;
+    int Match = 0;
+    int Count = 0;
+    FILE *fp;
+
+    if (IspEnvironment->JournalDir == NULL)
+    {
+        return 0;
+    }
+
+    Journal = (struct isp_journal *)calloc(1, sizeof(*Journal));
+    if (Journal == NULL)
+    {
+        return 0;
+    }
+
+    // Named after the full port path, so that /dev/ttyUSB0 and
+    // /dev/serial/by-id/.../ttyUSB0 don't share it: _dev_ttyUSB0.journal
+    snprintf(Port, sizeof(Port), "%s", IspEnvironment->serial_port);
+    for (p = Port; *p != '\0'; p++)
+    {
+        if (*p == '/' || *p == '\\' || *p == ':')
+        {
+            *p = '_';
+        }
+    }
+    sprintf(Journal->Image, "image %016llx %lu %lu",
+            JournalHash(IspEnvironment->BinaryContent, IspEnvironment->BinaryLength),
+            IspEnvironment->BinaryLength, IspEnvironment->BinaryOffset);
+    snprintf(Journal->Device, sizeof(Journal->Device), "device %s", Device);
+    snprintf(Journal->Name, sizeof(Journal->Name), "%s/%s.journal", IspEnvironment->JournalDir, Port);
+
+    if (!Fresh && (fp = fopen(Journal->Name, "r")) != NULL)
+    {
+        while (fgets(Line, sizeof(Line), fp) != NULL)
+        {
+            Line[strcspn(Line, "\r\n")] = '\0';
+            if (strncmp(Line, "image ", 6) == 0)
+            {
+                Match = strcmp(Line, Journal->Image) == 0;
+            }
+            else if (strncmp(Line, "device ", 7) == 0)
+            {
+                Match = Match && strcmp(Line, Journal->Device) == 0;
+            }
+            else if (Match && sscanf(Line, "sector %u", &Sector) == 1 &&
+                     Sector < JOURNAL_MAX_SECTORS && !Journal->Done[Sector])
+            {
+                Journal->Done[Sector] = 1;
+                Count++;
+            }
+        }
+        fclose(fp);
+    }
+
+    if (JournalWrite(Journal) != 0)
+    {
+        free(Journal);
+        return 0;
+    }
+
+    IspEnvironment->Journal = Journal;
+    return Count;
+}
+
+/***************************** JournalHasSector *************************/
+/**  Tells whether the journal lists the sector as programmed.
+*/
+int JournalHasSector(const ISP_ENVIRONMENT *IspEnvironment, unsigned long Sector)
+{
+    return IspEnvironment->Journal != NULL && Sector < JOURNAL_MAX_SECTORS &&
+           IspEnvironment->Journal->Done[Sector];
+}
+
+/***************************** JournalForget ****************************/
+/**  Drops all sectors from the journal, they are all programmed again.
+*/
+void JournalForget(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct isp_journal *Journal = IspEnvironment->Journal;
+
+    if (Journal == NULL)
+    {
+        return;
+    }
+
+    memset(Journal->Done, 0, sizeof(Journal->Done));
+    if (JournalWrite(Journal) != 0)
+    {
+        free(Journal);
+        IspEnvironment->Journal = NULL;
+    }
+}
+
+/***************************** JournalSector ****************************/
+/**  Records a sector as programmed. Entries are flushed to disk at most
+every JOURNAL_SYNC_MS, and when the journal is closed.
+*/
+void JournalSector(ISP_ENVIRONMENT *IspEnvironment, unsigned long Sector)
+{
+    struct isp_journal *Journal = IspEnvironment->Journal;
+
+    if (Journal == NULL || Sector >= JOURNAL_MAX_SECTORS)
+    {
+        return;
+    }
+
+    Journal->Done[Sector] = 1;
+    fprintf(Journal->File, "sector %lu\n", Sector);
+    Journal->Unsynced++;
+
+    if (IspClock() - Journal->LastSync >= JOURNAL_SYNC_MS * 1000ULL)
+    {
+        JournalSync(Journal);
+    }
+}
+
+/***************************** JournalFinish ****************************/
+/**  Removes the journal once all sectors are programmed.
+*/
+void JournalFinish(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct isp_journal *Journal = IspEnvironment->Journal;
+
+    if (Journal == NULL)
+    {
+        return;
+    }
+
+    fclose(Journal->File);
+    remove(Journal->Name);
+    free(Journal);
+    IspEnvironment->Journal = NULL;
+}
+
+/***************************** JournalClose *****************************/
+/**  Closes the journal of a download that ended early, it stays for the
+next run.
+*/
+void JournalClose(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct isp_journal *Journal = IspEnvironment->Journal;
+
+    if (Journal == NULL)
+    {
+        return;
+    }
+
+    if (Journal->Unsynced != 0)
+    {
+        JournalSync(Journal);
+    }
+    fclose(Journal->File);
+    DebugPrintf(2, "Journal %s kept to resume the download\n", Journal->Name);
+    free(Journal);
+    IspEnvironment->Journal = NULL;
+}
+
+#endif // !defined COMPILE_FOR_LPC21
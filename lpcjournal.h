@@ -0,0 +1,84 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcjournal.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+/* Resume journal (-journal<dir>).
+ *
+ * Keeps a journal file per port in <dir>, named after the full port path
+ * (e.g. _dev_ttyUSB0.journal). It names the image (hash, length, address)
+ * and the device (part ID and serial number), followed by one line per
+ * flash sector that was completely programmed (and verified with -verify):
+ *
+ *   # lpc21isp journal
+ *   image 9c1185a5c5e9fc54 20000 0
+ *   device 0444102B 4C504300 0 0 0
+ *   sector 1
+ *   sector 2
+ *
+ * A download that stops half way leaves the journal behind. The next run
+ * with the same image on the same device skips the sectors listed, once a
+ * blank check on the target shows they were not erased in between. A
+ * target without a serial number (no N command) can't be told from
+ * another board of the same part, so it is always programmed in full. It
+ * erases sector 0 first and programs it last as usual, so sector 0 is never
+ * skipped. A partly programmed sector is erased and programmed again: its
+ * flash can't be written twice without an erase. The journal is removed
+ * when all sectors are programmed.
+ *
+ * Entries are written as the sectors complete, but only flushed to disk
+ * every JOURNAL_SYNC_MS. A sector lost from the journal by a crash is just
+ * programmed again.
+ */
+
+#if !defined COMPILE_FOR_LPC21
+
+#define JOURNAL_SYNC_MS     500     /* Flush the journal to disk at most this often */
+#define JOURNAL_MAX_SECTORS 256
+
+int  JournalOpen(ISP_ENVIRONMENT *IspEnvironment, const char *Device, int Fresh);
+int  JournalHasSector(const ISP_ENVIRONMENT *IspEnvironment, unsigned long Sector);
+void JournalForget(ISP_ENVIRONMENT *IspEnvironment);
+void JournalSector(ISP_ENVIRONMENT *IspEnvironment, unsigned long Sector);
+void JournalFinish(ISP_ENVIRONMENT *IspEnvironment);
+void JournalClose(ISP_ENVIRONMENT *IspEnvironment);
+
+#else
+
+#define JournalHasSector(IspEnvironment, Sector)    0   // Cleanly remove this feature from the embedded version
+#define JournalForget(IspEnvironment)
+#define JournalSector(IspEnvironment, Sector)
+#define JournalFinish(IspEnvironment)
+#define JournalClose(IspEnvironment)
+
+#endif // !defined COMPILE_FOR_LPC21
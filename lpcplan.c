@@ -0,0 +1,463 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcplan.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+// Dry run planner, see lpcplan.h. The emulated target answers at once,
+// so the plan is built in a fraction of the real flash time; the times
+// printed come from the link model only.
+
+#include "lpc21isp.h"
+
+#if defined DRYRUN_SUPPORT
+#include "lpcprog.h"
+#include "lpcstats.h"
+#include "lpcemu.h"
+#include "lpcplan.h"
+
+#define PLAN_MAX_SECTORS    256
+
+/** One ISP command and everything sent and received until the next one. */
+typedef struct
+{
+    char           Text[32];        /**< The command line, without line end.   */
+    STATS_PHASE    Phase;
+    unsigned long  Tx;
+    unsigned long  Rx;
+    unsigned long  Data;            /**< Tx after the command line (W data).    */
+    unsigned long  Echo;            /**< Rx that only echoes Tx.                */
+    unsigned long  RoundTrips;
+    double         Busy;            /**< Target busy with the command (s).      */
+    double         Time;            /**< Predicted time of the whole step (s).  */
+} PLAN_ROW;
+
+/** In-process line between NxpDownload and the emulated target. */
+typedef struct
+{
+    EMU_PORT      *Target;
+    int            Sent;            /**< Host sent something since it last read. */
+    int            LineOpen;        /**< Last command line not finished yet.     */
+
+    PLAN_ROW      *Rows;
+    unsigned       nRows;
+    unsigned       MaxRows;
+
+    double         ByteTime;        /**< s per byte, 8N1.                        */
+    double         RoundTrip;       /**< s per turnaround.                       */
+    double         EraseTime;       /**< s per erased sector.                    */
+    double         ProgramTime;     /**< s per KiB copied to flash.              */
+
+    unsigned long  Payload;         /**< Bytes written to RAM (W).               */
+    unsigned long  Programmed;      /**< Bytes copied to flash (C).              */
+    long           Prepared;        /**< First sector of the last P, -1 if none. */
+    unsigned char  Visited[PLAN_MAX_SECTORS];   /**< Prepared at least once.     */
+    unsigned char  Erased[PLAN_MAX_SECTORS];
+    unsigned char  Copied[PLAN_MAX_SECTORS];
+} PLAN_LINK;
+
+static const char *const PlanPhaseName[STATS_PHASES] =
+{
+    "reset", "sync", "identify", "erase", "write", "copy", "verify", "go"
+};
+
+static PLAN_LINK Plan;
+
+/***************************** PlanMark *********************************/
+/**  Sets the flag of each sector in the range of a P or E command.
+*/
+static void PlanMark(unsigned char *Flags, const char *Text)
+{
+    unsigned long First, Last, i;
+
+    if (sscanf(Text + 1, "%lu %lu", &First, &Last) == 2)
+    {
+        for (i = First; i <= Last && i < PLAN_MAX_SECTORS; i++)
+        {
+            Flags[i] = 1;
+        }
+    }
+}
+
+/***************************** PlanEndRow *******************************/
+/**  Finishes the current step of the plan.
+\param [in] Next first letter of the command that follows, '\0' at the end.
+A prepare belongs to the phase of the command it prepares for.
+*/
+static void PlanEndRow(PLAN_LINK *Link, char Next)
+{
+    PLAN_ROW *Row;
+    unsigned long Line;
+
+    if (Link->nRows == 0)
+    {
+        return;
+    }
+    Row = &Link->Rows[Link->nRows - 1];
+    if (Row->Time != 0)
+    {
+        return;     // already finished
+    }
+
+    if (Row->Text[0] == 'P')
+    {
+        Row->Phase = Next == 'C' ? STATS_COPY : STATS_ERASE;
+    }
+
+    Line = Row->Tx > Row->Rx ? Row->Tx : Row->Rx;
+    Row->Time = Line * Link->ByteTime + Row->RoundTrips * Link->RoundTrip + Row->Busy;
+}
+
+/***************************** PlanStartRow *****************************/
+/**  Starts a new step of the plan for a command line the host sends.
+*/
+static void PlanStartRow(PLAN_LINK *Link, const char *Data, size_t Length)
+{
+    PLAN_ROW *Row;
+    unsigned long a1, a2, a3;
+    size_t n;
+
+    PlanEndRow(Link, Data[0]);
+
+    if (Link->nRows == Link->MaxRows)
+    {
+        Link->MaxRows = Link->MaxRows ? 2 * Link->MaxRows : 256;
+        Link->Rows = (PLAN_ROW *)realloc(Link->Rows, Link->MaxRows * sizeof(PLAN_ROW));
+        if (Link->Rows == NULL)
+        {
+            DebugPrintf(1, "Out of memory\n");
+            exit(1);
+        }
+    }
+    Row = &Link->Rows[Link->nRows++];
+    memset(Row, 0, sizeof(*Row));
+
+    for (n = 0; n < Length && n < sizeof(Row->Text) - 1 && Data[n] != '\r' && Data[n] != '\n'; n++)
+    {
+        Row->Text[n] = Data[n];
+    }
+
+    switch (Link->Target->State)
+    {
+    case EMU_AUTOBAUD:
+    case EMU_SYNC:
+    case EMU_OSC:
+        Row->Phase = STATS_SYNC;
+        return;
+
+    default:
+        break;
+    }
+
+    switch (Row->Text[1] == ' ' ? Row->Text[0] : '\0')
+    {
+    case 'P':
+        if (sscanf(Row->Text + 1, "%lu", &a1) == 1)
+        {
+            Link->Prepared = (long)a1;
+        }
+        PlanMark(Link->Visited, Row->Text);
+        break;
+
+    case 'E':
+        Row->Phase = STATS_ERASE;
+        if (sscanf(Row->Text + 1, "%lu %lu", &a1, &a2) == 2 && a2 >= a1)
+        {
+            Row->Busy = (a2 - a1 + 1) * Link->EraseTime;
+        }
+        PlanMark(Link->Erased, Row->Text);
+        break;
+
+    case 'W':
+        Row->Phase = STATS_WRITE;
+        if (sscanf(Row->Text + 1, "%lu %lu", &a1, &a2) == 2)
+        {
+            Link->Payload += a2;
+        }
+        break;
+
+    case 'C':
+        Row->Phase = STATS_COPY;
+        if (sscanf(Row->Text + 1, "%lu %lu %lu", &a1, &a2, &a3) == 3)
+        {
+            Row->Busy = a3 / 1024.0 * Link->ProgramTime;
+            Link->Programmed += a3;
+            if (Link->Prepared >= 0 && Link->Prepared < PLAN_MAX_SECTORS)
+            {
+                Link->Copied[Link->Prepared] = 1;
+            }
+        }
+        break;
+
+    case 'M':
+        Row->Phase = STATS_VERIFY;
+        break;
+
+    case 'G':
+        Row->Phase = STATS_GO;
+        break;
+
+    default:
+        Row->Phase = STATS_IDENTIFY;
+        break;
+    }
+}
+
+/***************************** PlanSend *********************************/
+static void PlanSend(void *Context, const void *Data, size_t Length)
+{
+    PLAN_LINK *Link = (PLAN_LINK *)Context;
+    const char *p = (const char *)Data;
+    EMU_STATE State = Link->Target->State;
+    int Line = State == EMU_AUTOBAUD || State == EMU_SYNC || State == EMU_OSC || State == EMU_COMMAND;
+    PLAN_ROW *Row;
+
+    if (Length == 0)
+    {
+        return;
+    }
+
+    if (Line && !Link->LineOpen)
+    {
+        PlanStartRow(Link, p, Length);
+    }
+
+    if (Link->nRows != 0)
+    {
+        Row = &Link->Rows[Link->nRows - 1];
+        Row->Tx += Length;
+        if (!Line)
+        {
+            Row->Data += Length;
+        }
+        if (Link->Target->Echo && State != EMU_AUTOBAUD && State != EMU_RUNNING)
+        {
+            Row->Echo += Length;
+        }
+    }
+
+    Link->LineOpen = Line && State != EMU_AUTOBAUD && p[Length - 1] != '\n';
+    Link->Sent = 1;
+    EmuHostWrite(Link->Target, Data, Length);
+}
+
+/***************************** PlanReceive ******************************/
+static unsigned long PlanReceive(void *Context, void *Data, unsigned long MaxLength)
+{
+    PLAN_LINK *Link = (PLAN_LINK *)Context;
+    unsigned long n;
+
+    n = EmuHostRead(Link->Target, Data, MaxLength);
+    if (n != 0 && Link->nRows != 0)
+    {
+        if (Link->Sent)
+        {
+            Link->Rows[Link->nRows - 1].RoundTrips++;
+            Link->Sent = 0;
+        }
+        Link->Rows[Link->nRows - 1].Rx += n;
+    }
+    return n;
+}
+
+static const ISP_TRANSPORT PlanTransport =
+{
+    PlanSend,
+    PlanReceive
+};
+
+/***************************** PlanOpen *********************************/
+/**  Selects the part of the dry run and puts the emulated target in place
+of the serial port.
+\return 0 on success, -1 if the part or the link model is not understood.
+*/
+int PlanOpen(ISP_ENVIRONMENT *IspEnvironment)
+{
+    double RoundTrip = 1000, Erase = 100, Program = 4;
+    unsigned long Baud;
+    char *End;
+
+    if (EmuSelectPart(IspEnvironment->DryRunPart) != 0)
+    {
+        return -1;
+    }
+
+    if (IspEnvironment->LinkModel != NULL)
+    {
+        RoundTrip = strtod(IspEnvironment->LinkModel, &End);
+        if (*End == ',')
+        {
+            Erase = strtod(End + 1, &End);
+        }
+        if (*End == ',')
+        {
+            Program = strtod(End + 1, &End);
+        }
+        if (*End != '\0' || RoundTrip < 0 || Erase < 0 || Program < 0)
+        {
+            DebugPrintf(1, "Invalid link model %s\n", IspEnvironment->LinkModel);
+            return -1;
+        }
+    }
+
+    Baud = strtoul(IspEnvironment->baud_rate, NULL, 10);
+    if (Baud == 0)
+    {
+        DebugPrintf(1, "Invalid baud rate %s\n", IspEnvironment->baud_rate);
+        return -1;
+    }
+
+    memset(&Plan, 0, sizeof(Plan));
+    Plan.Target      = EmuCreate(0);
+    Plan.Prepared    = -1;
+    Plan.ByteTime    = 10.0 / Baud;     // 8N1
+    Plan.RoundTrip   = RoundTrip / 1e6;
+    Plan.EraseTime   = Erase / 1e3;
+    Plan.ProgramTime = Program / 1e3;
+
+    IspEnvironment->Transport        = &PlanTransport;
+    IspEnvironment->TransportContext = &Plan;
+
+    DebugPrintf(2, "Dry run against an emulated %s, nothing is sent to %s.\n",
+                IspEnvironment->DryRunPart, IspEnvironment->serial_port);
+    return 0;
+}
+
+/***************************** PlanSectors ******************************/
+/**  Prints a list of sectors as ranges, with their total size.
+*/
+static void PlanSectors(const char *Title, const unsigned char *Flags, const unsigned char *Except,
+                        const LPC_DEVICE_TYPE *Part)
+{
+    unsigned long Bytes = 0;
+    unsigned i, First;
+    int Any = 0;
+
+    DebugPrintf(2, "%-11s", Title);
+    for (i = 0; i < Part->FlashSectors && i < PLAN_MAX_SECTORS; )
+    {
+        if (!Flags[i] || (Except != NULL && Except[i]))
+        {
+            i++;
+            continue;
+        }
+        First = i;
+        while (i < Part->FlashSectors && i < PLAN_MAX_SECTORS && Flags[i] && !(Except != NULL && Except[i]))
+        {
+            Bytes += Part->SectorTable[i];
+            i++;
+        }
+        if (First == i - 1)
+        {
+            DebugPrintf(2, "%s %u", Any ? "," : "", First);
+        }
+        else
+        {
+            DebugPrintf(2, "%s %u-%u", Any ? "," : "", First, i - 1);
+        }
+        Any = 1;
+    }
+    if (Any)
+    {
+        DebugPrintf(2, " (%lu KiB)\n", Bytes / 1024);
+    }
+    else
+    {
+        DebugPrintf(2, " none\n");
+    }
+}
+
+/***************************** PlanReport *******************************/
+/**  Prints the plan of the dry run and the predicted flash time, and
+releases the emulated target.
+\param [in] Result the result of the download.
+*/
+void PlanReport(ISP_ENVIRONMENT *IspEnvironment, int Result)
+{
+    PLAN_LINK *Link = &Plan;
+    const LPC_DEVICE_TYPE *Part = &LPCtypes[IspEnvironment->DetectedDevice];
+    double PhaseTime[STATS_PHASES];
+    double Total = 0;
+    unsigned long Tx = 0, Rx = 0, Data = 0, Echo = 0, RoundTrips = 0;
+    unsigned i;
+    int p;
+
+    PlanEndRow(Link, '\0');
+
+    memset(PhaseTime, 0, sizeof(PhaseTime));
+    DebugPrintf(2, "\nPlan for %s (0x%08lX), %lu bytes at %s baud:\n",
+                Part->Product, Part->id, IspEnvironment->BinaryLength, IspEnvironment->baud_rate);
+    DebugPrintf(2, "  %-9s %-28s %8s %8s %5s %10s\n", "phase", "command", "tx", "rx", "turns", "ms");
+    for (i = 0; i < Link->nRows; i++)
+    {
+        const PLAN_ROW *Row = &Link->Rows[i];
+
+        DebugPrintf(2, "  %-9s %-28s %8lu %8lu %5lu %10.3f\n", PlanPhaseName[Row->Phase], Row->Text,
+                    Row->Tx, Row->Rx, Row->RoundTrips, Row->Time * 1e3);
+        PhaseTime[Row->Phase] += Row->Time;
+        Total      += Row->Time;
+        Tx         += Row->Tx;
+        Rx         += Row->Rx;
+        Data       += Row->Data;
+        Echo       += Row->Echo;
+        RoundTrips += Row->RoundTrips;
+    }
+
+    DebugPrintf(2, "\n");
+    PlanSectors("Erase:", Link->Erased, NULL, Part);
+    PlanSectors("Program:", Link->Copied, NULL, Part);
+    PlanSectors("Skip 0xFF:", Link->Visited, Link->Copied, Part);
+
+    DebugPrintf(2, "Wire:      tx %lu bytes: %lu written to RAM, %lu uuencode, line end and\n"
+                   "           checksum overhead, %lu commands; rx %lu bytes: %lu echo,\n"
+                   "           %lu answers; %lu round trips, %lu bytes copied to flash\n",
+                Tx, Link->Payload, Data > Link->Payload ? Data - Link->Payload : 0, Tx - Data,
+                Rx, Echo, Rx - Echo, RoundTrips, Link->Programmed);
+    DebugPrintf(2, "Model:     %s baud, round trip %.3f ms, erase %.1f ms per sector, program %.1f ms per KiB\n",
+                IspEnvironment->baud_rate, Link->RoundTrip * 1e3, Link->EraseTime * 1e3, Link->ProgramTime * 1e3);
+    DebugPrintf(2, "Predicted flash time %.3f s:", Total);
+    for (p = STATS_SYNC; p < STATS_PHASES; p++)
+    {
+        DebugPrintf(2, " %s %.3f", PlanPhaseName[p], PhaseTime[p]);
+    }
+    DebugPrintf(2, "\n");
+
+    if (Result != 0)
+    {
+        DebugPrintf(1, "The dry run ended with error %d (0x%X), the plan is incomplete.\n", Result, Result);
+    }
+
+    free(Link->Rows);
+    EmuDestroy(Link->Target);
+    memset(Link, 0, sizeof(*Link));
+}
+
+#endif // DRYRUN_SUPPORT
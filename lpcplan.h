@@ -0,0 +1,62 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcplan.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+/* Dry run planner (-dryrun<part>).
+ *
+ * Runs the download against the emulated bootloader of lpcemu.c instead
+ * of a serial port, so no hardware is touched. <part> is a product name
+ * from LPCtypes or a part ID. Every ISP command NxpDownload sends is
+ * recorded with the bytes it puts on the wire in each direction (data
+ * lines, checksums and echo included) and the round trips it needs. At
+ * the end the plan is printed command by command, followed by the erased
+ * sectors, the sectors skipped because they are all 0xFF, and a flash
+ * time prediction per phase.
+ *
+ * The prediction uses a simple link model (-linkmodel<rtt>,<erase>,<prog>):
+ *
+ *   time = max(tx, rx) bytes * 10 bits / baud
+ *        + round trips * rtt (us, USB adapter and driver latency)
+ *        + erased sectors * erase (ms per sector)
+ *        + copied KiB * prog (ms per KiB written to flash)
+ *
+ * tx and rx overlap because the bootloader echoes while it receives.
+ */
+
+#if defined DRYRUN_SUPPORT
+
+int  PlanOpen(ISP_ENVIRONMENT *IspEnvironment);
+void PlanReport(ISP_ENVIRONMENT *IspEnvironment, int Result);
+
+#endif // DRYRUN_SUPPORT
@@ -42,301 +42,9 @@ Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.c
 
 #ifdef LPC_SUPPORT
 #include "lpcprog.h"
-
-static const unsigned int SectorTable_210x[] =
-{
-    8192, 8192, 8192, 8192, 8192, 8192, 8192, 8192,
-    8192, 8192, 8192, 8192, 8192, 8192, 8192
-};
-
-static const unsigned int SectorTable_2103[] =
-{
-    4096, 4096, 4096, 4096, 4096, 4096, 4096, 4096
-};
-
-static const unsigned int SectorTable_2109[] =
-{
-    8192, 8192, 8192, 8192, 8192, 8192, 8192, 8192
-};
-
-static const unsigned int SectorTable_211x[] =
-{
-    8192, 8192, 8192, 8192, 8192, 8192, 8192, 8192,
-    8192, 8192, 8192, 8192, 8192, 8192, 8192,
-};
-
-static const unsigned int SectorTable_212x[] =
-{
-    8192, 8192, 8192, 8192, 8192, 8192, 8192, 8192,
-    65536, 65536, 8192, 8192, 8192, 8192, 8192, 8192, 8192
-};
-
-// Used for devices with 500K (LPC2138 and LPC2148) and
-// for devices with 504K (1 extra 4k block at the end)
-static const unsigned int SectorTable_213x[] =
-{
-     4096,  4096,  4096,  4096,  4096,  4096,  4096,  4096,
-    32768, 32768, 32768, 32768, 32768, 32768, 32768, 32768,
-    32768, 32768, 32768, 32768, 32768, 32768,  4096,  4096,
-     4096,  4096,  4096,  4096
-};
-
-// Used for LPC11xx devices
-static const unsigned int SectorTable_11xx[] =
-{
-     4096,  4096,  4096,  4096,  4096,  4096,  4096,  4096,
-     4096,  4096,  4096,  4096,  4096,  4096,  4096,  4096,
-     4096,  4096,  4096,  4096,  4096,  4096,  4096,  4096,
-     4096,  4096,  4096,  4096,  4096,  4096,  4096,  4096
-};
-
-// Used for LPC17xx devices
-static const unsigned int SectorTable_17xx[] =
-{
-     4096,  4096,  4096,  4096,  4096,  4096,  4096,  4096,
-     4096,  4096,  4096,  4096,  4096,  4096,  4096,  4096,
-    32768, 32768, 32768, 32768, 32768, 32768, 32768, 32768,
-    32768, 32768, 32768, 32768, 32768, 32768
-};
-
-// Used for LPC18xx devices
-static const unsigned int SectorTable_18xx[] =
-{
-     8192,  8192,  8192,  8192,  8192,  8192,  8192,  8192,
-    65536, 65536, 65536, 65536, 65536, 65536, 65536
-};
-
-// Used for LPC43xx devices
-static const unsigned int SectorTable_43xx[] =
-{
-     8192,  8192,  8192,  8192,  8192,  8192,  8192,  8192,
-    65536, 65536, 65536, 65536, 65536, 65536, 65536
-};
-
-// Used for LPC8xx devices
-static const unsigned int SectorTable_8xx[] =
-{
-     1024,  1024,  1024,  1024,  1024,  1024,  1024,  1024,
-     1024,  1024,  1024,  1024,  1024,  1024,  1024,  1024
-};
-
-static int unsigned SectorTable_RAM[]  = { 65000 };
-
-static LPC_DEVICE_TYPE LPCtypes[] =
-{
-   { 0, 0, 0, 0, 0, 0, 0, 0, 0, CHIP_VARIANT_NONE },  /* unknown */
-
-   // id,        id2,  use id2, name of product,          flash size, ram size, total number of sector, max copy size, sector table, chip variant
-
-   { 0x00008100, 0x00000000, 0, "810M021FN8",                      4,   1,  4,  256, SectorTable_8xx,  CHIP_VARIANT_LPC8XX  },
-   { 0x00008110, 0x00000000, 0, "811M001FDH16",                    8,   2,  8, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX  },
-   { 0x00008120, 0x00000000, 0, "812M101FDH16",                   16,   4, 16, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX  },
-   { 0x00008121, 0x00000000, 0, "812M101FD20",                    16,   4, 16, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX  },
-   { 0x00008122, 0x00000000, 0, "812M101FDH20",                   16,   4, 16, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX  },
-
-   { 0x00008241, 0x00000000, 0, "824M201JHI33",                   32,   8, 32, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX },
-   { 0x00008221, 0x00000000, 0, "822M101JHI33",                   16,   4, 16, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX },
-   { 0x00008242, 0x00000000, 0, "824M201JDH20",                   32,   8, 32, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX },
-   { 0x00008222, 0x00000000, 0, "822M101JDH20",                   16,   4, 16, 1024, SectorTable_8xx,  CHIP_VARIANT_LPC8XX },
-
-   { 0x2500102B, 0x00000000, 0, "1102",                           32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-
-   { 0x0A07102B, 0x00000000, 0, "1110.../002",                     4,   1,  1, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x1A07102B, 0x00000000, 0, "1110.../002",                     4,   1,  1, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0A16D02B, 0x00000000, 0, "1111.../002",                     8,   2,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x1A16D02B, 0x00000000, 0, "1111.../002",                     8,   2,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x041E502B, 0x00000000, 0, "1111.../101",                     8,   2,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2516D02B, 0x00000000, 0, "1111.../102",                     8,   2,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00010013, 0x00000000, 0, "1111.../103",                     8,   2,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0416502B, 0x00000000, 0, "1111.../201",                     8,   4,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2516902B, 0x00000000, 0, "1111.../202",                     8,   4,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00010012, 0x00000000, 0, "1111.../203",                     8,   4,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x042D502B, 0x00000000, 0, "1112.../101",                    16,   2,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2524D02B, 0x00000000, 0, "1112.../102",                    16,   2,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0A24902B, 0x00000000, 0, "1112.../102",                    16,   4,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x1A24902B, 0x00000000, 0, "1112.../102",                    16,   4,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00020023, 0x00000000, 0, "1112.../103",                    16,   2,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0425502B, 0x00000000, 0, "1112.../201",                    16,   4,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2524902B, 0x00000000, 0, "1112.../202",                    16,   4,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00020022, 0x00000000, 0, "1112.../203",                    16,   4,  4, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0434502B, 0x00000000, 0, "1113.../201",                    24,   4,  6, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2532902B, 0x00000000, 0, "1113.../202",                    24,   4,  6, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00030032, 0x00000000, 0, "1113.../203",                    24,   4,  6, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0434102B, 0x00000000, 0, "1113.../301",                    24,   8,  6, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2532102B, 0x00000000, 0, "1113.../302",                    24,   8,  6, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00030030, 0x00000000, 0, "1113.../303",                    24,   8,  6, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0A40902B, 0x00000000, 0, "1114.../102",                    32,   4,  8, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x1A40902B, 0x00000000, 0, "1114.../102",                    32,   4,  8, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0444502B, 0x00000000, 0, "1114.../201",                    32,   4,  8, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2540902B, 0x00000000, 0, "1114.../202",                    32,   4,  8, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00040042, 0x00000000, 0, "1114.../203",                    32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x0444102B, 0x00000000, 0, "1114.../301",                    32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x2540102B, 0x00000000, 0, "1114.../302",                    32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00040040, 0x00000000, 0, "1114.../303",                    32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00040060, 0x00000000, 0, "1114.../323",                    32,   8, 12, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00040070, 0x00000000, 0, "1114.../333",                    32,   8, 14, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x00050080, 0x00000000, 0, "1115.../303",                    64,   8, 16, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-
-   { 0x1421102B, 0x00000000, 0, "11C12.../301",                   16,   8,  4, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x1440102B, 0x00000000, 0, "11C14.../301",                   32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x1431102B, 0x00000000, 0, "11C22.../301",                   16,   8,  4, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-   { 0x1430102B, 0x00000000, 0, "11C24.../301",                   32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX },
-
-   { 0x293E902B, 0x00000000, 0, "11E11FHN33/101",                  8,   4,  2, 1024, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10518 Rev. 3 -- 25 Nov 2013 */
-   { 0x2954502B, 0x00000000, 0, "11E12FBD48/201",                 16,   6,  4, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10518 Rev. 3 -- 25 Nov 2013 */
-   { 0x296A102B, 0x00000000, 0, "11E13FBD48/301",                 24,   8,  6, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10518 Rev. 3 -- 25 Nov 2013 */
-   { 0x2980102B, 0x00000000, 0, "11E14(FHN33,FBD48,FBD64)/401",   32,  10,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10518 Rev. 3 -- 25 Nov 2013 */
-   { 0x00009C41, 0x00000000, 0, "11E36(FBD64,FHN33)/501",         96,  12, 24, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10518 Rev. 3 -- 25 Nov 2013 */
-   { 0x00007C45, 0x00000000, 0, "11E37HFBD64/401",               128,  10, 32, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10518 Rev. 3 -- 25 Nov 2013 */
-   { 0x00007C41, 0x00000000, 0, "11E37(FBD48,FBD64)/501",        128,  12, 32, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10518 Rev. 3 -- 25 Nov 2013 */
-
-   { 0x095C802B, 0x00000000, 0, "11U12(FHN33,FBD48)/201",         16,   6,  4, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x295C802B, 0x00000000, 0, "11U12(FHN33,FBD48)/201",         16,   6,  4, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x097A802B, 0x00000000, 0, "11U13FBD48/201",                 24,   6,  6, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x297A802B, 0x00000000, 0, "11U13FBD48/201",                 24,   6,  6, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x0998802B, 0x00000000, 0, "11U14FHN33/201",                 32,   6,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x2998802B, 0x00000000, 0, "11U14(FHN,FHI)33/201",           32,   6,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x0998802B, 0x00000000, 0, "11U14(FBD,FET)48/201",           32,   6,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x2998802B, 0x00000000, 0, "11U14(FBD,FET)48/201",           32,   6,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x2972402B, 0x00000000, 0, "11U23FBD48/301",                 24,   8,  6, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x2988402B, 0x00000000, 0, "11U24(FHI33,FBD48,FET48)/301",   32,   8,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x2980002B, 0x00000000, 0, "11U24(FHN33,FBD48,FBD64)/401",   32,  10,  8, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x0003D440, 0x00000000, 0, "11U34(FHN33,FBD48)/311",         40,   8, 10, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x0001CC40, 0x00000000, 0, "11U34(FHN33,FBD48)/421",         48,  10, 12, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x0001BC40, 0x00000000, 0, "11U35(FHN33,FBD48,FBD64)/401",   64,  10, 16, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x0000BC40, 0x00000000, 0, "11U35(FHI33,FET48)/501",         64,  12, 16, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x00019C40, 0x00000000, 0, "11U36(FBD48,FBD64)/401",         96,  10, 24, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x00017C40, 0x00000000, 0, "11U37FBD48/401",                128,  10, 32, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x00007C44, 0x00000000, 0, "11U37HFBD64/401",               128,  10, 32, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-   { 0x00007C40, 0x00000000, 0, "11U37FBD64/501",                128,  12, 32, 4096, SectorTable_11xx, CHIP_VARIANT_LPC11XX }, /* From UM10462 Rev. 5 -- 20 Nov 2013 */
-
-   { 0x3640C02B, 0x00000000, 0, "1224.../101",                    32,   8,  4, 2048, SectorTable_17xx, CHIP_VARIANT_LPC11XX },
-   { 0x3642C02B, 0x00000000, 0, "1224.../121",                    48,  12, 32, 4096, SectorTable_17xx, CHIP_VARIANT_LPC11XX },
-   { 0x3650002B, 0x00000000, 0, "1225.../301",                    64,  16, 32, 4096, SectorTable_17xx, CHIP_VARIANT_LPC11XX },
-   { 0x3652002B, 0x00000000, 0, "1225.../321",                    80,  20, 32, 4096, SectorTable_17xx, CHIP_VARIANT_LPC11XX },
-   { 0x3660002B, 0x00000000, 0, "1226",                           96,  24, 32, 4096, SectorTable_17xx, CHIP_VARIANT_LPC11XX },
-   { 0x3670002B, 0x00000000, 0, "1227",                          128,  32, 32, 4096, SectorTable_17xx, CHIP_VARIANT_LPC11XX },
-
-   { 0x2C42502B, 0x00000000, 0, "1311",                            8,   4,  2, 1024, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x1816902B, 0x00000000, 0, "1311/01",                         8,   4,  2, 1024, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x2C40102B, 0x00000000, 0, "1313",                           32,   8,  8, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x1830102B, 0x00000000, 0, "1313/01",                        32,   8,  8, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x3A010523, 0x00000000, 0, "1315",                           32,   8,  8, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x1A018524, 0x00000000, 0, "1316",                           48,   8, 12, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x1A020525, 0x00000000, 0, "1317",                           64,   8, 16, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x3D01402B, 0x00000000, 0, "1342",                           16,   4,  4, 1024, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x3D00002B, 0x00000000, 0, "1343",                           32,   8,  8, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x28010541, 0x00000000, 0, "1345",                           32,   8,  8, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x08018542, 0x00000000, 0, "1346",                           48,   8, 12, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-   { 0x08020543, 0x00000000, 0, "1347",                           64,   8, 16, 4096, SectorTable_17xx, CHIP_VARIANT_LPC13XX },
-
-   { 0x25001118, 0x00000000, 0, "1751",                           32,   8,  8, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x25001121, 0x00000000, 0, "1752",                           64,  16, 16, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x25011722, 0x00000000, 0, "1754",                          128,  32, 18, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x25011723, 0x00000000, 0, "1756",                          256,  32, 22, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x25013F37, 0x00000000, 0, "1758",                          512,  64, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x25113737, 0x00000000, 0, "1759",                          512,  64, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x26012033, 0x00000000, 0, "1763",                          256,  64, 22, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x26011922, 0x00000000, 0, "1764",                          128,  32, 18, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x26013733, 0x00000000, 0, "1765",                          256,  64, 22, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x26013F33, 0x00000000, 0, "1766",                          256,  64, 22, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x26012837, 0x00000000, 0, "1767",                          512,  64, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x26013F37, 0x00000000, 0, "1768",                          512,  64, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x26113F37, 0x00000000, 0, "1769",                          512,  64, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-
-   { 0x27011132, 0x00000000, 0, "1774",                          128,  40, 18, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x27191F43, 0x00000000, 0, "1776",                          256,  80, 22, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x27193747, 0x00000000, 0, "1777",                          512,  96, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x27193F47, 0x00000000, 0, "1778",                          512,  96, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x281D1743, 0x00000000, 0, "1785",                          256,  80, 22, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x281D1F43, 0x00000000, 0, "1786",                          256,  80, 22, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x281D3747, 0x00000000, 0, "1787",                          512,  96, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-   { 0x281D3F47, 0x00000000, 0, "1788",                          512,  96, 30, 4096, SectorTable_17xx, CHIP_VARIANT_LPC17XX },
-
-   // LPC18xx
-   { 0xF00B1B3F, 0x00000000, 1, "1810",                            0,  32,  0, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX }, // Flashless
-   { 0xF001D830, 0x00000000, 1, "1812",                          512,  32, 15, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001D830, 0x00000000, 1, "1813",                          512,  32, 11, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001D830, 0x00000000, 1, "1815",                          768,  32, 13, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001D830, 0x00000000, 1, "1817",                         1024,  32, 15, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF00A9B3C, 0x00000000, 1, "1820",                            0,  32,  0, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX }, // Flashless
-   { 0xF001D830, 0x00000000, 1, "1822",                          512,  32, 15, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001D830, 0x00000000, 1, "1823",                          512,  32, 11, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001D830, 0x00000000, 1, "1825",                          768,  32, 13, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001D830, 0x00000000, 1, "1827",                         1024,  32, 15, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF0009A30, 0x00000000, 1, "1830",                            0,  32,  0, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX }, // Flashless
-   { 0xF001DA30, 0x00000044, 1, "1833",                          512,  32, 11, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001DA30, 0x00000000, 1, "1837",                         1024,  32, 15, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF0009830, 0x00000000, 1, "1850",                            0,  32,  0, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX }, // Flashless
-   { 0xF001D830, 0x00000044, 1, "1853",                          512,  32, 11, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-   { 0xF001D830, 0x00000000, 1, "1857",                         1024,  32, 15, 8192, SectorTable_18xx, CHIP_VARIANT_LPC18XX },
-
-   { 0x0004FF11, 0x00000000, 0, "2103",                           32,   8,  8, 4096, SectorTable_2103, CHIP_VARIANT_LPC2XXX },
-   { 0xFFF0FF12, 0x00000000, 0, "2104",                          128,  16, 15, 8192, SectorTable_210x, CHIP_VARIANT_LPC2XXX },
-   { 0xFFF0FF22, 0x00000000, 0, "2105",                          128,  32, 15, 8192, SectorTable_210x, CHIP_VARIANT_LPC2XXX },
-   { 0xFFF0FF32, 0x00000000, 0, "2106",                          128,  64, 15, 8192, SectorTable_210x, CHIP_VARIANT_LPC2XXX },
-   { 0x0201FF01, 0x00000000, 0, "2109",                           64,   8,  8, 4096, SectorTable_2109, CHIP_VARIANT_LPC2XXX },
-   { 0x0101FF12, 0x00000000, 0, "2114",                          128,  16, 15, 8192, SectorTable_211x, CHIP_VARIANT_LPC2XXX },
-   { 0x0201FF12, 0x00000000, 0, "2119",                          128,  16, 15, 8192, SectorTable_211x, CHIP_VARIANT_LPC2XXX },
-   { 0x0101FF13, 0x00000000, 0, "2124",                          256,  16, 17, 8192, SectorTable_212x, CHIP_VARIANT_LPC2XXX },
-   { 0x0201FF13, 0x00000000, 0, "2129",                          256,  16, 17, 8192, SectorTable_212x, CHIP_VARIANT_LPC2XXX },
-   { 0x0002FF01, 0x00000000, 0, "2131",                           32,   8,  8, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0002FF11, 0x00000000, 0, "2132",                           64,  16,  9, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0002FF12, 0x00000000, 0, "2134",                          128,  16, 11, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0002FF23, 0x00000000, 0, "2136",                          256,  32, 15, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0002FF25, 0x00000000, 0, "2138",                          512,  32, 27, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0402FF01, 0x00000000, 0, "2141",                           32,   8,  8, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0402FF11, 0x00000000, 0, "2142",                           64,  16,  9, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0402FF12, 0x00000000, 0, "2144",                          128,  16, 11, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0402FF23, 0x00000000, 0, "2146",                          256,  40, 15, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0402FF25, 0x00000000, 0, "2148",                          512,  40, 27, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0301FF13, 0x00000000, 0, "2194",                          256,  16, 17, 8192, SectorTable_212x, CHIP_VARIANT_LPC2XXX },
-   { 0x0301FF12, 0x00000000, 0, "2210",                            0,  16,  0, 8192, SectorTable_211x, CHIP_VARIANT_LPC2XXX }, /* table is a "don't care" */
-   { 0x0401FF12, 0x00000000, 0, "2212",                          128,  16, 15, 8192, SectorTable_211x, CHIP_VARIANT_LPC2XXX },
-   { 0x0601FF13, 0x00000000, 0, "2214",                          256,  16, 17, 8192, SectorTable_212x, CHIP_VARIANT_LPC2XXX },
-   /*                           "2290"; same id as the LPC2210 */
-   { 0x0401FF13, 0x00000000, 0, "2292",                          256,  16, 17, 8192, SectorTable_212x, CHIP_VARIANT_LPC2XXX },
-   { 0x0501FF13, 0x00000000, 0, "2294",                          256,  16, 17, 8192, SectorTable_212x, CHIP_VARIANT_LPC2XXX },
-   { 0x1600F701, 0x00000000, 0, "2361",                          128,  34, 11, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 4.1 -- 5 Sep 2012 */
-   { 0x1600FF22, 0x00000000, 0, "2362",                          128,  34, 11, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 4.1 -- 5 Sep 2012 */
-   { 0x0603FB02, 0x00000000, 0, "2364",                          128,  34, 11, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 01 -- 6 July 2007 */
-   { 0x1600F902, 0x00000000, 0, "2364",                          128,  34, 11, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1600E823, 0x00000000, 0, "2365",                          256,  58, 15, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0603FB23, 0x00000000, 0, "2366",                          256,  58, 15, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 01 -- 6 July 2007 */
-   { 0x1600F923, 0x00000000, 0, "2366",                          256,  58, 15, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1600E825, 0x00000000, 0, "2367",                          512,  58, 15, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0603FB25, 0x00000000, 0, "2368",                          512,  58, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 01 -- 6 July 2007 */
-   { 0x1600F925, 0x00000000, 0, "2368",                          512,  58, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1700E825, 0x00000000, 0, "2377",                          512,  58, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x0703FF25, 0x00000000, 0, "2378",                          512,  58, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 01 -- 6 July 2007 */
-   { 0x1600FD25, 0x00000000, 0, "2378",                          512,  58, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 01 -- 29 October 2007 */
-   { 0x1700FD25, 0x00000000, 0, "2378",                          512,  58, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1700FF35, 0x00000000, 0, "2387",                          512,  98, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX }, /* From UM10211 Rev. 03 -- 25 August 2008 */
-   { 0x1800F935, 0x00000000, 0, "2387",                          512,  98, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1800FF35, 0x00000000, 0, "2388",                          512,  98, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1500FF35, 0x00000000, 0, "2458",                          512,  98, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1600FF30, 0x00000000, 0, "2460",                            0,  98,  0, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1600FF35, 0x00000000, 0, "2468",                          512,  98, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1701FF30, 0x00000000, 0, "2470",                            0,  98,  0, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-   { 0x1701FF35, 0x00000000, 0, "2478",                          512,  98, 28, 4096, SectorTable_213x, CHIP_VARIANT_LPC2XXX },
-
-   { 0xA00A8B3F, 0x00000000, 1, "4310",                            0, 168,  0, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* From UM10503 Rev. 1.4 -- 3 Sep 2012 */
-   { 0xA00BCB3F, 0x00000080, 1, "4312",                          512, 104, 15, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA00BCB3F, 0x00000044, 1, "4313",                          512, 104, 11, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA001CB3F, 0x00000022, 1, "4315",                          768, 136, 13, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA001CB3F, 0x00000000, 1, "4317",                         1024, 136, 15, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA0008B3C, 0x00000000, 1, "4320",                            0, 200,  0, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* From UM10503 Rev. 1.4 -- 3 Sep 2012 */
-   { 0xA00BCB3C, 0x00000080, 1, "4322",                          512, 104, 15, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA00BCB3C, 0x00000044, 1, "4323",                          512, 104, 11, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA001CB3C, 0x00000022, 1, "4325",                          768, 136, 13, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA001CB3C, 0x00000000, 1, "4327",                         1024, 136, 15, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA0000A30, 0x00000000, 1, "4330",                            0, 264,  0, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* From UM10503 Rev. 1.4 -- 3 Sep 2012 */
-   { 0xA001CA30, 0x00000044, 1, "4333",                          512, 512, 11, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA001CA30, 0x00000000, 1, "4337",                         1024, 512, 15, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* info not yet available */
-   { 0xA0000830, 0x00000000, 1, "4350",                            0, 264,  0, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* From UM10503 Rev. 1.4 -- 3 Sep 2012 */
-   { 0xA001C830, 0x00000044, 1, "4353",                          512, 512, 11, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }, /* From UM10503 Rev. 1.4 -- 3 Sep 2012 */
-   { 0xA001C830, 0x00000000, 1, "4357",                         1024, 512, 15, 4096, SectorTable_43xx, CHIP_VARIANT_LPC43XX }  /* From UM10503 Rev. 1.4 -- 3 Sep 2012 */
-};
+#include "lpcstats.h"
+#include "lpcsession.h"
+#include "lpcjournal.h"
 
 /***************************** NXP Download *********************************/
 /**  Download the file from the internal memory image to the NXP microcontroller.
@@ -365,7 +73,7 @@ FormatCommand can work in place, meaning that In==Out is allowed!
 \param [out] Out Pointer to output buffer.
 */
 
-static void FormatCommand(const char *In, char *Out)
+void FormatCommand(const char *In, char *Out)
 {
   size_t i, j;
   for (i = 0, j = 0; In[j] != '\0'; i++, j++)
@@ -393,23 +101,407 @@ static void FormatCommand(const char *In, char *Out)
   Out[i] = '\0';
 }
 
-static int SendAndVerify(ISP_ENVIRONMENT *IspEnvironment, const char *Command,
-                                 char *AnswerBuffer, int AnswerLength)
+/***************************** MatchStart ***********************************/
+/**  Starts matching an answer where it was received, with the same
+tolerance for line ends as FormatCommand, but without copying it: any
+run of <CR> and <LF> counts as one line end, leading ones are leftovers
+of a previous answer. MatchLine, MatchNumber and MatchSkipLine then each
+take one line, MatchDone tells whether that was all.
+\param [out] Match the cursor.
+\param [in] Answer the received bytes.
+\param [in] Length the number of bytes in Answer.
+*/
+void MatchStart(ANSWER_MATCH *Match, const char *Answer, unsigned long Length)
+{
+    Match->Pos = Answer;
+    Match->End = Answer + Length;
+    while (Match->Pos < Match->End && (*Match->Pos == '\r' || *Match->Pos == '\n'))
+    {
+        Match->Pos++;
+    }
+}
+
+/***************************** MatchLineEnd *********************************/
+/**  Takes the line end at the cursor.
+\return 1 if there was one, 0 else.
+*/
+static int MatchLineEnd(ANSWER_MATCH *Match)
+{
+    if (Match->Pos == Match->End || (*Match->Pos != '\r' && *Match->Pos != '\n'))
+    {
+        return 0;
+    }
+    do
+    {
+        Match->Pos++;
+    } while (Match->Pos < Match->End && (*Match->Pos == '\r' || *Match->Pos == '\n'));
+    return 1;
+}
+
+/***************************** MatchLine ************************************/
+/**  Takes the next line of the answer if it is the given one, e.g. the
+echo of a command as it was sent.
+\param [in,out] Match the cursor.
+\param [in] Line the expected text, up to its first <CR>, <LF> or NUL.
+\return 1 if the line matched, 0 else.
+*/
+int MatchLine(ANSWER_MATCH *Match, const char *Line)
+{
+    while (*Line != '\0' && *Line != '\r' && *Line != '\n')
+    {
+        if (Match->Pos == Match->End || *Match->Pos != *Line)
+        {
+            return 0;
+        }
+        Match->Pos++;
+        Line++;
+    }
+    return MatchLineEnd(Match);
+}
+
+/***************************** MatchNumber **********************************/
+/**  Takes the next line of the answer if it is a decimal number, e.g. a
+return code or a checksum.
+\param [in,out] Match the cursor.
+\param [out] Value the number.
+\return 1 if the line was a number of at most MATCH_DIGITS digits, 0 else.
+*/
+int MatchNumber(ANSWER_MATCH *Match, unsigned long *Value)
+{
+    int Digits;
+
+    *Value = 0;
+    for (Digits = 0; Match->Pos < Match->End && *Match->Pos >= '0' && *Match->Pos <= '9'; Digits++)
+    {
+        if (Digits == MATCH_DIGITS)
+        {
+            return 0;
+        }
+        *Value = *Value * 10 + (*Match->Pos - '0');
+        Match->Pos++;
+    }
+    return Digits != 0 && MatchLineEnd(Match);
+}
+
+/***************************** MatchSkipLine ********************************/
+/**  Takes the next line of the answer, whatever it is.
+\return 1 if it was complete, 0 else.
+*/
+int MatchSkipLine(ANSWER_MATCH *Match)
+{
+    while (Match->Pos < Match->End && *Match->Pos != '\r' && *Match->Pos != '\n')
+    {
+        Match->Pos++;
+    }
+    return MatchLineEnd(Match);
+}
+
+/***************************** MatchDone ************************************/
+/**  \return 1 if the whole answer has been matched, 0 else.
+*/
+int MatchDone(const ANSWER_MATCH *Match)
+{
+    return Match->Pos == Match->End;
+}
+
+/***************************** UuencodeLine *********************************/
+/**  Uuencodes one line of a data transfer to RAM and adds its bytes to the
+checksum of the current block.
+\param [out] Out buffer for the line, at least 4 * ((Length + 2) / 3) + 4 bytes.
+\param [in] Data the bytes to encode.
+\param [in] Length the number of bytes, at most 45.
+\param [in,out] Checksum the running sum of the bytes of the block.
+\return the length of the line including <CR><LF>.
+*/
+int UuencodeLine(char *Out, const BINARY *Data, unsigned Length, unsigned long *Checksum)
+{
+    static const char uuencode_table[64] =    // 0x20 is translated to 0x60 !
+        "`!\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_";
+    unsigned long k;
+    unsigned long sum = 0;
+    unsigned i;
+    int Pos = 0;
+
+    Out[Pos++] = uuencode_table[Length];      // Encode Length of block
+
+    for (i = 0; i < Length; i += 3)    // Collecting always 3 Bytes, then do processing in 4 Bytes
+    {
+        k = (unsigned long)Data[i] << 16;
+        sum += Data[i];
+        if (i + 1 < Length)
+        {
+            k |= (unsigned long)Data[i + 1] << 8;
+            sum += Data[i + 1];
+        }
+        if (i + 2 < Length)
+        {
+            k |= Data[i + 2];
+            sum += Data[i + 2];
+        }
+
+        Out[Pos++] = uuencode_table[(k >> 18) & 63];
+        Out[Pos++] = uuencode_table[(k >> 12) & 63];
+        Out[Pos++] = uuencode_table[(k >>  6) & 63];
+        Out[Pos++] = uuencode_table[ k        & 63];
+    }
+
+    Out[Pos++] = '\r';
+    Out[Pos++] = '\n';
+    Out[Pos] = '\0';
+
+    *Checksum += sum;
+    return Pos;
+}
+
+/***************************** ImageBlock *******************************/
+/**  Returns the image data to send for a block, with the patched vector
+table checksum laid over it. The image itself is left untouched, so one
+image can be shared by several sessions.
+\param [in] Pos offset of the block in the image.
+\param [in,out] Length number of bytes wanted; may be reduced to
+BufferSize if the block has to be copied.
+\param [out] Buffer space for a copy of the block.
+\param [in] BufferSize size of Buffer.
+\return pointer to the data of the block.
+*/
+static const BINARY *ImageBlock(ISP_ENVIRONMENT *IspEnvironment, unsigned long Pos,
+                                unsigned long *Length, BINARY *Buffer, unsigned long BufferSize)
+{
+    unsigned long Patch = IspEnvironment->VectorPatchOffset;
+    unsigned long i;
+
+    if (Patch == 0 || Pos >= Patch + 4 || Pos + *Length <= Patch)
+    {
+        return &IspEnvironment->BinaryContent[Pos];
+    }
+
+    if (*Length > BufferSize)
+    {
+        *Length = BufferSize;
+    }
+
+    memcpy(Buffer, &IspEnvironment->BinaryContent[Pos], *Length);
+    for (i = 0; i < 4; i++)
+    {
+        if (Patch + i >= Pos && Patch + i < Pos + *Length)
+        {
+            Buffer[Patch + i - Pos] = IspEnvironment->VectorPatch[i];
+        }
+    }
+
+    return Buffer;
+}
+
+/***************************** ImageByte ********************************/
+/**  Returns one byte of the image data to send, see ImageBlock.
+\param [in] Pos offset of the byte in the image.
+*/
+static BINARY ImageByte(ISP_ENVIRONMENT *IspEnvironment, unsigned long Pos)
+{
+    unsigned long Patch = IspEnvironment->VectorPatchOffset;
+
+    if (Patch != 0 && Pos >= Patch && Pos < Patch + 4)
+    {
+        return IspEnvironment->VectorPatch[Pos - Patch];
+    }
+
+    return IspEnvironment->BinaryContent[Pos];
+}
+
+#if !defined COMPILE_FOR_LPC21
+
+/***************************** NxpLatencyModel **************************/
+/**  Finds the latency model of a kind of answer, or starts a new one.
+\param [in] Class the kind of answer.
+\param [in] Bytes size erased, copied or compared, 0 for the other kinds.
+\return the model, NULL if all of them are in use.
+*/
+static LATENCY_MODEL *NxpLatencyModel(ISP_ENVIRONMENT *IspEnvironment, LATENCY_CLASS Class, unsigned long Bytes)
+{
+    LATENCY_MODEL *Model, *Free = NULL;
+    int i;
+
+    for (i = 0; i < LATENCY_MODELS; i++)
+    {
+        Model = &IspEnvironment->Latency[i];
+        if (Model->Count == 0)
+        {
+            if (Free == NULL)
+            {
+                Free = Model;
+            }
+        }
+        else if (Model->Class == Class && Model->Bytes == Bytes)
+        {
+            return Model;
+        }
+    }
+
+    if (Free != NULL)
+    {
+        Free->Class = Class;
+        Free->Bytes = Bytes;
+    }
+    return Free;
+}
+
+/***************************** NxpTimeout *******************************/
+/**  Timeout for an answer. With -timeouts the mean latency plus
+TIMEOUT_DEVIATIONS times its mean deviation, both smoothed the way TCP
+does for its retransmission timer, within the limits of -timeouts. The
+ceiling without -timeouts and until the model has seen enough answers.
+\param [in] Model latency model of the answer, may be NULL.
+\return the timeout in milliseconds.
+*/
+static unsigned NxpTimeout(ISP_ENVIRONMENT *IspEnvironment, const LATENCY_MODEL *Model)
+{
+    unsigned Floor   = IspEnvironment->TimeoutFloor;
+    unsigned Ceiling = IspEnvironment->TimeoutCeiling != 0 ? IspEnvironment->TimeoutCeiling : TIMEOUT_CEILING_MS;
+    unsigned long Timeout;
+
+    if (Floor == 0 || Model == NULL || Model->Count < TIMEOUT_SAMPLES)
+    {
+        return Ceiling;
+    }
+
+    Timeout = (Model->Mean + TIMEOUT_DEVIATIONS * Model->Deviation + 999) / 1000;
+    if (Timeout < Floor)
+    {
+        Timeout = Floor;
+    }
+    if (Timeout > Ceiling)
+    {
+        Timeout = Ceiling;
+    }
+    return (unsigned)Timeout;
+}
+
+/***************************** NxpLatencyAdd ****************************/
+/**  Adds the latency of an answer to its model.
+\param [in] Latency time from sending to the complete answer (us).
+*/
+static void NxpLatencyAdd(LATENCY_MODEL *Model, unsigned long Latency)
+{
+    unsigned long Difference;
+
+    if (Model->Count++ == 0)
+    {
+        Model->Mean      = Latency;
+        Model->Deviation = Latency / 2;
+        return;
+    }
+
+    Difference = Latency > Model->Mean ? Latency - Model->Mean : Model->Mean - Latency;
+    Model->Deviation = Model->Deviation - Model->Deviation / 4 + Difference / 4;
+    Model->Mean      = Model->Mean - Model->Mean / 8 + Latency / 8;
+}
+
+/***************************** NxpLineEnds ******************************/
+/**  Counts the line ends of an answer: <LF>, and <CR> not followed by one.
+Unlike ReceiveComPort, a <LF> whose <CR> got lost on the line counts.
+\return the number of lines.
+*/
+static unsigned long NxpLineEnds(const char *Answer, unsigned long Length)
+{
+    unsigned long Pos, Lines = 0;
+
+    for (Pos = 0; Pos < Length; Pos++)
+    {
+        if (Answer[Pos] == '\n' || (Answer[Pos] == '\r' && (Pos + 1 == Length || Answer[Pos + 1] != '\n')))
+        {
+            Lines++;
+        }
+    }
+    return Lines;
+}
+
+/***************************** NxpReceive *******************************/
+/**  ReceiveComPort with the timeout learned for this kind of answer, the
+target is taken as gone if the answer isn't complete by then. Except for
+an answer that has been echoed: the target is just slower than learned
+(e.g. the flash, or a stall of the host or the USB adapter), the rest may
+take up to the ceiling of -timeouts, and its latency widens the model.
+An answer that doesn't complete at all doubles the learned timeout.
+\param [in] Class the kind of answer.
+\param [in] Bytes size erased, copied or compared, 0 for the other kinds.
+\param [in] Start IspClock time the command or data was sent.
+*/
+static void NxpReceive(ISP_ENVIRONMENT *IspEnvironment, char *Answer, unsigned long MaxSize,
+                       unsigned long *RealSize, unsigned long WantedNr0x0A,
+                       LATENCY_CLASS Class, unsigned long Bytes, unsigned long long Start)
+{
+    LATENCY_MODEL *Model = NxpLatencyModel(IspEnvironment, Class, Bytes);
+    unsigned Timeout = NxpTimeout(IspEnvironment, Model);
+    unsigned long More, Lines;
+
+    ReceiveComPort(IspEnvironment, Answer, MaxSize, RealSize, WantedNr0x0A, Timeout);
+
+    // Target still busy after the echo
+    Lines = NxpLineEnds(Answer, *RealSize);
+    if (Lines != 0 && Lines < WantedNr0x0A && *RealSize < MaxSize &&
+        (Answer[*RealSize - 1] == '\n' || Answer[*RealSize - 1] == '\r') &&
+        Timeout < NxpTimeout(IspEnvironment, NULL))
+    {
+        DebugPrintf(3, "Answer incomplete after %u ms, waiting longer\n", Timeout);
+        ReceiveComPort(IspEnvironment, Answer + *RealSize, MaxSize - *RealSize, &More,
+                       WantedNr0x0A - Lines, NxpTimeout(IspEnvironment, NULL) - Timeout);
+        *RealSize += More;
+        Lines = NxpLineEnds(Answer, *RealSize);
+    }
+
+    // Only complete answers tell how long the target takes. A missing
+    // one doubles the timeout, in case it was too short, the following
+    // answers bring it down again.
+    if (Model != NULL && Lines >= WantedNr0x0A)
+    {
+        NxpLatencyAdd(Model, (unsigned long)(IspClock() - Start));
+    }
+    else if (Model != NULL && Model->Count != 0 && Timeout < NxpTimeout(IspEnvironment, NULL))
+    {
+        Model->Mean = 2000UL * Timeout;
+        DebugPrintf(3, "No complete answer after %u ms, now waiting %u ms\n", Timeout, NxpTimeout(IspEnvironment, Model));
+    }
+}
+
+#endif // !defined COMPILE_FOR_LPC21
+
+/***************************** NxpSendAndVerify *************************/
+/**  Sends a command and checks that it was echoed and answered with 0.
+\param [in] Class the kind of answer, for its timeout.
+\param [in] Bytes size erased, copied or compared, 0 for the other kinds.
+\return 1 if the answer was as expected, 0 else.
+*/
+static int NxpSendAndVerify(ISP_ENVIRONMENT *IspEnvironment, const char *Command,
+                            char *AnswerBuffer, int AnswerLength,
+                            LATENCY_CLASS Class, unsigned long Bytes)
 {
     unsigned long realsize;
-    int cmdlen;
-    char *FormattedCommand;
+    unsigned long Status;
+    ANSWER_MATCH Match;
+#if !defined COMPILE_FOR_LPC21
+    unsigned long long Start;
+#endif
 
+    StatsCommand(IspEnvironment, Command);
+#if !defined COMPILE_FOR_LPC21
+    Start = IspClock();
+    SendComPort(IspEnvironment, Command);
+    NxpReceive(IspEnvironment, AnswerBuffer, AnswerLength - 1, &realsize, 2, Class, Bytes, Start);
+#else
     SendComPort(IspEnvironment, Command);
     ReceiveComPort(IspEnvironment, AnswerBuffer, AnswerLength - 1, &realsize, 2, 5000);
+#endif
+    StatsAnswer(IspEnvironment);
 
-    cmdlen = strlen(Command);
-    FormattedCommand = (char *)alloca(cmdlen+1);
-    FormatCommand(Command, FormattedCommand);
-    FormatCommand(AnswerBuffer, AnswerBuffer);
-    cmdlen = strlen(FormattedCommand);
-    return (strncmp(AnswerBuffer, FormattedCommand, cmdlen) == 0
-        && strcmp(AnswerBuffer + cmdlen, "0\n") == 0);
+    MatchStart(&Match, AnswerBuffer, realsize);
+    return MatchLine(&Match, Command) && MatchNumber(&Match, &Status) && Status == 0
+        && MatchDone(&Match);
+}
+
+static int SendAndVerify(ISP_ENVIRONMENT *IspEnvironment, const char *Command,
+                                 char *AnswerBuffer, int AnswerLength)
+{
+    return NxpSendAndVerify(IspEnvironment, Command, AnswerBuffer, AnswerLength, LATENCY_COMMAND, 0);
 }
 
 
@@ -529,37 +621,28 @@ static void NxpOutputErrorMessage(unsigned char ErrorNumber)
 /**  Find error number in string.  This will normally be the string
 returned from the microcontroller.
 \param [in] Answer the buffer to search for the error number.
-\return the error number found, if no linefeed found before the end of the
+\return the error number found, if no line end found before the end of the
 string an error value of 255 is returned. If a non-numeric value is found
 then it is printed to stdout and an error value of 255 is returned.
 */
 static unsigned char GetAndReportErrorNumber(const char *Answer)
 {
     unsigned char Result = 0xFF;                            // Error !!!
-    unsigned int i = 0;
+    unsigned long Value;
+    ANSWER_MATCH Match;
 
-    while (1)
+    // The number follows the echo of the command
+    MatchStart(&Match, Answer, strlen(Answer));
+    if (MatchSkipLine(&Match))
     {
-        if (Answer[i] == 0x00)
+        if (!MatchDone(&Match) && !isdigit((unsigned char)*Match.Pos))
         {
-            break;
+            DebugPrintf(1, "ErrorString: %s", Match.Pos);
         }
-
-        if (Answer[i] == 0x0a)
+        else if (MatchNumber(&Match, &Value))
         {
-            i++;
-
-            if (Answer[i] < '0' || Answer[i] > '9')
-            {
-                DebugPrintf(1, "ErrorString: %s", &Answer[i]);
-                break;
-            }
-
-            Result = (unsigned char) (atoi(&Answer[i]));
-            break;
+            Result = (unsigned char)Value;
         }
-
-        i++;
     }
 
     NxpOutputErrorMessage(Result);
@@ -568,87 +651,97 @@ static unsigned char GetAndReportErrorNumber(const char *Answer)
 }
 
 
-int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
+/***************************** SyncMatch ******************************/
+/**  Looks for the answer to '?' in what has been received so far. Line
+noise and autobaud garbage in front of it are skipped.
+\param [in,out] Answer the received bytes, NUL bytes are removed.
+\param [in,out] Size the number of bytes in Answer.
+\retval 1 "Synchronized" and a line end have been received.
+\retval 0 Answer ends with the beginning of "Synchronized", more is to come.
+\retval -1 no answer.
+*/
+static int SyncMatch(char *Answer, unsigned long *Size)
 {
-    unsigned long realsize;
-    char Answer[128];
-    char ExpectedAnswer[128];
-    char temp[128];
-    /*const*/ char *strippedAnswer, *endPtr;
-    int  strippedsize;
-    int nQuestionMarks;
-    int found;
-    unsigned long Sector;
-    unsigned long SectorLength;
-    unsigned long SectorStart, SectorOffset, SectorChunk;
-    char tmpString[128];
-    char uuencode_table[64];
-    int Line;
-    unsigned long tmpStringPos;
-    unsigned long BlockOffset;
-    unsigned long Block;
-    unsigned long Pos;
-    unsigned long Id[2];
-    unsigned long Id1Masked;
-    unsigned long CopyLength;
-    int c,k=0,i;
-    unsigned long ivt_CRC;          // CRC over interrupt vector table
-    unsigned long block_CRC;
-    time_t tStartUpload=0, tDoneUpload=0;
-    char tmp_string[64];
-    char * cmdstr;
+    static const char Expected[] = "Synchronized\r\n";
+    const char *Found;
+    unsigned long i, n;
 
-#if !defined COMPILE_FOR_LPC21
+    for (i = n = 0; i < *Size; i++)
+    {
+        if (Answer[i] != '\0')
+        {
+            Answer[n++] = Answer[i];
+        }
+    }
+    Answer[n] = '\0';
+    *Size = n;
 
-#if defined __BORLANDC__
-#define local_static static
-#else
-#define local_static
-#endif
+    for (Found = strstr(Answer, "Synchronized"); Found != NULL; Found = strstr(Found + 1, "Synchronized"))
+    {
+        if (Found[12] == '\r' || Found[12] == '\n')
+        {
+            return 1;
+        }
+    }
 
-//    char * cmdstr;
-    int repeat = 0;
-    // Puffer for data to resend after "RESEND\r\n" Target responce
-    local_static char sendbuf0[128];
-    local_static char sendbuf1[128];
-    local_static char sendbuf2[128];
-    local_static char sendbuf3[128];
-    local_static char sendbuf4[128];
-    local_static char sendbuf5[128];
-    local_static char sendbuf6[128];
-    local_static char sendbuf7[128];
-    local_static char sendbuf8[128];
-    local_static char sendbuf9[128];
-    local_static char sendbuf10[128];
-    local_static char sendbuf11[128];
-    local_static char sendbuf12[128];
-    local_static char sendbuf13[128];
-    local_static char sendbuf14[128];
-    local_static char sendbuf15[128];
-    local_static char sendbuf16[128];
-    local_static char sendbuf17[128];
-    local_static char sendbuf18[128];
-    local_static char sendbuf19[128];
-
-    char * sendbuf[20] = {    sendbuf0,  sendbuf1,  sendbuf2,  sendbuf3,  sendbuf4,
-                              sendbuf5,  sendbuf6,  sendbuf7,  sendbuf8,  sendbuf9,
-                              sendbuf10, sendbuf11, sendbuf12, sendbuf13, sendbuf14,
-                              sendbuf15, sendbuf16, sendbuf17, sendbuf18, sendbuf19};
+    for (i = n > sizeof(Expected) - 1 ? n - (sizeof(Expected) - 1) : 0; i < n; i++)
+    {
+        if (strncmp(&Answer[i], Expected, n - i) == 0)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/***************************** NxpSynchronize *************************/
+/**  Gets the bootloader's attention: '?' until it answers "Synchronized",
+then the same string back until it says OK.
+
+A missed '?' does not reset the target right away. The probes go out in
+bursts with a timeout long enough for the answer at the baud rate over a
+USB adapter (-syncprobe for a shorter one);
+only after a burst without answer the target is reset, and each burst is
+twice as long as the one before, so a target that needs a reset gets it
+early and a dead one doesn't spend most of nQuestionMarks in ResetTarget.
+Fragments of the answer are waited for. Late answers are drained before
+the handshake; a handshake that fails anyway (a late answer crossed a
+further '?') starts probing again with twice the timeout.
+\return 0 when synchronized, otherwise an error code.
+*/
+static int NxpSynchronize(ISP_ENVIRONMENT *IspEnvironment)
+{
+    char Answer[128];
+    unsigned long realsize, more;
+    unsigned ProbeTimeout;
+    int nQuestionMarks = 0;
+    int Burst = SYNC_FIRST_BURST;
+    int InBurst = 0;
+    int Missed = 0;
+    int Resets = 0;
+    int Match = -1;
+#if !defined COMPILE_FOR_LPC21
+    unsigned long long Start = IspClock();
 #endif
 
+    // "Synchronized\r\n" at the baud rate, plus the round trip and autobaud
+    ProbeTimeout = (IspEnvironment->SyncProbe != 0 ? IspEnvironment->SyncProbe : SYNC_PROBE_MS) +
+                   140000UL / (strtoul(IspEnvironment->baud_rate, NULL, 10) + 1);
+
     DebugPrintf(2, "Synchronizing (ESC to abort)");
 
     PrepareKeyboardTtySettings();
 
-#if defined INTEGRATED_IN_WIN_APP
-    if (IspEnvironment->NoSync)
+    while (nQuestionMarks < IspEnvironment->nQuestionMarks)
     {
-        found = 1;
-    }
-    else
+#if defined INTEGRATED_IN_WIN_APP
+        if (IspEnvironment->NoSync)
+        {
+            nQuestionMarks = IspEnvironment->nQuestionMarks;
+            Match = 1;
+        }
+        else
 #endif
-    {
-        for (nQuestionMarks = found = 0; !found && nQuestionMarks < IspEnvironment->nQuestionMarks; nQuestionMarks++)
         {
 #if defined INTEGRATED_IN_WIN_APP
             // allow calling application to abort when syncing takes too long
@@ -672,72 +765,135 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
 #endif
 
             DebugPrintf(2, ".");
+            StatsCount(IspEnvironment, STATS_SYNC_ATTEMPTS);
             SendComPort(IspEnvironment, "?");
+            nQuestionMarks++;
 
-            memset(Answer,0,sizeof(Answer));
-            ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1,100);
-
-            strippedAnswer = Answer;
-            strippedsize = realsize;
-            while ((strippedsize > 0) && ((*strippedAnswer == '?') || (*strippedAnswer == 0)))
+            memset(Answer, 0, sizeof(Answer));
+            ReceiveComPort(IspEnvironment, Answer, sizeof(Answer) - 1, &realsize, 1, ProbeTimeout);
+            Match = SyncMatch(Answer, &realsize);
+            while (Match == 0 && realsize < sizeof(Answer) - 1)
             {
-                strippedAnswer++;
-                strippedsize--;
+                ReceiveComPort(IspEnvironment, Answer + realsize, sizeof(Answer) - 1 - realsize, &more, 1, SYNC_FRAGMENT_MS);
+                if (more == 0)
+                {
+                    break;
+                }
+                realsize += more;
+                Match = SyncMatch(Answer, &realsize);
             }
 
-            sprintf(tmp_string, "StrippedAnswer(Length=%d): ", strippedsize);
-            DumpString(3, strippedAnswer, strippedsize, tmp_string);
-
-            tStartUpload = time(NULL);
-
-            FormatCommand(strippedAnswer, strippedAnswer);
-            if (strcmp(strippedAnswer, "Synchronized\n") == 0)
+            if (Match != 1)
             {
-                found = 1;
-            }
+                if (realsize != 0)
+                {
+                    DumpString(3, Answer, realsize, "No answer, received: ");
+                }
+                Missed++;
 #if !defined COMPILE_FOR_LPC21
-            else
-            {
-                ResetTarget(IspEnvironment, PROGRAM_MODE);
-            }
+                if (++InBurst == Burst && nQuestionMarks < IspEnvironment->nQuestionMarks)
+                {
+                    ResetTarget(IspEnvironment, PROGRAM_MODE);
+                    StatsCount(IspEnvironment, STATS_SYNC_RESETS);
+                    Resets++;
+                    InBurst = 0;
+                    Burst  *= 2;
+                }
 #endif
+                continue;
+            }
         }
-    }
 
-    ResetKeyboardTtySettings();
+        // The answer may be a late one to an earlier '?': the further
+        // answers and the echoes of the '?' sent since would spoil the
+        // handshake
+        if (Missed != 0)
+        {
+            do
+            {
+                ReceiveComPort(IspEnvironment, Answer, sizeof(Answer) - 1, &realsize, sizeof(Answer), RECOVER_QUIET_MS);
+            } while (realsize != 0);
+            Missed = 0;
+        }
 
-    if (!found)
-    {
-        DebugPrintf(1, " no answer on '?'\n");
-        return (NO_ANSWER_QM);
-    }
+        SendComPort(IspEnvironment, "Synchronized\r\n");
 
+        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer) - 1, &realsize, 2, 1000);
+
+        FormatCommand(Answer, Answer);
+        if (strcmp(Answer, "Synchronized\nOK\n") == 0)
+        {
+            ResetKeyboardTtySettings();
 #if defined INTEGRATED_IN_WIN_APP
-    AppSyncing(-1);                         // flag syncing done
+            AppSyncing(-1);                         // flag syncing done
 #endif
+            StatsSynced(IspEnvironment);
+            DebugPrintf(2, " OK\n");
+#if !defined COMPILE_FOR_LPC21
+            ResetTuneResult(IspEnvironment, 1, Resets);
+            DebugPrintf(3, "Synchronized after %.1f ms, %d '?', %d resets\n",
+                        (IspClock() - Start) / 1000.0, nQuestionMarks, Resets);
+#endif
+            return 0;
+        }
+        DebugPrintf(3, "No OK on 'Synchronized' (%s), probing again\n", Answer);
 
-    DebugPrintf(2, " OK\n");
-
-    SendComPort(IspEnvironment, "Synchronized\r\n");
+        // Most likely the link is slower than the probe timeout
+        if (ProbeTimeout < SYNC_PROBE_MAX_MS)
+        {
+            ProbeTimeout = ProbeTimeout * 2 < SYNC_PROBE_MAX_MS ? ProbeTimeout * 2 : SYNC_PROBE_MAX_MS;
+            DebugPrintf(3, "Waiting %u ms for the answer to '?' now\n", ProbeTimeout);
+        }
+    }
 
-    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer) - 1, &realsize, 2, 1000);
+    ResetKeyboardTtySettings();
+#if !defined COMPILE_FOR_LPC21
+    ResetTuneResult(IspEnvironment, 0, Resets);
+#endif
 
-    FormatCommand(Answer, Answer);
-    if (strcmp(Answer, "Synchronized\nOK\n") != 0)
+    if (Match == 1)
     {
         DebugPrintf(1, "No answer on 'Synchronized'\n");
         return (NO_ANSWER_SYNC);
     }
 
-    DebugPrintf(3, "Synchronized 1\n");
+    DebugPrintf(1, " no answer on '?'\n");
+    return (NO_ANSWER_QM);
+}
+
+/* Where a download stands, so it can resume after a recovery (-recover) */
+typedef struct
+{
+    unsigned long Sector;
+    unsigned long SectorStart;
+    unsigned long Length;               /**< Bytes of the image in the sector.  */
+    unsigned long Offset;               /**< Bytes of the sector copied.        */
+    int           Erased;
+    int           Copying;              /**< A chunk is being copied to flash.  */
+    int           Suspect;              /**< E or C came back with another echo.*/
+} NXP_CURSOR;
+
+/***************************** NxpOscillatorUnlock *********************/
+/**  Sets the oscillator frequency and unlocks the flash commands, the
+first commands after synchronizing.
+\param [in] IspEnvironment Programming environment.
+\return 0 if ok, error code else.
+*/
+static int NxpOscillatorUnlock(ISP_ENVIRONMENT *IspEnvironment)
+{
+    unsigned long realsize;
+    char Answer[128];
+    char temp[128];
 
     DebugPrintf(3, "Setting oscillator\n");
 
     sprintf(temp, "%s\r\n", IspEnvironment->StringOscillator);
 
+    StatsCommand(IspEnvironment, temp);
     SendComPort(IspEnvironment, temp);
 
     ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, 1000);
+    StatsAnswer(IspEnvironment);
 
     sprintf(temp, "%s\nOK\n", IspEnvironment->StringOscillator);
 
@@ -748,571 +904,350 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
         return (NO_ANSWER_OSC);
     }
 
-    DebugPrintf(3, "Unlock\n");
+    StatsPhase(IspEnvironment, STATS_IDENTIFY);
 
-    cmdstr = "U 23130\r\n";
+    DebugPrintf(3, "Unlock\n");
 
-    if (!SendAndVerify(IspEnvironment, cmdstr, Answer, sizeof Answer))
+    if (!SendAndVerify(IspEnvironment, "U 23130\r\n", Answer, sizeof Answer))
     {
         DebugPrintf(1, "Unlock-Command:\n");
         return (UNLOCK_ERROR + GetAndReportErrorNumber(Answer));
     }
 
-    DebugPrintf(2, "Read bootcode version: ");
-
-    cmdstr = "K\r\n";
+    return 0;
+}
 
-    SendComPort(IspEnvironment, cmdstr);
+/***************************** EchoDiffers ****************************/
+/**  Tells whether the target echoed something else than the command sent,
+that is it executed a command with garbled parameters.
+\param [in] Command The command as sent.
+\param [in] Answer The answer as received.
+\return 1 if there was an echo and it differs, else 0.
+*/
+static int EchoDiffers(const char *Command, const char *Answer)
+{
+    ANSWER_MATCH Match;
 
-    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 4,5000);
+    MatchStart(&Match, Answer, strlen(Answer));
+    return !MatchDone(&Match) && !MatchLine(&Match, Command);
+}
 
-    FormatCommand(cmdstr, temp);
-    FormatCommand(Answer, Answer);
-    if (strncmp(Answer, temp, strlen(temp)) != 0)
+/***************************** NxpGroupLines **************************/
+/**  Number of uuencoded lines to send per checksum for now. The bootloader
+wants a checksum after 20 lines or at the end of the write, so smaller
+groups are sent as writes of their own.
+*/
+static unsigned NxpGroupLines(ISP_ENVIRONMENT *IspEnvironment)
+{
+#if !defined COMPILE_FOR_LPC21
+    if (IspEnvironment->GroupLines == 0)
     {
-        DebugPrintf(1, "no answer on Read Boot Code Version\n");
-        return (NO_ANSWER_RBV);
+        IspEnvironment->GroupLines = GROUP_MAX_LINES;
     }
+    return IspEnvironment->GroupLines;
+#else
+    return GROUP_MAX_LINES;
+#endif
+}
 
-    if (strncmp(Answer + strlen(temp), "0\n", 2) == 0)
+#if !defined COMPILE_FOR_LPC21
+/***************************** NxpGroupDone ***************************/
+/**  Adapts the checksum group size to the link after each group: halved
+when the group had to be sent again, so a noisy link loses less on each
+RESEND, and grown by GROUP_STEP_LINES after GROUP_CLEAN clean groups in
+a row, so a clean link gets back to the fewest checksum round trips.
+\param [in] IspEnvironment Programming environment.
+\param [in] Resends times the group was sent again.
+*/
+static void NxpGroupDone(ISP_ENVIRONMENT *IspEnvironment, int Resends)
+{
+    unsigned Lines = NxpGroupLines(IspEnvironment);
+
+    StatsCount(IspEnvironment, STATS_GROUPS);
+
+    if (Resends != 0)
     {
-        strippedAnswer = Answer + strlen(temp) + 2;
-        /*
-        int maj, min, build;
-        if (sscanf(strippedAnswer, "%d %d %d", &build, &min, &maj) == 2) {
-        maj = min;
-        min = build;
-        build = 0;
-        } // if
-        DebugPrintf(2, "%d.%d.%d\n", maj, min, build);
-        */
-        DebugPrintf(2, strippedAnswer);
+        IspEnvironment->CleanGroups = 0;
+        Lines = Lines / 2 / GROUP_STEP_LINES * GROUP_STEP_LINES;
+        if (Lines < GROUP_MIN_LINES)
+        {
+            Lines = GROUP_MIN_LINES;
+        }
     }
-    else
+    else if (++IspEnvironment->CleanGroups >= GROUP_CLEAN && Lines < GROUP_MAX_LINES)
     {
-        DebugPrintf(2, "unknown\n");
+        IspEnvironment->CleanGroups = 0;
+        Lines += GROUP_STEP_LINES;
     }
 
-    DebugPrintf(2, "Read part ID: ");
-
-    cmdstr = "J\r\n";
+    if (Lines != IspEnvironment->GroupLines)
+    {
+        DebugPrintf(3, "Checksum group size %u lines\n", Lines);
+        IspEnvironment->GroupLines = Lines;
+    }
+}
+#endif
 
-    SendComPort(IspEnvironment, cmdstr);
+/***************************** NxpWriteCommand ************************/
+/**  Sends the Write to RAM command, the data has to follow.
+\return 0 if ok, error code else.
+*/
+static int NxpWriteCommand(ISP_ENVIRONMENT *IspEnvironment, unsigned long Address, unsigned long Length)
+{
+    char Answer[128];
+    char tmpString[128];
 
-    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 3, 5000);
+    sprintf(tmpString, "W %ld %ld\r\n", Address, Length);
 
-    FormatCommand(cmdstr, temp);
-    FormatCommand(Answer, Answer);
-    if (strncmp(Answer, temp, strlen(temp)) != 0)
+    if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
     {
-        DebugPrintf(1, "no answer on Read Part Id\n");
-        return (NO_ANSWER_RPID);
+        DebugPrintf(1, "Wrong answer on Write-Command\n");
+        return (WRONG_ANSWER_WRIT + GetAndReportErrorNumber(Answer));
     }
 
-    strippedAnswer = (strncmp(Answer, "J\n0\n", 4) == 0) ? Answer + 4 : Answer;
+    DebugPrintf(2, ".");
+    fflush(stdout);
+    return 0;
+}
 
-    Id[0] = strtoul(strippedAnswer, &endPtr, 10);
-    Id[1] = 0UL;
-    *endPtr = '\0'; /* delete \r\n */
-    for (i = sizeof LPCtypes / sizeof LPCtypes[0] - 1; i > 0 && LPCtypes[i].id != Id[0]; i--)
-        /* nothing */;
-    IspEnvironment->DetectedDevice = i;
-    if (LPCtypes[IspEnvironment->DetectedDevice].EvalId2 != 0)
+/***************************** NxpChecksumAnswered ********************/
+/**  Checks the answer to the checksum of a group of uuencoded lines.
+\param [in] Answer the received bytes.
+\param [in] Length the number of bytes in Answer.
+\param [in] Checksum the checksum sent.
+\return 1 if it was echoed and answered with OK, 0 else (RESEND).
+*/
+static int NxpChecksumAnswered(const char *Answer, unsigned long Length, unsigned long Checksum)
+{
+    ANSWER_MATCH Match;
+    unsigned long Echo;
+
+    MatchStart(&Match, Answer, Length);
+    return MatchNumber(&Match, &Echo) && Echo == Checksum && MatchLine(&Match, "OK")
+        && MatchDone(&Match);
+}
+
+/***************************** NxpProgramSector ***********************/
+/**  Erases and programs the sector at the cursor, starting with the chunk
+at Cursor->Offset. The cursor follows every completed chunk, so after a
+failure the download can resume where it stopped.
+\param [in] IspEnvironment Programming environment.
+\param [in,out] Cursor Download progress.
+\return 0 if ok, error code else.
+*/
+static int NxpProgramSector(ISP_ENVIRONMENT *IspEnvironment, NXP_CURSOR *Cursor)
+{
+    unsigned long realsize;
+    char Answer[128];
+    unsigned long Sector       = Cursor->Sector;
+    unsigned long SectorStart  = Cursor->SectorStart;
+    unsigned long SectorLength = Cursor->Length;
+    unsigned long SectorOffset, SectorChunk;
+    char tmpString[128];
+    int Line;
+    ANSWER_MATCH Match;
+    unsigned long Block;
+    const BINARY *BlockData;
+    BINARY BlockBuffer[1024];
+    unsigned long BlockPos, BlockLength;
+    unsigned long Pos;
+    unsigned long CopyLength;
+    unsigned long WritePos, WriteLength;
+    unsigned long block_CRC;
+    int Result;
+#if !defined COMPILE_FOR_LPC21
+    int i;
+    int repeat = 0;
+    unsigned long long Start;
+#endif
+
+    if (  (Cursor->Offset == 0 || !Cursor->Erased)   // Nothing to erase when resuming within the sector
+       && (  (IspEnvironment->BinaryOffset <  ReturnValueLpcRamStart(IspEnvironment))  // Skip Erase when running from RAM
+           ||(IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024))))
     {
-        /* Read out the second configuration word and run the search again */
-        *endPtr = '\n';
-        endPtr++;
-        if ((endPtr[0] == '\0') || (endPtr[strlen(endPtr)-1] != '\n'))
+        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
         {
-            /* No or incomplete word 2 */
-            ReceiveComPort(IspEnvironment, endPtr, sizeof(Answer)-(endPtr-Answer)-1, &realsize, 1, 100);
+            // TODO: Quick and dirty hack to address bank 0
+            sprintf(tmpString, "P %ld %ld 0\r\n", Sector, Sector);
         }
-
-        FormatCommand(endPtr, endPtr);
-        if ((*endPtr == '\0') || (*endPtr == '\n'))
+        else
         {
-            DebugPrintf(1, "incomplete answer on Read Part Id (second configuration word missing)\n");
-            return (NO_ANSWER_RPID);
+            sprintf(tmpString, "P %ld %ld\r\n", Sector, Sector);
         }
 
-        Id[1] = strtoul(endPtr, &endPtr, 10);
-        *endPtr = '\0'; /* delete \r\n */
-
-        Id1Masked = Id[1] & 0xFF;
-
-        /* now search the table again */
-        for (i = sizeof LPCtypes / sizeof LPCtypes[0] - 1; i > 0 && (LPCtypes[i].id != Id[0] || LPCtypes[i].id2 != Id1Masked); i--)
-            /* nothing */;
-        IspEnvironment->DetectedDevice = i;
-    }
-    if (IspEnvironment->DetectedDevice == 0) {
-        DebugPrintf(2, "unknown");
-    }
-    else {
-        DebugPrintf(2, "LPC%s, %d kiB FLASH / %d kiB SRAM",
-            LPCtypes[IspEnvironment->DetectedDevice].Product,
-            LPCtypes[IspEnvironment->DetectedDevice].FlashSize,
-            LPCtypes[IspEnvironment->DetectedDevice].RAMSize);
-    }
-    if (LPCtypes[IspEnvironment->DetectedDevice].EvalId2 != 0)
-    {
-        DebugPrintf(2, " (0x%08lX / 0x%08lX -> %08lX)\n", Id[0], Id[1], Id1Masked);
-    }
-    else
-    {
-        DebugPrintf(2, " (0x%08lX)\n", Id[0]);
-    }
-
-    if (!IspEnvironment->DetectOnly)
-    {
-        // Build up uuencode table
-        uuencode_table[0] = 0x60;           // 0x20 is translated to 0x60 !
-
-        for (i = 1; i < 64; i++)
+        if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
         {
-            uuencode_table[i] = (char)(0x20 + i);
+            DebugPrintf(1, "Wrong answer on Prepare-Command (1) (Sector %ld)\n", Sector);
+            return (WRONG_ANSWER_PREP + GetAndReportErrorNumber(Answer));
         }
 
-        if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC2XXX)
+        DebugPrintf(2, ".");
+        fflush(stdout);
+        if (!Cursor->Erased) // Sector 0 already erased, or the whole device wiped
         {
-            // Patch 0x14, otherwise it is not running and jumps to boot mode
-
-            ivt_CRC = 0;
-
-            // Clear the vector at 0x14 so it doesn't affect the checksum:
-            for (i = 0; i < 4; i++)
+            if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
             {
-                IspEnvironment->BinaryContent[i + 0x14] = 0;
+                // TODO: Quick and dirty hack to address bank 0
+                sprintf(tmpString, "E %ld %ld 0\r\n", Sector, Sector);
             }
-
-            // Calculate a native checksum of the little endian vector table:
-            for (i = 0; i < (4 * 8);) {
-                ivt_CRC += IspEnvironment->BinaryContent[i++];
-                ivt_CRC += IspEnvironment->BinaryContent[i++] << 8;
-                ivt_CRC += IspEnvironment->BinaryContent[i++] << 16;
-                ivt_CRC += IspEnvironment->BinaryContent[i++] << 24;
+            else
+            {
+                sprintf(tmpString, "E %ld %ld\r\n", Sector, Sector);
             }
 
-            /* Negate the result and place in the vector at 0x14 as little endian
-            * again. The resulting vector table should checksum to 0. */
-            ivt_CRC = (unsigned long) (0 - ivt_CRC);
-            for (i = 0; i < 4; i++)
+            if (!NxpSendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer, LATENCY_ERASE,
+                                   IspEnvironment->SectorTable[Sector]))
             {
-                IspEnvironment->BinaryContent[i + 0x14] = (unsigned char)(ivt_CRC >> (8 * i));
+                DebugPrintf(1, "Wrong answer on Erase-Command (Sector %ld)\n", Sector);
+                Cursor->Suspect = EchoDiffers(tmpString, Answer);
+                return (WRONG_ANSWER_ERAS + GetAndReportErrorNumber(Answer));
             }
+            Cursor->Erased = 1;
 
-            DebugPrintf(3, "Position 0x14 patched: ivt_CRC = 0x%08lX\n", ivt_CRC);
+            DebugPrintf(2, ".");
+            fflush(stdout);
         }
-        else if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX ||
-                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC17XX ||
-                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC13XX ||
-                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC11XX ||
-                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC8XX)
-        {
-            // Patch 0x1C, otherwise it is not running and jumps to boot mode
-
-            ivt_CRC = 0;
+    }
 
-            // Clear the vector at 0x1C so it doesn't affect the checksum:
-            for (i = 0; i < 4; i++)
+    for (SectorOffset = Cursor->Offset; SectorOffset < SectorLength; SectorOffset += SectorChunk)
+    {
+        // Check if we are to write only 0xFFs - it would be just a waste of time..
+        if (SectorOffset == 0) {
+            for (SectorOffset = 0; SectorOffset < SectorLength; ++SectorOffset)
             {
-                IspEnvironment->BinaryContent[i + 0x1C] = 0;
-            }
-
-            // Calculate a native checksum of the little endian vector table:
-            for (i = 0; i < (4 * 8);) {
-                ivt_CRC += IspEnvironment->BinaryContent[i++];
-                ivt_CRC += IspEnvironment->BinaryContent[i++] << 8;
-                ivt_CRC += IspEnvironment->BinaryContent[i++] << 16;
-                ivt_CRC += IspEnvironment->BinaryContent[i++] << 24;
+                if (ImageByte(IspEnvironment, SectorStart + SectorOffset) != 0xFF)
+                    break;
             }
-
-            /* Negate the result and place in the vector at 0x1C as little endian
-            * again. The resulting vector table should checksum to 0. */
-            ivt_CRC = (unsigned long) (0 - ivt_CRC);
-            for (i = 0; i < 4; i++)
+            if (SectorOffset == SectorLength) // all data contents were 0xFFs
             {
-                IspEnvironment->BinaryContent[i + 0x1C] = (unsigned char)(ivt_CRC >> (8 * i));
+                DebugPrintf(2, "Whole sector contents is 0xFFs, skipping programming.");
+                fflush(stdout);
+                StatsSectorDone(IspEnvironment, 0);
+                break;
             }
-
-            DebugPrintf(3, "Position 0x1C patched: ivt_CRC = 0x%08lX\n", ivt_CRC);
+            SectorOffset = 0; // re-set otherwise
         }
-        else
+
+        if (SectorOffset > 0)
         {
-          DebugPrintf(1, "Internal error: wrong chip variant %d (detected device %d)\n", LPCtypes[IspEnvironment->DetectedDevice].ChipVariant, IspEnvironment->DetectedDevice);
-          exit(1);
+            // Add a visible marker between segments in a sector
+            DebugPrintf(2, "|");  /* means: partial segment copied */
+            fflush(stdout);
         }
-    }
 
-#if 0
-    DebugPrintf(2, "Read Unique ID:\n");
+        // If the Flash ROM sector size is bigger than the number of bytes
+        // we can copy from RAM to Flash, we must "chop up" the sector and
+        // copy these individually.
+        // This is especially needed in the case where a Flash sector is
+        // bigger than the amount of SRAM.
+        SectorChunk = SectorLength - SectorOffset;
+        if (SectorChunk > IspEnvironment->MaxCopySize)
+        {
+            SectorChunk = IspEnvironment->MaxCopySize;
+        }
 
-    cmdstr = "N\r\n";
+        // Write multiple of 45 * 4 Byte blocks to RAM, but copy maximum of on sector to Flash
+        // In worst case we transfer up to 180 byte too much to RAM
+        // but then we can always use full 45 byte blocks and length is multiple of 4
+        CopyLength = SectorChunk;
+
+        if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC2XXX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC17XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC13XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC11XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX)
+        {
+            if ((CopyLength % (45 * 4)) != 0)
+            {
+                CopyLength += ((45 * 4) - (CopyLength % (45 * 4)));
+            }
+        }
 
-    SendComPort(IspEnvironment, cmdstr);
+        StatsPhase(IspEnvironment, STATS_WRITE);
 
-    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 5,5000);
+        if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC2XXX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC17XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC13XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC11XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX ||
+           LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX)
+        {
+            // Data goes to RAM in writes of one or more checksum groups,
+            // see NxpGroupDone
+            for (WritePos = 0; WritePos < CopyLength; WritePos += WriteLength)
+            {
+                WriteLength = CopyLength - WritePos;
+                if (NxpGroupLines(IspEnvironment) < 20 && WriteLength > NxpGroupLines(IspEnvironment) * 45)
+                {
+                    WriteLength = NxpGroupLines(IspEnvironment) * 45;
+                }
 
-    FormatCommand(cmdstr, temp);
-    FormatCommand(Answer, Answer);
-    if (strncmp(Answer, temp, strlen(temp)) != 0)
-    {
-        DebugPrintf(1, "no answer on Read Unique ID\n");
-        return (NO_ANSWER_RBV);
-    }
+                Result = NxpWriteCommand(IspEnvironment, ReturnValueLpcRamBase(IspEnvironment) + WritePos, WriteLength);
+                if (Result != 0)
+                {
+                    return Result;
+                }
 
-    if (strncmp(Answer + strlen(cmdstr), "0\n", 2) == 0)
-    {
-        strippedAnswer = Answer + strlen(temp) + 2;
-        DebugPrintf(2, strippedAnswer);
-    }
-    else
-    {
-        DebugPrintf(2, "unknown\n");
-    }
-#endif // 0
+                block_CRC = 0;
+                Line = 0;
 
-    /* In case of a download to RAM, use full RAM for downloading
-    * set the flash parameters to full RAM also.
-    * This makes sure that all code is downloaded as one big sector
-    */
+                // Transfer blocks of 45 * 4 bytes to RAM
+                for (Pos = SectorStart + SectorOffset + WritePos; (Pos < SectorStart + SectorOffset + WritePos + WriteLength) && (Pos < IspEnvironment->BinaryLength); Pos += (45 * 4))
+                {
+                    for (Block = 0; Block < 4; Block++)  // Each block 45 bytes
+                    {
+                        DebugPrintf(2, ".");
+                        fflush(stdout);
 
-    if ( (IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment))
-       &&(IspEnvironment->BinaryOffset + IspEnvironment->BinaryLength <= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
-    {
-        LPCtypes[IspEnvironment->DetectedDevice].FlashSectors = 1;
-        LPCtypes[IspEnvironment->DetectedDevice].MaxCopySize  = LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024 - (ReturnValueLpcRamBase(IspEnvironment) - ReturnValueLpcRamStart(IspEnvironment));
-        LPCtypes[IspEnvironment->DetectedDevice].SectorTable  = SectorTable_RAM;
-        SectorTable_RAM[0] = LPCtypes[IspEnvironment->DetectedDevice].MaxCopySize;
-    }
-    if (IspEnvironment->DetectOnly)
-        return (0);
+#if defined INTEGRATED_IN_WIN_APP
+                        // inform the calling application about having written another chuck of data
+                        AppWritten(45);
+#endif
 
-    if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC8XX)
-    {
-      // XON/XOFF must be switched off for LPC8XX
-      // otherwise problem during binary transmission of data to LPC8XX
-      DebugPrintf(3, "Switch off XON/XOFF !!!\n");
-      ControlXonXoffSerialPort(IspEnvironment, 0);
-    }
+                        // Uuencode one 45 byte block
+                        if ( (IspEnvironment->BinaryOffset <  ReturnValueLpcRamStart(IspEnvironment))
+                           ||(IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
+                        { // Flash: use full memory
+                            BlockPos = Pos + Block * 45;
+                        }
+                        else
+                        { // RAM: Skip first 0x200 bytes, these are used by the download program in LPC21xx
+                            BlockPos = Pos + Block * 45 + 0x200;
+                        }
+                        BlockLength = 45;
+                        BlockData = ImageBlock(IspEnvironment, BlockPos, &BlockLength, BlockBuffer, sizeof BlockBuffer);
 
-    // Start with sector 1 and go upward... Sector 0 containing the interrupt vectors
-    // will be loaded last, since it contains a checksum and device will re-enter
-    // bootloader mode as long as this checksum is invalid.
-    DebugPrintf(2, "Will start programming at Sector 1 if possible, and conclude with Sector 0 to ensure that checksum is written last.\n");
-    if (LPCtypes[IspEnvironment->DetectedDevice].SectorTable[0] >= IspEnvironment->BinaryLength)
-    {
-        Sector = 0;
-        SectorStart = 0;
-    }
-    else
-    {
-        SectorStart = LPCtypes[IspEnvironment->DetectedDevice].SectorTable[0];
-        Sector = 1;
-    }
-
-    if (IspEnvironment->WipeDevice == 1)
-    {
-        DebugPrintf(2, "Wiping Device. ");
-
-        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-        {
-            // TODO: Quick and dirty hack to address bank 0
-            sprintf(tmpString, "P %d %d 0\r\n", 0, LPCtypes[IspEnvironment->DetectedDevice].FlashSectors-1);
-        }
-        else
-        {
-            sprintf(tmpString, "P %d %d\r\n", 0, LPCtypes[IspEnvironment->DetectedDevice].FlashSectors-1);
-        }
-
-        if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-        {
-            DebugPrintf(1, "Wrong answer on Prepare-Command\n");
-            return (WRONG_ANSWER_PREP + GetAndReportErrorNumber(Answer));
-        }
-
-        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-        {
-            // TODO: Quick and dirty hack to address bank 0
-            sprintf(tmpString, "E %d %d 0\r\n", 0, LPCtypes[IspEnvironment->DetectedDevice].FlashSectors-1);
-        }
-        else
-        {
-            sprintf(tmpString, "E %d %d\r\n", 0, LPCtypes[IspEnvironment->DetectedDevice].FlashSectors-1);
-        }
-        if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-        {
-            DebugPrintf(1, "Wrong answer on Erase-Command\n");
-            return (WRONG_ANSWER_ERAS + GetAndReportErrorNumber(Answer));
-        }
-        DebugPrintf(2, "OK \n");
-
-        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-        {
-          DebugPrintf(2, "ATTENTION: Only bank A was wiped!!!\n");
-        }
-    }
-    else{
-        //no wiping requested: erasing sector 0 first
-        DebugPrintf(2, "Erasing sector 0 first, to invalidate checksum. ");
-
-        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-        {
-            // TODO: Quick and dirty hack to address bank 0
-            sprintf(tmpString, "P %d %d 0\r\n", 0, 0);
-        }
-        else
-        {
-            sprintf(tmpString, "P %d %d\r\n", 0, 0);
-        }
-
-        if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-        {
-            DebugPrintf(1, "Wrong answer on Prepare-Command\n");
-            return (WRONG_ANSWER_PREP + GetAndReportErrorNumber(Answer));
-        }
-
-        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-        {
-            // TODO: Quick and dirty hack to address bank 0
-            sprintf(tmpString, "E %d %d 0\r\n", 0, 0);
-        }
-        else
-        {
-            sprintf(tmpString, "E %d %d\r\n", 0, 0);
-        }
-
-        if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-        {
-            DebugPrintf(1, "Wrong answer on Erase-Command\n");
-            return (WRONG_ANSWER_ERAS + GetAndReportErrorNumber(Answer));
-        }
-        DebugPrintf(2, "OK \n");
-    }
-    while (1)
-    {
-        if (Sector >= LPCtypes[IspEnvironment->DetectedDevice].FlashSectors)
-        {
-            DebugPrintf(1, "Program too large; running out of Flash sectors.\n");
-            return (PROGRAM_TOO_LARGE);
-        }
-
-        DebugPrintf(2, "Sector %ld: ", Sector);
-        fflush(stdout);
-
-        if ( (IspEnvironment->BinaryOffset <  ReturnValueLpcRamStart(IspEnvironment))  // Skip Erase when running from RAM
-           ||(IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
-        {
-            if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-            {
-                // TODO: Quick and dirty hack to address bank 0
-                sprintf(tmpString, "P %ld %ld 0\r\n", Sector, Sector);
-            }
-            else
-            {
-                sprintf(tmpString, "P %ld %ld\r\n", Sector, Sector);
-            }
-
-            if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-            {
-                DebugPrintf(1, "Wrong answer on Prepare-Command (1) (Sector %ld)\n", Sector);
-                return (WRONG_ANSWER_PREP + GetAndReportErrorNumber(Answer));
-            }
-
-            DebugPrintf(2, ".");
-            fflush(stdout);
-            if (IspEnvironment->WipeDevice == 0 && (Sector!=0)) //Sector 0 already erased
-            {
-                if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-                    LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-                {
-                    // TODO: Quick and dirty hack to address bank 0
-                    sprintf(tmpString, "E %ld %ld 0\r\n", Sector, Sector);
-                }
-                else
-                {
-                    sprintf(tmpString, "E %ld %ld\r\n", Sector, Sector);
-                }
-
-                if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-                {
-                    DebugPrintf(1, "Wrong answer on Erase-Command (Sector %ld)\n", Sector);
-                    return (WRONG_ANSWER_ERAS + GetAndReportErrorNumber(Answer));
-                }
-
-                DebugPrintf(2, ".");
-                fflush(stdout);
-            }
-        }
-
-        SectorLength = LPCtypes[IspEnvironment->DetectedDevice].SectorTable[Sector];
-        if (SectorLength > IspEnvironment->BinaryLength - SectorStart)
-        {
-            SectorLength = IspEnvironment->BinaryLength - SectorStart;
-        }
-
-        for (SectorOffset = 0; SectorOffset < SectorLength; SectorOffset += SectorChunk)
-        {
-            // Check if we are to write only 0xFFs - it would be just a waste of time..
-            if (SectorOffset == 0) {
-                for (SectorOffset = 0; SectorOffset < SectorLength; ++SectorOffset)
-                {
-                    if (IspEnvironment->BinaryContent[SectorStart + SectorOffset] != 0xFF)
-                        break;
-                }
-                if (SectorOffset == SectorLength) // all data contents were 0xFFs
-                {
-                    DebugPrintf(2, "Whole sector contents is 0xFFs, skipping programming.");
-                    fflush(stdout);
-                    break;
-                }
-                SectorOffset = 0; // re-set otherwise
-            }
-
-            if (SectorOffset > 0)
-            {
-                // Add a visible marker between segments in a sector
-                DebugPrintf(2, "|");  /* means: partial segment copied */
-                fflush(stdout);
-            }
-
-            // If the Flash ROM sector size is bigger than the number of bytes
-            // we can copy from RAM to Flash, we must "chop up" the sector and
-            // copy these individually.
-            // This is especially needed in the case where a Flash sector is
-            // bigger than the amount of SRAM.
-            SectorChunk = SectorLength - SectorOffset;
-            if (SectorChunk > (unsigned)LPCtypes[IspEnvironment->DetectedDevice].MaxCopySize)
-            {
-                SectorChunk = LPCtypes[IspEnvironment->DetectedDevice].MaxCopySize;
-            }
-
-            // Write multiple of 45 * 4 Byte blocks to RAM, but copy maximum of on sector to Flash
-            // In worst case we transfer up to 180 byte too much to RAM
-            // but then we can always use full 45 byte blocks and length is multiple of 4
-            CopyLength = SectorChunk;
-
-            if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC2XXX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC17XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC13XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC11XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX)
-            {
-                if ((CopyLength % (45 * 4)) != 0)
-                {
-                    CopyLength += ((45 * 4) - (CopyLength % (45 * 4)));
-                }
-            }
-
-            sprintf(tmpString, "W %ld %ld\r\n", ReturnValueLpcRamBase(IspEnvironment), CopyLength);
-
-            if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-            {
-                DebugPrintf(1, "Wrong answer on Write-Command\n");
-                return (WRONG_ANSWER_WRIT + GetAndReportErrorNumber(Answer));
-            }
-
-            DebugPrintf(2, ".");
-            fflush(stdout);
-
-            if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC2XXX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC17XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC13XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC11XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX ||
-               LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX)
-            {
-                block_CRC = 0;
-                Line = 0;
-
-                // Transfer blocks of 45 * 4 bytes to RAM
-                for (Pos = SectorStart + SectorOffset; (Pos < SectorStart + SectorOffset + CopyLength) && (Pos < IspEnvironment->BinaryLength); Pos += (45 * 4))
-                {
-                    for (Block = 0; Block < 4; Block++)  // Each block 45 bytes
-                    {
-                        DebugPrintf(2, ".");
-                        fflush(stdout);
-
-#if defined INTEGRATED_IN_WIN_APP
-                        // inform the calling application about having written another chuck of data
-                        AppWritten(45);
-#endif
-
-                        // Uuencode one 45 byte block
-                        tmpStringPos = 0;
-
-#if !defined COMPILE_FOR_LPC21
-                        sendbuf[Line][tmpStringPos++] = (char)(' ' + 45);    // Encode Length of block
-#else
-                        tmpString[tmpStringPos++] = (char)(' ' + 45);        // Encode Length of block
-#endif
-
-                        for (BlockOffset = 0; BlockOffset < 45; BlockOffset++)
-                        {
-                            if ( (IspEnvironment->BinaryOffset <  ReturnValueLpcRamStart(IspEnvironment))
-                               ||(IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
-                            { // Flash: use full memory
-                                c = IspEnvironment->BinaryContent[Pos + Block * 45 + BlockOffset];
-                            }
-                            else
-                            { // RAM: Skip first 0x200 bytes, these are used by the download program in LPC21xx
-                                c = IspEnvironment->BinaryContent[Pos + Block * 45 + BlockOffset + 0x200];
-                            }
-
-                            block_CRC += c;
-
-                            k = (k << 8) + (c & 255);
-
-                            if ((BlockOffset % 3) == 2)   // Collecting always 3 Bytes, then do processing in 4 Bytes
-                            {
 #if !defined COMPILE_FOR_LPC21
-                                sendbuf[Line][tmpStringPos++] = uuencode_table[(k >> 18) & 63];
-                                sendbuf[Line][tmpStringPos++] = uuencode_table[(k >> 12) & 63];
-                                sendbuf[Line][tmpStringPos++] = uuencode_table[(k >>  6) & 63];
-                                sendbuf[Line][tmpStringPos++] = uuencode_table[ k        & 63];
+                        UuencodeLine(IspEnvironment->ResendLines[Line], BlockData, 45, &block_CRC);
 #else
-                                tmpString[tmpStringPos++] = uuencode_table[(k >> 18) & 63];
-                                tmpString[tmpStringPos++] = uuencode_table[(k >> 12) & 63];
-                                tmpString[tmpStringPos++] = uuencode_table[(k >>  6) & 63];
-                                tmpString[tmpStringPos++] = uuencode_table[ k        & 63];
+                        UuencodeLine(tmpString, BlockData, 45, &block_CRC);
 #endif
-                            }
-                        }
-
 
 #if !defined COMPILE_FOR_LPC21
-                        sendbuf[Line][tmpStringPos++] = '\r';
-                        sendbuf[Line][tmpStringPos++] = '\n';
-                        sendbuf[Line][tmpStringPos++] = 0;
-
-                        SendComPort(IspEnvironment, sendbuf[Line]);
+                        Start = IspClock();
+                        SendComPort(IspEnvironment, IspEnvironment->ResendLines[Line]);
                         // receive only for debug proposes
-                        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1, 5000);
-                        FormatCommand(sendbuf[Line], tmpString);
-                        FormatCommand(Answer, Answer);
-                        if (strncmp(Answer, tmpString, strlen(tmpString)) != 0)
+                        NxpReceive(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1, LATENCY_DATA, 0, Start);
+                        MatchStart(&Match, Answer, realsize);
+                        if (!MatchLine(&Match, IspEnvironment->ResendLines[Line]))
                         {
-                            DebugPrintf(1, "Error on writing data (1)\n");
-                            return (ERROR_WRITE_DATA);
+                            if (IspEnvironment->Recover == 0)
+                            {
+                                DebugPrintf(1, "Error on writing data (1)\n");
+                                return (ERROR_WRITE_DATA);
+                            }
+                            // The echo may be garbled on the way back only,
+                            // the block checksum tells what the target got
+                            DebugPrintf(3, "Echo differs on data line %d\n", Line);
                         }
 #else
-                        tmpString[tmpStringPos++] = '\r';
-                        tmpString[tmpStringPos++] = '\n';
-                        tmpString[tmpStringPos++] = 0;
-
                         SendComPort(IspEnvironment, tmpString);
                         ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1, 5000);
-                        FormatCommand(tmpString, tmpString);
-                        FormatCommand(Answer, Answer);
-                        if (strncmp(Answer, tmpString, tmpStringPos) != 0)
+                        MatchStart(&Match, Answer, realsize);
+                        if (!MatchLine(&Match, tmpString))
                         {
                             DebugPrintf(1, "Error on writing data (1)\n");
                             return (ERROR_WRITE_DATA);
@@ -1333,26 +1268,27 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
 
                                 sprintf(tmpString, "%ld\r\n", block_CRC);
 
+                                Start = IspClock();
                                 SendComPort(IspEnvironment, tmpString);
 
-                                ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, 5000);
+                                NxpReceive(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, LATENCY_DATA, 0, Start);
 
-                                sprintf(tmpString, "%ld\nOK\n", block_CRC);
-
-                                FormatCommand(tmpString, tmpString);
-                                FormatCommand(Answer, Answer);
-                                if (strcmp(Answer, tmpString) != 0)
+                                if (!NxpChecksumAnswered(Answer, realsize, block_CRC))
                                 {
+                                    StatsCount(IspEnvironment, STATS_RESENDS);
                                     for (i = 0; i < Line; i++)
                                     {
-                                        SendComPort(IspEnvironment, sendbuf[i]);
-                                        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1, 5000);
+                                        Start = IspClock();
+                                        SendComPort(IspEnvironment, IspEnvironment->ResendLines[i]);
+                                        NxpReceive(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1, LATENCY_DATA, 0, Start);
                                     }
                                 }
                                 else
                                     break;
                             }
 
+                            NxpGroupDone(IspEnvironment, repeat);
+
                             if (repeat >= 3)
                             {
                                 DebugPrintf(1, "Error on writing block_CRC (1)\n");
@@ -1365,10 +1301,7 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
 
                             ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2,5000);
 
-                            sprintf(tmpString, "%ld\nOK\n", block_CRC);
-                            FormatCommand(tmpString, tmpString);
-                            FormatCommand(Answer, Answer);
-                            if (strcmp(Answer, tmpString) != 0)
+                            if (!NxpChecksumAnswered(Answer, realsize, block_CRC))
                             {
                                 DebugPrintf(1, "Error on writing block_CRC (2)\n");
                                 return (ERROR_WRITE_CRC);
@@ -1387,26 +1320,27 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
                     {
                         sprintf(tmpString, "%ld\r\n", block_CRC);
 
+                        Start = IspClock();
                         SendComPort(IspEnvironment, tmpString);
 
-                        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2,5000);
+                        NxpReceive(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, LATENCY_DATA, 0, Start);
 
-                        sprintf(tmpString, "%ld\nOK\n", block_CRC);
-
-                        FormatCommand(tmpString, tmpString);
-                        FormatCommand(Answer, Answer);
-                        if (strcmp(Answer, tmpString) != 0)
+                        if (!NxpChecksumAnswered(Answer, realsize, block_CRC))
                         {
+                            StatsCount(IspEnvironment, STATS_RESENDS);
                             for (i = 0; i < Line; i++)
                             {
-                                SendComPort(IspEnvironment, sendbuf[i]);
-                                ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1,5000);
+                                Start = IspClock();
+                                SendComPort(IspEnvironment, IspEnvironment->ResendLines[i]);
+                                NxpReceive(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1, LATENCY_DATA, 0, Start);
                             }
                         }
                         else
                             break;
                     }
 
+                    NxpGroupDone(IspEnvironment, repeat);
+
                     if (repeat >= 3)
                     {
                         DebugPrintf(1, "Error on writing block_CRC (3)\n");
@@ -1418,10 +1352,7 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
 
                     ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2,5000);
 
-                    sprintf(tmpString, "%ld\nOK\n", block_CRC);
-                    FormatCommand(tmpString, tmpString);
-                    FormatCommand(Answer, Answer);
-                    if (strcmp(Answer, tmpString) != 0)
+                    if (!NxpChecksumAnswered(Answer, realsize, block_CRC))
                     {
                         DebugPrintf(1, "Error on writing block_CRC (4)\n");
                         return (ERROR_WRITE_CRC2);
@@ -1429,134 +1360,1110 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
 #endif
                 }
             }
-            else if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC8XX)
-            {
-                unsigned char BigAnswer[4096];
-                unsigned long CopyLengthPartialOffset = 0;
-                unsigned long CopyLengthPartialRemainingBytes;
-
-                while(CopyLengthPartialOffset < CopyLength)
-                {
-                    CopyLengthPartialRemainingBytes = CopyLength - CopyLengthPartialOffset;
-                    if(CopyLengthPartialRemainingBytes > 256)
-                    {
-                      // There seems to be an error in LPC812:
-                      // When too much bytes are written at high speed,
-                      // bytes get lost
-                      // Workaround: Use smaller blocks
-                      CopyLengthPartialRemainingBytes = 256;
-                    }
-
-                    SendComPortBlock(IspEnvironment, &IspEnvironment->BinaryContent[SectorStart + SectorOffset + CopyLengthPartialOffset], CopyLengthPartialRemainingBytes);
-
-                    if (ReceiveComPortBlockComplete(IspEnvironment, &BigAnswer, CopyLengthPartialRemainingBytes, 10000) != 0)
-                    {
-                        return (ERROR_WRITE_DATA);
-                    }
-
-                    if(memcmp(&IspEnvironment->BinaryContent[SectorStart + SectorOffset + CopyLengthPartialOffset], BigAnswer, CopyLengthPartialRemainingBytes))
-                    {
-                        return (ERROR_WRITE_DATA);
-                    }
+        }
+        else if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC8XX)
+        {
+            unsigned char BigAnswer[4096];
+            unsigned long CopyLengthPartialOffset = 0;
+            unsigned long CopyLengthPartialRemainingBytes;
 
-                    CopyLengthPartialOffset += CopyLengthPartialRemainingBytes;
-                }
+            Result = NxpWriteCommand(IspEnvironment, ReturnValueLpcRamBase(IspEnvironment), CopyLength);
+            if (Result != 0)
+            {
+                return Result;
             }
 
-            if ( (IspEnvironment->BinaryOffset <  ReturnValueLpcRamStart(IspEnvironment))
-               ||(IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
+            while(CopyLengthPartialOffset < CopyLength)
             {
-                // Prepare command must be repeated before every write
-                if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
-                    LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
-                {
-                    // TODO: Quick and dirty hack to address bank 0
-                    sprintf(tmpString, "P %ld %ld 0\r\n", Sector, Sector);
-                }
-                else
+                CopyLengthPartialRemainingBytes = CopyLength - CopyLengthPartialOffset;
+                if(CopyLengthPartialRemainingBytes > 256 &&
+                   IspEnvironment->PacingActive != PACING_TOKENBUCKET &&
+                   IspEnvironment->PacingActive != PACING_RTSCTS)
                 {
-                    sprintf(tmpString, "P %ld %ld\r\n", Sector, Sector);
+                  // There seems to be an error in LPC812:
+                  // When too much bytes are written at high speed,
+                  // bytes get lost
+                  // Workaround: Use smaller blocks (not needed when the
+                  // transmit rate is limited by pacing or flow control)
+                  CopyLengthPartialRemainingBytes = 256;
                 }
 
-                if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-                {
-                    DebugPrintf(1, "Wrong answer on Prepare-Command (2) (Sector %ld)\n", Sector);
-                    return (WRONG_ANSWER_PREP2 + GetAndReportErrorNumber(Answer));
-                }
+                BlockData = ImageBlock(IspEnvironment, SectorStart + SectorOffset + CopyLengthPartialOffset,
+                                       &CopyLengthPartialRemainingBytes, BlockBuffer, sizeof BlockBuffer);
+                SendComPortBlock(IspEnvironment, BlockData, CopyLengthPartialRemainingBytes);
 
-                // Round CopyLength up to one of the following values: 512, 1024,
-                // 4096, 8192; but do not exceed the maximum copy size (usually
-                // 8192, but chip-dependent)
-                if (CopyLength < 512)
-                {
-                    CopyLength = 512;
-                }
-                else if (SectorLength < 1024)
-                {
-                    CopyLength = 1024;
-                }
-                else if (SectorLength < 4096)
-                {
-                    CopyLength = 4096;
-                }
-                else
-                {
-                    CopyLength = 8192;
-                }
-                if (CopyLength > (unsigned)LPCtypes[IspEnvironment->DetectedDevice].MaxCopySize)
+                if (ReceiveComPortBlockComplete(IspEnvironment, &BigAnswer, CopyLengthPartialRemainingBytes, 10000) != 0)
                 {
-                    CopyLength = LPCtypes[IspEnvironment->DetectedDevice].MaxCopySize;
+                    return (ERROR_WRITE_DATA);
                 }
 
-                sprintf(tmpString, "C %ld %ld %ld\r\n", IspEnvironment->BinaryOffset + SectorStart + SectorOffset, ReturnValueLpcRamBase(IspEnvironment), CopyLength);
-
-                if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
+                if(memcmp(BlockData, BigAnswer, CopyLengthPartialRemainingBytes))
                 {
-                    DebugPrintf(1, "Wrong answer on Copy-Command\n");
-                    return (WRONG_ANSWER_COPY + GetAndReportErrorNumber(Answer));
+                    return (ERROR_WRITE_DATA);
                 }
 
-                if (IspEnvironment->Verify)
-                {
-
-                    //Avoid compare first 64 bytes.
-                    //Because first 64 bytes are re-mapped to flash boot sector,
-                    //and the compare result may not be correct.
-                    if (SectorStart + SectorOffset<64)
-                    {
-                        sprintf(tmpString, "M %d %ld %ld\r\n", 64, ReturnValueLpcRamBase(IspEnvironment) + (64 - SectorStart - SectorOffset), CopyLength-(64 - SectorStart - SectorOffset));
-                    }
-                    else
-                    {
-                        sprintf(tmpString, "M %ld %ld %ld\r\n", SectorStart + SectorOffset, ReturnValueLpcRamBase(IspEnvironment), CopyLength);
-                    }
-
-                    if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
-                    {
-                        DebugPrintf(1, "Wrong answer on Compare-Command\n");
-                        return (WRONG_ANSWER_COPY + GetAndReportErrorNumber(Answer));
-                    }
-                }
+                CopyLengthPartialOffset += CopyLengthPartialRemainingBytes;
             }
         }
 
-        DebugPrintf(2, "\n");
-        fflush(stdout);
-
-        if ((SectorStart + SectorLength) >= IspEnvironment->BinaryLength && Sector!=0)
-        {
-            Sector = 0;
-            SectorStart = 0;
+        if ( (IspEnvironment->BinaryOffset <  ReturnValueLpcRamStart(IspEnvironment))
+           ||(IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
+        {
+            StatsPhase(IspEnvironment, STATS_COPY);
+            Cursor->Copying = 1;
+
+            // Prepare command must be repeated before every write
+            if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
+            {
+                // TODO: Quick and dirty hack to address bank 0
+                sprintf(tmpString, "P %ld %ld 0\r\n", Sector, Sector);
+            }
+            else
+            {
+                sprintf(tmpString, "P %ld %ld\r\n", Sector, Sector);
+            }
+
+            if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
+            {
+                DebugPrintf(1, "Wrong answer on Prepare-Command (2) (Sector %ld)\n", Sector);
+                return (WRONG_ANSWER_PREP2 + GetAndReportErrorNumber(Answer));
+            }
+
+            // Round CopyLength up to one of the following values: 512, 1024,
+            // 4096, 8192; but do not exceed the maximum copy size (usually
+            // 8192, but chip-dependent)
+            if (CopyLength < 512)
+            {
+                CopyLength = 512;
+            }
+            else if (SectorLength < 1024)
+            {
+                CopyLength = 1024;
+            }
+            else if (SectorLength < 4096)
+            {
+                CopyLength = 4096;
+            }
+            else
+            {
+                CopyLength = 8192;
+            }
+            if (CopyLength > IspEnvironment->MaxCopySize)
+            {
+                CopyLength = IspEnvironment->MaxCopySize;
+            }
+
+            sprintf(tmpString, "C %ld %ld %ld\r\n", IspEnvironment->BinaryOffset + SectorStart + SectorOffset, ReturnValueLpcRamBase(IspEnvironment), CopyLength);
+
+            if (!NxpSendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer, LATENCY_COPY, CopyLength))
+            {
+                DebugPrintf(1, "Wrong answer on Copy-Command\n");
+                Cursor->Suspect = EchoDiffers(tmpString, Answer);
+                return (WRONG_ANSWER_COPY + GetAndReportErrorNumber(Answer));
+            }
+
+            if (IspEnvironment->Verify)
+            {
+                StatsPhase(IspEnvironment, STATS_VERIFY);
+
+                //Avoid compare first 64 bytes.
+                //Because first 64 bytes are re-mapped to flash boot sector,
+                //and the compare result may not be correct.
+                if (SectorStart + SectorOffset<64)
+                {
+                    sprintf(tmpString, "M %d %ld %ld\r\n", 64, ReturnValueLpcRamBase(IspEnvironment) + (64 - SectorStart - SectorOffset), CopyLength-(64 - SectorStart - SectorOffset));
+                }
+                else
+                {
+                    sprintf(tmpString, "M %ld %ld %ld\r\n", SectorStart + SectorOffset, ReturnValueLpcRamBase(IspEnvironment), CopyLength);
+                }
+
+                if (!NxpSendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer, LATENCY_COMPARE, CopyLength))
+                {
+                    DebugPrintf(1, "Wrong answer on Compare-Command\n");
+                    return (WRONG_ANSWER_COPY + GetAndReportErrorNumber(Answer));
+                }
+            }
+        }
+
+        Cursor->Offset  = SectorOffset + SectorChunk;
+        Cursor->Copying = 0;
+    }
+
+    return 0;
+}
+
+#if !defined COMPILE_FOR_LPC21
+/***************************** NxpRecoverTimeout **********************/
+/**  Timeout for an answer while recovering: the learned one, but no more
+than RECOVER_ANSWER_MS, as answers are missing here more often than not.
+*/
+static unsigned NxpRecoverTimeout(ISP_ENVIRONMENT *IspEnvironment, LATENCY_CLASS Class)
+{
+    unsigned Timeout = NxpTimeout(IspEnvironment, NxpLatencyModel(IspEnvironment, Class, 0));
+
+    return Timeout < RECOVER_ANSWER_MS ? Timeout : RECOVER_ANSWER_MS;
+}
+
+/***************************** NxpProbe *******************************/
+/**  Drains what is left of a failed answer and checks with Read Part ID
+whether the bootloader takes commands.
+\param [in] IspEnvironment Programming environment.
+\param [out] Answered set if anything came back at all.
+\return 1 if the bootloader is in command mode, else 0.
+*/
+static int NxpProbe(ISP_ENVIRONMENT *IspEnvironment, int *Answered)
+{
+    unsigned long realsize;
+    char Answer[128];
+
+    do
+    {
+        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, sizeof(Answer), RECOVER_QUIET_MS);
+    } while (realsize != 0);
+    ClearSerialPortBuffers(IspEnvironment);
+
+    StatsCommand(IspEnvironment, "J\r\n");
+    SendComPort(IspEnvironment, "J\r\n");
+    // A bootloader in the data phase only echoes, don't wait any longer
+    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 3,
+                   NxpRecoverTimeout(IspEnvironment, LATENCY_COMMAND));
+    StatsAnswer(IspEnvironment);
+
+    *Answered = realsize != 0;
+    FormatCommand(Answer, Answer);
+    return strncmp(Answer, "J\n0\n", 4) == 0;
+}
+
+/***************************** NxpLeaveDataMode ***********************/
+/**  Feeds lines of zeros to a bootloader stuck in the data phase of a
+write to RAM, until it has all the data it waits for. A line of zeros
+also passes as checksum 0 at the end of each group; once back in command
+mode, the bootloader rejects it as an invalid command.
+\param [in] IspEnvironment Programming environment.
+*/
+static void NxpLeaveDataMode(ISP_ENVIRONMENT *IspEnvironment)
+{
+    static const BINARY Zeros[45];
+    char ZeroLine[64];
+    char Answer[128];
+    char *Reply;
+    unsigned long realsize, Sum = 0;
+    unsigned long Lines, MaxLines, Total;
+
+    UuencodeLine(ZeroLine, Zeros, 45, &Sum);
+
+    // The longest write with one checksum per group, counted again after
+    // each RESEND, as a line hit by an error spoils its group
+    MaxLines = (IspEnvironment->MaxCopySize + 45 * 4) / 45 * 21 / 20 + 2;
+
+    for (Lines = Total = 0; Lines < MaxLines && Total < 4 * MaxLines; Lines++, Total++)
+    {
+        SendComPort(IspEnvironment, ZeroLine);
+        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 1,
+                       NxpRecoverTimeout(IspEnvironment, LATENCY_DATA));
+        FormatCommand(Answer, Answer);
+
+        for (Reply = Answer; *Reply != '\0'; Reply = strchr(Reply, '\n') + 1)
+        {
+            if (isdigit((unsigned char)*Reply))
+            {
+                DebugPrintf(3, "Back in command mode after %lu lines of zeros\n", Total + 1);
+                return;
+            }
+            if (strncmp(Reply, "RESEND\n", 7) == 0)
+            {
+                Lines = 0;
+            }
+            if (strchr(Reply, '\n') == NULL)
+            {
+                break;
+            }
+        }
+    }
+}
+
+/***************************** NxpRecover *****************************/
+/**  Brings the bootloader back into command mode after a failed command
+in the sector loop (-recover). If it doesn't answer Read Part ID, it is
+fed the rest of the data it may still wait for, then reset and
+synchronized again. The cursor is moved back to the start of the sector
+when the failure hit a copy to flash.
+\param [in] IspEnvironment Programming environment.
+\param [in,out] Cursor Where the download stands.
+\param [in] Error Error code of the failed command.
+\param [in] Recovery Number of this recovery.
+\return 0 to resume at the cursor, error code to give up with else.
+*/
+static int NxpRecover(ISP_ENVIRONMENT *IspEnvironment, NXP_CURSOR *Cursor, int Error, int Recovery)
+{
+    int Answered;
+    int Result;
+
+    StatsCount(IspEnvironment, STATS_RECOVERIES);
+    DebugPrintf(2, "\nError %d in sector %ld, recovering (%d of %d)\n",
+                Error, Cursor->Sector, Recovery, IspEnvironment->Recover);
+
+    if (!NxpProbe(IspEnvironment, &Answered))
+    {
+        if (Answered)
+        {
+            DebugPrintf(2, "Bootloader not in command mode, completing the data phase\n");
+            NxpLeaveDataMode(IspEnvironment);
+        }
+
+        if (!Answered || !NxpProbe(IspEnvironment, &Answered))
+        {
+            DebugPrintf(2, "No answer in command mode, synchronizing again\n");
+
+            ResetTarget(IspEnvironment, PROGRAM_MODE);
+            ClearSerialPortBuffers(IspEnvironment);
+
+            StatsPhase(IspEnvironment, STATS_SYNC);
+            Result = NxpSynchronize(IspEnvironment);
+            if (Result == 0)
+            {
+                Result = NxpOscillatorUnlock(IspEnvironment);
+            }
+            if (Result != 0)
+            {
+                return Result;
+            }
+        }
+    }
+
+    if (Cursor->Suspect)
+    {
+        DebugPrintf(2, "Garbled echo on a flash command, starting over\n");
+    }
+    else if (Cursor->Copying)
+    {
+        // The chunk may be half in flash, erase the sector again
+        Cursor->Offset = 0;
+        Cursor->Erased = 0;
+    }
+    Cursor->Copying = 0;
+
+    return 0;
+}
+#endif
+
+#if !defined COMPILE_FOR_LPC21
+/***************************** NxpJournalOpen *************************/
+/**  Opens the resume journal (-journal) of the target. Sectors it lists
+are blank checked: if one was erased since, or is not erased although its
+image is all 0xFF, the target is not the one the journal was written for
+and everything is programmed again. So is a target without a serial
+number: a blank check can't tell it from another board of the part.
+\param [in] IspEnvironment Programming environment.
+\param [in] PartId part ID read from the target.
+*/
+static void NxpJournalOpen(ISP_ENVIRONMENT *IspEnvironment, unsigned long PartId)
+{
+    unsigned long realsize;
+    char Answer[128];
+    char Command[32];
+    char Device[80];
+    unsigned long Sector, SectorStart, Pos;
+    unsigned long Status, Lines, More;
+    const char *Word;
+    size_t Length;
+    ANSWER_MATCH Match;
+    int Serial = 0;
+    int Blank;
+    int Count;
+
+    if (IspEnvironment->JournalDir == NULL)
+    {
+        return;
+    }
+
+    // The serial number tells boards apart on the same port, if the
+    // bootloader knows the command. Parts without it answer with an error
+    // code right after the echo, only a 0 is followed by the four words.
+    sprintf(Device, "%08lX", PartId);
+    StatsCommand(IspEnvironment, "N\r\n");
+    SendComPort(IspEnvironment, "N\r\n");
+    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, 1000);
+    MatchStart(&Match, Answer, realsize);
+    if (MatchLine(&Match, "N\r\n") && MatchNumber(&Match, &Status) && Status == 0)
+    {
+        // Four words of the serial number follow
+        Lines = NxpLineEnds(Answer, realsize);
+        if (Lines < 6)
+        {
+            ReceiveComPort(IspEnvironment, Answer + realsize, sizeof(Answer)-1 - realsize, &More, 6 - Lines, 1000);
+            realsize += More;
+            Match.End = Answer + realsize;
+        }
+        for (Pos = 0; Pos < 4; Pos++)
+        {
+            Word = Match.Pos;
+            if (!MatchSkipLine(&Match))
+            {
+                break;
+            }
+            Length = strcspn(Word, "\r\n");     // 32 bit words, up to 10 digits
+            sprintf(Device + strlen(Device), " %.*s", (int)(Length < 10 ? Length : 10), Word);
+        }
+        Serial = Pos == 4;
+    }
+    StatsAnswer(IspEnvironment);
+
+    // A wiped device or a download to RAM starts over
+    Count = JournalOpen(IspEnvironment, Device,
+                        IspEnvironment->WipeDevice || IspEnvironment->SectorTable == IspEnvironment->RamSectorTable);
+    if (Count == 0)
+    {
+        return;
+    }
+    if (!Serial)
+    {
+        DebugPrintf(2, "No serial number to tell the board by, programming all sectors\n");
+        JournalForget(IspEnvironment);
+        return;
+    }
+
+    for (Sector = 1, SectorStart = IspEnvironment->SectorTable[0];
+         Sector < IspEnvironment->FlashSectors && SectorStart < IspEnvironment->BinaryLength;
+         SectorStart += IspEnvironment->SectorTable[Sector++])
+    {
+        if (!JournalHasSector(IspEnvironment, Sector))
+        {
+            continue;
+        }
+
+        for (Pos = SectorStart; Pos < SectorStart + IspEnvironment->SectorTable[Sector] &&
+                                Pos < IspEnvironment->BinaryLength && ImageByte(IspEnvironment, Pos) == 0xFF; Pos++)
+            /* nothing */;
+        Blank = Pos == SectorStart + IspEnvironment->SectorTable[Sector] || Pos == IspEnvironment->BinaryLength;
+
+        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
+        {
+            // Flash bank 0, as in the erase commands
+            sprintf(Command, "I %ld %ld 0\r\n", Sector, Sector);
+        }
+        else
+        {
+            sprintf(Command, "I %ld %ld\r\n", Sector, Sector);
+        }
+
+        // Answer: 0 if blank, 8 (SECTOR_NOT_BLANK), offset and content else
+        StatsCommand(IspEnvironment, Command);
+        SendComPort(IspEnvironment, Command);
+        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, Blank ? 2 : 4, 1000);
+        StatsAnswer(IspEnvironment);
+        MatchStart(&Match, Answer, realsize);
+        if (!MatchLine(&Match, Command) || !MatchNumber(&Match, &Status) ||
+            Status != (Blank ? 0UL : 8UL))
+        {
+            DebugPrintf(2, "Sector %ld differs from the journal, programming all sectors\n", Sector);
+            ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, 100);
+            JournalForget(IspEnvironment);
+            return;
+        }
+    }
+
+    DebugPrintf(2, "Journal: %d sectors programmed before, skipping them\n", Count);
+}
+#endif
+
+#if !defined COMPILE_FOR_LPC21
+/***************************** NxpStillInCommandMode *****************/
+/**  Checks with Read Part ID whether the previous session on the port
+left the bootloader in command mode (-manifest: the part ID probe, a job
+for another part or a failed one) and it hasn't been reset since. It
+then doesn't answer '?' any more, but takes commands once unlocked again.
+\param [in] IspEnvironment Programming environment.
+\param [out] Result 0 if unlocked, error code else.
+\return 1 if the bootloader is in command mode, 0 to synchronize.
+*/
+static int NxpStillInCommandMode(ISP_ENVIRONMENT *IspEnvironment, int *Result)
+{
+    unsigned long realsize;
+    char Answer[128];
+    int Answered;
+
+    if (!IspEnvironment->CommandMode)
+    {
+        return 0;
+    }
+
+    StatsPhase(IspEnvironment, STATS_IDENTIFY);
+    if (!NxpProbe(IspEnvironment, &Answered))
+    {
+        return 0;
+    }
+
+    // The second ID word of some parts
+    do
+    {
+        ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, sizeof(Answer), RECOVER_QUIET_MS);
+    } while (realsize != 0);
+
+    DebugPrintf(2, "Bootloader still in command mode\n");
+
+    *Result = 0;
+    if (!SendAndVerify(IspEnvironment, "U 23130\r\n", Answer, sizeof Answer))
+    {
+        DebugPrintf(1, "Unlock-Command:\n");
+        *Result = UNLOCK_ERROR + GetAndReportErrorNumber(Answer);
+    }
+
+    return 1;
+}
+#endif
+
+#if !defined COMPILE_FOR_LPC21
+/***************************** NxpSetupPipelined **********************/
+/**  -pipeline: sends the commands after synchronizing back to back: the
+oscillator frequency, unlock, K and J unless the part is pinned. None of
+them depends on the answer to another. The answers to the first two are
+checked here, those to K and J are read from the same stream later.
+\param [in] IspEnvironment Programming environment.
+\param [in] ReadPartId send J too.
+\return 0 if ok, error code else.
+*/
+static int NxpSetupPipelined(ISP_ENVIRONMENT *IspEnvironment, int ReadPartId)
+{
+    unsigned long realsize;
+    char Answer[128];
+    char temp[64];
+
+    DebugPrintf(3, "Setting oscillator, unlock, reading boot code version%s\n", ReadPartId ? " and part ID" : "");
+
+    sprintf(temp, "%s\r\nU 23130\r\nK\r\n%s", IspEnvironment->StringOscillator, ReadPartId ? "J\r\n" : "");
+
+    // Timed from here, each until its answer is read
+    StatsCommand(IspEnvironment, IspEnvironment->StringOscillator);
+    StatsCommand(IspEnvironment, "U 23130\r\n");
+    StatsCommand(IspEnvironment, "K\r\n");
+    if (ReadPartId)
+    {
+        StatsCommand(IspEnvironment, "J\r\n");
+    }
+    SendComPort(IspEnvironment, temp);
+
+    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, 1000);
+    StatsAnswer(IspEnvironment);
+
+    sprintf(temp, "%s\nOK\n", IspEnvironment->StringOscillator);
+
+    FormatCommand(Answer, Answer);
+    if (strcmp(Answer, temp) != 0)
+    {
+        DebugPrintf(1, "No answer on Oscillator-Command\n");
+        return (NO_ANSWER_OSC);
+    }
+
+    StatsPhase(IspEnvironment, STATS_IDENTIFY);
+
+    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, 5000);
+    StatsAnswer(IspEnvironment);
+
+    FormatCommand(Answer, Answer);
+    if (strcmp(Answer, "U 23130\n0\n") != 0)
+    {
+        DebugPrintf(1, "Unlock-Command:\n");
+        return (UNLOCK_ERROR + GetAndReportErrorNumber(Answer));
+    }
+
+    return 0;
+}
+
+/***************************** NxpPinnedPart **************************/
+/**  -pinpart: the part of -partid, so its ID needs not be read, if it was
+read on this board before (-manifest reads it on every port first). The
+ID of -partid alone is never taken for the part. Parts told apart by the
+second configuration word are read anyway.
+\param [in] IspEnvironment Programming environment.
+\return index in LPCtypes, 0 to read the part ID.
+*/
+static int NxpPinnedPart(ISP_ENVIRONMENT *IspEnvironment)
+{
+    int i;
+
+    if (!IspEnvironment->PinPart || IspEnvironment->ExpectedPartId == 0 || IspEnvironment->DetectOnly)
+    {
+        return 0;
+    }
+    if (IspEnvironment->KnownPartId != IspEnvironment->ExpectedPartId)
+    {
+        DebugPrintf(3, "Part ID not read on this board before, reading it\n");
+        return 0;
+    }
+
+    for (i = LPCtypesCount - 1; i > 0 && LPCtypes[i].id != IspEnvironment->ExpectedPartId; i--)
+        /* nothing */;
+
+    if (i == 0 || LPCtypes[i].EvalId2 != 0)
+    {
+        DebugPrintf(3, "Part ID 0x%08lX doesn't tell the part, reading it\n", IspEnvironment->ExpectedPartId);
+        return 0;
+    }
+
+    return i;
+}
+#endif
+
+/***************************** NxpReadPartId **************************/
+/**  Reads the part ID, and the second configuration word if the first
+one doesn't tell the part, and looks the part up in LPCtypes.
+\param [out] Id the part ID and the second word (0 if not read).
+\param [in] SentAhead J has been sent already (NxpSetupPipelined).
+\return 0 if ok, error code else.
+*/
+static int NxpReadPartId(ISP_ENVIRONMENT *IspEnvironment, unsigned long Id[2], int SentAhead)
+{
+    unsigned long realsize;
+    char Answer[128];
+    char temp[128];
+    char *strippedAnswer, *endPtr;
+    const char *cmdstr;
+    int i;
+
+    cmdstr = "J\r\n";
+
+    if (!SentAhead)                     // else sent by NxpSetupPipelined
+    {
+        StatsCommand(IspEnvironment, cmdstr);
+        SendComPort(IspEnvironment, cmdstr);
+    }
+
+    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 3, 5000);
+    StatsAnswer(IspEnvironment);
+
+    FormatCommand(cmdstr, temp);
+    FormatCommand(Answer, Answer);
+    if (strncmp(Answer, temp, strlen(temp)) != 0)
+    {
+        DebugPrintf(1, "no answer on Read Part Id\n");
+        return (NO_ANSWER_RPID);
+    }
+
+    strippedAnswer = (strncmp(Answer, "J\n0\n", 4) == 0) ? Answer + 4 : Answer;
+
+    Id[0] = strtoul(strippedAnswer, &endPtr, 10);
+    Id[1] = 0UL;
+    *endPtr = '\0'; /* delete \r\n */
+    for (i = LPCtypesCount - 1; i > 0 && LPCtypes[i].id != Id[0]; i--)
+        /* nothing */;
+    IspEnvironment->DetectedDevice = i;
+    if (LPCtypes[IspEnvironment->DetectedDevice].EvalId2 != 0)
+    {
+        /* Read out the second configuration word and run the search again */
+        *endPtr = '\n';
+        endPtr++;
+        if ((endPtr[0] == '\0') || (endPtr[strlen(endPtr)-1] != '\n'))
+        {
+            /* No or incomplete word 2 */
+            ReceiveComPort(IspEnvironment, endPtr, sizeof(Answer)-(endPtr-Answer)-1, &realsize, 1, 100);
+        }
+
+        FormatCommand(endPtr, endPtr);
+        if ((*endPtr == '\0') || (*endPtr == '\n'))
+        {
+            DebugPrintf(1, "incomplete answer on Read Part Id (second configuration word missing)\n");
+            return (NO_ANSWER_RPID);
+        }
+
+        Id[1] = strtoul(endPtr, &endPtr, 10);
+        *endPtr = '\0'; /* delete \r\n */
+
+        /* now search the table again */
+        for (i = LPCtypesCount - 1; i > 0 && (LPCtypes[i].id != Id[0] || LPCtypes[i].id2 != (Id[1] & 0xFF)); i--)
+            /* nothing */;
+        IspEnvironment->DetectedDevice = i;
+    }
+
+    return 0;
+}
+
+int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
+{
+    unsigned long realsize;
+    char Answer[128];
+    char ExpectedAnswer[128];
+    char temp[128];
+    /*const*/ char *strippedAnswer;
+    int Result;
+    unsigned long Sector;
+    unsigned long SectorStart;
+    NXP_CURSOR Cursor;
+    int StartOver = 0;
+    char tmpString[128];
+    unsigned long Pos;
+    unsigned long Id[2];
+    int i;
+    unsigned long ivt_CRC;          // CRC over interrupt vector table
+    time_t tStartUpload=0, tDoneUpload=0;
+    char * cmdstr;
+    int SentAhead = 0;                  // K and J, -pipeline
+
+#if !defined COMPILE_FOR_LPC21
+//    char * cmdstr;
+    int Pinned;
+    int Recoveries = 0;
+    ISP_PROGRESS Progress;
+#endif
+
+#if !defined COMPILE_FOR_LPC21
+    Pinned = NxpPinnedPart(IspEnvironment);
+    if (!NxpStillInCommandMode(IspEnvironment, &Result))
+#endif
+    {
+        StatsPhase(IspEnvironment, STATS_SYNC);
+
+        Result = NxpSynchronize(IspEnvironment);
+        if (Result != 0)
+        {
+            return Result;
+        }
+
+        DebugPrintf(3, "Synchronized 1\n");
+
+#if !defined COMPILE_FOR_LPC21
+        if (IspEnvironment->Pipeline)
+        {
+            Result = NxpSetupPipelined(IspEnvironment, Pinned == 0);
+            SentAhead = 1;
+        }
+        else
+#endif
+        {
+            Result = NxpOscillatorUnlock(IspEnvironment);
+        }
+    }
+    if (Result != 0)
+    {
+        return Result;
+    }
+#if !defined COMPILE_FOR_LPC21
+    IspEnvironment->CommandMode = 1;
+#endif
+
+    tStartUpload = time(NULL);
+
+    DebugPrintf(2, "Read bootcode version: ");
+
+    cmdstr = "K\r\n";
+
+    if (!SentAhead)                     // else sent by NxpSetupPipelined
+    {
+        StatsCommand(IspEnvironment, cmdstr);
+        SendComPort(IspEnvironment, cmdstr);
+    }
+
+    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 4,5000);
+    StatsAnswer(IspEnvironment);
+
+    FormatCommand(cmdstr, temp);
+    FormatCommand(Answer, Answer);
+    if (strncmp(Answer, temp, strlen(temp)) != 0)
+    {
+        DebugPrintf(1, "no answer on Read Boot Code Version\n");
+        return (NO_ANSWER_RBV);
+    }
+
+    if (strncmp(Answer + strlen(temp), "0\n", 2) == 0)
+    {
+        strippedAnswer = Answer + strlen(temp) + 2;
+        /*
+        int maj, min, build;
+        if (sscanf(strippedAnswer, "%d %d %d", &build, &min, &maj) == 2) {
+        maj = min;
+        min = build;
+        build = 0;
+        } // if
+        DebugPrintf(2, "%d.%d.%d\n", maj, min, build);
+        */
+        DebugPrintf(2, strippedAnswer);
+    }
+    else
+    {
+        DebugPrintf(2, "unknown\n");
+    }
+
+#if !defined COMPILE_FOR_LPC21
+    if (Pinned != 0)
+    {
+        DebugPrintf(2, "Part ID pinned: ");
+        IspEnvironment->DetectedDevice = Pinned;
+        Id[0] = LPCtypes[Pinned].id;
+        Id[1] = 0UL;
+    }
+    else
+#endif
+    {
+        DebugPrintf(2, "Read part ID: ");
+        Result = NxpReadPartId(IspEnvironment, Id, SentAhead);
+        if (Result != 0)
+        {
+            return Result;
+        }
+    }
+    if (IspEnvironment->DetectedDevice == 0) {
+        DebugPrintf(2, "unknown");
+    }
+    else {
+        DebugPrintf(2, "LPC%s, %d kiB FLASH / %d kiB SRAM",
+            LPCtypes[IspEnvironment->DetectedDevice].Product,
+            LPCtypes[IspEnvironment->DetectedDevice].FlashSize,
+            LPCtypes[IspEnvironment->DetectedDevice].RAMSize);
+    }
+    if (LPCtypes[IspEnvironment->DetectedDevice].EvalId2 != 0)
+    {
+        DebugPrintf(2, " (0x%08lX / 0x%08lX -> %08lX)\n", Id[0], Id[1], Id[1] & 0xFF);
+    }
+    else
+    {
+        DebugPrintf(2, " (0x%08lX)\n", Id[0]);
+    }
+
+#if !defined COMPILE_FOR_LPC21
+    if (IspEnvironment->ExpectedPartId != 0 && Id[0] != IspEnvironment->ExpectedPartId)
+    {
+        DebugPrintf(1, "Wrong part, expected part ID 0x%08lX\n", IspEnvironment->ExpectedPartId);
+        return (WRONG_PART);
+    }
+#endif
+
+    IspEnvironment->VectorPatchOffset = 0;
+
+    if (!IspEnvironment->DetectOnly)
+    {
+        if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC2XXX)
+        {
+            // Patch 0x14, otherwise it is not running and jumps to boot mode
+            IspEnvironment->VectorPatchOffset = 0x14;
+        }
+        else if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX ||
+                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC17XX ||
+                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC13XX ||
+                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC11XX ||
+                LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC8XX)
+        {
+            // Patch 0x1C, otherwise it is not running and jumps to boot mode
+            IspEnvironment->VectorPatchOffset = 0x1C;
+        }
+        else
+        {
+          DebugPrintf(1, "Internal error: wrong chip variant %d (detected device %d)\n", LPCtypes[IspEnvironment->DetectedDevice].ChipVariant, IspEnvironment->DetectedDevice);
+          IspExit(IspEnvironment, 1);
+        }
+
+        // The patched vector is not written into the image (which may be
+        // shared), ImageBlock lays it over the image data while sending.
+        ivt_CRC = 0;
+
+        // Calculate a native checksum of the little endian vector table,
+        // leaving out the vector to patch:
+        for (i = 0; i < (4 * 8); i += 4) {
+            if ((unsigned long)i != IspEnvironment->VectorPatchOffset) {
+                ivt_CRC += (unsigned long)IspEnvironment->BinaryContent[i];
+                ivt_CRC += (unsigned long)IspEnvironment->BinaryContent[i + 1] << 8;
+                ivt_CRC += (unsigned long)IspEnvironment->BinaryContent[i + 2] << 16;
+                ivt_CRC += (unsigned long)IspEnvironment->BinaryContent[i + 3] << 24;
+            }
+        }
+
+        /* Negate the result and place in the vector as little endian
+        * again. The resulting vector table should checksum to 0. */
+        ivt_CRC = (unsigned long) (0 - ivt_CRC);
+        for (i = 0; i < 4; i++)
+        {
+            IspEnvironment->VectorPatch[i] = (BINARY)(ivt_CRC >> (8 * i));
+        }
+
+        DebugPrintf(3, "Position 0x%02lX patched: ivt_CRC = 0x%08lX\n", IspEnvironment->VectorPatchOffset, ivt_CRC);
+    }
+
+#if 0
+    DebugPrintf(2, "Read Unique ID:\n");
+
+    cmdstr = "N\r\n";
+
+    SendComPort(IspEnvironment, cmdstr);
+
+    ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 5,5000);
+
+    FormatCommand(cmdstr, temp);
+    FormatCommand(Answer, Answer);
+    if (strncmp(Answer, temp, strlen(temp)) != 0)
+    {
+        DebugPrintf(1, "no answer on Read Unique ID\n");
+        return (NO_ANSWER_RBV);
+    }
+
+    if (strncmp(Answer + strlen(cmdstr), "0\n", 2) == 0)
+    {
+        strippedAnswer = Answer + strlen(temp) + 2;
+        DebugPrintf(2, strippedAnswer);
+    }
+    else
+    {
+        DebugPrintf(2, "unknown\n");
+    }
+#endif // 0
+
+    /* In case of a download to RAM, use full RAM for downloading
+    * set the flash parameters to full RAM also.
+    * This makes sure that all code is downloaded as one big sector
+    */
+
+    IspEnvironment->FlashSectors = LPCtypes[IspEnvironment->DetectedDevice].FlashSectors;
+    IspEnvironment->MaxCopySize  = LPCtypes[IspEnvironment->DetectedDevice].MaxCopySize;
+    IspEnvironment->SectorTable  = LPCtypes[IspEnvironment->DetectedDevice].SectorTable;
+
+    if ( (IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment))
+       &&(IspEnvironment->BinaryOffset + IspEnvironment->BinaryLength <= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
+    {
+        IspEnvironment->FlashSectors = 1;
+        IspEnvironment->MaxCopySize  = LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024 - (ReturnValueLpcRamBase(IspEnvironment) - ReturnValueLpcRamStart(IspEnvironment));
+        IspEnvironment->RamSectorTable[0] = IspEnvironment->MaxCopySize;
+        IspEnvironment->SectorTable  = IspEnvironment->RamSectorTable;
+    }
+    if (IspEnvironment->DetectOnly)
+        return (0);
+
+#if !defined COMPILE_FOR_LPC21
+    NxpJournalOpen(IspEnvironment, Id[0]);
+#endif
+
+    if (IspEnvironment->Pacing != PACING_DEFAULT)
+    {
+      SetPacing(IspEnvironment, IspEnvironment->Pacing);
+    }
+    else if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC8XX)
+    {
+      // XON/XOFF must be switched off for LPC8XX
+      // otherwise problem during binary transmission of data to LPC8XX.
+      // The LPC8XX also loses bytes when they arrive back to back at high
+      // speed, so let the host limit the rate instead.
+      DebugPrintf(3, "Switch off XON/XOFF !!!\n");
+      SetPacing(IspEnvironment, PACING_TOKENBUCKET);
+    }
+
+    // Start with sector 1 and go upward... Sector 0 containing the interrupt vectors
+    // will be loaded last, since it contains a checksum and device will re-enter
+    // bootloader mode as long as this checksum is invalid.
+    DebugPrintf(2, "Will start programming at Sector 1 if possible, and conclude with Sector 0 to ensure that checksum is written last.\n");
+    if (IspEnvironment->SectorTable[0] >= IspEnvironment->BinaryLength)
+    {
+        Sector = 0;
+        SectorStart = 0;
+    }
+    else
+    {
+        SectorStart = IspEnvironment->SectorTable[0];
+        Sector = 1;
+    }
+
+#if !defined COMPILE_FOR_LPC21
+    memset(&Progress, 0, sizeof(Progress));
+    Progress.BytesTotal = IspEnvironment->BinaryLength;
+    for (Pos = 0; Pos < IspEnvironment->BinaryLength && Progress.SectorsTotal < (int)IspEnvironment->FlashSectors; )
+    {
+        Pos += IspEnvironment->SectorTable[Progress.SectorsTotal++];
+    }
+#endif
+
+    StatsPhase(IspEnvironment, STATS_ERASE);
+
+    if (IspEnvironment->WipeDevice == 1)
+    {
+        DebugPrintf(2, "Wiping Device. ");
+
+        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
+        {
+            // TODO: Quick and dirty hack to address bank 0
+            sprintf(tmpString, "P %d %d 0\r\n", 0, IspEnvironment->FlashSectors-1);
+        }
+        else
+        {
+            sprintf(tmpString, "P %d %d\r\n", 0, IspEnvironment->FlashSectors-1);
+        }
+
+        if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
+        {
+            DebugPrintf(1, "Wrong answer on Prepare-Command\n");
+            return (WRONG_ANSWER_PREP + GetAndReportErrorNumber(Answer));
+        }
+
+        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
+        {
+            // TODO: Quick and dirty hack to address bank 0
+            sprintf(tmpString, "E %d %d 0\r\n", 0, IspEnvironment->FlashSectors-1);
+        }
+        else
+        {
+            sprintf(tmpString, "E %d %d\r\n", 0, IspEnvironment->FlashSectors-1);
+        }
+        if (!NxpSendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer, LATENCY_ERASE, 0))
+        {
+            DebugPrintf(1, "Wrong answer on Erase-Command\n");
+            return (WRONG_ANSWER_ERAS + GetAndReportErrorNumber(Answer));
+        }
+        DebugPrintf(2, "OK \n");
+
+        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
+        {
+          DebugPrintf(2, "ATTENTION: Only bank A was wiped!!!\n");
+        }
+    }
+    else{
+        //no wiping requested: erasing sector 0 first
+        DebugPrintf(2, "Erasing sector 0 first, to invalidate checksum. ");
+
+        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
+        {
+            // TODO: Quick and dirty hack to address bank 0
+            sprintf(tmpString, "P %d %d 0\r\n", 0, 0);
+        }
+        else
+        {
+            sprintf(tmpString, "P %d %d\r\n", 0, 0);
+        }
+
+        if (!SendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer))
+        {
+            DebugPrintf(1, "Wrong answer on Prepare-Command\n");
+            return (WRONG_ANSWER_PREP + GetAndReportErrorNumber(Answer));
+        }
+
+        if (LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC43XX ||
+            LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC18XX)
+        {
+            // TODO: Quick and dirty hack to address bank 0
+            sprintf(tmpString, "E %d %d 0\r\n", 0, 0);
+        }
+        else
+        {
+            sprintf(tmpString, "E %d %d\r\n", 0, 0);
+        }
+
+        if (!NxpSendAndVerify(IspEnvironment, tmpString, Answer, sizeof Answer, LATENCY_ERASE, IspEnvironment->SectorTable[0]))
+        {
+            DebugPrintf(1, "Wrong answer on Erase-Command\n");
+            return (WRONG_ANSWER_ERAS + GetAndReportErrorNumber(Answer));
+        }
+        DebugPrintf(2, "OK \n");
+    }
+    Cursor.Sector      = Sector;
+    Cursor.SectorStart = SectorStart;
+    Cursor.Offset      = 0;
+    Cursor.Erased      = IspEnvironment->WipeDevice || Sector == 0;
+    Cursor.Copying     = 0;
+    Cursor.Suspect     = 0;
+
+    while (1)
+    {
+        if (Cursor.Sector >= IspEnvironment->FlashSectors)
+        {
+            DebugPrintf(1, "Program too large; running out of Flash sectors.\n");
+            return (PROGRAM_TOO_LARGE);
+        }
+
+        DebugPrintf(2, "Sector %ld: ", Cursor.Sector);
+        fflush(stdout);
+
+        StatsSector(IspEnvironment, Cursor.Sector);
+        StatsPhase(IspEnvironment, STATS_ERASE);
+
+        Cursor.Length = IspEnvironment->SectorTable[Cursor.Sector];
+        if (Cursor.Length > IspEnvironment->BinaryLength - Cursor.SectorStart)
+        {
+            Cursor.Length = IspEnvironment->BinaryLength - Cursor.SectorStart;
+        }
+
+        if (Cursor.Sector != 0 && JournalHasSector(IspEnvironment, Cursor.Sector))
+        {
+            DebugPrintf(2, "programmed before (journal)");
+            StatsSectorDone(IspEnvironment, 0);
+            Result = 0;
+        }
+        else
+        {
+            Result = NxpProgramSector(IspEnvironment, &Cursor);
+        }
+        if (Result != 0)
+        {
+#if !defined COMPILE_FOR_LPC21
+            if (Recoveries < IspEnvironment->Recover)
+            {
+                Recoveries++;
+                Result = NxpRecover(IspEnvironment, &Cursor, Result, Recoveries);
+            }
+#endif
+            if (Result != 0)
+            {
+                return Result;
+            }
+
+            if (Cursor.Suspect)
+            {
+                // Erase and program everything again, sector 0 included
+                Cursor.Sector      = Sector;
+                Cursor.SectorStart = SectorStart;
+                Cursor.Offset      = 0;
+                Cursor.Erased      = 0;
+                Cursor.Suspect     = 0;
+                StartOver          = 1;
+                JournalForget(IspEnvironment);
+#if !defined COMPILE_FOR_LPC21
+                Progress.SectorsDone = 0;
+                Progress.BytesDone   = 0;
+#endif
+            }
+            continue;
+        }
+
+        StatsSectorDone(IspEnvironment, Cursor.Length);
+        if (Cursor.Sector != 0)
+        {
+            JournalSector(IspEnvironment, Cursor.Sector);
+        }
+
+#if !defined COMPILE_FOR_LPC21
+        Progress.Sector     = Cursor.Sector;
+        Progress.SectorsDone++;
+        Progress.BytesDone += Cursor.Length;
+        if (IspEnvironment->Progress != NULL)
+        {
+            IspEnvironment->Progress(IspEnvironment->ProgressContext, &Progress);
+        }
+#endif
+
+        DebugPrintf(2, "\n");
+        fflush(stdout);
+
+        if ((Cursor.SectorStart + Cursor.Length) >= IspEnvironment->BinaryLength && Cursor.Sector!=0)
+        {
+            Cursor.Sector = 0;
+            Cursor.SectorStart = 0;
         }
-        else if (Sector == 0) {
+        else if (Cursor.Sector == 0) {
             break;
         }
         else {
-            SectorStart += LPCtypes[IspEnvironment->DetectedDevice].SectorTable[Sector];
-            Sector++;
+            Cursor.SectorStart += IspEnvironment->SectorTable[Cursor.Sector];
+            Cursor.Sector++;
         }
+        Cursor.Offset = 0;
+        Cursor.Erased = !StartOver && (IspEnvironment->WipeDevice || Cursor.Sector == 0);
     }
 
+    JournalFinish(IspEnvironment);
+
+    StatsPhase(IspEnvironment, STATS_GO);
+
     tDoneUpload = time(NULL);
     if (IspEnvironment->Verify)
         DebugPrintf(2, "Download Finished and Verified correct... taking %d seconds\n", tDoneUpload - tStartUpload);
@@ -1578,6 +2485,9 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
     {
         DebugPrintf(2, "Now launching the brand new code\n");
         fflush(stdout);
+#if !defined COMPILE_FOR_LPC21
+        IspEnvironment->CommandMode = 0;
+#endif
 
         if(LPCtypes[IspEnvironment->DetectedDevice].ChipVariant == CHIP_VARIANT_LPC2XXX)
         {
@@ -1598,14 +2508,16 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
         else
         {
             DebugPrintf(1, "Internal Error %s %d\n", __FILE__, __LINE__);
-            exit(1);
+            IspExit(IspEnvironment, 1);
         }
 
+        StatsCommand(IspEnvironment, tmpString);
         SendComPort(IspEnvironment, tmpString); //goto 0 : run this fresh new downloaded code code
         if ( (IspEnvironment->BinaryOffset <  ReturnValueLpcRamStart(IspEnvironment))
            ||(IspEnvironment->BinaryOffset >= ReturnValueLpcRamStart(IspEnvironment)+(LPCtypes[IspEnvironment->DetectedDevice].RAMSize*1024)))
         { // Skip response on G command - show response on Terminal instead
             ReceiveComPort(IspEnvironment, Answer, sizeof(Answer)-1, &realsize, 2, 5000);
+            StatsAnswer(IspEnvironment);
             /* the reply string is frequently terminated with a -1 (EOF) because the
             * connection gets broken; zero-terminate the string ourselves
             */
@@ -1634,7 +2546,7 @@ int NxpDownload(ISP_ENVIRONMENT *IspEnvironment)
             else
             {
                 DebugPrintf(1, "Internal Error %s %d\n", __FILE__, __LINE__);
-                exit(1);
+                IspExit(IspEnvironment, 1);
             }
 
             FormatCommand(Answer, Answer);
@@ -1683,7 +2595,7 @@ unsigned long ReturnValueLpcRamStart(ISP_ENVIRONMENT *IspEnvironment)
     return LPC_RAMSTART_LPC8XX;
   }
   DebugPrintf(1, "Error in ReturnValueLpcRamStart (%d)\n", LPCtypes[IspEnvironment->DetectedDevice].ChipVariant);
-  exit(1);
+  IspExit(IspEnvironment, 1);
 }
 
 
@@ -1718,5 +2630,5 @@ unsigned long ReturnValueLpcRamBase(ISP_ENVIRONMENT *IspEnvironment)
     return LPC_RAMBASE_LPC8XX;
   }
   DebugPrintf(1, "Error in ReturnValueLpcRamBase (%d)\n", LPCtypes[IspEnvironment->DetectedDevice].ChipVariant);
-  exit(1);
+  IspExit(IspEnvironment, 1);
 }
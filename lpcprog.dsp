@@ -96,5 +96,13 @@ SOURCE=.\lpcprog.c
 
 SOURCE=.\lpcterm.c
 # End Source File
+# Begin Source File
+
+SOURCE=.\lpctrace.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\lpctypes.c
+# End Source File
 # End Target
 # End Project
@@ -81,6 +81,40 @@ Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.c
 
 #define UNKNOWN_LPC         0x100B   /* Unknown LPC detected */
 
+#define USER_ABORT          0x100C   /* Session cancelled (SessionCancel) */
+
+#define WRONG_PART          0x100D   /* Part ID differs from -partid */
+
+/* Synchronization (NxpSynchronize) */
+
+#define SYNC_FIRST_BURST    4       /* '?' before the first reset, doubled after each reset */
+#define SYNC_PROBE_MS       100     /* Wait for "Synchronized" on top of its time on the line (-syncprobe) */
+#define SYNC_PROBE_MAX_MS   1000    /* Longest wait after handshakes spoilt by late answers */
+#define SYNC_FRAGMENT_MS    200     /* Wait for the rest of a partial "Synchronized" */
+
+/* Recovery after a failed command (NxpRecover) */
+
+#define RECOVER_QUIET_MS    100     /* Silence that ends the answer to a failed command */
+#define RECOVER_ANSWER_MS   1000    /* Longest wait for an answer while recovering */
+
+/* Checksum groups of uuencoded data (NxpGroupDone) */
+
+#define GROUP_MAX_LINES     20      /* The bootloader wants a checksum after 20 lines */
+#define GROUP_MIN_LINES     4       /* Writes are a multiple of 4 bytes, 4 lines of 45 */
+#define GROUP_STEP_LINES    4
+#define GROUP_CLEAN         8       /* Clean groups in a row before a group grows */
+
+/* Timeouts learned from the answers (NxpTimeout, -timeouts) */
+
+#define TIMEOUT_FLOOR_MS    100     /* -timeouts defaults */
+#define TIMEOUT_CEILING_MS  5000    /* also without -timeouts, and until a model has TIMEOUT_SAMPLES */
+#define TIMEOUT_SAMPLES     8
+#define TIMEOUT_DEVIATIONS  4       /* Timeout is mean + 4 * mean deviation */
+
+/* Answers matched in place (MatchLine) */
+
+#define MATCH_DIGITS        9       /* Longest number taken from an answer, fits 32 bits */
+
 #define UNLOCK_ERROR        0x1100   /* return value is 0x1100 + NXP ISP returned value (0 to 255) */
 #define WRONG_ANSWER_PREP   0x1200   /* return value is 0x1200 + NXP ISP returned value (0 to 255) */
 #define WRONG_ANSWER_ERAS   0x1300   /* return value is 0x1300 + NXP ISP returned value (0 to 255) */
@@ -130,14 +164,35 @@ typedef struct
     const char *Product;
     const unsigned int   FlashSize;     /* in kiB, for informational purposes only */
     const unsigned int   RAMSize;       /* in kiB, for informational purposes only */
-          unsigned int   FlashSectors;  /* total number of sectors */
-          unsigned int   MaxCopySize;   /* maximum size that can be copied to Flash in a single command */
+    const unsigned int   FlashSectors;  /* total number of sectors */
+    const unsigned int   MaxCopySize;   /* maximum size that can be copied to Flash in a single command */
     const unsigned int  *SectorTable;   /* pointer to a sector table with constant the sector sizes */
     const CHIP_VARIANT   ChipVariant;
 } LPC_DEVICE_TYPE;
 
+/* Supported parts, see lpctypes.c. Entry 0 is the unknown part. */
+extern const LPC_DEVICE_TYPE LPCtypes[];
+extern const unsigned int LPCtypesCount;
+
 int NxpDownload(ISP_ENVIRONMENT *IspEnvironment);
 
+void FormatCommand(const char *In, char *Out);
+
+/* Cursor over received bytes, see MatchStart. */
+typedef struct
+{
+    const char *Pos;        /* first byte not matched yet */
+    const char *End;        /* behind the last received byte */
+} ANSWER_MATCH;
+
+void MatchStart(ANSWER_MATCH *Match, const char *Answer, unsigned long Length);
+int MatchLine(ANSWER_MATCH *Match, const char *Line);
+int MatchNumber(ANSWER_MATCH *Match, unsigned long *Value);
+int MatchSkipLine(ANSWER_MATCH *Match);
+int MatchDone(const ANSWER_MATCH *Match);
+
+int UuencodeLine(char *Out, const BINARY *Data, unsigned Length, unsigned long *Checksum);
+
 unsigned long ReturnValueLpcRamStart(ISP_ENVIRONMENT *IspEnvironment);
 
 unsigned long ReturnValueLpcRamBase(ISP_ENVIRONMENT *IspEnvironment);
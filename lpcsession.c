@@ -0,0 +1,426 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcsession.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+// Reentrant programming API on top of ProgramTarget. Everything a download
+// needs lives in the ISP_ENVIRONMENT of its session, the image is shared
+// read only between sessions (NxpDownload lays the patched vector checksum
+// over it while sending). The debug level is thread local; each session
+// keeps its own and installs it while it runs.
+//
+// The step API runs ProgramTarget on a coroutine of lpcevent.c, the same
+// way the gang mode does, so NxpDownload stays one function.
+
+#if defined(_WIN32)
+#if !defined __BORLANDC__
+#include "StdAfx.h"
+#endif
+#endif // defined(_WIN32)
+#include "lpc21isp.h"
+#include "lpcprog.h"
+#include "lpcsession.h"
+#if defined GANG_SUPPORT
+#include "lpcevent.h"
+#endif
+
+/** Image loaded from a file, see ImageLoad. */
+struct isp_image
+{
+    BINARY        *Content;             /**< BINARY_PADDING bytes behind it.   */
+    unsigned long  Length;
+    unsigned long  Offset;
+    unsigned long  StartAddress;
+};
+
+/** One target, see SessionCreate. */
+struct isp_session
+{
+    ISP_ENVIRONMENT IspEnvironment;
+    int             DebugLevel;
+    int             Result;             /**< Of the last SessionProgram.       */
+#if defined GANG_SUPPORT
+    GANG_SESSION   *Steps;              /**< Of SessionStart, NULL before.     */
+#endif
+};
+
+/***************************** ImageLoad ********************************/
+/**  Reads an image file (Intel hex or binary).
+\param [in] FileName the file to read.
+\param [in] Hex nonzero for an Intel hex file, zero for a binary file.
+\param [out] Error error code if the image couldn't be loaded (may be NULL).
+\return the image, NULL on error.
+*/
+ISP_IMAGE *ImageLoad(const char *FileName, int Hex, int *Error)
+{
+    ISP_ENVIRONMENT IspEnvironment;
+    FILE_LIST File;
+    jmp_buf Abort;
+    ISP_IMAGE *Image;
+    int Result;
+
+    memset(&IspEnvironment, 0, sizeof(IspEnvironment));
+    File.name     = FileName;
+    File.prev     = NULL;
+    File.hex_flag = (char)(Hex != 0);
+    IspEnvironment.f_list = &File;
+
+    // The hex conversion ends the program on malformed files.
+    if (setjmp(Abort) == 0)
+    {
+        IspEnvironment.Abort = &Abort;
+        Result = LoadFiles(&IspEnvironment);
+    }
+    else
+    {
+        Result = IspEnvironment.ExitCode;
+        free(IspEnvironment.FileContent);
+    }
+
+    Image = NULL;
+    if (Result == 0)
+    {
+        Image = (ISP_IMAGE *)malloc(sizeof(ISP_IMAGE));
+        if (Image == NULL)
+        {
+            Result = ERR_FILE_ALLOC_HEX;
+        }
+    }
+
+    if (Result != 0)
+    {
+        free(IspEnvironment.BinaryContent);
+        if (Error != NULL)
+        {
+            *Error = Result;
+        }
+        return NULL;
+    }
+
+    Image->Content      = IspEnvironment.BinaryContent;
+    Image->Length       = IspEnvironment.BinaryLength;
+    Image->Offset       = IspEnvironment.BinaryOffset;
+    Image->StartAddress = IspEnvironment.StartAddress;
+
+    if (Error != NULL)
+    {
+        *Error = 0;
+    }
+    return Image;
+}
+
+/***************************** ImageFree ********************************/
+/**  Releases an image. No session may use it any more.
+*/
+void ImageFree(ISP_IMAGE *Image)
+{
+    if (Image != NULL)
+    {
+        free(Image->Content);
+        free(Image);
+    }
+}
+
+/***************************** ImageSize ********************************/
+/**  Size of an image.
+\return the number of bytes that get programmed.
+*/
+unsigned long ImageSize(const ISP_IMAGE *Image)
+{
+    return Image->Length;
+}
+
+/***************************** ImageAttach ******************************/
+/**  Makes an environment use an image (without copying it).
+*/
+void ImageAttach(const ISP_IMAGE *Image, ISP_ENVIRONMENT *IspEnvironment)
+{
+    IspEnvironment->BinaryContent = Image->Content;
+    IspEnvironment->BinaryLength  = Image->Length;
+    IspEnvironment->BinaryOffset  = Image->Offset;
+    IspEnvironment->StartAddress  = Image->StartAddress;
+}
+
+/***************************** SessionCreate ****************************/
+/**  Creates a session with the defaults of the command line program.
+\param [in] Port the serial port of the target.
+\param [in] Baud the baud rate.
+\param [in] Oscillator the oscillator frequency in kHz.
+\return the session, NULL if out of memory.
+*/
+ISP_SESSION *SessionCreate(const char *Port, const char *Baud, const char *Oscillator)
+{
+    ISP_SESSION *Session;
+
+    Session = (ISP_SESSION *)calloc(1, sizeof(ISP_SESSION));
+    if (Session == NULL)
+    {
+        return NULL;
+    }
+
+    Session->IspEnvironment.micro          = NXP_ARM;
+    Session->IspEnvironment.FileFormat     = FORMAT_HEX;
+    Session->IspEnvironment.ProgramChip    = 1;
+    Session->IspEnvironment.nQuestionMarks = 100;
+    Session->IspEnvironment.serial_port    = strdup(Port);
+    Session->IspEnvironment.baud_rate      = strdup(Baud);
+    strncpy(Session->IspEnvironment.StringOscillator, Oscillator,
+            sizeof(Session->IspEnvironment.StringOscillator) - 1);
+    Session->DebugLevel = debug_level;
+
+    if (Session->IspEnvironment.serial_port == NULL || Session->IspEnvironment.baud_rate == NULL)
+    {
+        SessionDestroy(Session);
+        return NULL;
+    }
+
+    return Session;
+}
+
+/***************************** SessionOption ****************************/
+/**  Applies a command line option (e.g. "-verify", "-debug3") to a session.
+\param [in] Option the option as it would be given on the command line.
+\return 1 if the option was applied, 0 if it is unknown.
+*/
+int SessionOption(ISP_SESSION *Session, const char *Option)
+{
+    int SavedDebugLevel;
+    int Known;
+
+    SavedDebugLevel = debug_level;
+    debug_level     = Session->DebugLevel;
+
+    Known = ParseOption(&Session->IspEnvironment, Option);
+
+    Session->DebugLevel = debug_level;
+    debug_level         = SavedDebugLevel;
+
+    return Known;
+}
+
+/***************************** SessionSetImage **************************/
+/**  Selects the image to program. The image is not copied, it has to stay
+loaded until the session is destroyed or gets another image.
+*/
+void SessionSetImage(ISP_SESSION *Session, const ISP_IMAGE *Image)
+{
+    ImageAttach(Image, &Session->IspEnvironment);
+}
+
+/***************************** SessionSetProgress ***********************/
+/**  Sets a function that is called after each programmed sector.
+\param [in] Progress the function, NULL for none.
+\param [in] Context passed to Progress.
+*/
+void SessionSetProgress(ISP_SESSION *Session,
+                        void (*Progress)(void *Context, const ISP_PROGRESS *Progress),
+                        void *Context)
+{
+    Session->IspEnvironment.Progress        = Progress;
+    Session->IspEnvironment.ProgressContext = Context;
+}
+
+/***************************** SessionProgram ***************************/
+/**  Programs the target: resets it into the bootloader, downloads the
+image and starts it, as the command line program does.
+\return 0 on success, an error code otherwise.
+*/
+int SessionProgram(ISP_SESSION *Session)
+{
+    int SavedDebugLevel;
+
+    SavedDebugLevel = debug_level;
+    debug_level     = Session->DebugLevel;
+
+    Session->Result = ProgramTarget(&Session->IspEnvironment);
+
+    Session->DebugLevel = debug_level;
+    debug_level         = SavedDebugLevel;
+
+    return Session->Result;
+}
+
+#if defined GANG_SUPPORT
+/***************************** SessionFinished **************************/
+/**  Takes over the outcome of a stepped session once it is done.
+\return 1 if it is done, 0 if it still runs.
+*/
+static int SessionFinished(ISP_SESSION *Session)
+{
+    if (!GangDone(Session->Steps, &Session->Result))
+    {
+        return 0;
+    }
+
+    Session->IspEnvironment.DetectedDevice = GangEnvironment(Session->Steps)->DetectedDevice;
+
+    return 1;
+}
+
+/***************************** SessionStart *****************************/
+/**  Starts programming the target like SessionProgram, but returns as
+soon as the session has to wait for the target. SessionStep continues.
+\return 0 if ok, -1 if out of memory.
+*/
+int SessionStart(ISP_SESSION *Session)
+{
+    int SavedDebugLevel;
+    int Result;
+
+    if (Session->Steps == NULL)
+    {
+        Session->Steps = GangCreate();
+        if (Session->Steps == NULL)
+        {
+            return -1;
+        }
+    }
+
+    SavedDebugLevel = debug_level;
+    debug_level     = Session->DebugLevel;
+
+    Session->IspEnvironment.DetectedDevice = 0;
+    Result = GangStart(Session->Steps, &Session->IspEnvironment, ProgramTarget);
+    if (Result == 0)
+    {
+        SessionFinished(Session);
+    }
+
+    Session->DebugLevel = debug_level;
+    debug_level         = SavedDebugLevel;
+
+    return Result;
+}
+
+/***************************** SessionStep ******************************/
+/**  Continues a started session for at most about BudgetMilliseconds.
+\param [in] BudgetMilliseconds the maximum time to wait for the target.
+\return 1 if the session is done (see SessionPoll), 0 if it still runs.
+*/
+int SessionStep(ISP_SESSION *Session, unsigned BudgetMilliseconds)
+{
+    int SavedDebugLevel;
+    int Done;
+
+    if (Session->Steps == NULL)
+    {
+        return 1;
+    }
+
+    SavedDebugLevel = debug_level;
+    debug_level     = Session->DebugLevel;
+
+    GangStep(Session->Steps, BudgetMilliseconds);
+    Done = SessionFinished(Session);
+
+    Session->DebugLevel = debug_level;
+    debug_level         = SavedDebugLevel;
+
+    return Done;
+}
+
+/***************************** SessionPoll ******************************/
+/**  Tells whether a started session is done, without waiting.
+\param [out] Result 0 on success, an error code otherwise (may be NULL).
+\return 1 if the session is done, 0 if it still runs.
+*/
+int SessionPoll(const ISP_SESSION *Session, int *Result)
+{
+    if (Session->Steps != NULL && !GangDone(Session->Steps, NULL))
+    {
+        return 0;
+    }
+
+    if (Result != NULL)
+    {
+        *Result = Session->Result;
+    }
+
+    return 1;
+}
+
+/***************************** SessionCancel ****************************/
+/**  Ends a started session right away, it is done with USER_ABORT. The
+port is closed, the target is left in the bootloader.
+*/
+void SessionCancel(ISP_SESSION *Session)
+{
+    int SavedDebugLevel;
+
+    if (Session->Steps == NULL)
+    {
+        return;
+    }
+
+    SavedDebugLevel = debug_level;
+    debug_level     = Session->DebugLevel;
+
+    GangCancel(Session->Steps);
+    SessionFinished(Session);
+
+    Session->DebugLevel = debug_level;
+    debug_level         = SavedDebugLevel;
+}
+#endif // GANG_SUPPORT
+
+/***************************** SessionPart ******************************/
+/**  Returns the product name of the part found by the last
+SessionProgram (or stepped session), NULL if no part was identified.
+*/
+const char *SessionPart(const ISP_SESSION *Session)
+{
+    if (Session->IspEnvironment.micro != NXP_ARM || Session->IspEnvironment.DetectedDevice == 0)
+    {
+        return NULL;
+    }
+
+    return LPCtypes[Session->IspEnvironment.DetectedDevice].Product;
+}
+
+/***************************** SessionDestroy ***************************/
+/**  Releases a session (not its image), a started one is cancelled.
+*/
+void SessionDestroy(ISP_SESSION *Session)
+{
+    if (Session != NULL)
+    {
+#if defined GANG_SUPPORT
+        if (Session->Steps != NULL)
+        {
+            SessionCancel(Session);
+            GangDestroy(Session->Steps);
+        }
+#endif
+        free(Session->IspEnvironment.serial_port);
+        free(Session->IspEnvironment.baud_rate);
+        free(Session);
+    }
+}
@@ -0,0 +1,93 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcsession.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+/* Programming API of the library build (liblpc21isp.a).
+ *
+ * An image is loaded once and can be programmed into any number of
+ * targets; each target is a session with its own port, settings and
+ * state, so sessions may run in different threads at the same time.
+ * Errors that end the command line program only end the session here:
+ * SessionProgram returns the exit code the program would have used.
+ *
+ * Capturing (-capture), replaying (-replay) and the timing statistics
+ * (-stats, -events) stay process wide, like on the command line.
+ *
+ * SessionProgram blocks until the target is done. On Linux a session can
+ * also be run in steps instead, so one thread can drive any number of
+ * targets (e.g. from the idle handler of a GUI):
+ *
+ *     SessionStart(Session);
+ *     while (!SessionStep(Session, 10))
+ *         ...                          // never more than about 10 ms each
+ *     SessionPoll(Session, &Result);
+ *
+ * SessionStep waits for the serial port or a protocol timeout for at most
+ * the given time and returns as soon as the session waits again. Writing
+ * to the port still blocks while the port's transmit buffer is full.
+ * SessionCancel ends a started session right away (USER_ABORT). A stepped
+ * session has to be started, stepped and cancelled by the same thread.
+ */
+
+/** Passed to the progress callback after each programmed sector. */
+typedef struct isp_progress
+{
+    int           Sector;               /**< Sector just programmed.           */
+    int           SectorsDone;
+    int           SectorsTotal;         /**< Sectors the image spans.          */
+    unsigned long BytesDone;
+    unsigned long BytesTotal;           /**< Image size.                       */
+} ISP_PROGRESS;
+
+typedef struct isp_image   ISP_IMAGE;
+typedef struct isp_session ISP_SESSION;
+
+ISP_IMAGE  *ImageLoad(const char *FileName, int Hex, int *Error);
+void        ImageFree(ISP_IMAGE *Image);
+unsigned long ImageSize(const ISP_IMAGE *Image);
+
+ISP_SESSION *SessionCreate(const char *Port, const char *Baud, const char *Oscillator);
+int          SessionOption(ISP_SESSION *Session, const char *Option);
+void         SessionSetImage(ISP_SESSION *Session, const ISP_IMAGE *Image);
+void         SessionSetProgress(ISP_SESSION *Session,
+                                void (*Progress)(void *Context, const ISP_PROGRESS *Progress),
+                                void *Context);
+int          SessionProgram(ISP_SESSION *Session);
+#if defined(__linux__)
+int          SessionStart(ISP_SESSION *Session);
+int          SessionStep(ISP_SESSION *Session, unsigned BudgetMilliseconds);
+int          SessionPoll(const ISP_SESSION *Session, int *Result);
+void         SessionCancel(ISP_SESSION *Session);
+#endif
+const char  *SessionPart(const ISP_SESSION *Session);
+void         SessionDestroy(ISP_SESSION *Session);
@@ -0,0 +1,1016 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcstats.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+// High resolution timing of downloads (-stats<file>, -events<file>).
+// NxpDownload tells us which phase it is in, when it sends an ISP command
+// and when the answer arrived, and which flash sector it works on. Each
+// session (one per port in gang mode) collects its own numbers; all of
+// them are written as one JSON document when the program ends.
+//
+// -metrics folds every finished session into process wide totals instead,
+// so a station can run for months without its statistics growing.
+
+#if defined(_WIN32)
+#if !defined __BORLANDC__
+#include "StdAfx.h"
+#endif
+#endif // defined(_WIN32)
+#include "lpc21isp.h"
+#include "lpcprog.h"
+#include "lpcstats.h"
+
+/* Commands[]: one per letter, and the oscillator frequency line. */
+#define STATS_OSCILLATOR    26
+#define STATS_COMMANDS      27
+
+/** Latency statistics of one ISP command letter. */
+typedef struct
+{
+    unsigned long      Count;
+    unsigned long long Total;               /**< Sum of all latencies (us).     */
+    unsigned long long Min;
+    unsigned long long Max;
+    unsigned long      Bucket[STATS_BUCKETS + 1];
+} STATS_COMMAND;
+
+typedef struct
+{
+    unsigned long      Sector;
+    unsigned long      Bytes;               /**< Image bytes programmed.        */
+    unsigned long long Time;                /**< Erase to verify (us).          */
+} STATS_SECTOR;
+
+struct isp_stats
+{
+    struct isp_stats  *Next;
+    char               Port[256];
+    char               Part[32];
+    int                Result;
+    int                Done;
+    unsigned long long Start;
+    unsigned long long End;
+    STATS_PHASE        Phase;
+    unsigned long long PhaseStart;
+    unsigned long long PhaseTime[STATS_PHASES];
+    int                Pending[STATS_PENDING];  /**< Commands waiting for   */
+    unsigned long long PendingStart[STATS_PENDING]; /* their answers, oldest*/
+    int                nPending;                /*   first.                 */
+    STATS_COMMAND      Commands[STATS_COMMANDS];
+    unsigned long long SectorStart;
+    int                SectorOpen;          /**< Sector clock is running.       */
+    STATS_SECTOR      *Sectors;
+    unsigned           nSectors;
+    unsigned           nSectorsAllocated;
+    unsigned long      Counters[STATS_COUNTERS];
+    unsigned long      Bytes;               /**< Image bytes programmed.        */
+    unsigned long long SyncTime;            /**< First '?' to synchronized (us),*/
+    int                Synced;              /*   valid if Synced is set.        */
+    int                Kept;                /**< In the list for -stats.        */
+    struct metrics_port *Metrics;           /**< Totals of the port.            */
+};
+
+/** -metrics: totals of one port. */
+struct metrics_port
+{
+    char               Port[256];           /**< Full path, by-id names are long. */
+    unsigned long      Ok;
+    unsigned long      Failed;
+    unsigned long      Latency[STATS_BUCKETS + 1];  /**< All commands.      */
+    unsigned long      Count;
+    unsigned long long Total;               /**< Sum of all latencies (us).     */
+    unsigned long      Sync[METRICS_SYNC_BUCKETS + 1];  /**< Time to sync.  */
+    unsigned long      SyncCount;
+    unsigned long long SyncTotal;           /**< Sum of all sync times (us).    */
+};
+
+/** -metrics: flash time of one part type. */
+typedef struct
+{
+    char               Part[32];
+    unsigned long      Bucket[METRICS_BUCKETS + 1];
+    unsigned long      Count;
+    double             Total;               /**< Sum of all times (s).          */
+} METRICS_PART;
+
+/** -metrics: downloads that ended with one result. */
+typedef struct
+{
+    int                Result;
+    unsigned long      Count;
+} METRICS_RESULT;
+
+#define METRICS_MAX     64      /**< Ports, parts and results kept apart.  */
+
+static const char *const StatsPhaseName[STATS_PHASES] =
+{
+    "reset", "sync", "identify", "erase", "write", "copy", "verify", "go"
+};
+
+static const double StatsBucketMs[STATS_BUCKETS] = { STATS_BUCKETS_MS };
+static const double MetricsBucketS[METRICS_BUCKETS] = { METRICS_BUCKETS_S };
+static const double MetricsSyncBucketMs[METRICS_SYNC_BUCKETS] = { METRICS_SYNC_BUCKETS_MS };
+
+static const char *const StatsCounterName[STATS_COUNTERS] =
+{
+    "sync_attempts", "resends", "sync_resets", "recoveries", "groups"
+};
+
+static const char *const MetricsCounterHelp[STATS_COUNTERS] =
+{
+    "Question marks sent to synchronize.", "Checksum groups sent again.",
+    "Target resets while synchronizing.", "Recoveries after failed commands.",
+    "Checksum groups of uuencoded data."
+};
+
+static const char *StatsFile;
+static FILE       *StatsEvents;
+static struct isp_stats *StatsSessions;
+static struct isp_stats **StatsLast = &StatsSessions;
+
+static const char         *MetricsPath;
+static time_t              MetricsWritten;
+static struct metrics_port MetricsPorts[METRICS_MAX];
+static int                 nMetricsPorts;
+static METRICS_PART        MetricsParts[METRICS_MAX];
+static int                 nMetricsParts;
+static METRICS_RESULT      MetricsResults[METRICS_MAX];
+static int                 nMetricsResults;
+static unsigned long       MetricsBytes;
+static unsigned long       MetricsCounters[STATS_COUNTERS];
+
+/***************************** StatsClock *******************************/
+/**  Monotonic time base of the statistics.
+\return time in microseconds.
+*/
+static unsigned long long StatsClock(void)
+{
+#if defined COMPILE_FOR_WINDOWS
+    LARGE_INTEGER freq, now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart * 1000000.0 / freq.QuadPart);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+#endif
+}
+
+/***************************** StatsString ******************************/
+/**  Writes a string as JSON string literal.
+*/
+static void StatsString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            fprintf(f, "\\%c", *s);
+        }
+        else if ((unsigned char)*s < 0x20)
+        {
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        }
+        else
+        {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/***************************** StatsEvent *******************************/
+/**  Starts a line in the event file with time stamp and port. The caller
+adds its fields and ends the line with StatsEventEnd.
+\return 1 if the line was started, 0 if there is no event file.
+*/
+static int StatsEvent(const struct isp_stats *Stats, unsigned long long Now, const char *Event)
+{
+    if (StatsEvents == NULL)
+    {
+        return 0;
+    }
+
+    fprintf(StatsEvents, "{\"t_ms\":%.3f,\"port\":", (Now - Stats->Start) / 1000.0);
+    StatsString(StatsEvents, Stats->Port);
+    fprintf(StatsEvents, ",\"event\":\"%s\"", Event);
+    return 1;
+}
+
+static void StatsEventEnd(void)
+{
+    fputs("}\n", StatsEvents);
+    fflush(StatsEvents);    // the station dashboard follows the file
+}
+
+/***************************** MetricsPort ******************************/
+/**  Finds (or adds) the totals of a port.
+\return the totals, NULL if too many ports.
+*/
+static struct metrics_port *MetricsPort(const char *Port)
+{
+    int i;
+
+    for (i = 0; i < nMetricsPorts; i++)
+    {
+        if (strcmp(MetricsPorts[i].Port, Port) == 0)
+        {
+            return &MetricsPorts[i];
+        }
+    }
+
+    if (nMetricsPorts == METRICS_MAX)
+    {
+        return NULL;
+    }
+
+    strncpy(MetricsPorts[nMetricsPorts].Port, Port, sizeof(MetricsPorts[0].Port) - 1);
+    return &MetricsPorts[nMetricsPorts++];
+}
+
+/***************************** MetricsAdd *******************************/
+/**  Adds a finished download to the totals.
+*/
+static void MetricsAdd(const struct isp_stats *Stats)
+{
+    double Seconds = (Stats->End - Stats->Start) / 1e6;
+    int i, b;
+
+    for (i = 0; i < nMetricsResults && MetricsResults[i].Result != Stats->Result; i++)
+        /* nothing */;
+    if (i < METRICS_MAX)
+    {
+        MetricsResults[i].Result = Stats->Result;
+        MetricsResults[i].Count++;
+        if (i == nMetricsResults)
+        {
+            nMetricsResults++;
+        }
+    }
+
+    if (Stats->Metrics != NULL)
+    {
+        if (Stats->Result == 0)
+        {
+            Stats->Metrics->Ok++;
+        }
+        else
+        {
+            Stats->Metrics->Failed++;
+        }
+
+        if (Stats->Synced)
+        {
+            for (b = 0; b < METRICS_SYNC_BUCKETS && Stats->SyncTime / 1000.0 > MetricsSyncBucketMs[b]; b++)
+                /* nothing */;
+            Stats->Metrics->Sync[b]++;
+            Stats->Metrics->SyncCount++;
+            Stats->Metrics->SyncTotal += Stats->SyncTime;
+        }
+    }
+
+    MetricsBytes += Stats->Bytes;
+    for (i = 0; i < STATS_COUNTERS; i++)
+    {
+        MetricsCounters[i] += Stats->Counters[i];
+    }
+
+    // Flash time of complete downloads only
+    if (Stats->Result != 0 || Stats->Part[0] == '\0' || Stats->Bytes == 0)
+    {
+        return;
+    }
+
+    for (i = 0; i < nMetricsParts && strcmp(MetricsParts[i].Part, Stats->Part) != 0; i++)
+        /* nothing */;
+    if (i == METRICS_MAX)
+    {
+        return;
+    }
+    if (i == nMetricsParts)
+    {
+        strcpy(MetricsParts[nMetricsParts++].Part, Stats->Part);
+    }
+
+    for (b = 0; b < METRICS_BUCKETS && Seconds > MetricsBucketS[b]; b++)
+        /* nothing */;
+    MetricsParts[i].Bucket[b]++;
+    MetricsParts[i].Count++;
+    MetricsParts[i].Total += Seconds;
+}
+
+/***************************** MetricsLabel *****************************/
+/**  Writes a label value, escaped for the Prometheus text format.
+*/
+static void MetricsLabel(FILE *f, const char *Name, const char *s)
+{
+    fprintf(f, "%s=\"", Name);
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            fprintf(f, "\\%c", *s);
+        }
+        else if (*s == '\n')
+        {
+            fputs("\\n", f);
+        }
+        else
+        {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/***************************** MetricsHistogram *************************/
+/**  Writes the lines of one histogram (buckets are not cumulative yet).
+*/
+static void MetricsHistogram(FILE *f, const char *Name, const char *Label, const char *Value,
+                             const double *Bounds, double Scale, int nBounds,
+                             const unsigned long *Buckets, unsigned long Count, double Sum)
+{
+    unsigned long Cumulative = 0;
+    int b;
+
+    for (b = 0; b < nBounds; b++)
+    {
+        Cumulative += Buckets[b];
+        fprintf(f, "%s_bucket{", Name);
+        MetricsLabel(f, Label, Value);
+        fprintf(f, ",le=\"%g\"} %lu\n", Bounds[b] * Scale, Cumulative);
+    }
+    fprintf(f, "%s_bucket{", Name);
+    MetricsLabel(f, Label, Value);
+    fprintf(f, ",le=\"+Inf\"} %lu\n", Count);
+
+    fprintf(f, "%s_sum{", Name);
+    MetricsLabel(f, Label, Value);
+    fprintf(f, "} %.6f\n", Sum);
+
+    fprintf(f, "%s_count{", Name);
+    MetricsLabel(f, Label, Value);
+    fprintf(f, "} %lu\n", Count);
+}
+
+/***************************** MetricsWrite *****************************/
+/**  Replaces the metrics file with the current totals. The new contents
+are written to a temporary file first, so readers never see half a file.
+*/
+static void MetricsWrite(void)
+{
+    char Temp[FILENAME_MAX];
+    FILE *f;
+    int i;
+
+    if (MetricsPath == NULL)
+    {
+        return;
+    }
+
+    snprintf(Temp, sizeof(Temp), "%s.tmp", MetricsPath);
+    f = fopen(Temp, "w");
+    if (f == NULL)
+    {
+        DebugPrintf(1, "Can't create metrics file %s\n", Temp);
+        return;
+    }
+
+    fputs("# HELP lpc21isp_downloads_total Downloads by result (0x0 or the error code).\n"
+          "# TYPE lpc21isp_downloads_total counter\n", f);
+    for (i = 0; i < nMetricsResults; i++)
+    {
+        fprintf(f, "lpc21isp_downloads_total{result=\"0x%X\"} %lu\n", MetricsResults[i].Result, MetricsResults[i].Count);
+    }
+
+    fputs("# HELP lpc21isp_port_downloads_total Downloads by port and outcome.\n"
+          "# TYPE lpc21isp_port_downloads_total counter\n", f);
+    for (i = 0; i < nMetricsPorts; i++)
+    {
+        fputs("lpc21isp_port_downloads_total{", f);
+        MetricsLabel(f, "port", MetricsPorts[i].Port);
+        fprintf(f, ",outcome=\"ok\"} %lu\n", MetricsPorts[i].Ok);
+        fputs("lpc21isp_port_downloads_total{", f);
+        MetricsLabel(f, "port", MetricsPorts[i].Port);
+        fprintf(f, ",outcome=\"failed\"} %lu\n", MetricsPorts[i].Failed);
+    }
+
+    fprintf(f, "# HELP lpc21isp_bytes_written_total Image bytes programmed.\n"
+               "# TYPE lpc21isp_bytes_written_total counter\n"
+               "lpc21isp_bytes_written_total %lu\n", MetricsBytes);
+
+    for (i = 0; i < STATS_COUNTERS; i++)
+    {
+        fprintf(f, "# HELP lpc21isp_%s_total %s\n"
+                   "# TYPE lpc21isp_%s_total counter\n"
+                   "lpc21isp_%s_total %lu\n", StatsCounterName[i], MetricsCounterHelp[i],
+                StatsCounterName[i], StatsCounterName[i], MetricsCounters[i]);
+    }
+
+    fputs("# HELP lpc21isp_flash_seconds Time of successful downloads by part.\n"
+          "# TYPE lpc21isp_flash_seconds histogram\n", f);
+    for (i = 0; i < nMetricsParts; i++)
+    {
+        MetricsHistogram(f, "lpc21isp_flash_seconds", "part", MetricsParts[i].Part, MetricsBucketS, 1,
+                         METRICS_BUCKETS, MetricsParts[i].Bucket, MetricsParts[i].Count, MetricsParts[i].Total);
+    }
+
+    fputs("# HELP lpc21isp_command_latency_seconds ISP command round trip by port.\n"
+          "# TYPE lpc21isp_command_latency_seconds histogram\n", f);
+    for (i = 0; i < nMetricsPorts; i++)
+    {
+        MetricsHistogram(f, "lpc21isp_command_latency_seconds", "port", MetricsPorts[i].Port, StatsBucketMs, 0.001,
+                         STATS_BUCKETS, MetricsPorts[i].Latency, MetricsPorts[i].Count, MetricsPorts[i].Total / 1e6);
+    }
+
+    fputs("# HELP lpc21isp_sync_seconds Time from the first '?' to the synchronized target by port.\n"
+          "# TYPE lpc21isp_sync_seconds histogram\n", f);
+    for (i = 0; i < nMetricsPorts; i++)
+    {
+        MetricsHistogram(f, "lpc21isp_sync_seconds", "port", MetricsPorts[i].Port, MetricsSyncBucketMs, 0.001,
+                         METRICS_SYNC_BUCKETS, MetricsPorts[i].Sync, MetricsPorts[i].SyncCount,
+                         MetricsPorts[i].SyncTotal / 1e6);
+    }
+
+    fprintf(f, "# HELP lpc21isp_metrics_time_seconds When this file was written.\n"
+               "# TYPE lpc21isp_metrics_time_seconds gauge\n"
+               "lpc21isp_metrics_time_seconds %lu\n", (unsigned long)time(NULL));
+
+    fclose(f);
+    MetricsWritten = time(NULL);
+
+#if defined COMPILE_FOR_WINDOWS
+    remove(MetricsPath);    // rename doesn't replace files there
+#endif
+    if (rename(Temp, MetricsPath) != 0)
+    {
+        DebugPrintf(1, "Can't replace metrics file %s\n", MetricsPath);
+    }
+}
+
+/***************************** StatsTick ********************************/
+/**  Rewrites the metrics file every METRICS_PERIOD_S seconds, so that the
+file of an idle daemon stays fresh. Called from the daemon loops.
+*/
+void StatsTick(void)
+{
+    if (MetricsPath != NULL && time(NULL) - MetricsWritten >= METRICS_PERIOD_S)
+    {
+        MetricsWrite();
+    }
+}
+
+/***************************** StatsOpen ********************************/
+/**  Enables the statistics.
+\param [in] SummaryFile file the JSON summary is written to at exit, NULL
+for none.
+\param [in] EventFile file the events are written to while programming,
+NULL for none.
+\param [in] MetricsFile file the totals are written to after each
+download and every METRICS_PERIOD_S seconds (StatsTick), NULL for none.
+\return 0 if successful, -1 if the event file can't be created.
+*/
+int StatsOpen(const char *SummaryFile, const char *EventFile, const char *MetricsFile)
+{
+    if (EventFile != NULL)
+    {
+        StatsEvents = fopen(EventFile, "w");
+        if (StatsEvents == NULL)
+        {
+            return -1;
+        }
+    }
+
+    StatsFile   = SummaryFile;
+    MetricsPath = MetricsFile;
+    MetricsWrite();         // the file is there before the first download
+
+    atexit(StatsClose);     // protocol errors end the program with exit()
+
+    return 0;
+}
+
+/***************************** StatsBegin *******************************/
+/**  Starts the statistics of a download on the port of IspEnvironment.
+Does nothing unless StatsOpen was called.
+*/
+void StatsBegin(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct isp_stats *Stats;
+
+    IspEnvironment->Stats = NULL;
+
+    if (StatsFile == NULL && StatsEvents == NULL && MetricsPath == NULL)
+    {
+        return;
+    }
+
+    Stats = (struct isp_stats *)calloc(1, sizeof(struct isp_stats));
+    if (Stats == NULL)
+    {
+        return;
+    }
+
+    strncpy(Stats->Port, IspEnvironment->serial_port != NULL ? IspEnvironment->serial_port : "", sizeof(Stats->Port) - 1);
+    Stats->Start      = StatsClock();
+    Stats->Phase      = STATS_NONE;
+    Stats->PhaseStart = Stats->Start;
+
+    if (StatsFile != NULL)
+    {
+        *StatsLast  = Stats;
+        StatsLast   = &Stats->Next;
+        Stats->Kept = 1;
+    }
+
+    if (MetricsPath != NULL)
+    {
+        Stats->Metrics = MetricsPort(Stats->Port);
+    }
+
+    IspEnvironment->Stats = Stats;
+
+    if (StatsEvent(Stats, Stats->Start, "begin"))
+    {
+        StatsEventEnd();
+    }
+}
+
+/***************************** StatsPhase *******************************/
+/**  Ends the current phase and starts another one.
+\param [in] Phase the new phase, STATS_NONE to stop the phase clock.
+*/
+void StatsPhase(ISP_ENVIRONMENT *IspEnvironment, STATS_PHASE Phase)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+    unsigned long long Now;
+
+    if (Stats == NULL || Stats->Phase == Phase)
+    {
+        return;
+    }
+
+    Now = StatsClock();
+    if (Stats->Phase != STATS_NONE)
+    {
+        Stats->PhaseTime[Stats->Phase] += Now - Stats->PhaseStart;
+    }
+    Stats->Phase      = Phase;
+    Stats->PhaseStart = Now;
+
+    if (Phase != STATS_NONE && StatsEvent(Stats, Now, "phase"))
+    {
+        fprintf(StatsEvents, ",\"phase\":\"%s\"", StatsPhaseName[Phase]);
+        StatsEventEnd();
+    }
+}
+
+/***************************** StatsCommandName *************************/
+/**  Name of an entry of Commands[] in the statistics.
+\param [out] Letter room for the name of a command letter.
+*/
+static const char *StatsCommandName(int i, char Letter[2])
+{
+    if (i == STATS_OSCILLATOR)
+    {
+        return "osc";
+    }
+    Letter[0] = (char)('A' + i);
+    Letter[1] = '\0';
+    return Letter;
+}
+
+/***************************** StatsCommand *****************************/
+/**  Notes that an ISP command is about to be sent. Its latency runs until
+the matching call of StatsAnswer: commands sent ahead (-pipeline) are
+answered in the order they were sent.
+\param [in] Command the command line, only the first character is used,
+a digit for the oscillator frequency.
+*/
+void StatsCommand(ISP_ENVIRONMENT *IspEnvironment, const char *Command)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+    int i;
+
+    if (Stats == NULL)
+    {
+        return;
+    }
+
+    if (Command[0] >= 'A' && Command[0] <= 'Z')
+    {
+        i = Command[0] - 'A';
+    }
+    else if (Command[0] >= '0' && Command[0] <= '9')
+    {
+        i = STATS_OSCILLATOR;
+    }
+    else
+    {
+        return;
+    }
+
+    // The oldest one never got its answer
+    if (Stats->nPending == STATS_PENDING)
+    {
+        memmove(Stats->Pending, Stats->Pending + 1, (STATS_PENDING - 1) * sizeof(Stats->Pending[0]));
+        memmove(Stats->PendingStart, Stats->PendingStart + 1, (STATS_PENDING - 1) * sizeof(Stats->PendingStart[0]));
+        Stats->nPending--;
+    }
+
+    Stats->Pending[Stats->nPending]      = i;
+    Stats->PendingStart[Stats->nPending] = StatsClock();
+    Stats->nPending++;
+}
+
+/***************************** StatsAnswer ******************************/
+/**  Notes that the answer to the oldest command waiting has been received.
+*/
+void StatsAnswer(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+    STATS_COMMAND *Command;
+    unsigned long long Now, Latency;
+    char Letter[2];
+    int b;
+
+    if (Stats == NULL || Stats->nPending == 0)
+    {
+        return;
+    }
+
+    Now     = StatsClock();
+    Latency = Now - Stats->PendingStart[0];
+    Command = &Stats->Commands[Stats->Pending[0]];
+
+    if (Command->Count == 0 || Latency < Command->Min)
+    {
+        Command->Min = Latency;
+    }
+    if (Latency > Command->Max)
+    {
+        Command->Max = Latency;
+    }
+    Command->Count++;
+    Command->Total += Latency;
+
+    for (b = 0; b < STATS_BUCKETS && Latency / 1000.0 > StatsBucketMs[b]; b++)
+        /* nothing */;
+    Command->Bucket[b]++;
+
+    if (Stats->Metrics != NULL)
+    {
+        Stats->Metrics->Latency[b]++;
+        Stats->Metrics->Count++;
+        Stats->Metrics->Total += Latency;
+    }
+
+    if (StatsEvent(Stats, Now, "command"))
+    {
+        fprintf(StatsEvents, ",\"cmd\":\"%s\",\"ms\":%.3f", StatsCommandName(Stats->Pending[0], Letter),
+                Latency / 1000.0);
+        StatsEventEnd();
+    }
+
+    Stats->nPending--;
+    memmove(Stats->Pending, Stats->Pending + 1, Stats->nPending * sizeof(Stats->Pending[0]));
+    memmove(Stats->PendingStart, Stats->PendingStart + 1, Stats->nPending * sizeof(Stats->PendingStart[0]));
+}
+
+/***************************** StatsSector ******************************/
+/**  Starts the clock of a flash sector.
+*/
+void StatsSector(ISP_ENVIRONMENT *IspEnvironment, unsigned long Sector)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+
+    if (Stats == NULL)
+    {
+        return;
+    }
+
+    if (Stats->nSectors == Stats->nSectorsAllocated)
+    {
+        unsigned n = Stats->nSectorsAllocated ? 2 * Stats->nSectorsAllocated : 32;
+        STATS_SECTOR *Sectors = (STATS_SECTOR *)realloc(Stats->Sectors, n * sizeof(STATS_SECTOR));
+
+        if (Sectors == NULL)
+        {
+            return;
+        }
+        Stats->Sectors           = Sectors;
+        Stats->nSectorsAllocated = n;
+    }
+
+    Stats->Sectors[Stats->nSectors].Sector = Sector;
+    Stats->Sectors[Stats->nSectors].Bytes  = 0;
+    Stats->Sectors[Stats->nSectors].Time   = 0;
+    Stats->SectorStart = StatsClock();
+    Stats->SectorOpen  = 1;
+}
+
+/***************************** StatsSectorDone **************************/
+/**  Stops the clock of the flash sector started last. Does nothing if
+it has already been stopped.
+\param [in] Bytes number of image bytes written to the sector, 0 if it
+was skipped.
+*/
+void StatsSectorDone(ISP_ENVIRONMENT *IspEnvironment, unsigned long Bytes)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+    STATS_SECTOR *Sector;
+    unsigned long long Now;
+
+    if (Stats == NULL || !Stats->SectorOpen)
+    {
+        return;
+    }
+
+    Now = StatsClock();
+    Stats->SectorOpen = 0;
+    Sector = &Stats->Sectors[Stats->nSectors++];
+    Sector->Bytes = Bytes;
+    Sector->Time  = Now - Stats->SectorStart;
+    Stats->Bytes += Bytes;
+
+    if (StatsEvent(Stats, Now, "sector"))
+    {
+        fprintf(StatsEvents, ",\"sector\":%lu,\"bytes\":%lu,\"ms\":%.3f,\"bytes_per_s\":%.0f",
+                Sector->Sector, Sector->Bytes, Sector->Time / 1000.0,
+                Sector->Time ? Sector->Bytes * 1e6 / Sector->Time : 0.0);
+        StatsEventEnd();
+    }
+}
+
+/***************************** StatsCount *******************************/
+/**  Counts an event of the current download.
+*/
+void StatsCount(ISP_ENVIRONMENT *IspEnvironment, STATS_COUNTER Counter)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+
+    if (Stats != NULL)
+    {
+        Stats->Counters[Counter]++;
+    }
+}
+
+/***************************** StatsSynced ******************************/
+/**  Notes that the target answered the synchronization. The time to sync
+runs from the start of the sync phase.
+*/
+void StatsSynced(ISP_ENVIRONMENT *IspEnvironment)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+    unsigned long long Now;
+
+    if (Stats == NULL || Stats->Phase != STATS_SYNC)
+    {
+        return;
+    }
+
+    Now = StatsClock();
+    Stats->SyncTime = Now - Stats->PhaseStart;
+    Stats->Synced   = 1;
+
+    if (StatsEvent(Stats, Now, "synced"))
+    {
+        fprintf(StatsEvents, ",\"ms\":%.3f,\"attempts\":%lu,\"resets\":%lu", Stats->SyncTime / 1000.0,
+                Stats->Counters[STATS_SYNC_ATTEMPTS], Stats->Counters[STATS_SYNC_RESETS]);
+        StatsEventEnd();
+    }
+}
+
+/***************************** StatsEnd *********************************/
+/**  Ends the statistics of a download.
+\param [in] Result result of the download, 0 if successful.
+*/
+void StatsEnd(ISP_ENVIRONMENT *IspEnvironment, int Result)
+{
+    struct isp_stats *Stats = IspEnvironment->Stats;
+    int p;
+
+    if (Stats == NULL)
+    {
+        return;
+    }
+
+    StatsPhase(IspEnvironment, STATS_NONE);
+    Stats->End    = StatsClock();
+    Stats->Result = Result;
+    Stats->Done   = 1;
+
+#ifdef LPC_SUPPORT
+    if (IspEnvironment->micro == NXP_ARM && IspEnvironment->DetectedDevice != 0)
+    {
+        sprintf(Stats->Part, "LPC%.28s", LPCtypes[IspEnvironment->DetectedDevice].Product);
+    }
+#endif
+
+    if (StatsEvent(Stats, Stats->End, "end"))
+    {
+        fprintf(StatsEvents, ",\"result\":%d,\"total_ms\":%.3f", Result, (Stats->End - Stats->Start) / 1000.0);
+        StatsEventEnd();
+    }
+
+    DebugPrintf(3, "Time per phase (ms):");
+    for (p = 0; p < STATS_PHASES; p++)
+    {
+        DebugPrintf(3, " %s %.1f", StatsPhaseName[p], Stats->PhaseTime[p] / 1000.0);
+    }
+    DebugPrintf(3, ", total %.1f\n", (Stats->End - Stats->Start) / 1000.0);
+
+    IspEnvironment->Stats = NULL;
+
+    if (MetricsPath != NULL)
+    {
+        MetricsAdd(Stats);
+        MetricsWrite();
+    }
+
+    if (!Stats->Kept)
+    {
+        free(Stats->Sectors);
+        free(Stats);
+    }
+}
+
+/***************************** StatsWriteSession ************************/
+/**  Writes the summary of one session as JSON object.
+*/
+static void StatsWriteSession(FILE *f, const struct isp_stats *Stats)
+{
+    unsigned long long End = Stats->Done ? Stats->End : StatsClock();
+    const char *Separator;
+    char Letter[2];
+    unsigned i;
+    int b;
+
+    fputs("    {\n      \"port\": ", f);
+    StatsString(f, Stats->Port);
+    fputs(",\n      \"part\": ", f);
+    if (Stats->Part[0] != '\0')
+    {
+        StatsString(f, Stats->Part);
+    }
+    else
+    {
+        fputs("null", f);
+    }
+    if (Stats->Done)
+    {
+        fprintf(f, ",\n      \"result\": %d", Stats->Result);
+    }
+    else
+    {
+        fputs(",\n      \"result\": null", f);      // ended by exit()
+    }
+    fprintf(f, ",\n      \"total_ms\": %.3f", (End - Stats->Start) / 1000.0);
+    if (Stats->Synced)
+    {
+        fprintf(f, ",\n      \"sync_ms\": %.3f", Stats->SyncTime / 1000.0);
+    }
+    else
+    {
+        fputs(",\n      \"sync_ms\": null", f);
+    }
+    for (i = 0; i < STATS_COUNTERS; i++)
+    {
+        fprintf(f, ",\n      \"%s\": %lu", StatsCounterName[i], Stats->Counters[i]);
+    }
+
+    fputs(",\n      \"phases_ms\": {", f);
+    for (i = 0; i < STATS_PHASES; i++)
+    {
+        unsigned long long t = Stats->PhaseTime[i];
+
+        if (!Stats->Done && Stats->Phase == (STATS_PHASE)i)
+        {
+            t += End - Stats->PhaseStart;
+        }
+        fprintf(f, "%s\"%s\": %.3f", i ? ", " : " ", StatsPhaseName[i], t / 1000.0);
+    }
+    fputs(" }", f);
+
+    fputs(",\n      \"commands\": {", f);
+    Separator = "";
+    for (i = 0; i < STATS_COMMANDS; i++)
+    {
+        const STATS_COMMAND *Command = &Stats->Commands[i];
+
+        if (Command->Count == 0)
+        {
+            continue;
+        }
+        fprintf(f, "%s\n        \"%s\": { \"count\": %lu, \"total_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f, \"buckets\": [",
+                Separator, StatsCommandName(i, Letter), Command->Count, Command->Total / 1000.0, Command->Min / 1000.0, Command->Max / 1000.0);
+        for (b = 0; b <= STATS_BUCKETS; b++)
+        {
+            fprintf(f, "%s%lu", b ? ", " : "", Command->Bucket[b]);
+        }
+        fputs("] }", f);
+        Separator = ",";
+    }
+    fputs(*Separator ? "\n      }" : " }", f);
+
+    fputs(",\n      \"sectors\": [", f);
+    for (i = 0; i < Stats->nSectors; i++)
+    {
+        const STATS_SECTOR *Sector = &Stats->Sectors[i];
+
+        fprintf(f, "%s\n        { \"sector\": %lu, \"bytes\": %lu, \"ms\": %.3f, \"bytes_per_s\": %.0f }",
+                i ? "," : "", Sector->Sector, Sector->Bytes, Sector->Time / 1000.0,
+                Sector->Time ? Sector->Bytes * 1e6 / Sector->Time : 0.0);
+    }
+    fputs(Stats->nSectors ? "\n      ]\n    }" : " ]\n    }", f);
+}
+
+/***************************** StatsClose *******************************/
+/**  Writes the JSON summary of all sessions and closes the event file.
+*/
+void StatsClose(void)
+{
+    struct isp_stats *Stats, *Next;
+    FILE *f;
+    int b;
+
+    if (MetricsPath != NULL)
+    {
+        MetricsWrite();
+        MetricsPath = NULL;
+    }
+
+    if (StatsFile != NULL)
+    {
+        f = fopen(StatsFile, "w");
+        if (f == NULL)
+        {
+            DebugPrintf(1, "Can't create statistics file %s\n", StatsFile);
+        }
+        else
+        {
+            fputs("{\n  \"format\": 1,\n  \"bucket_bounds_ms\": [", f);
+            for (b = 0; b < STATS_BUCKETS; b++)
+            {
+                fprintf(f, "%s%g", b ? ", " : "", StatsBucketMs[b]);
+            }
+            fputs("],\n  \"sessions\": [", f);
+            for (Stats = StatsSessions; Stats != NULL; Stats = Stats->Next)
+            {
+                fputs(Stats == StatsSessions ? "\n" : ",\n", f);
+                StatsWriteSession(f, Stats);
+            }
+            fputs(StatsSessions != NULL ? "\n  ]\n}\n" : "]\n}\n", f);
+            fclose(f);
+        }
+        StatsFile = NULL;
+    }
+
+    if (StatsEvents != NULL)
+    {
+        fclose(StatsEvents);
+        StatsEvents = NULL;
+    }
+
+    for (Stats = StatsSessions; Stats != NULL; Stats = Next)
+    {
+        Next = Stats->Next;
+        free(Stats->Sectors);
+        free(Stats);
+    }
+    StatsSessions = NULL;
+    StatsLast     = &StatsSessions;
+}
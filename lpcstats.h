@@ -0,0 +1,124 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC1000 / LPC2000 family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpcstats.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/* Timing statistics of a download (-stats<file>, -events<file>).
+ *
+ * The protocol code marks the phase it is in and the ISP commands it
+ * sends; time is taken with CLOCK_MONOTONIC (QueryPerformanceCounter on
+ * Windows). At exit a JSON summary with the time per phase, a latency
+ * histogram per command letter (and "osc" for the oscillator frequency)
+ * and the throughput per flash sector is written for every session.
+ * Commands sent ahead (-pipeline) are timed from when they were sent. Optionally each of these steps is appended
+ * to an event file as one JSON object per line while the download runs.
+ *
+ * For stations that run for a long time (-daemon, -manifest, -gang) the
+ * totals over all downloads can be kept in a Prometheus text file
+ * (-metrics<file>, e.g. for the node exporter's textfile collector). It
+ * is replaced after every download, at exit, and every METRICS_PERIOD_S
+ * seconds while -daemon or -manifest waits for work.
+ */
+
+typedef enum
+{
+    STATS_NONE = -1,
+    STATS_RESET,
+    STATS_SYNC,
+    STATS_IDENTIFY,
+    STATS_ERASE,
+    STATS_WRITE,
+    STATS_COPY,
+    STATS_VERIFY,
+    STATS_GO,
+    STATS_PHASES
+} STATS_PHASE;
+
+/** Events that are only counted. */
+typedef enum
+{
+    STATS_SYNC_ATTEMPTS,    /**< Question marks sent to synchronize.   */
+    STATS_RESENDS,          /**< Checksum groups sent again.           */
+    STATS_SYNC_RESETS,      /**< Resets while synchronizing.           */
+    STATS_RECOVERIES,       /**< Recoveries after failed commands.     */
+    STATS_GROUPS,           /**< Checksum groups of uuencoded data.    */
+    STATS_COUNTERS
+} STATS_COUNTER;
+
+/* Upper bounds (ms) of the command latency histogram buckets, there is
+ * one more bucket for everything above the last bound.
+ */
+#define STATS_BUCKETS_MS    0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000
+#define STATS_BUCKETS       12
+
+/* Commands sent ahead of their answers (-pipeline) that are timed. */
+#define STATS_PENDING       4
+
+/* -metrics: the daemon rewrites the file at least this often (s). */
+#define METRICS_PERIOD_S    15
+
+/* Upper bounds (s) of the flash time histogram of -metrics. */
+#define METRICS_BUCKETS_S   0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500
+#define METRICS_BUCKETS     10
+
+/* Upper bounds (ms) of the time to synchronize histogram of -metrics. */
+#define METRICS_SYNC_BUCKETS_MS 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+#define METRICS_SYNC_BUCKETS    10
+
+#if defined COMPILE_FOR_LPC21
+
+#define StatsBegin(env)
+#define StatsPhase(env, phase)
+#define StatsCommand(env, cmd)
+#define StatsAnswer(env)
+#define StatsSector(env, sector)
+#define StatsSectorDone(env, bytes)
+#define StatsCount(env, counter)
+#define StatsSynced(env)
+#define StatsEnd(env, result)
+#define StatsTick()
+
+#else
+
+int  StatsOpen(const char *SummaryFile, const char *EventFile, const char *MetricsFile);
+void StatsBegin(ISP_ENVIRONMENT *IspEnvironment);
+void StatsPhase(ISP_ENVIRONMENT *IspEnvironment, STATS_PHASE Phase);
+void StatsCommand(ISP_ENVIRONMENT *IspEnvironment, const char *Command);
+void StatsAnswer(ISP_ENVIRONMENT *IspEnvironment);
+void StatsSector(ISP_ENVIRONMENT *IspEnvironment, unsigned long Sector);
+void StatsSectorDone(ISP_ENVIRONMENT *IspEnvironment, unsigned long Bytes);
+void StatsCount(ISP_ENVIRONMENT *IspEnvironment, STATS_COUNTER Counter);
+void StatsSynced(ISP_ENVIRONMENT *IspEnvironment);
+void StatsEnd(ISP_ENVIRONMENT *IspEnvironment, int Result);
+void StatsTick(void);
+void StatsClose(void);
+
+#endif // defined COMPILE_FOR_LPC21
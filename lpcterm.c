@@ -42,7 +42,7 @@ Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.c
 /***************************** Terminal *********************************/
 /**  Acts as a simple dumb terminal. Press 'ESC' to exit.
 */
-BOOL CheckTerminalParameters(ISP_ENVIRONMENT *IspEnvironment, char* pstr)
+BOOL CheckTerminalParameters(ISP_ENVIRONMENT *IspEnvironment, const char* pstr)
 {
     if (stricmp(pstr, "-localecho") == 0)
     {
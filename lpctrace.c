@@ -0,0 +1,486 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpctrace.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Binary capture of the serial traffic (-capture<file>). Every block sent
+// or received is stored with a timestamp, so the time spent on the link
+// can be analysed afterwards (see lpctracedump.c). Records are collected
+// in a buffer and written in large pieces, so capturing does not slow
+// down the transfer it observes.
+//
+// A trace can also be replayed (-replay<file>): the protocol code then
+// talks to the recorded answers instead of a serial port. Everything the
+// host sends is compared with the recording, and the time the host spends
+// between two commands is measured without the link latency.
+
+#if defined(_WIN32)
+#if !defined __BORLANDC__
+#include "StdAfx.h"
+#endif
+#endif // defined(_WIN32)
+#include "lpc21isp.h"
+#include "lpctrace.h"
+
+#define TRACE_BUFFER_SIZE   (64 * 1024)
+
+static FILE *TraceFile;
+static unsigned char TraceBuffer[TRACE_BUFFER_SIZE];
+static size_t TraceFill;
+static unsigned long long TraceStart;
+
+typedef struct
+{
+    unsigned long long Time;        /**< Time stamp in the recording (ns).      */
+    int                Direction;
+    unsigned long      Length;
+    unsigned char     *Data;
+} REPLAY_RECORD;
+
+static REPLAY_RECORD *ReplayRecords;
+static unsigned long  nReplayRecords;
+static unsigned long  ReplayIndex;          /**< Current record.                    */
+static unsigned long  ReplayOffset;         /**< Bytes used of the current record.  */
+static unsigned long long ReplayLeft;       /**< Time control went back to the host.*/
+static unsigned long  ReplayStep;           /**< Number of the current command.     */
+static int            ReplayAnswered;       /**< Target answered the current one.   */
+static unsigned long long ReplayStepHost;   /**< Host time of the current command.  */
+static unsigned long long ReplayStepStart;  /**< Its recorded time stamp.           */
+static char           ReplayStepText[41];
+static unsigned long long ReplayHostTotal;
+static unsigned long long ReplayHostMax;
+static unsigned long  ReplayHostMaxStep;
+static char           ReplayHostMaxText[41];
+
+/***************************** TraceClock *******************************/
+/**  Monotonic time base for the trace.
+\return time in nanoseconds.
+*/
+static unsigned long long TraceClock(void)
+{
+#if defined COMPILE_FOR_WINDOWS
+    LARGE_INTEGER freq, now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (unsigned long long)(now.QuadPart * (1000000000.0 / freq.QuadPart));
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/***************************** TracePut *********************************/
+/**  Stores a little endian number in the buffer.
+*/
+static void TracePut(unsigned long long Value, int Bytes)
+{
+    while (Bytes-- > 0)
+    {
+        TraceBuffer[TraceFill++] = (unsigned char)Value;
+        Value >>= 8;
+    }
+}
+
+/***************************** TraceFlush *******************************/
+/**  Writes the buffered records to the trace file.
+*/
+static void TraceFlush(void)
+{
+    if (TraceFill != 0)
+    {
+        fwrite(TraceBuffer, 1, TraceFill, TraceFile);
+        TraceFill = 0;
+    }
+}
+
+/***************************** TraceOpen ********************************/
+/**  Creates the trace file and starts the trace clock.
+\param [in] FileName name of the trace file.
+\return 0 if successful, -1 if the file can't be created.
+*/
+int TraceOpen(const char *FileName)
+{
+    TraceFile = fopen(FileName, "wb");
+    if (TraceFile == NULL)
+    {
+        return -1;
+    }
+
+    // We buffer ourselves
+    setvbuf(TraceFile, NULL, _IONBF, 0);
+
+    TraceStart = TraceClock();
+    TraceFill  = 0;
+    memcpy(TraceBuffer, TRACE_MAGIC, 8);
+    TraceFill = 8;
+    TracePut(TRACE_VERSION, 4);
+
+    atexit(TraceClose);     // protocol errors end the program with exit()
+
+    return 0;
+}
+
+/***************************** TraceRecord ******************************/
+/**  Adds a record to the trace. Does nothing if no trace is open.
+\param [in] PortId number of the port (0 unless in gang mode).
+\param [in] Direction TRACE_TX, TRACE_RX or TRACE_PORT.
+\param [in] Data the bytes sent or received.
+\param [in] Length number of bytes.
+*/
+void TraceRecord(unsigned PortId, int Direction, const void *Data, size_t Length)
+{
+    if (TraceFile == NULL)
+    {
+        return;
+    }
+
+    if (TraceFill + TRACE_RECORD_SIZE + Length > sizeof(TraceBuffer))
+    {
+        TraceFlush();
+    }
+
+    TracePut(TraceClock() - TraceStart, 8);
+    TracePut(PortId, 2);
+    TracePut(Direction, 1);
+    TracePut(0, 1);
+    TracePut(Length, 4);
+
+    if (TRACE_RECORD_SIZE + Length > sizeof(TraceBuffer))
+    {
+        // Too big to buffer, write it directly
+        TraceFlush();
+        fwrite(Data, 1, Length, TraceFile);
+    }
+    else
+    {
+        memcpy(&TraceBuffer[TraceFill], Data, Length);
+        TraceFill += Length;
+    }
+}
+
+/***************************** TraceClose *******************************/
+/**  Writes out the remaining records and closes the trace file.
+*/
+void TraceClose(void)
+{
+    if (TraceFile != NULL)
+    {
+        TraceFlush();
+        fclose(TraceFile);
+        TraceFile = NULL;
+    }
+}
+
+/***************************** ReplayLoadLE *****************************/
+/**  Reads a little endian number.
+*/
+static unsigned long long ReplayLoadLE(const unsigned char *p, int Bytes)
+{
+    unsigned long long Value = 0;
+
+    while (Bytes-- > 0)
+    {
+        Value = (Value << 8) | p[Bytes];
+    }
+    return Value;
+}
+
+/***************************** ReplayEscape *****************************/
+/**  Printable form of (the start of) a block of data.
+*/
+static void ReplayEscape(char *Out, size_t OutSize, const unsigned char *Data, unsigned long Length)
+{
+    size_t Used = 0;
+    unsigned long i;
+
+    for (i = 0; i < Length && Used + 5 < OutSize; i++)
+    {
+        if (Data[i] >= 0x20 && Data[i] <= 0x7e)
+        {
+            Out[Used++] = Data[i];
+        }
+        else
+        {
+            Used += sprintf(&Out[Used], "(%02X)", Data[i]);
+        }
+    }
+    Out[Used] = '\0';
+}
+
+/***************************** ReplayEnter ******************************/
+/**  Called whenever the protocol code calls the transport: adds the time
+since the last call to the host time of the current command.
+*/
+static void ReplayEnter(void)
+{
+    ReplayStepHost += TraceClock() - ReplayLeft;
+}
+
+/***************************** ReplayEndStep ****************************/
+/**  Closes the current command.
+\param [in] NextTime recorded time stamp of the next command.
+*/
+static void ReplayEndStep(unsigned long long NextTime)
+{
+    if (ReplayStep == 0)
+    {
+        return;
+    }
+
+    DebugPrintf(3, "Replay step %lu: host %.3f ms, recorded %.3f ms '%s'\n",
+                ReplayStep, ReplayStepHost / 1e6,
+                (NextTime - ReplayStepStart) / 1e6, ReplayStepText);
+
+    ReplayHostTotal += ReplayStepHost;
+    if (ReplayStepHost > ReplayHostMax)
+    {
+        ReplayHostMax     = ReplayStepHost;
+        ReplayHostMaxStep = ReplayStep;
+        strcpy(ReplayHostMaxText, ReplayStepText);
+    }
+}
+
+/***************************** ReplayReport *****************************/
+/**  Prints the timing summary of the replay, called at exit.
+*/
+static void ReplayReport(void)
+{
+    unsigned long long Recorded = 0;
+    unsigned long Left = 0;
+    unsigned long i;
+
+    if (nReplayRecords != 0)
+    {
+        ReplayEndStep(ReplayRecords[nReplayRecords - 1].Time);
+        Recorded = ReplayRecords[nReplayRecords - 1].Time - ReplayRecords[0].Time;
+    }
+
+    for (i = ReplayIndex; i < nReplayRecords; i++)
+    {
+        if (ReplayRecords[i].Direction == TRACE_TX)
+        {
+            Left++;
+        }
+    }
+
+    DebugPrintf(2, "Replay: %lu commands, host time %.3f ms (longest %.3f ms in command %lu '%s'), recorded %.3f ms\n",
+                ReplayStep, ReplayHostTotal / 1e6, ReplayHostMax / 1e6,
+                ReplayHostMaxStep, ReplayHostMaxText, Recorded / 1e6);
+    if (Left != 0)
+    {
+        DebugPrintf(1, "Replay: host stopped early, %lu recorded blocks were not sent\n", Left);
+    }
+}
+
+/***************************** ReplayOpen *******************************/
+/**  Loads the records of one port from a trace for replay.
+\param [in] FileName name of the trace file.
+\param [in] PortId port whose traffic is replayed.
+\return 0 if successful, -1 if the file can't be read.
+*/
+int ReplayOpen(const char *FileName, unsigned PortId)
+{
+    FILE *File;
+    unsigned char Header[TRACE_RECORD_SIZE];
+    REPLAY_RECORD *Record;
+    unsigned long Allocated = 0;
+
+    File = fopen(FileName, "rb");
+    if (File == NULL)
+    {
+        return -1;
+    }
+
+    if (fread(Header, 1, TRACE_HEADER_SIZE, File) != TRACE_HEADER_SIZE ||
+        memcmp(Header, TRACE_MAGIC, 8) != 0 ||
+        ReplayLoadLE(&Header[8], 4) != TRACE_VERSION)
+    {
+        fclose(File);
+        return -1;
+    }
+
+    while (fread(Header, 1, TRACE_RECORD_SIZE, File) == TRACE_RECORD_SIZE)
+    {
+        if (nReplayRecords == Allocated)
+        {
+            Allocated = Allocated ? 2 * Allocated : 1024;
+            ReplayRecords = (REPLAY_RECORD *)realloc(ReplayRecords, Allocated * sizeof(REPLAY_RECORD));
+            if (ReplayRecords == NULL)
+            {
+                fclose(File);
+                return -1;
+            }
+        }
+
+        Record = &ReplayRecords[nReplayRecords];
+        Record->Time      = ReplayLoadLE(&Header[0], 8);
+        Record->Direction = Header[10];
+        Record->Length    = (unsigned long)ReplayLoadLE(&Header[12], 4);
+        Record->Data      = (unsigned char *)malloc(Record->Length + 1);
+        if (Record->Data == NULL ||
+            fread(Record->Data, 1, Record->Length, File) != Record->Length)
+        {
+            fclose(File);
+            return -1;
+        }
+
+        if (ReplayLoadLE(&Header[8], 2) != PortId || Record->Direction == TRACE_PORT)
+        {
+            free(Record->Data);     // not replayed
+            continue;
+        }
+        nReplayRecords++;
+    }
+
+    fclose(File);
+
+    DebugPrintf(3, "Replay %lu records from %s\n", nReplayRecords, FileName);
+
+    atexit(ReplayReport);
+    ReplayLeft = TraceClock();
+
+    return 0;
+}
+
+/***************************** ReplaySend *******************************/
+/**  Compares data sent by the host with the recording. Ends the program
+if the host does not send exactly what was recorded.
+\param [in] Data the bytes the host sends.
+\param [in] Length number of bytes.
+*/
+void ReplaySend(const void *Data, size_t Length)
+{
+    const unsigned char *Sent = (const unsigned char *)Data;
+    REPLAY_RECORD *Record;
+    char Expected[41], Got[41];
+    size_t i;
+
+    ReplayEnter();
+
+    // Skip answers the host never read
+    while (ReplayIndex < nReplayRecords &&
+           (ReplayRecords[ReplayIndex].Direction == TRACE_RX ||
+            ReplayOffset == ReplayRecords[ReplayIndex].Length))
+    {
+        ReplayIndex++;
+        ReplayOffset = 0;
+    }
+
+    if (ReplayStep == 0 || ReplayAnswered)
+    {
+        unsigned long long Now = ReplayIndex < nReplayRecords ? ReplayRecords[ReplayIndex].Time : 0;
+
+        ReplayEndStep(Now);
+        ReplayStep++;
+        ReplayAnswered  = 0;
+        ReplayStepHost  = 0;
+        ReplayStepStart = Now;
+        ReplayEscape(ReplayStepText, sizeof(ReplayStepText), Sent, Length);
+    }
+
+    for (i = 0; i < Length; i++)
+    {
+        if (ReplayIndex < nReplayRecords &&
+            ReplayOffset == ReplayRecords[ReplayIndex].Length)
+        {
+            ReplayIndex++;
+            ReplayOffset = 0;
+        }
+
+        if (ReplayIndex >= nReplayRecords || ReplayRecords[ReplayIndex].Direction != TRACE_TX)
+        {
+            ReplayEscape(Got, sizeof(Got), &Sent[i], Length - i);
+            DebugPrintf(1, "Replay mismatch in command %lu: host sends '%s', recording expects %s\n",
+                        ReplayStep, Got, ReplayIndex >= nReplayRecords ? "nothing" : "an answer");
+            exit(1);
+        }
+
+        Record = &ReplayRecords[ReplayIndex];
+        if (Record->Data[ReplayOffset] != Sent[i])
+        {
+            ReplayEscape(Got, sizeof(Got), &Sent[i], Length - i);
+            ReplayEscape(Expected, sizeof(Expected), &Record->Data[ReplayOffset], Record->Length - ReplayOffset);
+            DebugPrintf(1, "Replay mismatch in command %lu: host sends '%s', recording has '%s'\n",
+                        ReplayStep, Got, Expected);
+            exit(1);
+        }
+        ReplayOffset++;
+    }
+
+    ReplayLeft = TraceClock();
+}
+
+/***************************** ReplayReceive ****************************/
+/**  Returns the next recorded answer, or nothing (like a timeout) when the
+host has to send something first.
+\param [out] Data buffer for the answer.
+\param [in] MaxLength size of the buffer.
+\return number of bytes returned.
+*/
+unsigned long ReplayReceive(void *Data, unsigned long MaxLength)
+{
+    REPLAY_RECORD *Record;
+    unsigned long Length = 0;
+
+    ReplayEnter();
+
+    if (ReplayIndex < nReplayRecords &&
+        ReplayRecords[ReplayIndex].Direction == TRACE_TX &&
+        ReplayOffset == ReplayRecords[ReplayIndex].Length)
+    {
+        ReplayIndex++;
+        ReplayOffset = 0;
+    }
+
+    if (ReplayIndex < nReplayRecords && ReplayRecords[ReplayIndex].Direction == TRACE_RX)
+    {
+        Record = &ReplayRecords[ReplayIndex];
+        Length = Record->Length - ReplayOffset;
+        if (Length > MaxLength)
+        {
+            Length = MaxLength;
+        }
+        memcpy(Data, &Record->Data[ReplayOffset], Length);
+        ReplayOffset += Length;
+        if (ReplayOffset == Record->Length)
+        {
+            ReplayIndex++;
+            ReplayOffset = 0;
+        }
+        ReplayAnswered = 1;
+    }
+
+    ReplayLeft = TraceClock();
+
+    return Length;
+}
@@ -0,0 +1,57 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC1000 / LPC2000 family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpctrace.h
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/* Trace file layout (all numbers little endian):
+ *
+ *   file header:  "LPCTRACE" (8 bytes), version (4 bytes)
+ *   each record:  time in ns since the trace was opened (8 bytes),
+ *                 port id (2 bytes), direction (1 byte), reserved (1 byte),
+ *                 length (4 bytes), followed by 'length' bytes of data.
+ *
+ * The time base is CLOCK_MONOTONIC (QueryPerformanceCounter on Windows).
+ */
+#define TRACE_MAGIC         "LPCTRACE"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   12
+#define TRACE_RECORD_SIZE   16
+
+#define TRACE_TX            0   /**< Data sent to the target.                */
+#define TRACE_RX            1   /**< Data received from the target.          */
+#define TRACE_PORT          2   /**< Port opened, data is the port name.     */
+
+int  TraceOpen(const char *FileName);
+void TraceRecord(unsigned PortId, int Direction, const void *Data, size_t Length);
+void TraceClose(void);
+
+int  ReplayOpen(const char *FileName, unsigned PortId);
+void ReplaySend(const void *Data, size_t Length);
+unsigned long ReplayReceive(void *Data, unsigned long MaxLength);
@@ -0,0 +1,334 @@
+/******************************************************************************
+
+Project:           Portable command line ISP for NXP LPC family
+                   and Analog Devices ADUC70xx
+
+Filename:          lpctracedump.c
+
+Compiler:          GCC Linux
+
+Author:            Martin Maurer (Martin.Maurer@clibb.de)
+
+Copyright:         (c) Martin Maurer 2003-2014, All rights reserved
+Portions Copyright (c) by Aeolus Development 2004 http://www.aeolusdevelopment.com
+
+    This file is part of lpc21isp.
+
+    lpc21isp is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    any later version.
+
+    lpc21isp is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    and GNU General Public License along with lpc21isp.
+    If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Decoder for the traces written by lpc21isp -capture<file>.
+//
+//   lpctracedump trace.bin         one line per record, then a summary
+//   lpctracedump -csv trace.bin    one CSV line per command with the time
+//                                  to the first and the last byte of the
+//                                  answer
+//
+// A command is everything sent to a port until the target answers; it
+// ends when the host sends again. Data lines and checksums count as
+// commands of their own.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lpctrace.h"
+
+#define COMMAND_TEXT_SIZE   40
+
+typedef struct
+{
+    char          Name[64];
+    unsigned long Records;
+    unsigned long TxBytes;
+    unsigned long RxBytes;
+    unsigned long Commands;
+    double        FirstTime;
+    double        LastTime;
+    double        RoundTripSum;     /**< Sum of all command round trips (s).    */
+
+    int           InCommand;        /**< A command is open.                     */
+    double        CmdStart;
+    double        CmdFirstRx;       /**< < 0 if nothing received yet.           */
+    double        CmdLastRx;
+    unsigned long CmdTxBytes;
+    unsigned long CmdRxBytes;
+    char          CmdText[COMMAND_TEXT_SIZE + 1];
+} PORT_STATS;
+
+static PORT_STATS *Ports;
+static unsigned    nPorts;
+static int         Csv;
+
+/***************************** GetLE ************************************/
+/**  Reads a little endian number.
+*/
+static unsigned long long GetLE(const unsigned char *p, int Bytes)
+{
+    unsigned long long Value = 0;
+
+    while (Bytes-- > 0)
+    {
+        Value = (Value << 8) | p[Bytes];
+    }
+    return Value;
+}
+
+/***************************** GetPort **********************************/
+/**  Returns the statistics of a port, growing the table as needed.
+*/
+static PORT_STATS *GetPort(unsigned Id)
+{
+    if (Id >= nPorts)
+    {
+        Ports = (PORT_STATS *)realloc(Ports, (Id + 1) * sizeof(PORT_STATS));
+        if (Ports == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        memset(&Ports[nPorts], 0, (Id + 1 - nPorts) * sizeof(PORT_STATS));
+        while (nPorts <= Id)
+        {
+            sprintf(Ports[nPorts].Name, "port %u", nPorts);
+            nPorts++;
+        }
+    }
+    return &Ports[Id];
+}
+
+/***************************** Escape ***********************************/
+/**  Converts data to printable text, non printables as (XX) like the
+debug output of lpc21isp does.
+*/
+static void Escape(char *Out, size_t OutSize, const unsigned char *Data, unsigned long Length)
+{
+    size_t Used = 0;
+    unsigned long i;
+
+    for (i = 0; i < Length && Used + 5 < OutSize; i++)
+    {
+        if (Data[i] >= 0x20 && Data[i] <= 0x7e && Data[i] != '"')
+        {
+            Out[Used++] = Data[i];
+        }
+        else
+        {
+            Used += sprintf(&Out[Used], "(%02X)", Data[i]);
+        }
+    }
+    Out[Used] = '\0';
+}
+
+/***************************** EndCommand *******************************/
+/**  Finishes the open command of a port and prints it in CSV mode.
+*/
+static void EndCommand(unsigned Id, PORT_STATS *Port)
+{
+    if (!Port->InCommand)
+    {
+        return;
+    }
+
+    Port->Commands++;
+    if (Port->CmdFirstRx >= 0)
+    {
+        Port->RoundTripSum += Port->CmdLastRx - Port->CmdStart;
+    }
+
+    if (Csv)
+    {
+        printf("%u,%.6f,\"%s\",%lu,%lu,", Id, Port->CmdStart, Port->CmdText,
+               Port->CmdTxBytes, Port->CmdRxBytes);
+        if (Port->CmdFirstRx >= 0)
+        {
+            printf("%.3f,%.3f\n", (Port->CmdFirstRx - Port->CmdStart) * 1000.0,
+                                  (Port->CmdLastRx  - Port->CmdStart) * 1000.0);
+        }
+        else
+        {
+            printf(",\n");
+        }
+    }
+
+    Port->InCommand = 0;
+}
+
+/***************************** Record ***********************************/
+/**  Processes one record of the trace.
+*/
+static void Record(double Time, unsigned Id, int Direction,
+                   const unsigned char *Data, unsigned long Length)
+{
+    PORT_STATS *Port = GetPort(Id);
+    char Text[1024];
+
+    if (Direction == TRACE_PORT)
+    {
+        if (Length >= sizeof(Port->Name))
+        {
+            Length = sizeof(Port->Name) - 1;
+        }
+        memcpy(Port->Name, Data, Length);
+        Port->Name[Length] = '\0';
+        if (!Csv)
+        {
+            printf("%12.6f  %u  open %s\n", Time, Id, Port->Name);
+        }
+        return;
+    }
+
+    if (Port->Records == 0)
+    {
+        Port->FirstTime = Time;
+    }
+    Port->Records++;
+    Port->LastTime = Time;
+
+    if (Direction == TRACE_TX)
+    {
+        Port->TxBytes += Length;
+        if (Port->InCommand && Port->CmdRxBytes != 0)
+        {
+            EndCommand(Id, Port);
+        }
+        if (!Port->InCommand)
+        {
+            Port->InCommand  = 1;
+            Port->CmdStart   = Time;
+            Port->CmdFirstRx = -1;
+            Port->CmdTxBytes = 0;
+            Port->CmdRxBytes = 0;
+            Escape(Port->CmdText, sizeof(Port->CmdText), Data, Length);
+        }
+        Port->CmdTxBytes += Length;
+    }
+    else
+    {
+        Port->RxBytes += Length;
+        if (Port->InCommand)
+        {
+            if (Port->CmdFirstRx < 0)
+            {
+                Port->CmdFirstRx = Time;
+            }
+            Port->CmdLastRx   = Time;
+            Port->CmdRxBytes += Length;
+        }
+    }
+
+    if (!Csv)
+    {
+        Escape(Text, sizeof(Text), Data, Length);
+        printf("%12.6f  %u  %s %5lu  '%s'%s\n", Time, Id,
+               Direction == TRACE_TX ? "TX" : "RX", Length, Text,
+               strlen(Text) + 5 >= sizeof(Text) ? "..." : "");
+    }
+}
+
+/***************************** main *************************************/
+int main(int argc, char *argv[])
+{
+    FILE *File;
+    unsigned char Header[TRACE_RECORD_SIZE];
+    unsigned char *Data = NULL;
+    unsigned long DataSize = 0;
+    unsigned long Length;
+    unsigned i;
+
+    if (argc == 3 && strcmp(argv[1], "-csv") == 0)
+    {
+        Csv = 1;
+    }
+    else if (argc != 2)
+    {
+        fprintf(stderr, "Usage: lpctracedump [-csv] tracefile\n"
+                        "       -csv  one line per command with round trip times (ms)\n");
+        return 1;
+    }
+
+    File = fopen(argv[argc - 1], "rb");
+    if (File == NULL)
+    {
+        fprintf(stderr, "Can't open %s\n", argv[argc - 1]);
+        return 1;
+    }
+
+    if (fread(Header, 1, TRACE_HEADER_SIZE, File) != TRACE_HEADER_SIZE ||
+        memcmp(Header, TRACE_MAGIC, 8) != 0 ||
+        GetLE(&Header[8], 4) != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s is not a lpc21isp trace\n", argv[argc - 1]);
+        return 1;
+    }
+
+    if (Csv)
+    {
+        printf("port,start_s,command,tx_bytes,rx_bytes,first_rx_ms,last_rx_ms\n");
+    }
+
+    while (fread(Header, 1, TRACE_RECORD_SIZE, File) == TRACE_RECORD_SIZE)
+    {
+        Length = (unsigned long)GetLE(&Header[12], 4);
+        if (Length > DataSize)
+        {
+            DataSize = Length;
+            Data = (unsigned char *)realloc(Data, DataSize);
+            if (Data == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+        if (fread(Data, 1, Length, File) != Length)
+        {
+            fprintf(stderr, "Trace is truncated\n");
+            break;
+        }
+
+        Record(GetLE(&Header[0], 8) / 1e9, (unsigned)GetLE(&Header[8], 2),
+               Header[10], Data, Length);
+    }
+
+    fclose(File);
+
+    for (i = 0; i < nPorts; i++)
+    {
+        EndCommand(i, &Ports[i]);
+    }
+
+    if (!Csv)
+    {
+        printf("\n");
+        for (i = 0; i < nPorts; i++)
+        {
+            PORT_STATS *Port = &Ports[i];
+
+            if (Port->Records == 0)
+            {
+                continue;
+            }
+            printf("%u %s: %.3f s, %lu bytes sent, %lu bytes received, "
+                   "%lu commands, %.3f s waiting for answers\n",
+                   i, Port->Name, Port->LastTime - Port->FirstTime,
+                   Port->TxBytes, Port->RxBytes, Port->Commands, Port->RoundTripSum);
+        }
+    }
+
+    free(Data);
+    free(Ports);
+
+    return 0;
+}